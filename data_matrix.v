@@ -21,6 +21,8 @@
 // Each bit in the LUT row indicates TX ports for the data to be forwarded to.
 // Any LUT configuration is valid.
 //
+// tools/matsim checks whether it keeps up with given traffic.
+//
 //                                                                              
 //                  +---------------+                          + - - - - - - -
 //                  |               |                                     
@@ -94,6 +94,8 @@ endmodule
 // https://github.com/Calinou/free-blue-noise-textures/blob/master/32_32/HDR_L_0.png
 // https://github.com/Calinou/free-blue-noise-textures/blob/master/64_64/HDR_L_0.png
 // Note: Textures have been flattened to 8-bit depth.
+// Maps of other sizes or kernel widths can be generated with tools/bngen,
+// and loaded here in place of the above.
 //
 //                          +-----------------+
 //                in[8] ===>|                 |---> out
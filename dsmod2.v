@@ -4,6 +4,7 @@
 // Transforms signed integers into a bit stream.
 // Note: Since 2nd order modulators are not unconditionally stable,
 // it may misbehave in certain circumstances.
+// tools/dssim maps out the input amplitudes and frequencies it handles.
 //
 //             +--------------------------------------------+
 //     clk --->|                  +------+      +------+    |
@@ -49,6 +49,8 @@
 // Certainly n=10 and m=2048 is possible and will glue five 4k blocks together.
 // However the "m" parameter must always be the power of 2 due to module design
 // choices.
+//
+// tools/fifosim finds the depth needed for given traffic.
 
 `ifndef _fifo_v_
 `define _fifo_v_
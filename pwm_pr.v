@@ -15,6 +15,8 @@
 // 0 | 4 | 2 | 6 | 1 | 5 | 3 | 7 
 //
 // This modulator works only with periods being a power of 2.
+// tools/pwmord searches fill orders for any period, with less ripple at low
+// frequencies, and writes them as modules like this one.
 // The input to output path is purely combinational, so it reacts instantly to
 // input data changes. This structure may be reused in multiplexed
 // input/output scenarios.
@@ -17,6 +17,8 @@
 // size of ROM, the "content_size" parameter must be defined, in order to
 // assure correct data padding. See tb_rom.v for an example.
 //
+// tools/rompack builds ROMs of any size from binary or .mem files.
+//
 //
 //                +----------------+
 //        clk --->|                |
@@ -15,6 +15,7 @@
 // called by external logic, and protects against interrupting unfinished
 // procedures. 
 // FIFO can be used for scheduling tasks with no additional logic.
+// tools/seqasm assembles programs for it and simulates them.
 //
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 //
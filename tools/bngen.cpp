@@ -0,0 +1,309 @@
+// Blue noise threshold map generator
+// by Tomek Szczęsny 2024
+//
+// Generates maps for blue_mono (dither.v) with the void-and-cluster
+// method of R. Ulichney, and writes them as .mem files in the format
+// of assets/bn*.mem: 8-bit hex values, 32 per line, indexed by {x, y}.
+//
+// The Gaussian energy field is kept up to date incrementally: setting or
+// clearing a pixel only adds or removes its kernel in the neighbourhood,
+// and the tightest cluster and the largest void are found in segment trees
+// instead of by scanning the whole map. A 256x256 map takes seconds.
+// Several maps (sizes and sigmas of a sweep) are generated concurrently.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+const double inf = std::numeric_limits<double>::infinity();
+
+class mintree {
+	// A segment tree keeping the index of the smallest leaf
+
+	private:
+	int m;
+	std::vector<double> v;
+	std::vector<int> at;
+
+	public:
+	mintree(int m = 0) : m(m), v(2*m, inf), at(2*m)
+	{
+		for (int i=0; i<m; i++) at[m+i] = i;
+		for (int i=m-1; i>0; i--) at[i] = at[2*i];
+	}
+	void set(int i, double x)
+	{
+		i += m;
+		v[i] = x;
+		for (i /= 2; i > 0; i /= 2)
+		{
+			int a = 2*i, b = 2*i+1;
+			int w = v[b] < v[a] ? b : a;
+			v[i] = v[w];
+			at[i] = at[w];
+		}
+	}
+	int top() const
+	{
+		return at[1];
+	}
+};
+
+class field {
+	// Binary pattern on a torus with its Gaussian energy field
+
+	private:
+	int n, bits;
+	int r;				// Kernel reaches r pixels each way
+	std::vector<double> k;		// Kernel, (2r+1) x (2r+1)
+	std::vector<double> e;		// Energy of every pixel
+	mintree voids;			// Energy of zeros, ones are +inf
+	mintree clusters;		// Negated energy of ones, zeros are +inf
+
+	void update(int p)
+	{
+		voids.set(p, b[p] ? inf : e[p]);
+		clusters.set(p, b[p] ? -e[p] : inf);
+	}
+
+	public:
+	std::vector<char> b;
+	int ones = 0;
+
+	field(int n, double sigma) : n(n), voids(n*n), clusters(n*n), e(n*n, 0), b(n*n, 0)
+	{
+		bits = 0;
+		while ((1 << bits) < n) bits++;
+		// Beyond 4 sigma the kernel is negligible; on small maps it wraps around instead
+		r = std::min(int(std::ceil(4*sigma)), (n-1)/2);
+		int w = 2*r+1;
+		k.assign(w*w, 0);
+		for (int dy=-r; dy<=r; dy++)
+		{
+			for (int dx=-r; dx<=r; dx++)
+			{
+				k[(dy+r)*w + dx+r] = std::exp(-(dx*dx + dy*dy) / (2*sigma*sigma));
+			}
+		}
+		for (int p=0; p<n*n; p++) update(p);
+	}
+
+	// Sets or clears a pixel
+	void toggle(int p)
+	{
+		b[p] ^= 1;
+		double s = b[p] ? 1 : -1;
+		ones += b[p] ? 1 : -1;
+		int x = p & (n-1), y = p >> bits;
+		int w = 2*r+1;
+		for (int dy=-r; dy<=r; dy++)
+		{
+			int row = ((y+dy) & (n-1)) << bits;
+			const double * kr = &k[(dy+r)*w + r];
+			for (int dx=-r; dx<=r; dx++)
+			{
+				int q = row | ((x+dx) & (n-1));
+				e[q] += s * kr[dx];
+				update(q);
+			}
+		}
+	}
+
+	int tightest_cluster() const
+	{
+		return clusters.top();
+	}
+
+	int largest_void() const
+	{
+		return voids.top();
+	}
+};
+
+// Returns the rank of every pixel, 0 to n*n-1
+std::vector<int> void_and_cluster(int n, double sigma, uint64_t seed)
+{
+	int m = n*n;
+	std::vector<int> rank(m);
+	field f(n, sigma);
+
+	// Initial pattern: about a tenth of random pixels,
+	// then moving the tightest cluster to the largest void until it stays put
+	std::mt19937_64 rng(seed);
+	std::vector<int> px(m);
+	for (int i=0; i<m; i++) px[i] = i;
+	std::shuffle(px.begin(), px.end(), rng);
+	for (int i=0; i<std::max(1, m/10); i++) f.toggle(px[i]);
+	for (long i=0; i<4L*m; i++)
+	{
+		int c = f.tightest_cluster();
+		f.toggle(c);
+		int v = f.largest_void();
+		f.toggle(v);
+		if (v == c) break;
+	}
+	field proto = f;
+
+	// Phase 1: removing the tightest clusters ranks the initial pixels downwards
+	while (f.ones)
+	{
+		int c = f.tightest_cluster();
+		f.toggle(c);
+		rank[c] = f.ones;
+	}
+
+	// Phases 2 and 3: filling the largest voids ranks the rest upwards.
+	// Past half of the map, the tightest cluster of zeros is the largest void of ones,
+	// since both energies add up to the same total everywhere.
+	f = proto;
+	while (f.ones < m)
+	{
+		int v = f.largest_void();
+		rank[v] = f.ones;
+		f.toggle(v);
+	}
+	return rank;
+}
+
+// Writes ranks as 8-bit thresholds, in the order of rom[{x,y}] in blue_mono
+std::string mem(int n, const std::vector<int> & rank)
+{
+	std::string s;
+	char h[4];
+	long m = long(n)*n;
+	for (long i=0; i<m; i++)
+	{
+		long x = i / n, y = i % n;
+		snprintf(h, sizeof(h), "%02x", int(rank[y*n + x] * 256 / m));
+		s += h;
+		s += (i % 32 == 31 || i == m-1) ? "\n" : " ";
+	}
+	return s;
+}
+
+struct job {
+	int n;
+	double sigma;
+	std::string file;
+	double seconds;
+};
+
+int main(int argc, char** argv)
+{
+	std::vector<int> sizes;
+	std::vector<double> sigmas;
+	std::string dir;
+	uint64_t seed = 1;
+	int threads = std::thread::hardware_concurrency();
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "bngen [sizes] [options]\n";
+			std::cerr << "  -s [sigma]  Gaussian kernel width, may be repeated for a sweep (default: 1.5)\n";
+			std::cerr << "  -o [dir]    Write bn[size].mem files there, or bn[size]_[sigma].mem\n";
+			std::cerr << "              for several sigmas (default: print a single map)\n";
+			std::cerr << "  --seed [n]  Seed of the initial pattern (default: 1)\n";
+			std::cerr << "  -j [jobs]   Maps generated at once (default: all cores)\n";
+			std::cerr << "Sizes are powers of two, e.g. bngen 16 32 64 128 256 -o ../assets\n";
+			return 0;
+		}
+		if (a+1 < argc && o == "-s") sigmas.push_back(atof(argv[++a]));
+		else if (a+1 < argc && o == "-o") dir = argv[++a];
+		else if (a+1 < argc && o == "--seed") seed = strtoull(argv[++a], nullptr, 0);
+		else if (a+1 < argc && o == "-j") threads = atoi(argv[++a]);
+		else if (isdigit(o[0])) sizes.push_back(atoi(o.c_str()));
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (sigmas.empty()) sigmas.push_back(1.5);
+	for (int n : sizes)
+	{
+		if (n < 4 || n > 4096 || (n & (n-1))) {
+			std::cerr << "Size " << n << " is not a power of two between 4 and 4096\n";
+			return 1;
+		}
+	}
+	for (double s : sigmas)
+	{
+		if (!(s > 0)) {
+			std::cerr << "Sigma must be positive\n";
+			return 1;
+		}
+	}
+	if (sizes.empty()) {
+		std::cerr << "No size given, see -h\n";
+		return 1;
+	}
+	if (dir.empty() && sizes.size() * sigmas.size() > 1) {
+		std::cerr << "Several maps need -o\n";
+		return 1;
+	}
+
+	std::vector<job> jobs;
+	for (double s : sigmas)
+	{
+		for (int n : sizes)
+		{
+			job j = {n, s, "", 0};
+			if (!dir.empty())
+			{
+				char sg[32] = "";
+				if (sigmas.size() > 1) snprintf(sg, sizeof(sg), "_%g", s);
+				j.file = dir + "/bn" + std::to_string(n) + sg + ".mem";
+			}
+			jobs.push_back(j);
+		}
+	}
+	// Largest first, so the longest job does not start last
+	std::stable_sort(jobs.begin(), jobs.end(), [](const job & a, const job & b) { return a.n > b.n; });
+
+	std::atomic<int> next{0};
+	std::atomic<bool> failed{0};
+	auto worker = [&]()
+	{
+		int i;
+		while ((i = next++) < jobs.size())
+		{
+			job & j = jobs[i];
+			auto t0 = std::chrono::steady_clock::now();
+			std::string s = mem(j.n, void_and_cluster(j.n, j.sigma, seed));
+			j.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			if (j.file.empty()) std::cout << s;
+			else
+			{
+				std::ofstream f(j.file);
+				f << s;
+				if (!f) failed = 1;
+			}
+		}
+	};
+	threads = std::max(1, std::min(threads, int(jobs.size())));
+	std::vector<std::thread> pool;
+	for (int t=1; t<threads; t++) pool.emplace_back(worker);
+	worker();
+	for (auto & t : pool) t.join();
+
+	for (auto & j : jobs)
+	{
+		std::cerr << "//// " << j.n << "x" << j.n << ", sigma " << j.sigma << ": " << j.seconds << " s";
+		if (!j.file.empty()) std::cerr << ", " << j.file;
+		std::cerr << "\n";
+	}
+	if (failed) {
+		std::cerr << "Can't write to " << dir << "\n";
+		return 1;
+	}
+	return 0;
+}
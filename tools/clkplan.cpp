@@ -0,0 +1,1125 @@
+// Clock plan solver
+// by Tomek Szczęsny 2024
+//
+// Finds the cheapest way to derive a set of clocks from one oscillator with
+// the dividers of this library: clkdiv, clkdiv_2_3, clkdiv_2_5 and
+// clkdiv_prog (clkdiv.v), and the pseudo random dividers and counters that
+// prdiv (div_pr<p>) and prcnt (ctr_pr<p>) generate.
+//
+// Each target is reached through a cascade of up to --stages dividers.
+// Cascades of different targets share the stages they have in common, so a
+// plan is a tree rooted at the oscillator, and costs the logic cells of
+// the blocks in it. A target of several frequencies (baud=115200,9600) ends
+// in a clkdiv_prog that selects between them at run time.
+//
+// Cost model, per block, as yosys maps them to iCE40 logic cells, each one
+// holding a LUT4 and a DFF (so a block takes max(LUTs, FFs) cells):
+//   clkdiv /d          n = clog2(d): n FFs of a down counter plus the output;
+//                      n LUTs on the carry chain, n/4 each for the zero test
+//                      and the duty cycle compare
+//   clkdiv_2_3 /2, /3  4 LUTs, 4 FFs, sel tied off
+//   clkdiv_2_5 /2, /5  5 LUTs, 4 FFs, sel tied off
+//   clkdiv_prog        n bit div input: counter, latched div, reload mux,
+//                      compares and the transition state machine
+//   div_pr<p>          one LUT and one FF per register bit, its MSB is the
+//                      clock; b = bitness(p), prdiv may need extra bits
+//   ctr_pr<p>          b FFs fed by up to two LUTs, plus a registered decode
+//                      of one state, which makes a one cycle pulse
+// and a rough fmax, in MHz, that the input of a stage may not exceed:
+//   clkdiv 250 - 6n, clkdiv_prog 200 - 6n, clkdiv_2_3 and clkdiv_2_5 400,
+//   div_pr and ctr_pr 300. --speed scales them all.
+//
+// The search lists candidate cascades of every target, then picks one per
+// target, branch and bound, in parallel. A stage of a cascade can only be
+// shared if its output is also a target or still above one. A cascade
+// holding an unshareable stage might as well finish the cheapest way from
+// there, as nobody else uses its tail. So candidates are all paths of
+// shareable stages, each finished either right there or by the cheapest
+// tail. Candidates costing more than serving every target on its own would
+// are dropped. While picking, a cascade whose stages are all in the plan
+// already is the only one worth trying, as a tree holding more stages
+// never costs less. Of the candidates that add the same stages usable by
+// the targets still to pick, only the cheapest is tried. Deep targets can
+// have millions of candidates; past --max-candidates only the cheapest are
+// kept, and the plan is reported as possibly not the best.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+enum block {
+	clkdiv,
+	clkdiv_2_3,
+	clkdiv_2_5,
+	clkdiv_prog,
+	div_pr,
+	ctr_pr,
+	blocks
+};
+
+const char * names[blocks] = {"clkdiv", "clkdiv_2_3", "clkdiv_2_5", "clkdiv_prog", "div_pr", "ctr_pr"};
+
+const int max_stages = 4;
+const long max_pr = 10240;		// As prcnt and prdiv go
+const int min_cells = 3;		// Of any block, clkdiv /2
+
+int clog2(long v)
+{
+	int n = 0;
+	while ((1L << n) < v) n++;
+	return n;
+}
+
+// Bits to hold "v"
+int bits(long v)
+{
+	int n = 0;
+	while (v >> n) n++;
+	return n;
+}
+
+// Register width of a pseudo random counter, as in prsearch.cpp
+int bitness(long p)
+{
+	return std::max(4, clog2(p));
+}
+
+struct cost {
+	int lut = 0;
+	int ff = 0;
+
+	int cells() const
+	{
+		return std::max(lut, ff);
+	}
+};
+
+// "d" is the divider, or the div width of clkdiv_prog
+cost model(int b, long d)
+{
+	int n;
+	switch (b)
+	{
+		case clkdiv:
+			n = clog2(d);
+			return {n + 2*((n+3)/4), n+1};
+		case clkdiv_2_3:
+			return {4, 4};
+		case clkdiv_2_5:
+			return {5, 4};
+		case clkdiv_prog:
+			return {int(2*d + 3*((d+3)/4) + 4), int(2*d + 4)};
+		case div_pr:
+			n = bitness(d);
+			return {n, n};
+		case ctr_pr:
+			n = bitness(d);
+			return {2 + (n+1)/3, n+1};
+	}
+	return {};
+}
+
+// Highest input frequency in Hz
+double fmax(int b, long d)
+{
+	switch (b)
+	{
+		case clkdiv:		return (250 - 6*clog2(d)) * 1e6;
+		case clkdiv_prog:	return (200 - 6*d) * 1e6;
+		case clkdiv_2_3:
+		case clkdiv_2_5:	return 400e6;
+		default:		return 300e6;
+	}
+}
+
+// Divider ranges of a block whose cost does not change within them,
+// cheapest first. Empty past the last one.
+bool cost_class(int b, int i, long & lo, long & hi)
+{
+	switch (b)
+	{
+		case clkdiv:
+			if (i >= 31) return 0;
+			lo = i ? (1L << i) + 1 : 2;
+			hi = 2L << i;
+			return 1;
+		case clkdiv_2_3:
+		case clkdiv_2_5:
+			if (i > 1) return 0;
+			lo = hi = i ? (b == clkdiv_2_3 ? 3 : 5) : 2;
+			return 1;
+		case div_pr:
+		case ctr_pr:
+			lo = i ? (8L << i) + 1 : 3;
+			hi = std::min(16L << i, max_pr);
+			return lo <= hi;
+	}
+	return 0;
+}
+
+struct stage {
+	int8_t b = 0;
+	int d = 0;		// Divider, or the div width of clkdiv_prog
+};
+
+// A way to reach a target from the input, or the end part of one
+struct cascade {
+	stage s[max_stages];
+	uint64_t key[max_stages];	// Tree node of each stage
+	int n = 0;
+	int cells = 0;
+	double err = 0;			// Worst relative frequency error
+
+	bool valid() const
+	{
+		return cells < INT_MAX;
+	}
+};
+
+cascade none()
+{
+	cascade c;
+	c.cells = INT_MAX;
+	return c;
+}
+
+bool better(const cascade & a, const cascade & b)
+{
+	return a.cells < b.cells || (a.cells == b.cells && a.err < b.err);
+}
+
+uint64_t mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+struct target {
+	std::string name;
+	std::vector<double> f;		// Hz, more than one for a clkdiv_prog
+	double tol = 0;			// Relative
+	std::vector<long> lo, hi;	// Total dividers within tolerance, per frequency
+
+	bool prog() const
+	{
+		return f.size() > 1;
+	}
+};
+
+typedef std::unordered_map<uint64_t, std::pair<cascade, int>> memo_map;
+
+class planner {
+	public:
+	double fin = 0;
+	std::vector<target> t;
+	int stages = 3;
+	double speed = 1;
+	long max_candidates = 1L << 16;
+	double seconds = 0;		// Time limit of the pick, 0 - none
+	int threads = 1;
+
+	std::vector<std::vector<cascade>> cand;
+	std::vector<cascade> standalone;	// Cheapest cascade of each target on its own
+	std::vector<cascade> plan;		// Best so far, one cascade per target
+	int best = INT_MAX;
+	std::atomic<bool> truncated{0};		// Some candidates were left out
+	std::vector<int> cut;			// Costlier candidates than this were left out
+	std::atomic<bool> timed_out{0};
+	std::atomic<long> nodes{0};
+
+	private:
+	std::mutex m;
+	std::atomic<int> bound{INT_MAX};
+	std::chrono::steady_clock::time_point deadline;
+
+	bool fits(int b, long d, long p) const
+	{
+		return fin / p <= fmax(b, d) * speed;
+	}
+
+	// The last stage of target "j" after a total divider of "p", using block "b"
+	cascade final(int j, long p, int b) const
+	{
+		const target & g = t[j];
+		cascade c = none();
+		if (g.prog() != (b == clkdiv_prog)) return c;
+		if (b == clkdiv_prog)
+		{
+			// The div input is as wide as the largest divider needs
+			int w = 0;
+			for (size_t k=0; k<g.f.size(); k++)
+			{
+				long lo = std::max(1L, (g.lo[k] + p-1) / p);
+				if (lo > g.hi[k] / p) return c;
+				w = std::max(w, bits(lo));
+			}
+			if (w > 24 || !fits(b, w, p)) return c;
+			c.n = 1;
+			c.s[0].b = b;
+			c.s[0].d = w;
+			c.cells = model(b, w).cells();
+			c.err = 0;
+			for (size_t k=0; k<g.f.size(); k++)
+			{
+				long d = select(j, k, p, w);
+				c.err = std::max(c.err, std::abs(fin / (p*d) / g.f[k] - 1));
+			}
+			return c;
+		}
+		long lo = (g.lo[0] + p-1) / p;
+		long hi = g.hi[0] / p;
+		long l, h;
+		for (int i=0; cost_class(b, i, l, h); i++)
+		{
+			l = std::max(l, lo);
+			h = std::min(h, hi);
+			if (l > h) continue;
+			if (!fits(b, l, p)) return c;
+			// The cheapest class, and in there the nearest to the target
+			long d = std::llround(fin / p / g.f[0]);
+			d = std::min(std::max(d, l), h);
+			if (b == clkdiv_2_3 || b == clkdiv_2_5) d = l;
+			c.n = 1;
+			c.s[0].b = b;
+			c.s[0].d = d;
+			c.cells = model(b, d).cells();
+			c.err = std::abs(fin / (p*d) / g.f[0] - 1);
+			return c;
+		}
+		return c;
+	}
+
+	// Cheapest end of a cascade of target "j" from a total divider of "p",
+	// "r" stages at most, if it costs less than "bound". Tails are kept in
+	// "memo" with the bound they were looked for under.
+	cascade tail(int j, long p, int r, memo_map & memo, int bound) const
+	{
+		uint64_t mk = uint64_t(p) << 4 | r;
+		auto it = memo.find(mk);
+		if (it != memo.end())
+		{
+			const cascade & c = it->second.first;
+			if (c.valid() && c.cells < it->second.second) return c.cells < bound ? c : none();
+			if (bound <= it->second.second) return none();
+		}
+
+		cascade best = none();
+		for (int b=0; b<blocks; b++)
+		{
+			cascade c = final(j, p, b);
+			if (c.valid() && better(c, best)) best = c;
+		}
+		if (r > 1)
+		{
+			long top = 0;
+			for (long h : t[j].hi) top = std::max(top, h);
+			top /= p * (t[j].prog() ? 1 : 2);	// Room for the last stage
+			for (int b=0; b<blocks; b++)
+			{
+				if (b == clkdiv_prog) continue;
+				long l, h;
+				for (int i=0; cost_class(b, i, l, h); i++)
+				{
+					int cc = model(b, l).cells();
+					if (cc + min_cells >= std::min(best.cells, bound)) break;
+					if (l > top || !fits(b, l, p)) break;
+					h = std::min(h, top);
+					// Larger dividers leave less to the rest, but the rest
+					// has to land in the tolerance, so a few are tried
+					for (long d = h, k = 0; d >= l && k < 8; d--, k++)
+					{
+						cascade rest = tail(j, p*d, r-1, memo, std::min(best.cells, bound) - cc);
+						if (!rest.valid()) continue;
+						cascade c;
+						c.n = rest.n + 1;
+						c.s[0].b = b;
+						c.s[0].d = d;
+						for (int q=0; q<rest.n; q++) c.s[q+1] = rest.s[q];
+						c.cells = cc + rest.cells;
+						c.err = rest.err;
+						if (better(c, best)) best = c;
+					}
+				}
+			}
+		}
+		if (best.cells >= bound) best = none();
+		memo[mk] = {best, bound};
+		return best;
+	}
+
+	// A stage with total divider "p" can be shared with another target
+	bool shareable(int j, long p) const
+	{
+		for (size_t k=0; k<t.size(); k++)
+		{
+			if (k == j) continue;
+			for (size_t q=0; q<t[k].f.size(); q++)
+			{
+				if (2*p <= t[k].hi[q]) return 1;
+				if (!t[k].prog() && p >= t[k].lo[q] && p <= t[k].hi[q]) return 1;
+			}
+		}
+		return 0;
+	}
+
+	public:
+	// Total divider before stage "n" of "c"
+	long product(const cascade & c, int n) const
+	{
+		long p = 1;
+		for (int i=0; i<n; i++) if (c.s[i].b != clkdiv_prog) p *= c.s[i].d;
+		return p;
+	}
+
+	// Divider of clkdiv_prog for frequency "k" of target "j"
+	long select(int j, int k, long p, int w) const
+	{
+		const target & g = t[j];
+		long lo = std::max(1L, (g.lo[k] + p-1) / p);
+		long hi = std::min(g.hi[k] / p, (1L << w) - 1);
+		long d = std::llround(fin / p / g.f[k]);
+		return std::min(std::max(d, lo), hi);
+	}
+
+	// Fills in node keys. clkdiv_prog stages belong to their target alone.
+	void keys(int j, cascade & c) const
+	{
+		uint64_t k = 0;
+		for (int i=0; i<c.n; i++)
+		{
+			k = mix(k ^ (uint64_t(c.s[i].b) << 40 | uint64_t(c.s[i].d)) + 0x9e3779b97f4a7c15ull);
+			if (c.s[i].b == clkdiv_prog) k = mix(k + j + 1);
+			c.key[i] = k;
+		}
+	}
+
+	bool prepare(std::string & err)
+	{
+		if (stages < 1 || stages > max_stages)
+		{
+			err = "Stages are 1 to " + std::to_string(max_stages);
+			return 0;
+		}
+		for (auto & g : t)
+		{
+			for (double f : g.f)
+			{
+				if (!(f > 0) || f > fin / 2 * (1 + g.tol))
+				{
+					err = g.name + ": a divider can't make " + std::to_string(f) + " Hz";
+					return 0;
+				}
+				g.lo.push_back(std::max(1L, long(std::ceil(fin / (f * (1 + g.tol)) - 1e-9))));
+				g.hi.push_back(long(std::floor(fin / (f * (1 - g.tol)) + 1e-9)));
+			}
+		}
+		return 1;
+	}
+
+	// Cheapest cascade of every target on its own, and all that could do
+	// better in a shared tree. One target per thread.
+	void candidates()
+	{
+		size_t n = t.size();
+		standalone.assign(n, none());
+		cand.assign(n, {});
+		cut.assign(n, INT_MAX);
+		std::vector<memo_map> memo(n);
+		std::atomic<int> next{0};
+		auto solo = [&]()
+		{
+			int j;
+			while ((j = next++) < int(n))
+			{
+				standalone[j] = tail(j, 1, stages, memo[j], INT_MAX);
+				keys(j, standalone[j]);
+			}
+		};
+		run(solo, n);
+
+		int ub = 0;
+		for (auto & c : standalone)
+		{
+			if (!c.valid()) return;
+			ub += c.cells;
+		}
+		plan = standalone;
+		best = ub;
+		bound = ub;
+
+		next = 0;
+		auto list = [&]()
+		{
+			int j;
+			while ((j = next++) < int(n))
+			{
+				std::unordered_set<uint64_t> have;
+				cascade c;
+				walk(j, c, 1, ub, memo[j], have);
+				auto & v = cand[j];
+				std::sort(v.begin(), v.end(), better);
+				if (v.size() > max_candidates)
+				{
+					v.resize(max_candidates);
+					truncated = 1;
+				}
+			}
+		};
+		run(list, n);
+	}
+
+	void add(int j, const cascade & c, std::unordered_set<uint64_t> & have)
+	{
+		if (c.cells > cut[j]) return;
+		if (!have.insert(c.key[c.n-1]).second) return;
+		cand[j].push_back(c);
+		// Trimmed as it goes, the cheapest are kept and the walk
+		// does not look for any costlier than those
+		if (cand[j].size() >= 2*max_candidates)
+		{
+			auto & v = cand[j];
+			std::nth_element(v.begin(), v.begin() + max_candidates, v.end(), better);
+			cut[j] = v[max_candidates].cells;
+			v.resize(max_candidates);
+			truncated = 1;
+		}
+	}
+
+	// Paths of shareable stages from "c", finished where they are or by
+	// the cheapest tail
+	void walk(int j, cascade & c, long p, int ub, memo_map & memo, std::unordered_set<uint64_t> & have)
+	{
+		const target & g = t[j];
+		if (c.n && !g.prog() && p >= g.lo[0] && p <= g.hi[0])
+		{
+			cascade e = c;
+			e.err = std::abs(fin / p / g.f[0] - 1);
+			keys(j, e);
+			add(j, e, have);
+		}
+		if (c.n == stages) return;
+
+		cascade r = tail(j, p, stages - c.n, memo, ub - c.cells + 1);
+		if (r.valid() && c.cells + r.cells <= ub)
+		{
+			cascade e = c;
+			for (int i=0; i<r.n; i++) e.s[e.n++] = r.s[i];
+			e.cells += r.cells;
+			e.err = r.err;
+			keys(j, e);
+			add(j, e, have);
+		}
+		if (c.n + 1 == stages) return;
+
+		long top = 0;
+		for (long h : g.hi) top = std::max(top, h);
+		top /= p * (g.prog() ? 1 : 2);
+		// Nothing past the slowest of the other targets is shared
+		long other = 0;
+		for (size_t k=0; k<t.size(); k++) for (long h : t[k].hi) if (int(k) != j) other = std::max(other, h);
+		top = std::min(top, other / p);
+		for (int b=0; b<blocks; b++)
+		{
+			if (b == clkdiv_prog) continue;
+			long l, h;
+			for (int i=0; cost_class(b, i, l, h); i++)
+			{
+				int cc = model(b, l).cells();
+				if (c.cells + cc + min_cells > std::min(ub, cut[j])) break;
+				if (l > top || !fits(b, l, p)) break;
+				h = std::min(h, top);
+				for (long d=l; d<=h; d++)
+				{
+					if (!shareable(j, p*d)) continue;
+					cascade e = c;
+					e.s[e.n].b = b;
+					e.s[e.n].d = d;
+					e.n++;
+					e.cells += cc;
+					walk(j, e, p*d, ub, memo, have);
+				}
+			}
+		}
+	}
+
+	// Picks one candidate per target
+	void pick()
+	{
+		if (best == INT_MAX) return;
+		deadline = std::chrono::steady_clock::now()
+			+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+		// The most constrained target first
+		order.resize(t.size());
+		for (size_t i=0; i<order.size(); i++) order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return cand[a].size() < cand[b].size(); });
+		// No plan costs less than the cheapest candidate of any target
+		lb = 0;
+		for (auto & c : cand)
+		{
+			if (c.empty()) return;
+			lb = std::max(lb, c[0].cells);
+		}
+		later.assign(order.size(), {});
+		for (int d=int(order.size())-2; d>=0; d--)
+		{
+			later[d] = later[d+1];
+			for (auto & c : cand[order[d+1]]) later[d].insert(c.key, c.key + c.n);
+		}
+		// Candidates by the first divider they hang on, and the ones worth
+		// trying when nothing is shared
+		by_root.assign(order.size(), {});
+		alone.assign(order.size(), {});
+		sigs.assign(order.size(), {});
+		for (size_t d=0; d<order.size(); d++)
+		{
+			auto & cs = cand[order[d]];
+			std::unordered_set<uint64_t> seen;
+			for (size_t i=0; i<cs.size(); i++)
+			{
+				uint64_t k = 1;
+				for (int q=0; q<cs[i].n; q++) if (later[d].count(cs[i].key[q])) k = mix(k ^ cs[i].key[q]);
+				sigs[d].push_back(k);
+				by_root[d][cs[i].key[0]].push_back(i);
+				if (seen.insert(k).second) alone[d].push_back(i);
+			}
+		}
+
+		// Nothing to share with yet, the first target tries one candidate
+		// of every signature
+		auto & first = alone[0];
+		std::atomic<size_t> next{0};
+		auto work = [&]()
+		{
+			std::vector<std::pair<uint64_t, int>> tree;	// Nodes, users
+			std::vector<const cascade *> chosen(t.size());
+			long local = 0;
+			size_t i;
+			while ((i = next++) < first.size())
+			{
+				const cascade & c = cand[order[0]][first[i]];
+				if (std::max(c.cells, lb) >= bound) break;
+				enter(c, tree);
+				chosen[order[0]] = &c;
+				search(1, c.cells, tree, chosen, local);
+				leave(c, tree);
+				if (timed_out) break;
+			}
+			nodes += local;
+		};
+		run(work, threads);
+	}
+
+	private:
+	std::vector<int> order;			// Of targets in the pick
+	std::vector<std::unordered_set<uint64_t>> later;	// Nodes of candidates of targets after each
+	std::vector<std::unordered_map<uint64_t, std::vector<int>>> by_root;
+	std::vector<std::vector<int>> alone;
+	std::vector<std::vector<uint64_t>> sigs;	// Nodes of each candidate later targets could use
+	int lb = 0;
+
+	template <class F>
+	void run(F & f, size_t jobs)
+	{
+		std::vector<std::thread> pool;
+		for (int i=1; i<std::min<int>(threads, jobs); i++) pool.emplace_back([&]() { f(); });
+		f();
+		for (auto & th : pool) th.join();
+	}
+
+	// Cells "c" adds to "tree"
+	static int extra(const cascade & c, const std::vector<std::pair<uint64_t, int>> & tree)
+	{
+		int e = 0;
+		for (int i=c.n-1; i>=0; i--)
+		{
+			bool in = 0;
+			for (auto & q : tree) if (q.first == c.key[i]) in = 1;
+			// The stages before a node in the tree are in it too
+			if (in) break;
+			e += model(c.s[i].b, c.s[i].d).cells();
+		}
+		return e;
+	}
+
+	static void enter(const cascade & c, std::vector<std::pair<uint64_t, int>> & tree)
+	{
+		for (int i=0; i<c.n; i++)
+		{
+			bool in = 0;
+			for (auto & q : tree) if (q.first == c.key[i]) q.second++, in = 1;
+			if (!in) tree.push_back({c.key[i], 1});
+		}
+	}
+
+	static void leave(const cascade & c, std::vector<std::pair<uint64_t, int>> & tree)
+	{
+		for (int i=0; i<c.n; i++)
+		{
+			for (size_t q=0; q<tree.size(); q++)
+			{
+				if (tree[q].first != c.key[i]) continue;
+				if (--tree[q].second == 0)
+				{
+					tree[q] = tree.back();
+					tree.pop_back();
+				}
+				break;
+			}
+		}
+	}
+
+	static bool in(uint64_t k, const std::vector<std::pair<uint64_t, int>> & tree)
+	{
+		for (auto & q : tree) if (q.first == k) return 1;
+		return 0;
+	}
+
+	struct option {
+		int e;			// Cells added to the tree
+		int i;			// Candidate
+		uint64_t sig;
+	};
+
+	// Candidates of target "order[d]" hanging on a node of "tree", the
+	// only ones that cost less than they are worth alone, by the cells they
+	// add. Of those adding the same nodes that later targets could use,
+	// only the cheapest one is kept, as they leave the same choices behind.
+	std::vector<option> sharing(size_t d, int cells, const std::vector<std::pair<uint64_t, int>> & tree)
+	{
+		std::vector<option> opt;
+		std::unordered_map<uint64_t, size_t> sig;
+		auto & cs = cand[order[d]];
+		for (auto & q : tree)
+		{
+			auto r = by_root[d].find(q.first);
+			if (r == by_root[d].end()) continue;
+			for (int i : r->second)
+			{
+				// A plan holding "c" costs at least as much as "c"
+				if (cs[i].cells >= bound) break;
+				int e = extra(cs[i], tree);
+				if (e == 0)
+				{
+					opt.assign(1, {0, i, sigs[d][i]});
+					return opt;
+				}
+				if (std::max(cells + e, lb) >= bound) continue;
+				auto it = sig.find(sigs[d][i]);
+				if (it == sig.end())
+				{
+					sig[sigs[d][i]] = opt.size();
+					opt.push_back({e, i, sigs[d][i]});
+				}
+				else if (e < opt[it->second].e) opt[it->second] = {e, i, sigs[d][i]};
+			}
+		}
+		std::stable_sort(opt.begin(), opt.end(), [](const option & a, const option & b) { return a.e < b.e; });
+		return opt;
+	}
+
+	void search(size_t d, int cells, std::vector<std::pair<uint64_t, int>> & tree, std::vector<const cascade *> & chosen, long & local)
+	{
+		if ((++local & 4095) == 0 && seconds > 0 && std::chrono::steady_clock::now() >= deadline) timed_out = 1;
+		if (timed_out) return;
+		if (d == order.size())
+		{
+			std::lock_guard<std::mutex> l(m);
+			if (cells >= best) return;
+			best = cells;
+			bound = cells;
+			for (size_t j=0; j<t.size(); j++) plan[j] = *chosen[j];
+			return;
+		}
+		int j = order[d];
+		auto & cs = cand[j];
+		auto sh = sharing(d, cells, tree);
+		std::unordered_set<uint64_t> used;		// Signatures tried
+		auto go = [&](int i, int e)
+		{
+			enter(cs[i], tree);
+			chosen[j] = &cs[i];
+			search(d+1, cells + e, tree, chosen, local);
+			leave(cs[i], tree);
+		};
+		// Sharing options merged with the cheapest candidate of every
+		// other signature, which add all their cells
+		size_t a = 0, b = 0;
+		auto & al = alone[d];
+		while (!timed_out)
+		{
+			while (b < al.size() && in(cs[al[b]].key[0], tree)) b++;
+			bool take_a = a < sh.size() && (b == al.size() || sh[a].e <= cs[al[b]].cells);
+			if (!take_a && b == al.size()) break;
+			int i = take_a ? sh[a].i : al[b];
+			int e = take_a ? sh[a].e : cs[i].cells;
+			if (std::max(cells + e, lb) >= bound) break;
+			take_a ? a++ : b++;
+			if (!used.insert(sigs[d][i]).second) continue;
+			go(i, e);
+			if (take_a && e == 0) break;
+		}
+	}
+};
+
+// "25.175M", "115200", "32.768kHz"
+bool parse_freq(const std::string & s, double & f)
+{
+	char * e;
+	f = strtod(s.c_str(), &e);
+	std::string u = e;
+	if (u.size() >= 2 && (u.substr(u.size()-2) == "Hz" || u.substr(u.size()-2) == "hz")) u.resize(u.size()-2);
+	if (u == "k" || u == "K") f *= 1e3;
+	else if (u == "M") f *= 1e6;
+	else if (u == "G") f *= 1e9;
+	else if (!u.empty()) return 0;
+	return e != s.c_str() && f > 0;
+}
+
+// "0.5%", "200ppm", or a percentage
+bool parse_tol(const std::string & s, double & t)
+{
+	char * e;
+	t = strtod(s.c_str(), &e);
+	std::string u = e;
+	if (u == "ppm") t *= 1e-6;
+	else if (u == "%" || u.empty()) t *= 1e-2;
+	else return 0;
+	return e != s.c_str() && t >= 0 && t < 1;
+}
+
+// "[name=]f[,f..][~tol]"
+bool parse_target(const std::string & s, double tol, target & g)
+{
+	std::string v = s;
+	size_t e = v.find('=');
+	if (e != std::string::npos)
+	{
+		g.name = v.substr(0, e);
+		v = v.substr(e + 1);
+	}
+	g.tol = tol;
+	e = v.find('~');
+	if (e != std::string::npos)
+	{
+		if (!parse_tol(v.substr(e + 1), g.tol)) return 0;
+		v = v.substr(0, e);
+	}
+	size_t a = 0;
+	while (1)
+	{
+		size_t c = v.find(',', a);
+		double f;
+		if (!parse_freq(v.substr(a, c == std::string::npos ? std::string::npos : c - a), f)) return 0;
+		g.f.push_back(f);
+		if (c == std::string::npos) break;
+		a = c + 1;
+	}
+	return 1;
+}
+
+std::string hz(double f)
+{
+	char s[32];
+	if (f >= 1e6) snprintf(s, sizeof(s), "%.6g MHz", f / 1e6);
+	else if (f >= 1e3) snprintf(s, sizeof(s), "%.6g kHz", f / 1e3);
+	else snprintf(s, sizeof(s), "%.6g Hz", f);
+	return s;
+}
+
+std::string err(double e)
+{
+	char s[32];
+	if (std::abs(e) < 1e-4) snprintf(s, sizeof(s), "%+.1f ppm", e * 1e6);
+	else snprintf(s, sizeof(s), "%+.3f%%", e * 100);
+	return s;
+}
+
+// A stage of the chosen plan
+struct node {
+	int parent = -1;
+	stage s;
+	long p = 1;			// Total divider up to its output
+	std::vector<int> ends;		// Targets taken from its output
+	int id = 0;
+};
+
+int main(int argc, char** argv)
+{
+	planner pl;
+	double tol = 0.005;
+	std::string out, name = "clk_plan";
+	pl.threads = std::thread::hardware_concurrency();
+	if (pl.threads < 1) pl.threads = 1;
+	std::vector<std::string> ts;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "clkplan [options] [input] [target] [target] ...\n";
+			std::cerr << "Plans dividers from the input clock to every target, see clkplan.cpp.\n";
+			std::cerr << "Targets are \"[name=]freq[,freq..][~tolerance]\", e.g. \"pix=25.175M~0.5%\",\n";
+			std::cerr << "\"baud=115200,9600~200ppm\"; several frequencies are selected at run time.\n";
+			std::cerr << "  --tol [t]           Default tolerance, % or ppm (default: 0.5%)\n";
+			std::cerr << "  --stages [n]        Longest cascade, 1 - 4 (default: 3)\n";
+			std::cerr << "  --speed [factor]    Scales the fmax of all blocks (default: 1)\n";
+			std::cerr << "  --max-candidates [n]  Per target (default: 65536)\n";
+			std::cerr << "  --time-limit [s]    Stop picking after s seconds, with the best plan so far\n";
+			std::cerr << "  -o [file]           Also write the plan as a Verilog module\n";
+			std::cerr << "  --name [name]       Module name (default: clk_plan)\n";
+			std::cerr << "  -j [threads]        Threads (default: all)\n";
+			return 0;
+		}
+		if (a+1 < argc && o == "--tol")
+		{
+			if (!parse_tol(argv[++a], tol)) {
+				std::cerr << "Bad tolerance " << argv[a] << "\n";
+				return 1;
+			}
+		}
+		else if (a+1 < argc && o == "--stages") pl.stages = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--speed") pl.speed = atof(argv[++a]);
+		else if (a+1 < argc && o == "--max-candidates") pl.max_candidates = std::max(1L, atol(argv[++a]));
+		else if (a+1 < argc && o == "--time-limit") pl.seconds = atof(argv[++a]);
+		else if (a+1 < argc && o == "-o") out = argv[++a];
+		else if (a+1 < argc && o == "--name") name = argv[++a];
+		else if (a+1 < argc && o == "-j") pl.threads = std::max(1, atoi(argv[++a]));
+		else if (o[0] != '-') ts.push_back(o);
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (ts.size() < 2) {
+		std::cerr << "An input and at least one target, see -h\n";
+		return 1;
+	}
+	if (!parse_freq(ts[0], pl.fin)) {
+		std::cerr << "Bad input frequency " << ts[0] << "\n";
+		return 1;
+	}
+	for (size_t i=1; i<ts.size(); i++)
+	{
+		target g;
+		if (!parse_target(ts[i], tol, g)) {
+			std::cerr << "Bad target " << ts[i] << "\n";
+			return 1;
+		}
+		if (g.name.empty()) g.name = "clk" + std::to_string(i);
+		pl.t.push_back(g);
+	}
+	std::string e;
+	if (!pl.prepare(e)) {
+		std::cerr << e << "\n";
+		return 1;
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	pl.candidates();
+	for (size_t j=0; j<pl.t.size(); j++)
+	{
+		if (!pl.standalone[j].valid()) {
+			std::cerr << pl.t[j].name << " can't be reached within tolerance in " << pl.stages << " stages\n";
+			return 1;
+		}
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	pl.pick();
+	auto t2 = std::chrono::steady_clock::now();
+
+	long total = 0;
+	for (auto & c : pl.cand) total += c.size();
+	int solo = 0;
+	for (auto & c : pl.standalone) solo += c.cells;
+	std::cerr << "//// " << total << " candidate cascades in " << std::chrono::duration<double>(t1 - t0).count()
+		<< " s, " << pl.nodes << " partial plans in " << std::chrono::duration<double>(t2 - t1).count() << " s\n";
+	std::cerr << "//// " << solo << " cells without sharing, " << pl.best << " shared\n";
+	if (pl.truncated) std::cerr << "//// Too many candidates, the cheapest were kept; the plan may not be the best\n";
+	if (pl.timed_out) std::cerr << "//// Time limit hit; the plan may not be the best\n";
+
+	// Builds the tree
+	std::vector<node> nodes(1);
+	std::map<uint64_t, int> at;
+	for (size_t j=0; j<pl.t.size(); j++)
+	{
+		const cascade & c = pl.plan[j];
+		int up = 0;
+		for (int i=0; i<c.n; i++)
+		{
+			auto it = at.find(c.key[i]);
+			if (it == at.end())
+			{
+				node q;
+				q.parent = up;
+				q.s = c.s[i];
+				q.p = nodes[up].p * (c.s[i].b == clkdiv_prog ? 1 : c.s[i].d);
+				q.id = nodes.size();
+				nodes.push_back(q);
+				it = at.insert({c.key[i], q.id}).first;
+			}
+			up = it->second;
+		}
+		nodes[up].ends.push_back(j);
+	}
+	std::vector<std::vector<int>> kids(nodes.size());
+	for (size_t i=1; i<nodes.size(); i++) kids[nodes[i].parent].push_back(i);
+
+	cost sum;
+	for (size_t i=1; i<nodes.size(); i++)
+	{
+		cost c = model(nodes[i].s.b, nodes[i].s.d);
+		sum.lut += c.lut;
+		sum.ff += c.ff;
+	}
+	printf("// Clock plan from %s: %d logic cells, %d LUTs and %d FFs in the model\n",
+		hz(pl.fin).c_str(), pl.best, sum.lut, sum.ff);
+
+	// Prints what a node gives to its targets
+	auto label = [&](const node & q)
+	{
+		std::string s;
+		for (int j : q.ends)
+		{
+			const target & g = pl.t[j];
+			if (!s.empty()) s += ", ";
+			s += g.name + " (";
+			for (size_t k=0; k<g.f.size(); k++)
+			{
+				double f = pl.fin / q.p;
+				if (g.prog())
+				{
+					long d = pl.select(j, k, nodes[q.parent].p, q.s.d);
+					f /= d;
+					s += (k ? ", /" : "/") + std::to_string(d) + " ";
+				}
+				s += hz(f) + " " + err(f / g.f[k] - 1);
+			}
+			s += ")";
+		}
+		return s;
+	};
+	std::vector<std::pair<int, int>> stack = {{0, 0}};
+	while (!stack.empty())
+	{
+		int i = stack.back().first, dep = stack.back().second;
+		stack.pop_back();
+		const node & q = nodes[i];
+		std::string what;
+		if (i == 0) what = "in";
+		else if (q.s.b == clkdiv_prog) what = "clkdiv_prog n=" + std::to_string(q.s.d);
+		else if (q.s.b == div_pr || q.s.b == ctr_pr) what = names[q.s.b] + std::to_string(q.s.d);
+		else what = std::string(names[q.s.b]) + " /" + std::to_string(q.s.d);
+		std::string l = std::string(2*dep, ' ') + what;
+		std::string f = q.s.b == clkdiv_prog && i ? "" : hz(pl.fin / q.p);
+		std::string c;
+		if (i)
+		{
+			cost k = model(q.s.b, q.s.d);
+			c = std::to_string(k.lut) + " LUT " + std::to_string(k.ff) + " FF";
+		}
+		printf("//   %-28s %-14s %-14s %s\n", l.c_str(), f.c_str(), c.c_str(), label(q).c_str());
+		for (auto it = kids[i].rbegin(); it != kids[i].rend(); it++) stack.push_back({*it, dep+1});
+	}
+	for (size_t i=1; i<nodes.size(); i++)
+	{
+		if (nodes[i].s.b == ctr_pr)
+		{
+			printf("// ctr_pr outputs are one cycle pulses.\n");
+			break;
+		}
+	}
+	for (size_t i=1; i<nodes.size(); i++)
+	{
+		if (nodes[i].s.b == div_pr || nodes[i].s.b == ctr_pr)
+		{
+			printf("// Generate div_pr<p> with prdiv and ctr_pr<p> with prcnt, they may need extra bits.\n");
+			break;
+		}
+	}
+
+	if (out.empty()) return 0;
+	FILE * f = fopen(out.c_str(), "w");
+	if (!f) {
+		std::cerr << "Can't open " << out << "\n";
+		return 1;
+	}
+	fprintf(f, "// Clock plan from %s, made by clkplan\n", hz(pl.fin).c_str());
+	fprintf(f, "`include \"clkdiv.v\"\n\n");
+	fprintf(f, "module %s(\n\tinput wire clk_in", name.c_str());
+	for (size_t j=0; j<pl.t.size(); j++)
+	{
+		const target & g = pl.t[j];
+		if (g.prog()) fprintf(f, ",\n\tinput wire [%d:0] %s_sel", std::max(0, bits(g.f.size() - 1) - 1), g.name.c_str());
+	}
+	for (auto & g : pl.t) fprintf(f, ",\n\toutput wire %s", g.name.c_str());
+	fprintf(f, "\n);\n\n");
+	auto src = [&](int i) { return i ? "c" + std::to_string(i) : std::string("clk_in"); };
+	for (size_t i=1; i<nodes.size(); i++)
+	{
+		const node & q = nodes[i];
+		std::string in = src(q.parent), o = src(i);
+		int w = bitness(q.s.d);
+		fprintf(f, "wire %s;\n", o.c_str());
+		switch (q.s.b)
+		{
+			case clkdiv:
+				fprintf(f, "clkdiv #(.divider(%d)) d%zu (.in(%s), .out(%s));\n", q.s.d, i, in.c_str(), o.c_str());
+				break;
+			case clkdiv_2_3:
+			case clkdiv_2_5:
+				fprintf(f, "%s d%zu (.sel(1'b%d), .in(%s), .out(%s));\n", names[q.s.b], i, q.s.d != 2, in.c_str(), o.c_str());
+				break;
+			case clkdiv_prog:
+			{
+				int j = q.ends.at(0);
+				const target & g = pl.t[j];
+				fprintf(f, "reg [%d:0] %s_div;\n", q.s.d-1, g.name.c_str());
+				fprintf(f, "always @(*) begin\n\tcase (%s_sel)\n", g.name.c_str());
+				for (size_t k=0; k<g.f.size(); k++)
+				{
+					fprintf(f, "\t\t%zu: %s_div = %ld;\t// %s\n", k, g.name.c_str(),
+						pl.select(j, k, nodes[q.parent].p, q.s.d), hz(g.f[k]).c_str());
+				}
+				fprintf(f, "\t\tdefault: %s_div = 0;\n\tendcase\nend\n", g.name.c_str());
+				fprintf(f, "clkdiv_prog #(.n(%d)) d%zu (.in(%s), .div(%s_div), .reset(), .out(%s));\n",
+					q.s.d, i, in.c_str(), g.name.c_str(), o.c_str());
+				break;
+			}
+			case div_pr:
+				fprintf(f, "wire [%d:0] s%zu;\n", w-1, i);
+				fprintf(f, "div_pr%d d%zu (.clk(%s), .rst(1'b0), .out(s%zu));\t// prdiv %d\n", q.s.d, i, in.c_str(), i, q.s.d);
+				fprintf(f, "assign %s = s%zu[%d];\n", o.c_str(), i, w-1);
+				break;
+			case ctr_pr:
+				fprintf(f, "wire [%d:0] s%zu;\n", w-1, i);
+				fprintf(f, "reg p%zu = 0;\n", i);
+				fprintf(f, "ctr_pr%d d%zu (.clk(%s), .inc(1'b1), .out(s%zu));\t// prcnt %d\n", q.s.d, i, in.c_str(), i, q.s.d);
+				fprintf(f, "always @(posedge %s) p%zu <= (s%zu == 0);\n", in.c_str(), i, i);
+				fprintf(f, "assign %s = p%zu;\n", o.c_str(), i);
+				break;
+		}
+	}
+	fprintf(f, "\n");
+	for (size_t i=0; i<nodes.size(); i++)
+	{
+		for (int j : nodes[i].ends) fprintf(f, "assign %s = %s;\n", pl.t[j].name.c_str(), src(i).c_str());
+	}
+	fprintf(f, "\nendmodule\n");
+	fclose(f);
+	return 0;
+}
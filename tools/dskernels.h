@@ -0,0 +1,39 @@
+// Delta sigma modulator simulator
+// by Tomek Szczęsny 2024
+//
+// Modulator kernels of dssim.
+// dskernels_isa.cpp is built once per instruction set;
+// the best set the CPU supports is picked at startup.
+//
+
+#ifndef DSKERNELS_H
+#define DSKERNELS_H
+
+#include <cstdint>
+
+namespace ds {
+
+const int lanes = 8;
+
+// Eight modulators simulated side by side, one per lane.
+// Integrators are kept sign extended in 32 bits and wrap at their width,
+// as the "out" register of integrator.v does.
+struct batch {
+	int32_t second[lanes];		// -1 for dsmod2, 0 for dsmod1
+	int32_t sh1[lanes], sh2[lanes];	// 32 - integrator widths
+	int32_t d1hi[lanes], d1lo[lanes];	// ddc1 outputs feeding the first integrator
+	int32_t d2hi[lanes], d2lo[lanes];	// ... and the second one
+	int32_t bin[lanes];		// Input: a*tab[(bin*t) & mask] + dc, rounded
+	float a[lanes];
+	int32_t dc[lanes];
+};
+
+struct kernel_set {
+	const char * name;
+	// Runs len clock cycles from reset; bit i of out[t] is "out" of lane i
+	void (*run)(const batch * b, const float * tab, int mask, long len, uint8_t * out);
+};
+
+}
+
+#endif
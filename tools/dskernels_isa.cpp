@@ -0,0 +1,87 @@
+// Delta sigma modulator simulator
+// by Tomek Szczęsny 2024
+//
+// Runs a batch of modulator configurations side by side, one per lane,
+// one object per instruction set (DSK_ISA).
+//
+
+#include "dskernels.h"
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifndef DSK_ISA
+#define DSK_ISA scalar
+#endif
+
+#define DSK_STR2(x) #x
+#define DSK_STR(x) DSK_STR2(x)
+#define DSK_CAT2(a, b) a ## b
+#define DSK_CAT(a, b) DSK_CAT2(a, b)
+
+namespace ds {
+namespace DSK_CAT(isa_, DSK_ISA) {
+
+#if defined(__AVX2__)
+
+static void run(const batch * b, const float * tab, int mask, long len, uint8_t * out)
+{
+	#define LD(f) _mm256_loadu_si256((const __m256i *) b->f)
+	const __m256i second = LD(second), sh1 = LD(sh1), sh2 = LD(sh2);
+	const __m256i d1hi = LD(d1hi), d1lo = LD(d1lo), d2hi = LD(d2hi), d2lo = LD(d2lo);
+	const __m256i bin = LD(bin), dc = LD(dc), vmask = _mm256_set1_epi32(mask);
+	#undef LD
+	const __m256 a = _mm256_loadu_ps(b->a);
+	__m256i i1 = _mm256_setzero_si256(), i2 = i1, ph = i1;
+	for (long t=0; t<len; t++)
+	{
+		// "out" is the sign of the last integrator
+		__m256i o = _mm256_blendv_epi8(i1, i2, second);
+		out[t] = _mm256_movemask_ps(_mm256_castsi256_ps(o));
+		o = _mm256_srai_epi32(o, 31);
+		__m256i x = _mm256_add_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(a, _mm256_i32gather_ps(tab, ph, 4))), dc);
+		ph = _mm256_and_si256(_mm256_add_epi32(ph, bin), vmask);
+		__m256i n1 = _mm256_sub_epi32(_mm256_add_epi32(i1, x), _mm256_blendv_epi8(d1lo, d1hi, o));
+		__m256i n2 = _mm256_sub_epi32(_mm256_add_epi32(i2, i1), _mm256_blendv_epi8(d2lo, d2hi, o));
+		i1 = _mm256_srav_epi32(_mm256_sllv_epi32(n1, sh1), sh1);
+		i2 = _mm256_srav_epi32(_mm256_sllv_epi32(n2, sh2), sh2);
+	}
+}
+
+#else
+
+static void run(const batch * b, const float * tab, int mask, long len, uint8_t * out)
+{
+	int32_t i1[lanes] = {0}, i2[lanes] = {0};
+	uint32_t ph[lanes] = {0};
+	for (long t=0; t<len; t++)
+	{
+		uint8_t bits = 0;
+		for (int l=0; l<lanes; l++)
+		{
+			bool o = (b->second[l] ? i2[l] : i1[l]) < 0;
+			bits |= o << l;
+			int32_t x = int32_t(lrintf(b->a[l] * tab[ph[l]])) + b->dc[l];
+			ph[l] = (ph[l] + b->bin[l]) & mask;
+			// Unsigned sums wrap like the hardware does
+			uint32_t n1 = uint32_t(i1[l]) + uint32_t(x) - uint32_t(o ? b->d1hi[l] : b->d1lo[l]);
+			uint32_t n2 = uint32_t(i2[l]) + uint32_t(i1[l]) - uint32_t(o ? b->d2hi[l] : b->d2lo[l]);
+			i1[l] = int32_t(n1 << b->sh1[l]) >> b->sh1[l];
+			i2[l] = int32_t(n2 << b->sh2[l]) >> b->sh2[l];
+		}
+		out[t] = bits;
+	}
+}
+
+#endif
+
+}
+
+extern const kernel_set DSK_CAT(dsk_, DSK_ISA) = {
+	DSK_STR(DSK_ISA),
+	DSK_CAT(isa_, DSK_ISA)::run
+};
+
+}
@@ -0,0 +1,510 @@
+// Delta sigma modulator simulator
+// by Tomek Szczęsny 2024
+//
+// A bit exact model of dsmod1 and dsmod2, integrators wrapping at their
+// widths included, for sweeps of input amplitude, frequency and bit width.
+// Eight configurations run side by side in vector lanes (see dskernels.h)
+// and batches of them are spread over threads.
+//
+// Inputs are sine waves with a whole number of periods in the analyzed
+// record, quantized to n bits, or constants (frequency 0). Every record
+// is preceded by a settling time, which is not analyzed. The output
+// stream, decoded to the ddc1 levels, is Hann windowed and transformed;
+// SQNR counts the noise in the band up to fs / (2 * OSR).
+// A configuration is stable when the signal comes out with the gain of
+// the input, to within --max-gain dB (or 1% of full scale for constants).
+// Below --min-sqnr the gain is mostly noise and is not tested; such tones
+// are marked "noise". Integrators wrap in normal operation (the output is
+// their sign), so wrapping tells nothing. Instead a tone whose SQNR falls
+// 10 dB below that of a lower amplitude of the same configuration is
+// unstable, as SQNR only grows with the signal until the modulator breaks.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "dskernels.h"
+
+namespace ds {
+extern const kernel_set dsk_scalar;
+#if defined(__x86_64__)
+extern const kernel_set dsk_avx2;
+#endif
+}
+
+namespace {
+
+struct isa {
+	const ds::kernel_set * ks;
+	bool (*supported)();
+};
+
+// Best first
+const isa isas[] = {
+#if defined(__x86_64__)
+	{&ds::dsk_avx2, []() -> bool { return __builtin_cpu_supports("avx2"); }},
+#endif
+	{&ds::dsk_scalar, []() -> bool { return true; }},
+};
+
+const ds::kernel_set * ks = nullptr;
+
+bool set_isa(const std::string & name)
+{
+	for (auto & i : isas)
+	{
+		if ((name == "auto" || name == i.ks->name) && i.supported())
+		{
+			ks = i.ks;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+typedef std::complex<double> cpx;
+
+class fft {
+	// Radix 2 FFT of real records, through a complex one of half the length
+
+	private:
+	int n;				// Real length
+	std::vector<cpx> w;		// Twiddles of the complex transform
+	std::vector<cpx> wr;		// ... and of splitting it into the real one
+	std::vector<int> rev;
+
+	public:
+	fft(int n) : n(n), w(n/4), wr(n/2+1), rev(n/2)
+	{
+		int h = n/2, bits = 0;
+		while ((1 << bits) < h) bits++;
+		for (int i=0; i<n/4; i++) w[i] = std::polar(1.0, -2*M_PI*i/h);
+		for (int k=0; k<=h; k++) wr[k] = std::polar(1.0, -2*M_PI*k/n);
+		for (int i=0; i<h; i++)
+		{
+			rev[i] = 0;
+			for (int b=0; b<bits; b++) rev[i] |= ((i >> b) & 1) << (bits-1-b);
+		}
+	}
+
+	// Power |X[k]|^2 of bins 0 to n/2 of real x
+	std::vector<double> power(const std::vector<double> & x) const
+	{
+		int h = n/2;
+		std::vector<cpx> z(h);
+		for (int i=0; i<h; i++) z[rev[i]] = cpx(x[2*i], x[2*i+1]);
+		for (int len=2; len<=h; len*=2)
+		{
+			int step = h / len;
+			for (int i=0; i<h; i+=len)
+			{
+				for (int j=0; j<len/2; j++)
+				{
+					cpx u = z[i+j], v = z[i+j+len/2] * w[j*step];
+					z[i+j] = u + v;
+					z[i+j+len/2] = u - v;
+				}
+			}
+		}
+		std::vector<double> p(h+1);
+		for (int k=0; k<=h; k++)
+		{
+			cpx a = z[k % h], b = std::conj(z[(h-k) % h]);
+			cpx e = (a + b) * 0.5, o = (a - b) * cpx(0, -0.5);
+			cpx X = e + wr[k] * o;
+			p[k] = std::norm(X);
+		}
+		return p;
+	}
+};
+
+struct config {
+	int order, n, w1, w2;
+	double dbfs, f;		// Amplitude, frequency as a fraction of the band
+	// Results
+	int bin;
+	double sqnr, gain, error, density;
+	bool stable;
+	bool noisy;		// Too little signal to measure the gain
+};
+
+struct sweep {
+	int osr = 64;
+	int logn = 20;
+	long settle = 4096;
+	double max_gain = 1;
+	double min_sqnr = 10;
+	std::vector<float> tab;		// Sine, one period
+	std::vector<double> win;	// Hann window
+	double sw2;			// Sum of its squares
+
+	int length() const
+	{
+		return 1 << logn;
+	}
+
+	// Full scale of an n-bit input
+	static double full(int n)
+	{
+		return (1 << (n-1)) - 1;
+	}
+
+	void setup(ds::batch & b, int l, config & c) const
+	{
+		int n = c.n;
+		b.second[l] = c.order == 2 ? -1 : 0;
+		b.sh1[l] = 32 - c.w1;
+		b.sh2[l] = 32 - (c.order == 2 ? c.w2 : 32);
+		// ddc1 of n bits, and of n+3 bits for the second integrator of dsmod2
+		b.d1hi[l] = (1 << (n-1)) - 1;
+		b.d1lo[l] = -(1 << (n-1));
+		b.d2hi[l] = (1 << (n+2)) - 1;
+		b.d2lo[l] = -(1 << (n+2));
+		double amp = full(n) * std::pow(10, c.dbfs / 20);
+		if (c.f > 0)
+		{
+			// An odd bin visits every table entry, nearest to the frequency asked for
+			int band = length() / (2*osr);
+			c.bin = std::max(1, int(std::lround(c.f * band / 2 - 0.5)) * 2 + 1);
+			b.bin[l] = c.bin;
+			b.a[l] = amp;
+			b.dc[l] = 0;
+		}
+		else
+		{
+			c.bin = 0;
+			b.bin[l] = 0;
+			b.a[l] = 0;
+			b.dc[l] = std::lround(amp);
+		}
+	}
+
+	void analyze(const uint8_t * bits, int l, config & c, const fft & tf) const
+	{
+		int N = length();
+		double hi = (1 << (c.n-1)) - 1, lo = -(1 << (c.n-1));
+		std::vector<double> x(N);
+		double ones = 0;
+		for (int t=0; t<N; t++)
+		{
+			bool o = (bits[settle + t] >> l) & 1;
+			ones += o;
+			x[t] = (o ? hi : lo) * win[t];
+		}
+		c.density = ones / N;
+		std::vector<double> p = tf.power(x);
+		int band = N / (2*osr);
+		double amp = full(c.n) * std::pow(10, c.dbfs / 20);
+		double noise = 0, sig = 0;
+		// The Hann window spreads a tone over 3 bins, leave some room around it
+		for (int k=3; k<=band; k++)
+		{
+			if (c.bin && std::abs(k - c.bin) <= 3) sig += p[k];
+			else noise += p[k];
+		}
+		double scale = 4 / (double(N) * sw2);	// Power in a bin to squared amplitude
+		if (c.bin)
+		{
+			double a = std::sqrt(sig * scale);
+			c.sqnr = 10 * std::log10(sig / noise);
+			c.gain = 20 * std::log10(a / amp);
+			c.error = 0;
+			c.noisy = c.sqnr < min_sqnr;
+			c.stable = c.noisy || std::abs(c.gain) <= max_gain;
+		}
+		else
+		{
+			// Mean of the decoded stream against the constant
+			double mean = lo + (hi - lo) * c.density;
+			c.error = (mean - std::lround(amp)) / full(c.n);
+			c.sqnr = 10 * std::log10(full(c.n) * full(c.n) / 2 / (noise * scale / 2));
+			c.gain = 0;
+			c.stable = std::abs(c.error) <= 0.01;
+		}
+
+	}
+};
+
+// Parses "a,b,c" and "from:to:step" lists
+std::vector<double> list(const std::string & s)
+{
+	std::vector<double> v;
+	size_t i = 0;
+	while (i <= s.size())
+	{
+		size_t j = s.find(',', i);
+		if (j == std::string::npos) j = s.size();
+		std::string e = s.substr(i, j-i);
+		double a, b, st;
+		if (sscanf(e.c_str(), "%lf:%lf:%lf", &a, &b, &st) == 3 && st != 0)
+		{
+			for (double x = a; st > 0 ? x <= b + 1e-9 : x >= b - 1e-9; x += st) v.push_back(x);
+		}
+		else if (!e.empty()) v.push_back(atof(e.c_str()));
+		i = j + 1;
+	}
+	return v;
+}
+
+// Compares the kernel sets on random batches
+bool selftest()
+{
+	std::mt19937 g(1);
+	std::vector<float> tab(4096);
+	for (int i=0; i<4096; i++) tab[i] = std::sin(2*M_PI*i/4096);
+	bool ok = 1;
+	for (auto & i : isas)
+	{
+		if (!i.supported()) continue;
+		long bad = 0;
+		for (int r=0; r<50; r++)
+		{
+			ds::batch b;
+			for (int l=0; l<ds::lanes; l++)
+			{
+				int n = 2 + g() % 20;
+				b.second[l] = g() & 1 ? -1 : 0;
+				b.sh1[l] = 32 - (n + 2 + g() % 4);
+				b.sh2[l] = 32 - (n + 4 + g() % 4);
+				b.d1hi[l] = (1 << (n-1)) - 1;
+				b.d1lo[l] = -(1 << (n-1));
+				b.d2hi[l] = (1 << (n+2)) - 1;
+				b.d2lo[l] = -(1 << (n+2));
+				b.bin[l] = g() % 4096;
+				b.a[l] = (g() % 1000) / 1000.0 * ((1 << (n-1)) - 1);
+				b.dc[l] = 0;
+			}
+			std::vector<uint8_t> o1(5000), o2(5000);
+			i.ks->run(&b, tab.data(), 4095, o1.size(), o1.data());
+			ds::dsk_scalar.run(&b, tab.data(), 4095, o2.size(), o2.data());
+			if (o1 != o2) bad++;
+		}
+		std::cerr << "ISA " << i.ks->name << ": " << (bad ? "FAILED, " + std::to_string(bad) + " mismatches" : "ok") << "\n";
+		if (bad) ok = 0;
+	}
+	return ok;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	sweep sw;
+	std::vector<double> orders = {1, 2}, bits = {16}, w1s = {0}, w2s = {0}, amps = {-6}, freqs = {0.25};
+	int threads = std::thread::hardware_concurrency();
+	long trace = 0;
+	bool quiet = 0;
+	std::string isaname = "auto";
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "dssim [options]\n";
+			std::cerr << "Lists are given as a,b,c or from:to:step, and every combination is simulated.\n";
+			std::cerr << "  -o [list]       Modulator orders, 1 for dsmod1, 2 for dsmod2 (default: 1,2)\n";
+			std::cerr << "  -n [list]       Input bit widths, 2 - 24 (default: 16)\n";
+			std::cerr << "  --w1 [list]     Width of the first integrator, 0 for the one of dsmod1 / dsmod2\n";
+			std::cerr << "  --w2 [list]     Width of the second integrator of dsmod2, 0 for the one of dsmod2\n";
+			std::cerr << "  -a [list]       Input amplitudes in dBFS (default: -6)\n";
+			std::cerr << "  -f [list]       Input frequencies as a fraction of the band, 0 for constant\n";
+			std::cerr << "                  inputs (default: 0.25)\n";
+			std::cerr << "  --osr [ratio]   Oversampling ratio, the band ends at fs / (2 * OSR) (default: 64)\n";
+			std::cerr << "  -N [log2]       Analyzed samples, 2^N (default: 20)\n";
+			std::cerr << "  --settle [n]    Samples skipped after reset (default: 4096)\n";
+			std::cerr << "  --max-gain [dB] Gain error of stable modulators (default: 1)\n";
+			std::cerr << "  --min-sqnr [dB] SQNR below which the gain of a tone is not tested (default: 10)\n";
+			std::cerr << "  --trace [n]     Print the first n samples of the first configuration\n";
+			std::cerr << "  -q              Print the stability summary only\n";
+			std::cerr << "  -j [threads]    Threads (default: all cores)\n";
+			std::cerr << "  --isa [name]    Kernel instruction set: auto, scalar, avx2\n";
+			std::cerr << "  --selftest      Checks that all kernel sets agree\n";
+			return 0;
+		}
+		if (o == "--selftest") return selftest() ? 0 : 1;
+		if (a+1 < argc && o == "-o") orders = list(argv[++a]);
+		else if (a+1 < argc && o == "-n") bits = list(argv[++a]);
+		else if (a+1 < argc && o == "--w1") w1s = list(argv[++a]);
+		else if (a+1 < argc && o == "--w2") w2s = list(argv[++a]);
+		else if (a+1 < argc && o == "-a") amps = list(argv[++a]);
+		else if (a+1 < argc && o == "-f") freqs = list(argv[++a]);
+		else if (a+1 < argc && o == "--osr") sw.osr = atoi(argv[++a]);
+		else if (a+1 < argc && o == "-N") sw.logn = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--settle") sw.settle = atol(argv[++a]);
+		else if (a+1 < argc && o == "--max-gain") sw.max_gain = atof(argv[++a]);
+		else if (a+1 < argc && o == "--min-sqnr") sw.min_sqnr = atof(argv[++a]);
+		else if (a+1 < argc && o == "--trace") trace = atol(argv[++a]);
+		else if (o == "-q") quiet = 1;
+		else if (a+1 < argc && o == "-j") threads = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--isa") isaname = argv[++a];
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (!set_isa(isaname)) {
+		std::cerr << "ISA " << isaname << " is not supported here\n";
+		return 1;
+	}
+	if (sw.logn < 8 || sw.logn > 26 || sw.osr < 1 || (1 << sw.logn) / (2*sw.osr) < 16 || sw.settle < 0) {
+		std::cerr << "Need 2^8 to 2^26 samples, and at least 16 bins in the band\n";
+		return 1;
+	}
+
+	// Every combination, with integrator widths resolved
+	std::vector<config> cs;
+	for (double o : orders) for (double n : bits) for (double w1 : w1s) for (double w2 : w2s)
+	{
+		int in = n;
+		if ((o != 1 && o != 2) || in < 2 || in > 24) {
+			std::cerr << "Orders are 1 or 2, input widths 2 to 24\n";
+			return 1;
+		}
+		config c = {};
+		c.order = o;
+		c.n = in;
+		c.w1 = w1 ? int(w1) : o == 1 ? in+2 : in+3;
+		c.w2 = o == 2 ? (w2 ? int(w2) : in+5) : 0;
+		if (c.w1 < 2 || c.w1 > 32 || (o == 2 && (c.w2 < 2 || c.w2 > 32))) {
+			std::cerr << "Integrators are 2 to 32 bits wide\n";
+			return 1;
+		}
+		// Widths of dsmod1 don't depend on --w2
+		if (o == 1 && w2 != w2s[0]) continue;
+		for (double a : amps) for (double f : freqs)
+		{
+			if (a > 0 || f < 0 || f > 1) {
+				std::cerr << "Amplitudes are up to 0 dBFS, frequencies 0 to 1 of the band\n";
+				return 1;
+			}
+			c.dbfs = a;
+			c.f = f;
+			cs.push_back(c);
+		}
+	}
+
+	int N = sw.length();
+	sw.tab.resize(N);
+	sw.win.resize(N);
+	sw.sw2 = 0;
+	for (int i=0; i<N; i++)
+	{
+		sw.tab[i] = std::sin(2*M_PI*i/N);
+		sw.win[i] = 0.5 - 0.5 * std::cos(2*M_PI*i/N);
+		sw.sw2 += sw.win[i] * sw.win[i];
+	}
+	fft tf(N);
+	long len = sw.settle + N;
+	int batches = (cs.size() + ds::lanes - 1) / ds::lanes;
+	auto t0 = std::chrono::steady_clock::now();
+
+	if (trace)
+	{
+		ds::batch b = {};
+		for (int l=0; l<ds::lanes; l++) sw.setup(b, l, cs[0]);
+		long n = std::min(trace, len);
+		std::vector<uint8_t> o(n);
+		ks->run(&b, sw.tab.data(), N-1, n, o.data());
+		for (long t=0; t<n; t++)
+		{
+			long x = std::lrint(b.a[0] * sw.tab[(long(b.bin[0]) * t) & (N-1)]) + b.dc[0];
+			std::cout << "in: " << x << ", out: " << (o[t] & 1) << "\n";
+		}
+		return 0;
+	}
+
+	std::atomic<int> next{0};
+	std::atomic<double> simtime{0};
+	auto worker = [&]()
+	{
+		int i;
+		std::vector<uint8_t> out(len);
+		while ((i = next++) < batches)
+		{
+			ds::batch b = {};
+			int first = i * ds::lanes;
+			int used = std::min<int>(ds::lanes, cs.size() - first);
+			// Spare lanes repeat the first configuration
+			for (int l=0; l<ds::lanes; l++) sw.setup(b, l, cs[first + (l < used ? l : 0)]);
+			auto t1 = std::chrono::steady_clock::now();
+			ks->run(&b, sw.tab.data(), N-1, len, out.data());
+			double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+			double s = simtime;
+			while (!simtime.compare_exchange_weak(s, s + t));
+			for (int l=0; l<used; l++) sw.analyze(out.data(), l, cs[first + l], tf);
+		}
+	};
+	threads = std::max(1, std::min(threads, batches));
+	std::vector<std::thread> pool;
+	for (int t=1; t<threads; t++) pool.emplace_back(worker);
+	worker();
+	for (auto & t : pool) t.join();
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	// Stability regions: the highest amplitude up to which every one tested was stable
+	std::map<std::tuple<int, int, int, int, double>, std::vector<config *>> groups;
+	for (auto & c : cs) groups[std::make_tuple(c.order, c.n, c.w1, c.w2, c.f)].push_back(&c);
+	for (auto & g : groups)
+	{
+		auto & v = g.second;
+		std::sort(v.begin(), v.end(), [](const config * a, const config * b) { return a->dbfs < b->dbfs; });
+		// A tone that loses 10 dB of SQNR to a quieter one broke down
+		double top = -INFINITY;
+		for (auto c : v)
+		{
+			if (!c->bin) continue;
+			if (c->sqnr < top - 10) c->stable = 0;
+			top = std::max(top, c->sqnr);
+		}
+	}
+
+	char line[160];
+	if (!quiet)
+	{
+		std::cout << "// order   n  w1  w2    dBFS  f/band   bin    SQNR    ENOB    gain   error density stable\n";
+		for (auto & c : cs)
+		{
+			snprintf(line, sizeof(line), "%8d %3d %3d %3d %7.2f %7.4f %5d %7.2f %7.2f %7.3f %7.4f %7.5f %s\n",
+				c.order, c.n, c.w1, c.w2, c.dbfs, c.f, c.bin, c.sqnr, (c.sqnr - 1.76) / 6.02, c.gain, c.error,
+				c.density, !c.stable ? "NO" : c.noisy ? "noise" : "yes");
+			std::cout << line;
+		}
+	}
+
+	std::cout << "// Stability, order n w1 w2 f/band: stable up to / first unstable at [dBFS], best SQNR [dB] at [dBFS]\n";
+	for (auto & g : groups)
+	{
+		auto & v = g.second;
+		const config * ok = nullptr, * bad = nullptr, * best = nullptr;
+		for (auto c : v)
+		{
+			if (!c->stable)
+			{
+				bad = c;
+				break;
+			}
+			ok = c;
+			if (!best || c->sqnr > best->sqnr) best = c;
+		}
+		const config & c = *v[0];
+		snprintf(line, sizeof(line), "// %d %d %d %d %.4f: ", c.order, c.n, c.w1, c.w2, c.f);
+		std::cout << line;
+		if (ok) std::cout << "stable up to " << ok->dbfs;
+		else std::cout << "unstable at all amplitudes";
+		if (ok && bad) std::cout << ", ";
+		if (bad && ok) std::cout << "first unstable at " << bad->dbfs;
+		if (best && c.f > 0) std::cout << ", best SQNR " << best->sqnr << " at " << best->dbfs;
+		std::cout << "\n";
+	}
+	std::cerr << "//// " << cs.size() << " configurations of " << len << " samples, " << total << " s, "
+		<< double(batches) * ds::lanes * len / simtime / 1e6 << " Msamples/s simulated with " << ks->name << " kernels\n";
+	return 0;
+}
@@ -0,0 +1,209 @@
+// Event streams of the simulators
+// by Tomek Szczęsny 2024
+//
+// Times of events from text files or statistical models, moved to the
+// edges of a clock, used by fifosim and matsim.
+//
+// Sources:
+//   file            Text lines "time [value]", time in ticks, not decreasing,
+//                   with an optional value, 0x prefix for hex.
+//   periodic:P[:J]  Every P ticks, jittered by up to J ticks either way
+//   poisson:I       Random, I ticks apart on average
+//   burst:N:S:P     Bursts of N events S ticks apart, starting every P ticks
+//   bernoulli:x     At each clock edge with probability x
+//
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <algorithm>
+#include <limits.h>
+#include <math.h>
+#include <random>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+class events {
+	// A stream of event times, with optional values
+
+	public:
+	enum {FILE_, PERIODIC, POISSON, BURST, BERNOULLI} kind;
+	long grid = 1;		// Clock period
+	long serial = 0;	// Events at least this far apart, 0 allows several per tick
+	std::mt19937_64 rng;
+	double x = 0, lq = 0;
+	std::vector<uint64_t> cdf;
+	long P = 0, J = 0, N = 0, S = 0;
+
+	FILE * f = nullptr;
+	std::vector<char> buf;
+	size_t pos = 0, len = 0;
+	long line = 0;
+
+	long t = 0, k = 0, last = LONG_MIN / 2;
+
+	events(const std::string & spec, long grid, long serial, unsigned long seed) : grid(grid), serial(serial), rng(seed)
+	{
+		std::vector<std::string> a;
+		size_t p = 0, c;
+		while ((c = spec.find(':', p)) != std::string::npos)
+		{
+			a.push_back(spec.substr(p, c-p));
+			p = c+1;
+		}
+		a.push_back(spec.substr(p));
+		auto num = [&](int i) -> double
+		{
+			if (i >= int(a.size())) throw std::runtime_error("too few parameters in " + spec);
+			return atof(a[i].c_str());
+		};
+		if (a[0] == "periodic")
+		{
+			kind = PERIODIC;
+			P = num(1);
+			J = a.size() > 2 ? num(2) : 0;
+			if (P < 1 || 2*J >= P) throw std::runtime_error("periodic:P:J needs P >= 1, J < P/2");
+		}
+		else if (a[0] == "poisson")
+		{
+			kind = POISSON;
+			x = num(1);
+			if (x <= 0) throw std::runtime_error("poisson:I needs I > 0");
+		}
+		else if (a[0] == "burst")
+		{
+			kind = BURST;
+			N = num(1);
+			S = num(2);
+			P = num(3);
+			if (N < 1 || S < 0 || P < 1 || (N-1)*S >= P) throw std::runtime_error("burst:N:S:P needs (N-1)*S < P");
+		}
+		else if (a[0] == "bernoulli")
+		{
+			kind = BERNOULLI;
+			x = num(1);
+			if (x <= 0 || x > 1) throw std::runtime_error("bernoulli:x needs 0 < x <= 1");
+			lq = 1 / log1p(-x);
+			// P(skip <= i), for the 32 shortest skips
+			double q = 1;
+			if (x >= 1. / 32 && x < 1)
+			{
+				for (int i=0; i<32; i++)
+				{
+					q *= 1 - x;
+					cdf.push_back(uint64_t((1 - q) * 0x1p64));
+				}
+			}
+		}
+		else
+		{
+			kind = FILE_;
+			f = fopen(spec.c_str(), "r");
+			if (!f) throw std::runtime_error("can't open " + spec);
+			buf.resize(1 << 20);
+		}
+	}
+
+	~events()
+	{
+		if (f) fclose(f);
+	}
+
+	// Next event; 0 at the end of a file
+	bool next(long & time, long & value)
+	{
+		value = 0;
+		long r = 0;
+		switch (kind)
+		{
+			case FILE_:
+				if (!read(r, value)) return 0;
+				break;
+			case PERIODIC:
+				r = k++ * P + P;
+				if (J) r += std::uniform_int_distribution<long>(-J, J)(rng);
+				break;
+			case POISSON:
+				t += std::max(1L, lround(std::exponential_distribution<double>(1 / x)(rng)));
+				r = t;
+				break;
+			case BURST:
+				// k counts events within a burst, t is the burst start
+				if (k == N)
+				{
+					k = 0;
+					t += P;
+				}
+				r = t + P + k++ * S;
+				break;
+			case BERNOULLI:
+				// Skips the edges without events at once; dense events
+				// look the skip up in a table, sparse ones take a logarithm
+				t += grid;
+				if (x < 1)
+				{
+					uint64_t u = rng();
+					size_t i = 0;
+					while (i < cdf.size() && u >= cdf[i]) i++;
+					if (i == cdf.size())
+						i = long(log1p(-((u >> 11) * 0x1p-53)) * lq);
+					t += grid * i;
+				}
+				r = t;
+				break;
+		}
+		if (grid > 1) r = (r + grid - 1) / grid * grid;
+		if (serial) r = std::max(r, last + serial);
+		else r = std::max(r, last);
+		last = r;
+		time = r;
+		return 1;
+	}
+
+	private:
+
+	int getc()
+	{
+		if (pos == len)
+		{
+			len = fread(buf.data(), 1, buf.size(), f);
+			pos = 0;
+			if (!len) return -1;
+		}
+		return buf[pos++];
+	}
+
+	bool read(long & time, long & value)
+	{
+		while (1)
+		{
+			int c = getc();
+			line++;
+			while (c == ' ' || c == '\t') c = getc();
+			if (c < 0) return 0;
+			if (c == '\n' || c == '\r') continue;
+			if (c == '/' || c == '#')
+			{
+				while (c >= 0 && c != '\n') c = getc();
+				continue;
+			}
+			// "time [value]"
+			std::string s;
+			while (c >= 0 && c != '\n')
+			{
+				s += char(c);
+				c = getc();
+			}
+			char * e;
+			time = strtol(s.c_str(), &e, 0);
+			if (e == s.c_str()) throw std::runtime_error("bad event on line " + std::to_string(line));
+			value = strtol(e, nullptr, 0);
+			return 1;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,447 @@
+// FIFO depth sizing simulator
+// by Tomek Szczęsny 2024
+//
+// Replays producer and consumer activity through cycle accurate models of
+// fifo, fifo_cke, fifo_8 and fifo_multi (fifo.v), for many buffer depths
+// side by side, and reports the smallest depth that loses nothing or never
+// stalls the producer, peak occupancy and stall cycles.
+//
+// Time is counted in ticks, a unit common to both ends. The producer and
+// consumer clocks have periods of --pclk and --cclk ticks, events are moved
+// to the next edge of their clock and one word moves per edge at each end.
+// Both ends see the buffer level from before the edge, so a write into a full
+// buffer fails even if a word is read out at the same edge, and so does
+// a read of an empty buffer.
+//
+// Only events are simulated, so idle cycles are free. Each thread takes
+// a share of the depths and reads its own copy of the events.
+//
+// Producer (-p) and consumer (-c) events come from files or models, see
+// events.h. File values are the address masks of fifo_multi writes and
+// the sub-buffers read.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits.h>
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "events.h"
+
+// Level thresholds at which the producer stops, for status based clock enables
+enum {GATE_DROP, GATE_FULL, GATE_S1, GATE_S2, GATE_S3};
+
+struct lane {
+	// One buffer depth; o > 1 for fifo_multi
+
+	long m;			// Depth
+	long g;			// Writes wait while the level is g or more (wait modes)
+	std::vector<long> l;	// Levels
+	long b = 0;		// Words waiting at the producer
+	long tw = 0;		// Last producer edge accounted for
+	long peak = 0;		// Largest level seen by a write, plus one
+	long written = 0, lost = 0, stall = 0, maxb = 0, empty = 0, reads = 0;
+
+	// Takes the state of a deeper lane which hasn't come near its limits yet
+	void follow(const lane & r)
+	{
+		l = r.l;
+		b = r.b;
+		tw = r.tw;
+		peak = r.peak;
+		written = r.written;
+		lost = r.lost;
+		stall = r.stall;
+		maxb = r.maxb;
+		empty = r.empty;
+		reads = r.reads;
+	}
+};
+
+// Lanes are sorted by depth and end with one that never fills. Lanes far from
+// their limits behave the same as that one, so only the lanes below "split"
+// are simulated on their own; the rest take its state when they come close.
+
+struct config {
+	std::string variant = "fifo";
+	int gate = GATE_DROP;
+	int o = 8;
+	long pclk = 1, cclk = 1;
+	long end = LONG_MAX;
+	std::string prod, cons;
+	std::string mask = "random", caddr = "rr";
+	unsigned long seed = 1;
+};
+
+// fifo, fifo_cke and fifo_8
+void run_single(const config & c, std::vector<lane> & lanes)
+{
+	events prod(c.prod, c.pclk, 0, c.seed);
+	events cons(c.cons, c.cclk, c.cclk, c.seed ^ 0x9e3779b97f4a7c15);
+	long tp, tc, v;
+	bool hp = prod.next(tp, v), hc = cons.next(tc, v);
+	bool drop = c.gate == GATE_DROP;
+	long pg = c.pclk;
+	lane & ref = lanes.back();
+	size_t split = 0;
+	auto catchup = [&](lane & L, long t)
+	{
+		// Producer edges in (tw, t), with no reads in between; the level only grows
+		long E = pg == 1 ? t - 1 - L.tw : (t-1) / pg - L.tw / pg;
+		if (!L.b || E <= 0) return;
+		long & l = L.l[0];
+		long k = std::min(L.b, E);
+		if (drop)
+		{
+			long w = std::min(k, std::max(0L, L.m - l));
+			L.peak = std::max(L.peak, l + k);
+			l += w;
+			L.written += w;
+			L.lost += k - w;
+			L.b -= k;
+			L.peak = std::min(L.peak, L.m);
+		}
+		else
+		{
+			long w = std::min(k, std::max(0L, L.g - l));
+			if (w) L.peak = std::max(L.peak, l + w);
+			l += w;
+			L.written += w;
+			L.b -= w;
+			if (L.b) L.stall += E - w;
+		}
+	};
+	while (hp || hc)
+	{
+		long t = hp && (!hc || tp <= tc) ? tp : tc;
+		if (t > c.end) break;
+		long a = 0, r = 0;
+		while (hp && tp == t)
+		{
+			a++;
+			hp = prod.next(tp, v);
+		}
+		if (hc && tc == t)
+		{
+			r = 1;
+			hc = cons.next(tc, v);
+		}
+		bool edge = pg == 1 || t % pg == 0;
+		while (split + 1 < lanes.size() && ref.l[0] + ref.b + a >= (drop ? lanes[split].m : lanes[split].g))
+			lanes[split++].follow(ref);
+		for (size_t i = split ? 0 : lanes.size()-1; i < lanes.size(); i = i+1 < split ? i+1 : std::max(i+1, lanes.size()-1))
+		{
+			lane & L = lanes[i];
+			catchup(L, t);
+			long & l = L.l[0];
+			L.b += a;
+			L.maxb = std::max(L.maxb, L.b);
+			long w = 0, rd = 0;
+			if (edge && L.b)
+			{
+				if (l < (drop ? L.m : L.g))
+				{
+					w = 1;
+					L.peak = std::max(L.peak, l + 1);
+				}
+				else if (drop) L.lost++;
+				else L.stall++;
+				if (w || drop) L.b--;
+			}
+			if (r)
+			{
+				L.reads++;
+				if (l) rd = 1;
+				else L.empty++;
+			}
+			l += w - rd;
+			L.written += w;
+			L.tw = t;
+		}
+	}
+	long t = c.end == LONG_MAX ? 0 : c.end + 1;
+	for (lane & L : lanes) if (t > L.tw) catchup(L, t);
+	while (split + 1 < lanes.size()) lanes[split++].follow(ref);
+}
+
+// fifo_multi: latches start the input state machine, which writes sub-buffer i
+// i+1 clock cycles later and is ready one cycle after the last write
+void run_multi(const config & c, std::vector<lane> & lanes, long & rdy_stall, long & aborted)
+{
+	events prod(c.prod, c.pclk, 0, c.seed);
+	events cons(c.cons, c.cclk, c.cclk, c.seed ^ 0x9e3779b97f4a7c15);
+	std::mt19937_64 rng(c.seed + 1);
+	int o = c.o;
+	long omask = (1L << o) - 1;
+	long fixed = -1;
+	if (c.mask != "random" && c.mask != "rr") fixed = strtol(c.mask.c_str(), nullptr, 0) & omask;
+	bool pmodel = prod.kind != events::FILE_, cmodel = cons.kind != events::FILE_;
+	long tp, vp, tc, vc;
+	bool hp = prod.next(tp, vp), hc = cons.next(tc, vc);
+	bool wait = c.gate != GATE_DROP;
+	long pg = c.pclk;
+	long rr_in = 0, rr_out = 0;
+	long ready = LONG_MIN;		// When the state machine takes the next latch
+	std::vector<std::pair<long, int>> pending;	// Scheduled writes, in time order
+	size_t pi = 0;
+	rdy_stall = aborted = 0;
+	std::vector<long> wsub;
+	lane & ref = lanes.back();
+	size_t split = 0;
+	while (hp || hc || pi < pending.size())
+	{
+		long t = LONG_MAX;
+		if (hp) t = std::max(tp, wait ? ready : tp);
+		if (hc) t = std::min(t, tc);
+		if (pi < pending.size()) t = std::min(t, pending[pi].first);
+		if (t > c.end) break;
+		// A latch, which restarts the state machine
+		if (hp && std::max(tp, wait ? ready : tp) == t)
+		{
+			long mask = vp & omask;
+			if (fixed >= 0) mask = fixed;
+			else if (pmodel)
+				mask = c.mask == "rr" ? 1L << (rr_in++ % o) : 1L << std::uniform_int_distribution<int>(0, o-1)(rng);
+			rdy_stall += (t - tp) / pg;
+			for (size_t i = pi; i < pending.size(); i++) if (pending[i].first >= t) aborted++;
+			pending.clear();
+			pi = 0;
+			int hi = -1;
+			for (int i=0; i<o; i++)
+			{
+				if (mask >> i & 1)
+				{
+					pending.push_back({t + (i+1) * pg, i});
+					hi = i;
+				}
+			}
+			ready = t + (hi + 2) * pg;
+			hp = prod.next(tp, vp);
+		}
+		// Writes at this edge
+		wsub.clear();
+		while (pi < pending.size() && pending[pi].first == t) wsub.push_back(pending[pi++].second);
+		bool r = 0;
+		long addr = 0;
+		if (hc && tc == t)
+		{
+			r = 1;
+			if (!cmodel) addr = vc % o;
+			else if (c.caddr == "random") addr = std::uniform_int_distribution<int>(0, o-1)(rng);
+			else addr = rr_out++ % o;
+			hc = cons.next(tc, vc);
+		}
+		long most = *std::max_element(ref.l.begin(), ref.l.end());
+		while (split + 1 < lanes.size() && most + long(wsub.size()) >= lanes[split].m)
+			lanes[split++].follow(ref);
+		for (size_t i = split ? 0 : lanes.size()-1; i < lanes.size(); i = i+1 < split ? i+1 : std::max(i+1, lanes.size()-1))
+		{
+			lane & L = lanes[i];
+			long a = addr;
+			if (r && c.caddr == "busiest")
+				a = std::max_element(L.l.begin(), L.l.end()) - L.l.begin();
+			bool rd = 0;
+			if (r)
+			{
+				L.reads++;
+				if (L.l[a]) rd = 1;
+				else L.empty++;
+			}
+			for (int s : wsub)
+			{
+				if (L.l[s] < L.m)
+				{
+					L.peak = std::max(L.peak, L.l[s] + 1);
+					L.l[s]++;
+					L.written++;
+				}
+				else L.lost++;
+			}
+			L.l[a] -= rd;
+			L.tw = t;
+		}
+	}
+	while (split + 1 < lanes.size()) lanes[split++].follow(ref);
+}
+
+int main(int argc, char** argv)
+{
+	config c;
+	long mfrom = 32, mto = 65536;
+	int threads = std::thread::hardware_concurrency();
+	if (threads < 1) threads = 1;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "fifosim [options]\n";
+			std::cerr << "Sizes FIFO buffers of fifo.v by replaying events, see fifosim.cpp.\n";
+			std::cerr << "  -v [variant]    fifo, fifo_cke, fifo_8 or fifo_multi (default: fifo)\n";
+			std::cerr << "  -p [events]     Producer events: a file or a model (see fifosim.cpp)\n";
+			std::cerr << "  -c [events]     Consumer events\n";
+			std::cerr << "  -m [from:to]    Depths tried, powers of 2 (default: 32:65536)\n";
+			std::cerr << "  -o [n]          fifo_multi sub-buffers (default: 8)\n";
+			std::cerr << "  --gate [g]      Producer behaviour at a full buffer:\n";
+			std::cerr << "                  drop - writes anyway and loses the word (default)\n";
+			std::cerr << "                  full - waits for room, like fifo_8 with cke = ~status[1]\n";
+			std::cerr << "                  s1, s2, s3 - waits while status[n] is high, s3 as in video_test\n";
+			std::cerr << "                  fifo_multi producers wait for \"rdy\" with any gate but drop\n";
+			std::cerr << "  --pclk [ticks]  Producer clock period (default: 1)\n";
+			std::cerr << "  --cclk [ticks]  Consumer clock period (default: 1)\n";
+			std::cerr << "  -t [ticks]      Time simulated (default: to the end of the files)\n";
+			std::cerr << "  --mask [m]      fifo_multi write masks of models: random, rr or a mask (random)\n";
+			std::cerr << "  --addr [a]      fifo_multi reads of models: rr, random or busiest (rr)\n";
+			std::cerr << "  -s [seed]       Random seed (default: 1)\n";
+			std::cerr << "  -j [threads]    Threads (default: all)\n";
+			return 0;
+		}
+		if (a+1 < argc && o == "-v") c.variant = argv[++a];
+		else if (a+1 < argc && o == "-p") c.prod = argv[++a];
+		else if (a+1 < argc && o == "-c") c.cons = argv[++a];
+		else if (a+1 < argc && o == "-m")
+		{
+			std::string s = argv[++a];
+			size_t k = s.find(':');
+			mfrom = atol(s.c_str());
+			mto = k == std::string::npos ? mfrom : atol(s.c_str() + k + 1);
+		}
+		else if (a+1 < argc && o == "-o") c.o = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--gate")
+		{
+			std::string g = argv[++a];
+			if (g == "drop") c.gate = GATE_DROP;
+			else if (g == "full") c.gate = GATE_FULL;
+			else if (g == "s1") c.gate = GATE_S1;
+			else if (g == "s2") c.gate = GATE_S2;
+			else if (g == "s3") c.gate = GATE_S3;
+			else std::cerr << "Unknown gate " << g << "\n";
+		}
+		else if (a+1 < argc && o == "--pclk") c.pclk = std::max(1L, atol(argv[++a]));
+		else if (a+1 < argc && o == "--cclk") c.cclk = std::max(1L, atol(argv[++a]));
+		else if (a+1 < argc && o == "-t") c.end = atol(argv[++a]);
+		else if (a+1 < argc && o == "--mask") c.mask = argv[++a];
+		else if (a+1 < argc && o == "--addr") c.caddr = argv[++a];
+		else if (a+1 < argc && o == "-s") c.seed = atol(argv[++a]);
+		else if (a+1 < argc && o == "-j") threads = std::max(1, atoi(argv[++a]));
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (c.prod.empty() || c.cons.empty()) {
+		std::cerr << "Both -p and -c are needed, see -h\n";
+		return 1;
+	}
+	bool multi = c.variant == "fifo_multi";
+	if (c.variant != "fifo" && c.variant != "fifo_cke" && c.variant != "fifo_8" && !multi) {
+		std::cerr << "Unknown variant " << c.variant << "\n";
+		return 1;
+	}
+	if (c.end == LONG_MAX && c.prod.find(':') != std::string::npos && c.cons.find(':') != std::string::npos) {
+		std::cerr << "Models never end, give the time with -t\n";
+		return 1;
+	}
+	if (multi && (c.o < 2 || c.o > 32 || (c.o & (c.o-1)))) {
+		std::cerr << "fifo_multi needs a power of 2 of sub-buffers, 2 to 32\n";
+		return 1;
+	}
+	if (c.variant == "fifo_8")
+	{
+		// ctr_pr9 runs through all 512 states, so it holds 512 words
+		mfrom = mto = 512;
+		if (c.gate == GATE_S1 || c.gate == GATE_S2 || c.gate == GATE_S3) {
+			std::cerr << "fifo_8 has \"full\" and \"empty\" only\n";
+			return 1;
+		}
+	}
+
+	// Depths, and one that never fills, for the exact need
+	std::vector<long> depths;
+	for (long m = 1; m <= mto; m *= 2) if (m >= mfrom) depths.push_back(m);
+	if (depths.empty()) {
+		std::cerr << "No power of 2 depths in " << mfrom << ":" << mto << "\n";
+		return 1;
+	}
+	depths.push_back(LONG_MAX / 4);
+	std::vector<lane> lanes(depths.size());
+	for (int i=0; i<depths.size(); i++)
+	{
+		lane & L = lanes[i];
+		L.m = depths[i];
+		L.l.assign(multi ? c.o : 1, 0);
+		switch (c.gate)
+		{
+			case GATE_S1: L.g = L.m / 4; break;
+			case GATE_S2: L.g = L.m / 2; break;
+			case GATE_S3: L.g = L.m / 16 * 15; break;
+			default:      L.g = L.m;
+		}
+	}
+
+	// Threads take depths in turns, each replays the events
+	// Every thread follows its own copy of the lane that never fills
+	threads = std::min<int>(threads, lanes.size() - 1);
+	std::vector<std::vector<int>> share(threads);
+	for (int i=0; i+1<lanes.size(); i++) share[i % threads].push_back(i);
+	for (int th=0; th<threads; th++) share[th].push_back(lanes.size() - 1);
+	std::atomic<bool> failed{0};
+	std::string error;
+	long rdy_stall = 0, aborted = 0;
+	long last = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector<std::vector<lane>> own(threads);
+	for (int th=0; th<threads; th++) for (int i : share[th]) own[th].push_back(lanes[i]);
+	auto work = [&](int th)
+	{
+		std::vector<lane> & mine = own[th];
+		try {
+			long rs, ab;
+			if (multi) run_multi(c, mine, rs, ab);
+			else run_single(c, mine);
+			if (th == 0 && multi)
+			{
+				rdy_stall = rs;
+				aborted = ab;
+			}
+		} catch (std::exception & e) {
+			if (!failed.exchange(1)) error = e.what();
+			return;
+		}
+		for (int k=0; k<share[th].size(); k++) if (th == 0 || k+1 < share[th].size()) lanes[share[th][k]] = mine[k];
+	};
+	std::vector<std::thread> pool;
+	for (int th=1; th<threads; th++) pool.emplace_back(work, th);
+	work(0);
+	for (auto & th : pool) th.join();
+	if (failed) {
+		std::cerr << error << "\n";
+		return 1;
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	for (lane & L : lanes) last = std::max(last, L.tw);
+	if (c.end != LONG_MAX) last = c.end;
+
+	bool drop = c.gate == GATE_DROP;
+	lane & inf = lanes.back();
+	printf("%-8s %10s %12s %12s %12s %10s %12s\n", "depth", "peak", "written", "lost", "stalls", "backlog", "empty reads");
+	long safe = -1;
+	for (int i=0; i+1<lanes.size(); i++)
+	{
+		lane & L = lanes[i];
+		printf("%-8ld %10ld %12ld %12ld %12ld %10ld %12ld\n", L.m, L.peak, L.written, L.lost, L.stall, L.maxb, L.empty);
+		if (safe < 0 && !L.lost && !L.stall) safe = L.m;
+	}
+	printf("%-8s %10ld %12ld %12ld %12ld %10ld %12ld\n", "inf", inf.peak, inf.written, inf.lost, inf.stall, inf.maxb, inf.empty);
+	if (multi) printf("// State machine: %ld producer cycles waiting for rdy, %ld writes aborted by early latches\n", rdy_stall, aborted);
+	if (safe > 0) printf("// Smallest safe depth: %ld\n", safe);
+	else printf("// No depth tried is safe\n");
+	if (drop || c.gate == GATE_FULL || multi) printf("// Exact need: %ld words%s\n", inf.peak, multi ? " per sub-buffer" : "");
+	std::cerr << "//// " << last << " ticks in " << secs << " s, " << last / secs / 1e9 * 60 << " G ticks/min\n";
+	return 0;
+}
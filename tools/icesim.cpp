@@ -0,0 +1,685 @@
+// Cycle simulator for iCE40 primitive netlists
+// by Tomek Szczęsny 2024
+//
+// Reads a flattened netlist of SB_LUT4, SB_CARRY and SB_DFF* cells in
+// Yosys JSON, e.g. written by:
+//   yosys -p "synth_ice40 -top top; write_json top.json" top.v
+// and simulates it with the semantics of sim.v. Every net is a machine
+// word, so 64 independent stimulus lanes run at once, one bit each.
+// The combinational logic is levelized once into a flat list of word
+// operations, and every cycle is a single pass over it.
+//
+// A cycle is one rising edge of the clock. Inputs are applied and the
+// logic settles (asynchronous set / reset included) before the edge;
+// traced signals show these settled values.
+//
+// Stimulus file, one assignment per line, held until changed:
+//   [cycle] [input] [value] [lane]
+// where value is decimal, 0x.. or 0b.., and lane is optional (all lanes by default).
+// Lines starting with # are comments.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+//
+// A minimal JSON reader, enough for Yosys netlists
+//
+
+struct json {
+	enum kind { null, number, string, array, object } k = null;
+	std::string s;			// String, or number as written
+	std::vector<json> a;
+	std::vector<std::pair<std::string, json>> o;
+
+	const json * get(const std::string & key) const
+	{
+		for (auto & i : o) if (i.first == key) return &i.second;
+		return nullptr;
+	}
+};
+
+class json_reader {
+	const std::string & t;
+	size_t p = 0;
+
+	void ws()
+	{
+		while (p < t.size() && isspace(t[p])) p++;
+	}
+
+	bool str(std::string & s)
+	{
+		p++;
+		while (p < t.size() && t[p] != '"')
+		{
+			if (t[p] == '\\' && p+1 < t.size())
+			{
+				p++;
+				char c = t[p];
+				if (c == 'u') p += 4;		// Net names are ASCII
+				else s += c == 'n' ? '\n' : c == 't' ? '\t' : c;
+			}
+			else s += t[p];
+			p++;
+		}
+		p++;
+		return p <= t.size();
+	}
+
+	public:
+	json_reader(const std::string & t) : t(t) {}
+
+	bool value(json & v)
+	{
+		ws();
+		if (p >= t.size()) return 0;
+		char c = t[p];
+		if (c == '{')
+		{
+			v.k = json::object;
+			p++;
+			ws();
+			if (t[p] == '}') { p++; return 1; }
+			while (1)
+			{
+				ws();
+				std::string key;
+				if (t[p] != '"' || !str(key)) return 0;
+				ws();
+				if (t[p++] != ':') return 0;
+				v.o.emplace_back(key, json());
+				if (!value(v.o.back().second)) return 0;
+				ws();
+				if (t[p] == ',') { p++; continue; }
+				if (t[p++] == '}') return 1;
+				return 0;
+			}
+		}
+		if (c == '[')
+		{
+			v.k = json::array;
+			p++;
+			ws();
+			if (t[p] == ']') { p++; return 1; }
+			while (1)
+			{
+				v.a.emplace_back();
+				if (!value(v.a.back())) return 0;
+				ws();
+				if (t[p] == ',') { p++; continue; }
+				if (t[p++] == ']') return 1;
+				return 0;
+			}
+		}
+		if (c == '"')
+		{
+			v.k = json::string;
+			return str(v.s);
+		}
+		size_t s = p;
+		while (p < t.size() && (isalnum(t[p]) || t[p] == '-' || t[p] == '+' || t[p] == '.')) p++;
+		v.s = t.substr(s, p-s);
+		v.k = isdigit(v.s[0]) || v.s[0] == '-' ? json::number : json::null;
+		return p > s;
+	}
+};
+
+//
+// Netlist
+//
+
+const int net0 = 0;
+const int net1 = 1;
+
+// Operations of the levelized combinational logic
+struct op {
+	int o;
+	int in[4];
+	uint16_t init;		// SB_LUT4 only
+	int k;			// SB_LUT4 inputs left after folding
+	bool carry;
+};
+
+// Drops LUT inputs tied to constants or repeated, so that only
+// the inputs that matter are evaluated
+void fold(op & o)
+{
+	int in[4], k = 0;
+	for (int n : o.in)
+	{
+		if (n > net1 && std::find(in, in+k, n) == in+k) in[k++] = n;
+	}
+	uint16_t init = 0;
+	for (int j=0; j<(1 << k); j++)
+	{
+		int idx = 0;
+		for (int q=0; q<4; q++)
+		{
+			int n = o.in[q];
+			int b = n == net1 || (n > net1 && (j >> (std::find(in, in+k, n) - in)) & 1);
+			idx |= b << q;
+		}
+		init |= ((o.init >> idx) & 1) << j;
+	}
+	o.init = init;
+	o.k = k;
+	for (int q=0; q<4; q++) o.in[q] = q < k ? in[q] : net0;
+}
+
+// Flip-flop flavours of sim.v
+struct dff {
+	int q, d, e, sr;	// e and sr are -1 when absent
+	bool set;		// S instead of R
+	bool async;
+};
+
+struct signal {
+	std::string name;
+	std::vector<int> bits;	// Net numbers, LSB first
+};
+
+class netlist {
+	public:
+	std::vector<op> ops;
+	std::vector<dff> ffs;
+	std::vector<signal> inputs, outputs, names;
+	int nets = 2;
+	int clock = -1;
+	int levels = 0;
+	std::string error;
+
+	// Net number of a Yosys bit: an integer id, or "0" / "1" / "x" / "z"
+	int net(const json & b)
+	{
+		if (b.k == json::string) return b.s == "1" ? net1 : net0;
+		int n = atoi(b.s.c_str());
+		nets = std::max(nets, n+1);
+		return n;
+	}
+
+	std::vector<int> bits(const json * j)
+	{
+		std::vector<int> r;
+		if (j) for (auto & b : j->a) r.push_back(net(b));
+		return r;
+	}
+
+	bool fail(const std::string & msg)
+	{
+		if (error.empty()) error = msg;
+		return 0;
+	}
+
+	bool load(const json & root, std::string top, std::string clk)
+	{
+		const json * mods = root.get("modules");
+		if (!mods || mods->o.empty()) return fail("no modules");
+		const json * m = nullptr;
+		for (auto & i : mods->o)
+		{
+			const json * at = i.second.get("attributes");
+			const json * t = at ? at->get("top") : nullptr;
+			bool istop = t && t->s.find('1') != std::string::npos;
+			if (top.empty() ? istop : i.first == top) m = &i.second;
+		}
+		if (!m && top.empty() && mods->o.size() == 1) m = &mods->o[0].second;
+		if (!m) return fail(top.empty() ? "no top module, use -m" : "no module " + top);
+
+		const json * ports = m->get("ports");
+		if (ports) for (auto & i : ports->o)
+		{
+			const json * dir = i.second.get("direction");
+			signal s = {i.first, bits(i.second.get("bits"))};
+			if (dir && dir->s == "input") inputs.push_back(s);
+			else outputs.push_back(s);
+		}
+		const json * nn = m->get("netnames");
+		if (nn) for (auto & i : nn->o) names.push_back({i.first, bits(i.second.get("bits"))});
+
+		// Cells
+		std::vector<int> driver;	// Op driving each net, -1 for none
+		std::vector<int> clocks;
+		const json * cells = m->get("cells");
+		if (cells) for (auto & i : cells->o)
+		{
+			const json & c = i.second;
+			const json * tj = c.get("type");
+			std::string type = tj ? tj->s : "";
+			const json * con = c.get("connections");
+			auto pin = [&](const char * n) -> int
+			{
+				const json * p = con ? con->get(n) : nullptr;
+				if (!p || p->a.empty()) return -1;
+				return net(p->a[0]);
+			};
+			if (type == "SB_LUT4" || type == "SB_CARRY")
+			{
+				op o;
+				o.carry = type == "SB_CARRY";
+				o.o = pin(o.carry ? "CO" : "O");
+				const char * in[4] = {"I0", "I1", "I2", "I3"};
+				if (o.carry) in[2] = "CI";
+				for (int k=0; k<4; k++) o.in[k] = o.carry && k == 3 ? net0 : pin(in[k]);
+				for (int & k : o.in) if (k < 0) k = net0;
+				o.init = 0;
+				if (!o.carry)
+				{
+					const json * pr = c.get("parameters");
+					const json * li = pr ? pr->get("LUT_INIT") : nullptr;
+					if (!li) return fail(i.first + " has no LUT_INIT");
+					if (li->k == json::number) o.init = atol(li->s.c_str());
+					else for (char ch : li->s) o.init = (o.init << 1) | (ch == '1');
+				}
+				if (o.o < 0) continue;		// Unconnected output
+				if (!o.carry) fold(o);
+				ops.push_back(o);
+			}
+			else if (type.compare(0, 6, "SB_DFF") == 0)
+			{
+				// SB_DFF is not in sim.v, but synth_ice40 uses it for plain registers
+				std::string f = type.substr(6);
+				dff d;
+				d.e = -1;
+				d.sr = -1;
+				if (!f.empty() && f[0] == 'N') return fail(type + ": falling edge flip-flops are not supported");
+				if (!f.empty() && f[0] == 'E')
+				{
+					d.e = pin("E");
+					f = f.substr(1);
+				}
+				if (f != "" && f != "R" && f != "S" && f != "SR" && f != "SS") return fail("unknown cell type " + type);
+				d.set = f == "S" || f == "SS";
+				d.async = f.size() == 1;
+				if (!f.empty()) d.sr = pin(d.set ? "S" : "R");
+				d.q = pin("Q");
+				d.d = pin("D");
+				if (d.d < 0) d.d = net0;
+				if (d.e < 0 && type.size() > 6 && type[6] == 'E') d.e = net0;
+				if (d.sr < 0 && !f.empty()) d.sr = net0;
+				int c = pin("C");
+				if (c >= 0 && std::find(clocks.begin(), clocks.end(), c) == clocks.end()) clocks.push_back(c);
+				if (d.q >= 0) ffs.push_back(d);
+			}
+			else return fail(i.first + ": unsupported cell type " + type + (mods->get(type) ? ", flatten the design first" : ""));
+		}
+
+		// The clock
+		if (clk.empty())
+		{
+			if (clocks.size() > 1) return fail("flip-flops use several clocks, only one domain is supported");
+			if (clocks.size() == 1) clock = clocks[0];
+		}
+		else
+		{
+			for (auto & s : inputs) if (s.name == clk && s.bits.size() == 1) clock = s.bits[0];
+			if (clock < 0) return fail("no clock input " + clk);
+			for (int c : clocks) if (c != clock) return fail("some flip-flops are not clocked by " + clk);
+		}
+
+		// Levelize: an op runs after all ops driving its inputs
+		driver.assign(nets, -1);
+		for (int k=0; k<ops.size(); k++)
+		{
+			if (driver[ops[k].o] >= 0) return fail("net " + std::to_string(ops[k].o) + " has several drivers");
+			driver[ops[k].o] = k;
+		}
+		std::vector<int> level(ops.size(), 0);
+		std::vector<int> deps(ops.size(), 0);
+		std::vector<std::vector<int>> users(ops.size());
+		std::vector<int> ready;
+		for (int k=0; k<ops.size(); k++)
+		{
+			for (int i : ops[k].in)
+			{
+				if (driver[i] < 0) continue;
+				users[driver[i]].push_back(k);
+				deps[k]++;
+			}
+			if (!deps[k]) ready.push_back(k);
+		}
+		size_t done = 0;
+		while (!ready.empty())
+		{
+			int k = ready.back();
+			ready.pop_back();
+			done++;
+			levels = std::max(levels, level[k] + 1);
+			for (int u : users[k])
+			{
+				level[u] = std::max(level[u], level[k] + 1);
+				if (--deps[u] == 0) ready.push_back(u);
+			}
+		}
+		if (done < ops.size()) return fail("combinational loop");
+		std::vector<int> order(ops.size());
+		for (int k=0; k<ops.size(); k++) order[k] = k;
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return level[a] < level[b]; });
+		std::vector<op> sorted;
+		for (int k : order) sorted.push_back(ops[k]);
+		ops.swap(sorted);
+		return 1;
+	}
+};
+
+//
+// Simulation
+//
+
+class simulator {
+	const netlist & n;
+	std::vector<uint64_t> v;	// Value of every net, one bit per lane
+	std::vector<uint64_t> next;
+
+	static uint64_t mux(uint64_t s, uint64_t a, uint64_t b)
+	{
+		return a ^ ((a ^ b) & s);
+	}
+
+	void eval()
+	{
+		for (const op & o : n.ops)
+		{
+			uint64_t i0 = v[o.in[0]], i1 = v[o.in[1]], i2 = v[o.in[2]];
+			if (o.carry)
+			{
+				v[o.o] = (i0 & i1) | (i2 & (i0 | i1));
+				continue;
+			}
+			if (o.k == 0)
+			{
+				v[o.o] = -uint64_t(o.init & 1);
+				continue;
+			}
+			// A tree of multiplexers, I0 selecting between pairs of LUT_INIT bits
+			uint64_t l[8];
+			int m = 1 << (o.k-1);
+			for (int k=0; k<m; k++)
+			{
+				uint64_t a = -uint64_t((o.init >> (2*k)) & 1);
+				uint64_t b = -uint64_t((o.init >> (2*k+1)) & 1);
+				l[k] = mux(i0, a, b);
+			}
+			if (o.k > 1) for (int k=0; k<m/2; k++) l[k] = mux(i1, l[2*k], l[2*k+1]);
+			if (o.k > 2) for (int k=0; k<m/4; k++) l[k] = mux(i2, l[2*k], l[2*k+1]);
+			if (o.k > 3) l[0] = mux(v[o.in[3]], l[0], l[1]);
+			v[o.o] = l[0];
+		}
+	}
+
+	// Asynchronous set and reset act as soon as they are high.
+	// Returns 1 if a register changed.
+	bool async()
+	{
+		bool changed = 0;
+		for (const dff & f : n.ffs)
+		{
+			if (!f.async) continue;
+			uint64_t q = v[f.q];
+			if (f.set) q |= v[f.sr];
+			else q &= ~v[f.sr];
+			changed |= q != v[f.q];
+			v[f.q] = q;
+		}
+		return changed;
+	}
+
+	public:
+	std::string error;
+
+	simulator(const netlist & n) : n(n), v(n.nets, 0), next(n.ffs.size())
+	{
+		v[net1] = ~0ull;		// Registers start at 0, as in sim.v
+	}
+
+	uint64_t & operator[](int net)
+	{
+		return v[net];
+	}
+
+	// Settles the logic after inputs changed
+	bool settle()
+	{
+		for (int k=0; k<8; k++)
+		{
+			eval();
+			if (!async()) return 1;
+		}
+		error = "asynchronous set / reset does not settle";
+		return 0;
+	}
+
+	// The rising clock edge
+	void edge()
+	{
+		for (int k=0; k<n.ffs.size(); k++)
+		{
+			const dff & f = n.ffs[k];
+			uint64_t d = v[f.d];
+			if (f.sr >= 0) d = f.set ? d | v[f.sr] : d & ~v[f.sr];
+			if (f.e >= 0) d = mux(v[f.e], v[f.q], d);
+			// Asynchronous ones win over the enable
+			if (f.async && f.e >= 0) d = f.set ? d | v[f.sr] : d & ~v[f.sr];
+			next[k] = d;
+		}
+		for (int k=0; k<n.ffs.size(); k++) v[n.ffs[k].q] = next[k];
+	}
+};
+
+struct assignment {
+	long cycle;
+	int input;
+	uint64_t value;
+	int lane;		// -1 for all lanes
+};
+
+uint64_t number(const std::string & s)
+{
+	if (s.compare(0, 2, "0b") == 0) return strtoull(s.c_str()+2, nullptr, 2);
+	return strtoull(s.c_str(), nullptr, 0);
+}
+
+std::string binary(simulator & sim, const signal & s, int lane)
+{
+	std::string r;
+	for (int k=s.bits.size()-1; k>=0; k--) r += (sim[s.bits[k]] >> lane) & 1 ? '1' : '0';
+	return r;
+}
+
+int main(int argc, char** argv)
+{
+	std::string file, top, clk, stim;
+	std::vector<std::string> traced, randomized;
+	long cycles = 1000;
+	int lane = 0;
+	bool quiet = 0;
+	uint64_t seed = 1;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "icesim [netlist.json] [options]\n";
+			std::cerr << "  -m [module]  Top module (default: the one marked top)\n";
+			std::cerr << "  -c [input]   Clock (default: the net clocking all flip-flops)\n";
+			std::cerr << "  -n [cycles]  Cycles to run (default: 1000)\n";
+			std::cerr << "  -s [file]    Stimulus file\n";
+			std::cerr << "  -r [input]   Drive an input with random values, different in every lane\n";
+			std::cerr << "  --seed [n]   Seed of -r (default: 1)\n";
+			std::cerr << "  -t [signal]  Print a port or net every cycle (default: all outputs)\n";
+			std::cerr << "  -l [lane]    Lane to print, 0 - 63 (default: 0)\n";
+			std::cerr << "  -q           Print nothing but the final values\n";
+			return 0;
+		}
+		if (a+1 < argc && o == "-m") top = argv[++a];
+		else if (a+1 < argc && o == "-c") clk = argv[++a];
+		else if (a+1 < argc && o == "-n") cycles = atol(argv[++a]);
+		else if (a+1 < argc && o == "-s") stim = argv[++a];
+		else if (a+1 < argc && o == "-r") randomized.push_back(argv[++a]);
+		else if (a+1 < argc && o == "--seed") seed = number(argv[++a]);
+		else if (a+1 < argc && o == "-t") traced.push_back(argv[++a]);
+		else if (a+1 < argc && o == "-l") lane = atoi(argv[++a]) & 63;
+		else if (o == "-q") quiet = 1;
+		else if (o[0] != '-' && file.empty()) file = o;
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (file.empty()) {
+		std::cerr << "No netlist given, see -h\n";
+		return 1;
+	}
+
+	std::ifstream in(file);
+	if (!in) {
+		std::cerr << "Can't open " << file << "\n";
+		return 1;
+	}
+	std::stringstream ss;
+	ss << in.rdbuf();
+	std::string text = ss.str();
+	json root;
+	if (!json_reader(text).value(root) || root.k != json::object) {
+		std::cerr << file << ": not a JSON netlist\n";
+		return 1;
+	}
+	netlist n;
+	if (!n.load(root, top, clk)) {
+		std::cerr << file << ": " << n.error << "\n";
+		return 1;
+	}
+
+	auto find = [&](const std::string & name) -> const signal *
+	{
+		for (auto & s : n.inputs) if (s.name == name) return &s;
+		for (auto & s : n.outputs) if (s.name == name) return &s;
+		for (auto & s : n.names) if (s.name == name) return &s;
+		return nullptr;
+	};
+	auto input = [&](const std::string & name) -> int
+	{
+		for (int k=0; k<n.inputs.size(); k++) if (n.inputs[k].name == name) return k;
+		return -1;
+	};
+
+	std::vector<assignment> as;
+	if (!stim.empty())
+	{
+		std::ifstream sf(stim);
+		if (!sf) {
+			std::cerr << "Can't open " << stim << "\n";
+			return 1;
+		}
+		std::string line;
+		int ln = 0;
+		while (std::getline(sf, line))
+		{
+			ln++;
+			std::istringstream ls(line);
+			std::string c, name, val, l;
+			if (!(ls >> c) || c[0] == '#') continue;
+			ls >> name >> val >> l;
+			assignment x;
+			x.cycle = atol(c.c_str());
+			x.input = input(name);
+			x.value = number(val);
+			x.lane = l.empty() ? -1 : atoi(l.c_str()) & 63;
+			if (x.input < 0 || val.empty()) {
+				std::cerr << stim << ":" << ln << ": bad assignment\n";
+				return 1;
+			}
+			as.push_back(x);
+		}
+		std::stable_sort(as.begin(), as.end(), [](const assignment & a, const assignment & b) { return a.cycle < b.cycle; });
+	}
+	std::vector<int> rnd;
+	for (auto & r : randomized)
+	{
+		int k = input(r);
+		if (k < 0) {
+			std::cerr << "No input " << r << "\n";
+			return 1;
+		}
+		rnd.push_back(k);
+	}
+	std::vector<const signal *> tr;
+	if (traced.empty()) for (auto & s : n.outputs) tr.push_back(&s);
+	std::vector<const signal *> fin = tr;
+	for (auto & t : traced)
+	{
+		const signal * s = find(t);
+		if (!s) {
+			std::cerr << "No signal " << t << "\n";
+			return 1;
+		}
+		tr.push_back(s);
+	}
+
+	std::cerr << "//// " << n.ops.size() << " LUTs and carries in " << n.levels << " levels, "
+		<< n.ffs.size() << " flip-flops, " << n.nets << " nets\n";
+	if (n.clock < 0) std::cerr << "//// No flip-flops, the logic is only settled every cycle\n";
+
+	simulator sim(n);
+	size_t ai = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	std::string out;
+	for (long c=0; c<cycles; c++)
+	{
+		for (; ai < as.size() && as[ai].cycle <= c; ai++)
+		{
+			const assignment & x = as[ai];
+			const signal & s = n.inputs[x.input];
+			uint64_t m = x.lane < 0 ? ~0ull : 1ull << x.lane;
+			for (int k=0; k<s.bits.size(); k++)
+			{
+				if (s.bits[k] < 2) continue;
+				uint64_t & w = sim[s.bits[k]];
+				w = (x.value >> k) & 1 ? w | m : w & ~m;
+			}
+		}
+		for (int k : rnd)
+		{
+			for (int b : n.inputs[k].bits)
+			{
+				// xorshift64*
+				seed ^= seed >> 12;
+				seed ^= seed << 25;
+				seed ^= seed >> 27;
+				if (b >= 2) sim[b] = seed * 0x2545f4914f6cdd1dull;
+			}
+		}
+		if (n.clock >= 2) sim[n.clock] = 0;
+		if (!sim.settle()) {
+			std::cerr << "Cycle " << c << ": " << sim.error << "\n";
+			return 1;
+		}
+		if (!quiet)
+		{
+			out += std::to_string(c);
+			for (auto s : tr) out += " " + s->name + "=" + binary(sim, *s, lane);
+			out += "\n";
+			if (out.size() > (1 << 16))
+			{
+				std::cout << out;
+				out.clear();
+			}
+		}
+		sim.edge();
+	}
+	std::cout << out;
+	if (quiet)
+	{
+		std::cout << cycles;
+		for (auto s : fin) std::cout << " " << s->name << "=" << binary(sim, *s, lane);
+		std::cout << "\n";
+	}
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	std::cerr << "//// " << cycles << " cycles x 64 lanes in " << s << " s, "
+		<< cycles / s / 1e6 << " Mcycles/s per lane\n";
+	return 0;
+}
@@ -0,0 +1,521 @@
+// Data / UART matrix throughput simulator
+// by Tomek Szczęsny 2024
+//
+// Cycle level model of data_matrix.v and uart_matrix.v with their RX
+// and TX buffers, for checking whether a matrix keeps up with a traffic mix
+// before synthesis. Sweeps port counts, routing LUTs and buffer depths,
+// one configuration per thread.
+//
+// The matrix polls RX port (cycle % m) at every clk edge and, if it holds
+// data, forwards a word to the TX buffers of the LUT row of that port.
+// TX buffers take it one cycle later and are drained by their own events.
+//
+// data_matrix: RX ports are FIFOs (--rxd words), which lose words when full.
+// uart_matrix: RX ports are uart_rx_no_dr single frame receivers, one clk
+//   per bit. Frames start at traffic events, at least 10 cycles apart.
+//   A frame shows on "out" at its last data bit and sets "dr" on the stop
+//   bit negedge, unless rx_reset still holds "dr" down after a read of
+//   the previous frame. A frame not read before the next one is lost.
+// Neither matrix looks at the TX buffers, words for a full one are lost.
+// --hold models a matrix that waits instead, which blocks the RX port
+// (head of line blocking).
+// --rtl models data_matrix.v as it is written: "tx_cke <= lut[inc]" takes one
+//   bit of the flat LUT vector, so only TX port 0 is ever written, and
+//   rx_pop bits stay set over consecutive ready polls, popping words that
+//   are never forwarded.
+//
+// Latency is counted from the arrival of a word (the end of a UART frame)
+// to the clk edge it is written into a TX buffer, and to the TX event that
+// takes it out.
+//
+// Traffic (-p, RX ports) and TX drain (-c) events come from files or models,
+// see events.h. "-p 3=poisson:500" sets port 3 only.
+//
+// LUTs (--lut, may be repeated):
+//   diag          port i to output i % n
+//   shift:s       port i to output (i + s) % n
+//   bcast         every port to every output
+//   hot:j         every port to output j
+//   rand:k        every port to k random outputs
+//   0x3/0x4/...   rows, for ports 0, 1, ...
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "events.h"
+
+// A FIFO of arrival times
+class queue {
+	public:
+	std::vector<long> v;
+	long head = 0, size = 0, peak = 0;
+
+	queue(long depth) : v(depth) {}
+
+	bool full() const
+	{
+		return size == long(v.size());
+	}
+	bool push(long t)
+	{
+		if (full()) return 0;
+		v[(head + size++) % v.size()] = t;
+		peak = std::max(peak, size);
+		return 1;
+	}
+	long pop()
+	{
+		long t = v[head];
+		head = (head + 1) % v.size();
+		size--;
+		return t;
+	}
+};
+
+struct port_stats {
+	long offered = 0, forwarded = 0, lost = 0, dup = 0, hol = 0;
+	long lat_max = 0;
+	double lat_sum = 0;
+	long out_lat_max = 0;		// TX ports: arrival to drain
+	double out_lat_sum = 0;
+	long drained = 0, peak_level = 0;
+};
+
+struct config {
+	bool uart = 0, rtl = 0, hold = 0;
+	int m = 8, n = 8;
+	std::string lut = "diag";
+	long rxd = 512, txd = 512;
+	std::map<int, std::string> prod, cons;	// -1 for all ports
+	long T = 1000000;
+	unsigned long seed = 1;
+
+	// Results
+	std::vector<port_stats> in, out;
+	long copies_lost = 0, copies = 0;
+	std::string error;
+};
+
+std::vector<long> make_lut(const config & c)
+{
+	std::vector<long> r(c.m, 0);
+	long all = c.n >= 63 ? -1 : (1L << c.n) - 1;
+	const std::string & s = c.lut;
+	std::mt19937_64 rng(c.seed * 7919);
+	if (s == "diag") for (int i=0; i<c.m; i++) r[i] = 1L << (i % c.n);
+	else if (s.rfind("shift:", 0) == 0)
+	{
+		int k = atoi(s.c_str() + 6);
+		for (int i=0; i<c.m; i++) r[i] = 1L << (((i + k) % c.n + c.n) % c.n);
+	}
+	else if (s == "bcast") for (int i=0; i<c.m; i++) r[i] = all;
+	else if (s.rfind("hot:", 0) == 0)
+	{
+		int j = atoi(s.c_str() + 4);
+		if (j < 0 || j >= c.n) throw std::runtime_error("hot:j needs j < n");
+		for (int i=0; i<c.m; i++) r[i] = 1L << j;
+	}
+	else if (s.rfind("rand:", 0) == 0)
+	{
+		int k = std::min(atoi(s.c_str() + 5), c.n);
+		for (int i=0; i<c.m; i++)
+		{
+			std::vector<int> o(c.n);
+			for (int j=0; j<c.n; j++) o[j] = j;
+			std::shuffle(o.begin(), o.end(), rng);
+			for (int j=0; j<k; j++) r[i] |= 1L << o[j];
+		}
+	}
+	else if (s.rfind("0x", 0) == 0 || isdigit(s[0]))
+	{
+		size_t p = 0;
+		for (int i=0; i<c.m && p <= s.size(); i++)
+		{
+			r[i] = strtol(s.c_str() + p, nullptr, 0) & all;
+			p = s.find('/', p);
+			if (p == std::string::npos) break;
+			p++;
+		}
+	}
+	else throw std::runtime_error("unknown LUT " + s);
+	return r;
+}
+
+std::string spec(const std::map<int, std::string> & m, int i)
+{
+	auto it = m.find(i);
+	if (it != m.end()) return it->second;
+	return m.at(-1);
+}
+
+void run(config & c)
+{
+	std::vector<long> lut = make_lut(c);
+	std::vector<std::unique_ptr<events>> src, sink;
+	// Next event of every RX and TX port
+	std::vector<long> ta(c.m), tc(c.n);
+	std::vector<bool> ha(c.m), hc(c.n);
+	long v;
+	for (int i=0; i<c.m; i++)
+	{
+		src.emplace_back(new events(spec(c.prod, i), 1, c.uart ? 10 : 0, c.seed * 1000003 + i));
+		ha[i] = src[i]->next(ta[i], v);
+	}
+	for (int j=0; j<c.n; j++)
+	{
+		sink.emplace_back(new events(spec(c.cons, j), 1, 1, c.seed * 999983 + j + 500));
+		hc[j] = sink[j]->next(tc[j], v);
+	}
+	c.in.assign(c.m, port_stats());
+	c.out.assign(c.n, port_stats());
+	std::vector<queue> rx(c.m, queue(c.uart ? 1 : c.rxd));
+	std::vector<queue> tx(c.n, queue(c.txd));
+
+	// uart_rx_no_dr state: frames started (arrival times), "out" and "dr"
+	struct urx {
+		std::vector<long> frames;	// Start edges, not yet seen by "dr"
+		size_t fo = 0;			// Frames shown on "out"
+		size_t fd = 0;			// Frames through the "dr" logic
+		long out = -1;			// Start of the frame on "out"
+		long last_read = LONG_MIN;	// Start of the frame last forwarded
+		bool dr = 0;
+		long reset = LONG_MIN;		// Last read edge, rx_reset holds dr down after it
+	};
+	std::vector<urx> u(c.m);
+
+	// Words pulled from the traffic sources up to edge e (not including it)
+	auto arrivals = [&](int i, long e)
+	{
+		while (ha[i] && ta[i] < e)
+		{
+			if (c.uart) u[i].frames.push_back(ta[i]);
+			else
+			{
+				c.in[i].offered++;
+				if (!rx[i].push(ta[i])) c.in[i].lost++;
+			}
+			ha[i] = src[i]->next(ta[i], v);
+		}
+	};
+	auto drain = [&](int j, long e)
+	{
+		// TX events up to e, before a write at e + 1/2
+		while (hc[j] && tc[j] <= e)
+		{
+			if (tx[j].size)
+			{
+				long a = tx[j].pop();
+				port_stats & o = c.out[j];
+				o.drained++;
+				o.out_lat_max = std::max(o.out_lat_max, tc[j] - a);
+				o.out_lat_sum += tc[j] - a;
+			}
+			hc[j] = sink[j]->next(tc[j], v);
+		}
+	};
+	// Takes what an RX port offers at edge e: its arrival time, or -1
+	auto peek = [&](int i, long e) -> long
+	{
+		arrivals(i, e);
+		if (!c.uart) return rx[i].size ? rx[i].v[rx[i].head] : -1;
+		urx & r = u[i];
+		// "out" is written at the last data bit, s+8; "dr" set on the negedge of s+9
+		while (r.fo < r.frames.size() && r.frames[r.fo] + 8 < e) r.out = r.frames[r.fo++];
+		while (r.fd < r.frames.size() && r.frames[r.fd] + 9 < e)
+		{
+			if (r.frames[r.fd] + 9 != r.reset) r.dr = 1;
+			r.fd++;
+		}
+		return r.dr ? r.out + 10 : -1;
+	};
+	// --rtl: rx_pop is a register, a FIFO pops at the edge after a poll and
+	// at every edge its bit stays set. Words forwarded, not yet popped:
+	std::vector<long> pending(c.m, 0);
+	long pop_mask = 0;
+	auto take = [&](int i, long e)
+	{
+		if (c.rtl) pending[i]++;
+		else if (!c.uart) rx[i].pop();
+		else
+		{
+			urx & r = u[i];
+			r.dr = 0;
+			r.reset = e;
+			if (r.out == r.last_read) c.in[i].dup++;
+			r.last_read = r.out;
+		}
+	};
+
+	for (long t = 0; t < c.T; t++)
+	{
+		int i = t % c.m;
+		long a = peek(i, t);
+		long row = c.rtl ? (lut[i / c.n] >> (i % c.n) & 1) : lut[i];
+		bool fwd = a >= 0;
+		if (fwd && c.hold)
+		{
+			for (int j=0; j<c.n; j++)
+			{
+				if (!(row >> j & 1)) continue;
+				drain(j, t);
+				if (tx[j].full()) fwd = 0;
+			}
+			if (!fwd) c.in[i].hol++;
+		}
+		if (fwd) take(i, t);
+		if (c.rtl)
+		{
+			for (int k=0; k<c.m; k++)
+			{
+				if (!(pop_mask >> k & 1)) continue;
+				arrivals(k, t);
+				if (!rx[k].size) continue;
+				rx[k].pop();
+				if (pending[k]) pending[k]--;
+				else c.in[k].lost++;
+			}
+			pop_mask = fwd ? pop_mask | 1L << i : 0;
+		}
+		if (!fwd)
+		{
+			// Skips idle time; nothing moves until the next arrival
+			if (!c.uart && !pop_mask)
+			{
+				bool busy = 0;
+				long next = c.T;
+				for (int k=0; k<c.m && !busy; k++)
+				{
+					busy = rx[k].size > 0;
+					if (ha[k]) next = std::min(next, ta[k]);
+				}
+				if (!busy && next > t + 1) t = next - 1;
+			}
+			continue;
+		}
+		port_stats & s = c.in[i];
+		s.forwarded++;
+		s.lat_max = std::max(s.lat_max, t + 1 - a);
+		s.lat_sum += t + 1 - a;
+		for (int j=0; j<c.n; j++)
+		{
+			if (!(row >> j & 1)) continue;
+			drain(j, t + 1);
+			c.copies++;
+			if (!tx[j].push(a)) c.copies_lost++;
+		}
+	}
+	for (int i=0; i<c.m; i++)
+	{
+		arrivals(i, c.T);
+		if (c.uart)
+		{
+			peek(i, c.T);
+			c.in[i].offered = u[i].frames.size();
+			// Frames never forwarded, but the last one which may still be read
+			c.in[i].lost = c.in[i].offered - (c.in[i].forwarded - c.in[i].dup) - (u[i].dr ? 1 : 0);
+		}
+	}
+	for (int j=0; j<c.n; j++)
+	{
+		drain(j, c.T);
+		c.out[j].peak_level = tx[j].peak;
+	}
+}
+
+// Lists: "a,b,c" or "from:to[:step]", steps multiply if they start with "*"
+std::vector<long> parse_list(const std::string & s)
+{
+	std::vector<long> r;
+	if (s.find(':') == std::string::npos)
+	{
+		size_t p = 0;
+		while (p <= s.size())
+		{
+			r.push_back(atol(s.c_str() + p));
+			p = s.find(',', p);
+			if (p == std::string::npos) break;
+			p++;
+		}
+		return r;
+	}
+	long from = atol(s.c_str()), to = from, step = 1;
+	bool mul = 0;
+	size_t p = s.find(':');
+	to = atol(s.c_str() + p + 1);
+	p = s.find(':', p + 1);
+	if (p != std::string::npos)
+	{
+		mul = s[p+1] == '*';
+		step = atol(s.c_str() + p + 1 + mul);
+	}
+	if (step < 1 || (mul && step < 2)) step = mul ? 2 : 1;
+	for (long x = from; x <= to; x = mul ? x * step : x + step) r.push_back(x);
+	return r;
+}
+
+int main(int argc, char** argv)
+{
+	config base;
+	std::vector<long> ms = {8}, ns = {8}, rxds = {512}, txds = {512};
+	std::vector<std::string> luts;
+	base.prod[-1] = "poisson:100";
+	base.cons[-1] = "periodic:10";
+	bool verbose = 0;
+	int threads = std::thread::hardware_concurrency();
+	if (threads < 1) threads = 1;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "matsim [options]\n";
+			std::cerr << "Simulates data_matrix / uart_matrix with their buffers, see matsim.cpp.\n";
+			std::cerr << "Lists are \"a,b,c\", \"from:to:step\" or \"from:to:*factor\".\n";
+			std::cerr << "  -u              uart_matrix (default: data_matrix)\n";
+			std::cerr << "  -m [list]       RX ports (default: 8)\n";
+			std::cerr << "  -n [list]       TX ports (default: 8)\n";
+			std::cerr << "  --lut [lut]     Routing LUT, may be repeated (default: diag)\n";
+			std::cerr << "  -p [i=]events   RX traffic, for port i or all (default: poisson:100)\n";
+			std::cerr << "  -c [j=]events   TX drain, for port j or all (default: periodic:10)\n";
+			std::cerr << "  --rxd [list]    data_matrix RX FIFO depths (default: 512)\n";
+			std::cerr << "  --txd [list]    TX FIFO depths (default: 512)\n";
+			std::cerr << "  --hold          Hold words for full TX FIFOs instead of dropping them\n";
+			std::cerr << "  --rtl           data_matrix.v as written, see matsim.cpp\n";
+			std::cerr << "  -t [cycles]     Cycles simulated (default: 1000000)\n";
+			std::cerr << "  -s [seed]       Random seed (default: 1)\n";
+			std::cerr << "  -v              Per port results\n";
+			std::cerr << "  -j [threads]    Threads (default: all)\n";
+			return 0;
+		}
+		if (o == "-u") base.uart = 1;
+		else if (a+1 < argc && o == "-m") ms = parse_list(argv[++a]);
+		else if (a+1 < argc && o == "-n") ns = parse_list(argv[++a]);
+		else if (a+1 < argc && o == "--lut") luts.push_back(argv[++a]);
+		else if (a+1 < argc && (o == "-p" || o == "-c"))
+		{
+			std::string s = argv[++a];
+			auto & m = o == "-p" ? base.prod : base.cons;
+			size_t e = s.find('=');
+			if (e != std::string::npos) m[atoi(s.c_str())] = s.substr(e + 1);
+			else m[-1] = s;
+		}
+		else if (a+1 < argc && o == "--rxd") rxds = parse_list(argv[++a]);
+		else if (a+1 < argc && o == "--txd") txds = parse_list(argv[++a]);
+		else if (o == "--hold") base.hold = 1;
+		else if (o == "--rtl") base.rtl = 1;
+		else if (a+1 < argc && o == "-t") base.T = atol(argv[++a]);
+		else if (a+1 < argc && o == "-s") base.seed = atol(argv[++a]);
+		else if (o == "-v") verbose = 1;
+		else if (a+1 < argc && o == "-j") threads = std::max(1, atoi(argv[++a]));
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (luts.empty()) luts.push_back("diag");
+	if (base.rtl && (base.uart || base.hold)) {
+		std::cerr << "--rtl is for data_matrix without --hold\n";
+		return 1;
+	}
+	if (base.uart) rxds = {1};
+
+	std::vector<config> cs;
+	for (long m : ms) for (long n : ns) for (auto & l : luts) for (long rd : rxds) for (long td : txds)
+	{
+		if (m < 1 || n < 1 || n > 62 || rd < 1 || td < 1) {
+			std::cerr << "Bad configuration m=" << m << " n=" << n << "\n";
+			return 1;
+		}
+		config c = base;
+		c.m = m;
+		c.n = n;
+		c.lut = l;
+		c.rxd = rd;
+		c.txd = td;
+		cs.push_back(c);
+	}
+
+	std::atomic<int> next{0};
+	auto t0 = std::chrono::steady_clock::now();
+	auto work = [&]()
+	{
+		int k;
+		while ((k = next++) < int(cs.size()))
+		{
+			try {
+				run(cs[k]);
+			} catch (std::exception & e) {
+				cs[k].error = e.what();
+			}
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int th=1; th<std::min<int>(threads, cs.size()); th++) pool.emplace_back(work);
+	work();
+	for (auto & th : pool) th.join();
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	printf("%-4s %-4s %-12s %6s %6s %9s %9s %8s %8s %8s %8s %8s %6s %4s\n",
+		"m", "n", "lut", "rxd", "txd", "offered", "through", "rx lost", "tx lost", "lat max", "lat avg", "hol", "fair", "ok");
+	long cycles = 0;
+	for (auto & c : cs)
+	{
+		if (!c.error.empty()) {
+			std::cerr << "m=" << c.m << " n=" << c.n << " " << c.lut << ": " << c.error << "\n";
+			continue;
+		}
+		cycles += c.T;
+		long off = 0, fwd = 0, lost = 0, latmax = 0, hol = 0, dup = 0;
+		double latsum = 0, sx = 0, sxx = 0;
+		int act = 0;
+		for (auto & s : c.in)
+		{
+			off += s.offered;
+			fwd += s.forwarded - s.dup;
+			lost += s.lost;
+			dup += s.dup;
+			hol += s.hol;
+			latmax = std::max(latmax, s.lat_max);
+			latsum += s.lat_sum;
+			// Jain's fairness index of the forwarded share of the offered traffic
+			if (s.offered)
+			{
+				double x = double(s.forwarded - s.dup) / s.offered;
+				sx += x;
+				sxx += x*x;
+				act++;
+			}
+		}
+		double fair = sxx > 0 ? sx*sx / (act * sxx) : 1;
+		bool ok = !lost && !c.copies_lost && !dup;
+		printf("%-4d %-4d %-12s %6ld %6ld %9.5f %9.5f %7.3f%% %7.3f%% %8ld %8.1f %7.3f%% %6.3f %4s\n",
+			c.m, c.n, c.lut.c_str(), c.uart ? 1 : c.rxd, c.txd, double(off) / c.T, double(fwd) / c.T,
+			off ? 100. * lost / off : 0., c.copies ? 100. * c.copies_lost / c.copies : 0.,
+			latmax, fwd ? latsum / (fwd + dup) : 0., 100. * hol / c.T, fair, ok ? "yes" : "no");
+		if (!verbose) continue;
+		for (int i=0; i<c.m; i++)
+		{
+			auto & s = c.in[i];
+			printf("//   rx %-3d offered %9ld forwarded %9ld lost %7ld dup %5ld hol %7ld latency max %6ld avg %8.1f\n",
+				i, s.offered, s.forwarded - s.dup, s.lost, s.dup, s.hol, s.lat_max, s.forwarded ? s.lat_sum / s.forwarded : 0.);
+		}
+		for (int j=0; j<c.n; j++)
+		{
+			auto & s = c.out[j];
+			printf("//   tx %-3d drained %9ld peak %6ld latency max %8ld avg %8.1f\n",
+				j, s.drained, s.peak_level, s.out_lat_max, s.drained ? s.out_lat_sum / s.drained : 0.);
+		}
+	}
+	std::cerr << "//// " << cs.size() << " configurations, " << cycles / secs / 1e6 << " M cycles/s\n";
+	return 0;
+}
@@ -0,0 +1,963 @@
+// Pseudo random counter / divider checker
+// by Tomek Szczęsny 2024
+//
+// Checks generated ctr_pr / div_pr modules without a Verilog simulator.
+// Reads the Verilog subset written by prcnt, prdiv and prgen (and used in
+// counters.v), or solution records streamed with --all.
+// Each module is simulated from all of its 2^(b+x) states at once,
+// every signal being a bit-sliced vector with one bit per state.
+// Then it checks that:
+//   - the period from reset matches the module name,
+//     and modules with a reset input reset into that cycle,
+//   - no output value repeats within the period,
+//     and the sequence matches the "States:" comment or record if given,
+//   - every state eventually joins the main cycle (no lock-up).
+// prcnt does not avoid lock-up states, so they only fail the check with -l,
+// and never in modules that have a reset input.
+// Exits with 1 if any module fails.
+//
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+const int konst0 = -1;
+const int konst1 = -2;
+const int wires = 1 << 20;	// Signal numbers from here up are wire bits
+const int maxw = 24;
+
+struct cell {
+	uint16_t d = 0;		// LUT_INIT, bit i is the output for {I3, I2, I1, I0} = i
+	uint16_t x = 0;		// Don't care bits of LUT_INIT
+	bool init = 0;
+	std::string name;
+	int in[4] = {konst0, konst0, konst0, konst0};
+};
+
+struct design {
+	std::string name;
+	int period = 0;		// Expected, from the name; 0 if unknown
+	int w = 0;		// State bits
+	int b = 0;		// Output bits, the lowest state bits
+	std::vector<cell> luts;
+	std::vector<int> driver;	// LUT driving each wire bit
+	std::vector<int> next;		// Signal loaded into each state bit
+	uint32_t reset = 0;
+	bool has_rst = 0;
+	std::vector<long> states;	// Expected output sequence, if known
+	std::string error;
+};
+
+// Parses a Verilog number like 4, 16'b01x1 or 8'hff.
+// Returns its width, or 0 if unsized.
+int literal(const std::string & s, uint64_t & v, uint64_t & x)
+{
+	v = 0;
+	x = 0;
+	size_t q = s.find('\'');
+	if (q == std::string::npos)
+	{
+		v = strtoull(s.c_str(), nullptr, 10);
+		return 0;
+	}
+	int w = atoi(s.substr(0, q).c_str());
+	char base = tolower(s[q+1]);
+	int sh = base == 'b' ? 1 : base == 'o' ? 3 : base == 'h' ? 4 : 0;
+	std::string digits = s.substr(q+2);
+	if (!sh)
+	{
+		v = strtoull(digits.c_str(), nullptr, 10);
+		return w;
+	}
+	for (char c : digits)
+	{
+		if (c == '_') continue;
+		v <<= sh;
+		x <<= sh;
+		c = tolower(c);
+		if (c == 'x' || c == 'z') x |= (1 << sh) - 1;
+		else v |= isdigit(c) ? c - '0' : c - 'a' + 10;
+	}
+	return w;
+}
+
+//
+// Verilog reader
+//
+
+class reader {
+	std::vector<std::string> t;
+	std::vector<std::vector<long>> comments;	// "States:" lists, by token position
+	size_t i = 0;
+
+	struct signal {
+		int base;
+		int width;
+		int lsb;
+	};
+
+	// Per module
+	design * d;
+	std::map<std::string, std::string> params;
+	std::map<std::string, signal> sigs;
+	std::map<std::string, int> cells;
+	std::vector<std::string> inputs;
+	std::vector<uint64_t> init;
+	int nwires;
+
+	bool fail(const std::string & msg)
+	{
+		if (d->error.empty()) d->error = msg + " near \"" + (i < t.size() ? t[i] : "end of file") + "\"";
+		return 0;
+	}
+
+	const std::string & peek(int k = 0)
+	{
+		static const std::string none;
+		return i+k < t.size() ? t[i+k] : none;
+	}
+
+	bool expect(const std::string & s)
+	{
+		if (peek() != s) return fail("expected \"" + s + "\"");
+		i++;
+		return 1;
+	}
+
+	static bool ident(const std::string & s)
+	{
+		return !s.empty() && (isalpha(s[0]) || s[0] == '_');
+	}
+
+	// Constant expressions: numbers and localparams with + - *
+	bool factor(long & v)
+	{
+		std::string s = peek();
+		if (s == "(")
+		{
+			i++;
+			return expr(v) && expect(")");
+		}
+		if (s == "-")
+		{
+			i++;
+			if (!factor(v)) return 0;
+			v = -v;
+			return 1;
+		}
+		i++;
+		if (ident(s))
+		{
+			auto p = params.find(s);
+			if (p == params.end()) return fail("unknown parameter " + s);
+			s = p->second;
+		}
+		if (s.empty() || !isdigit(s[0])) return fail("expected a number");
+		uint64_t u, x;
+		literal(s, u, x);
+		v = u;
+		return 1;
+	}
+
+	bool term(long & v)
+	{
+		if (!factor(v)) return 0;
+		while (peek() == "*")
+		{
+			long r;
+			i++;
+			if (!factor(r)) return 0;
+			v *= r;
+		}
+		return 1;
+	}
+
+	bool expr(long & v)
+	{
+		if (!term(v)) return 0;
+		while (peek() == "+" || peek() == "-")
+		{
+			bool neg = peek() == "-";
+			long r;
+			i++;
+			if (!term(r)) return 0;
+			v += neg ? -r : r;
+		}
+		return 1;
+	}
+
+	bool range(long & hi, long & lo)
+	{
+		return expect("[") && expr(hi) && expect(":") && expr(lo) && expect("]");
+	}
+
+	// Reads a signal reference into a list of signal numbers, LSB first
+	bool ref(std::vector<int> & bits)
+	{
+		bits.clear();
+		std::string s = peek();
+		if (s == "{")
+		{
+			i++;
+			std::vector<std::vector<int>> parts;
+			while (1)
+			{
+				parts.emplace_back();
+				if (!ref(parts.back())) return 0;
+				if (peek() != ",") break;
+				i++;
+			}
+			for (auto p = parts.rbegin(); p != parts.rend(); p++) bits.insert(bits.end(), p->begin(), p->end());
+			return expect("}");
+		}
+		if (!s.empty() && isdigit(s[0]))
+		{
+			i++;
+			uint64_t v, x;
+			int w = literal(s, v, x);
+			if (!w) w = 32;
+			for (int k=0; k<w; k++) bits.push_back((v >> k) & 1 ? konst1 : konst0);
+			return 1;
+		}
+		auto f = sigs.find(s);
+		if (f == sigs.end()) return fail("unknown signal");
+		i++;
+		signal g = f->second;
+		long hi = g.lsb + g.width - 1, lo = g.lsb;
+		if (peek() == "[")
+		{
+			i++;
+			if (!expr(hi)) return 0;
+			lo = hi;
+			if (peek() == ":")
+			{
+				i++;
+				if (!expr(lo)) return 0;
+			}
+			if (!expect("]")) return 0;
+		}
+		if (lo > hi || lo < g.lsb || hi >= g.lsb + g.width) return fail("bit select out of range");
+		for (long k=lo; k<=hi; k++) bits.push_back(g.base + k - g.lsb);
+		return 1;
+	}
+
+	// input / output / wire / reg declarations, up to ";" or the end of a port list
+	bool decl()
+	{
+		bool in = peek() == "input";
+		bool reg = 0;
+		while (peek() == "input" || peek() == "output" || peek() == "inout" || peek() == "wire" || peek() == "reg")
+		{
+			if (peek() == "reg") reg = 1;
+			i++;
+		}
+		long hi = 0, lo = 0;
+		if (peek() == "[" && !range(hi, lo)) return 0;
+		if (hi < lo) std::swap(hi, lo);
+		int w = hi - lo + 1;
+		while (1)
+		{
+			std::string n = peek();
+			if (!ident(n)) return fail("expected a name");
+			i++;
+			signal g;
+			g.width = w;
+			g.lsb = lo;
+			if (in) inputs.push_back(n);
+			if (in) g.base = konst1;	// Only read in conditions
+			else if (reg)
+			{
+				g.base = d->w;
+				if (d->w == 0) d->b = w;	// The first register is the output
+				d->w += w;
+				init.resize(d->w, 0);
+				for (int k=g.base; k<d->w; k++) d->next.push_back(k);	// Registers hold unless assigned
+			}
+			else
+			{
+				g.base = wires + nwires;
+				nwires += w;
+				d->driver.resize(nwires, -1);
+			}
+			sigs[n] = g;
+			if (peek() == "=")
+			{
+				i++;
+				uint64_t v, x;
+				std::string s = peek();
+				i++;
+				if (s.empty() || !isdigit(s[0])) return fail("expected a constant");
+				literal(s, v, x);
+				if (reg) for (int k=0; k<w; k++) init[g.base + k] = (v >> k) & 1;
+			}
+			if (peek() != ",") break;
+			std::string a = peek(1);
+			if (a == "input" || a == "output" || a == "inout") break;
+			i++;
+		}
+		return 1;
+	}
+
+	// LUT_INIT value, a literal or a localparam
+	bool lutinit(cell & c)
+	{
+		std::string s = peek();
+		i++;
+		if (ident(s))
+		{
+			auto p = params.find(s);
+			if (p == params.end()) return fail("unknown parameter " + s);
+			s = p->second;
+		}
+		if (s.empty() || !isdigit(s[0])) return fail("expected LUT_INIT data");
+		uint64_t v, x;
+		literal(s, v, x);
+		c.d = v;
+		c.x = x;
+		c.init = 1;
+		return 1;
+	}
+
+	bool instance()
+	{
+		i++;
+		cell c;
+		if (peek() == "#")
+		{
+			i++;
+			if (!(expect("(") && expect(".") && expect("LUT_INIT") && expect("(") && lutinit(c) && expect(")") && expect(")"))) return 0;
+		}
+		c.name = peek();
+		i++;
+		if (!expect("(")) return 0;
+		int o = -1;
+		while (peek() == ".")
+		{
+			i++;
+			std::string port = peek();
+			i++;
+			std::vector<int> bits;
+			if (!(expect("(") && ref(bits) && expect(")"))) return 0;
+			if (bits.size() != 1) return fail("ports are single bits");
+			if (port == "O") o = bits[0];
+			else if (port.size() == 2 && port[0] == 'I' && port[1] >= '0' && port[1] <= '3') c.in[port[1]-'0'] = bits[0];
+			else return fail("unknown port " + port);
+			if (peek() == ",") i++;
+		}
+		if (!(expect(")") && expect(";"))) return 0;
+		if (o < wires) return fail("LUT output must be a wire");
+		if (d->driver[o - wires] >= 0) return fail("wire driven twice");
+		d->driver[o - wires] = d->luts.size();
+		cells[c.name] = d->luts.size();
+		d->luts.push_back(c);
+		return 1;
+	}
+
+	bool defparam()
+	{
+		i++;
+		auto f = cells.find(peek());
+		if (f == cells.end()) return fail("unknown instance");
+		i++;
+		return expect(".") && expect("LUT_INIT") && expect("=") && lutinit(d->luts[f->second]) && expect(";");
+	}
+
+	// Conditions of "if": inputs named rst or reset are 1 only in reset mode,
+	// any other input (inc, enables) is 1.
+	bool cond(bool reset, bool & v)
+	{
+		if (peek() == "~" || peek() == "!")
+		{
+			i++;
+			if (!cond(reset, v)) return 0;
+			v = !v;
+			return 1;
+		}
+		std::string s = peek();
+		i++;
+		if (!s.empty() && isdigit(s[0]))
+		{
+			uint64_t u, x;
+			literal(s, u, x);
+			v = u & 1;
+			return 1;
+		}
+		bool found = 0;
+		for (auto & n : inputs) found |= n == s;
+		if (!found) return fail("conditions may only use inputs");
+		v = (s == "rst" || s == "reset") ? reset : 1;
+		return 1;
+	}
+
+	// Runs a statement of the always block.
+	// Normal mode fills the next state, reset mode collects constant assignments.
+	bool stmt(bool on, bool reset)
+	{
+		if (peek() == "begin")
+		{
+			i++;
+			while (peek() != "end")
+			{
+				if (i >= t.size()) return fail("missing end");
+				if (!stmt(on, reset)) return 0;
+			}
+			i++;
+			return 1;
+		}
+		if (peek() == "if")
+		{
+			i++;
+			bool c;
+			if (!(expect("(") && cond(reset, c) && expect(")") && stmt(on && c, reset))) return 0;
+			if (peek() == "else")
+			{
+				i++;
+				return stmt(on && !c, reset);
+			}
+			return 1;
+		}
+		std::vector<int> l, r;
+		if (!ref(l)) return 0;
+		if (peek() != "<=" && peek() != "=") return fail("expected an assignment");
+		i++;
+		if (!(ref(r) && expect(";"))) return 0;
+		if (!on) return 1;
+		for (int k=0; k<l.size(); k++)
+		{
+			if (l[k] < 0 || l[k] >= wires) return fail("only registers can be assigned");
+			int s = k < r.size() ? r[k] : konst0;
+			if (!reset) d->next[l[k]] = s;
+			else if (s < 0)
+			{
+				d->has_rst = 1;
+				init[l[k]] = s == konst1;
+			}
+		}
+		return 1;
+	}
+
+	bool always()
+	{
+		i++;
+		if (!expect("@")) return 0;
+		int depth = 0;
+		do {
+			if (peek() == "(") depth++;
+			if (peek() == ")") depth--;
+			i++;
+		} while (depth > 0 && i < t.size());
+		size_t s = i;
+		if (!stmt(1, 0)) return 0;
+		i = s;
+		return stmt(1, 1);
+	}
+
+	bool module()
+	{
+		i++;
+		d->name = peek();
+		i++;
+		size_t digits = d->name.find_last_not_of("0123456789") + 1;
+		if (digits < d->name.size()) d->period = atoi(d->name.c_str() + digits);
+
+		// localparams first, they may be used before they are declared
+		size_t s = i;
+		for (; i < t.size() && t[i] != "endmodule"; i++)
+		{
+			if ((t[i] == "localparam" || t[i] == "parameter") && i+3 < t.size() && t[i+2] == "=") params[t[i+1]] = t[i+3];
+		}
+		size_t e = i;
+		i = s;
+
+		if (!expect("(")) return 0;
+		while (peek() != ")")
+		{
+			if (!decl()) return 0;
+			if (peek() == ",") i++;
+			else if (peek() != ")") return fail("expected a port");
+		}
+		i++;
+		if (!expect(";")) return 0;
+
+		while (i < e)
+		{
+			std::string k = peek();
+			if (k == "localparam" || k == "parameter")
+			{
+				while (i < e && t[i] != ";") i++;
+				i++;
+			}
+			else if (k == "input" || k == "output" || k == "inout" || k == "wire" || k == "reg")
+			{
+				if (!(decl() && expect(";"))) return 0;
+			}
+			else if (k == "SB_LUT4")
+			{
+				if (!instance()) return 0;
+			}
+			else if (k == "defparam")
+			{
+				if (!defparam()) return 0;
+			}
+			else if (k == "always")
+			{
+				if (!always()) return 0;
+			}
+			else return fail("unsupported statement");
+		}
+		i = e+1;
+
+		if (d->w == 0) return fail("no registers");
+		if (d->w > maxw) return fail("too many state bits");
+		for (int k=0; k<nwires; k++) if (d->driver[k] < 0) return fail("undriven wire");
+		for (auto & c : d->luts) if (!c.init) return fail("no LUT_INIT for " + c.name);
+		for (int k=0; k<d->w; k++) d->reset |= init[k] << k;
+		if (d->period == d->b) d->period = 1 << d->b;	// counters.v names full length counters by width
+		return 1;
+	}
+
+	public:
+	reader(const std::string & text)
+	{
+		std::vector<long> pending;
+		size_t p = 0;
+		while (p < text.size())
+		{
+			char c = text[p];
+			if (isspace(c)) { p++; continue; }
+			if (text.compare(p, 2, "//") == 0)
+			{
+				size_t e = text.find('\n', p);
+				if (e == std::string::npos) e = text.size();
+				std::string line = text.substr(p+2, e-p-2);
+				size_t k = line.find("States:");
+				if (k != std::string::npos)
+				{
+					std::istringstream in(line.substr(k+7));
+					long v;
+					pending.clear();
+					while (in >> v) pending.push_back(v);
+					comments.resize(t.size()+1);
+					comments[t.size()] = pending;
+				}
+				p = e;
+				continue;
+			}
+			if (text.compare(p, 2, "/*") == 0)
+			{
+				size_t e = text.find("*/", p+2);
+				p = e == std::string::npos ? text.size() : e+2;
+				continue;
+			}
+			size_t s = p;
+			if (isalpha(c) || c == '_' || c == '`' || c == '$')
+			{
+				p++;
+				while (p < text.size() && (isalnum(text[p]) || text[p] == '_' || text[p] == '$')) p++;
+			}
+			else if (isdigit(c))
+			{
+				while (p < text.size() && (isdigit(text[p]) || text[p] == '_')) p++;
+				if (p < text.size() && text[p] == '\'')
+				{
+					p += 2;
+					while (p < text.size() && (isalnum(text[p]) || text[p] == '_')) p++;
+				}
+			}
+			else if (text.compare(p, 2, "<=") == 0) p += 2;
+			else p++;
+			t.push_back(text.substr(s, p-s));
+		}
+		comments.resize(t.size()+1);
+	}
+
+	// Reads all modules
+	std::vector<design> read()
+	{
+		std::vector<design> r;
+		std::vector<long> states;
+		for (i=0; i<t.size(); )
+		{
+			if (!comments[i].empty()) states = comments[i];
+			if (t[i] != "module")
+			{
+				i++;
+				continue;
+			}
+			r.emplace_back();
+			d = &r.back();
+			d->states = states;
+			states.clear();
+			params.clear();
+			sigs.clear();
+			cells.clear();
+			inputs.clear();
+			init.clear();
+			nwires = 0;
+			if (!module())
+			{
+				while (i < t.size() && t[i] != "endmodule") i++;
+				i++;
+			}
+		}
+		return r;
+	}
+};
+
+//
+// Solution records of prcnt / prdiv --all
+//
+
+design from_record(const std::string & line)
+{
+	design d;
+	std::map<std::string, std::string> f;
+	std::istringstream in(line);
+	std::string kind, kv;
+	in >> kind;
+	while (in >> kv)
+	{
+		size_t e = kv.find('=');
+		if (e != std::string::npos) f[kv.substr(0, e)] = kv.substr(e+1);
+	}
+	int p = atoi(f["p"].c_str());
+	d.b = atoi(f["b"].c_str());
+	d.w = d.b + atoi(f["x"].c_str());
+	d.period = p;
+	d.name = (kind == "cnt" ? "ctr_pr" : "div_pr") + std::to_string(p);
+	if (d.b < 1 || d.w > maxw)
+	{
+		d.error = "bad record";
+		return d;
+	}
+	auto inputs = [&](const std::string & cfg, cell & c)
+	{
+		int k = 0;
+		for (int j=0; j<cfg.size(); j++)
+		{
+			if (cfg[cfg.size()-1-j] == '1' && k < 4) c.in[k++] = j;
+		}
+	};
+	auto bits = [&](const std::string & s, cell & c)
+	{
+		uint64_t v, x;
+		literal("16'b" + s, v, x);
+		c.d = v;
+		c.x = x;
+	};
+
+	if (kind == "cnt")
+	{
+		// A shift register fed by a chain of LUTs, each one feeding I3 of
+		// the next, as counter_module wires them. lut2 is left out when
+		// cfg2 selects nothing.
+		for (int n=1; f.count("lut" + std::to_string(n)); n++)
+		{
+			std::string k = std::to_string(n);
+			if (n == 2 && f["cfg2"].find('1') == std::string::npos) continue;
+			cell c;
+			c.d = strtol(f["lut" + k].c_str(), nullptr, 16);
+			inputs(f["cfg" + k], c);
+			if (!d.luts.empty()) c.in[3] = wires + d.luts.size() - 1;
+			d.luts.push_back(c);
+		}
+		for (int j=0; j<d.luts.size(); j++) d.driver.push_back(j);
+		d.next.push_back(wires + d.luts.size() - 1);
+		for (int j=1; j<d.w; j++) d.next.push_back(j-1);
+	}
+	else
+	{
+		// One LUT per state bit
+		std::istringstream ls(f["luts"]), cs(f["cfg"]), ss(f["states"]);
+		std::string l, c;
+		while (std::getline(ls, l, ',') && std::getline(cs, c, ','))
+		{
+			cell n;
+			bits(l, n);
+			inputs(c, n);
+			d.driver.push_back(d.luts.size());
+			d.next.push_back(wires + d.luts.size());
+			d.luts.push_back(n);
+		}
+		std::string s;
+		while (std::getline(ss, s, ',')) d.states.push_back(atol(s.c_str()));
+		d.b = d.w;
+		d.has_rst = 1;
+		if (d.luts.size() != size_t(d.w)) d.error = "bad record";
+	}
+	return d;
+}
+
+//
+// Simulation
+//
+
+class simulator {
+	const design & d;
+	bool xval;
+	int words;
+	uint64_t mask;
+	std::vector<std::vector<uint64_t>> lo;	// Outputs of LUTs
+	std::vector<char> done;
+
+	public:
+	std::string error;
+
+	simulator(const design & d, bool xval) : d(d), xval(xval)
+	{
+		long n = 1L << d.w;
+		words = (n + 63) / 64;
+		mask = n >= 64 ? ~0ull : (1ull << n) - 1;
+	}
+
+	// Word k of a signal holds its value in states 64k .. 64k+63
+	uint64_t word(int s, int k)
+	{
+		static const uint64_t pattern[6] = {
+			0xaaaaaaaaaaaaaaaaull, 0xccccccccccccccccull, 0xf0f0f0f0f0f0f0f0ull,
+			0xff00ff00ff00ff00ull, 0xffff0000ffff0000ull, 0xffffffff00000000ull};
+		if (s == konst0) return 0;
+		if (s == konst1) return mask;
+		if (s >= wires) return lo[d.driver[s - wires]][k];
+		if (s < 6) return pattern[s] & mask;
+		return (k >> (s-6)) & 1 ? ~0ull : 0;
+	}
+
+	bool eval(int j)
+	{
+		if (done[j] == 2) return 1;
+		if (done[j] == 1)
+		{
+			error = "combinational loop through " + d.luts[j].name;
+			return 0;
+		}
+		done[j] = 1;
+		const cell & c = d.luts[j];
+		for (int s : c.in) if (s >= wires && !eval(d.driver[s - wires])) return 0;
+		uint16_t data = c.d & ~c.x;
+		if (xval) data |= c.x;
+		auto & o = lo[j];
+		o.assign(words, 0);
+		for (int m=0; m<16; m++)
+		{
+			if (!((data >> m) & 1)) continue;
+			for (int k=0; k<words; k++)
+			{
+				uint64_t v = mask;
+				for (int q=0; q<4; q++)
+				{
+					uint64_t a = word(c.in[q], k);
+					v &= (m >> q) & 1 ? a : ~a;
+				}
+				o[k] |= v;
+			}
+		}
+		done[j] = 2;
+		return 1;
+	}
+
+	// Returns the successor of every state, or an empty list on error
+	std::vector<uint32_t> run()
+	{
+		std::vector<uint32_t> succ;
+		lo.assign(d.luts.size(), {});
+		done.assign(d.luts.size(), 0);
+		for (int j=0; j<d.luts.size(); j++) if (!eval(j)) return succ;
+		succ.assign(1L << d.w, 0);
+		for (int j=0; j<d.w; j++)
+		{
+			for (int k=0; k<words; k++)
+			{
+				uint64_t v = word(d.next[j], k);
+				uint32_t * s = succ.data() + 64L*k;
+				int n = std::min(64L, (1L << d.w) - 64L*k);
+				for (int q=0; q<n; q++) s[q] |= uint32_t((v >> q) & 1) << j;
+			}
+		}
+		return succ;
+	}
+};
+
+struct report {
+	long period = 0;	// Length of the cycle reached from reset
+	long tail = 0;		// Steps from reset to that cycle
+	bool unique = 1;
+	long mismatch = -1;	// First step differing from the expected states
+	long lockup = 0;	// States that never reach the main cycle
+	long cycles = 0;	// Other cycles
+	bool ok = 0;
+};
+
+report check(const design & d, const std::vector<uint32_t> & succ, bool strict)
+{
+	report r;
+	long n = succ.size();
+	uint32_t omask = (1u << d.b) - 1;
+
+	// Period from reset
+	std::vector<long> seen(n, -1);
+	uint32_t s = d.reset;
+	long t = 0;
+	while (seen[s] < 0)
+	{
+		seen[s] = t++;
+		s = succ[s];
+	}
+	r.tail = seen[s];
+	r.period = t - r.tail;
+
+	// Outputs along the period
+	std::vector<char> out(omask+1, 0);
+	s = d.reset;
+	for (t=0; t<r.tail+r.period; t++)
+	{
+		if (t >= r.tail)
+		{
+			if (out[s & omask]) r.unique = 0;
+			out[s & omask] = 1;
+		}
+		if (r.mismatch < 0 && !d.states.empty() && (t >= d.states.size() || d.states[t] != (s & omask))) r.mismatch = t;
+		s = succ[s];
+	}
+	if (r.mismatch < 0 && !d.states.empty() && d.states.size() != r.tail+r.period) r.mismatch = r.tail+r.period;
+
+	// Lock-up: 1 joins the main cycle, 2 does not, 3 is on the current walk
+	std::vector<char> c(n, 0);
+	s = d.reset;
+	for (t=0; t<r.tail; t++) s = succ[s];
+	for (t=0; t<r.period; t++, s = succ[s]) c[s] = 1;
+	std::vector<uint32_t> walk;
+	for (long i=0; i<n; i++)
+	{
+		walk.clear();
+		s = i;
+		while (!c[s])
+		{
+			c[s] = 3;
+			walk.push_back(s);
+			s = succ[s];
+		}
+		char v = c[s];
+		if (v == 3)
+		{
+			r.cycles++;
+			v = 2;
+		}
+		for (uint32_t w : walk) c[w] = v;
+		if (v == 2) r.lockup += walk.size();
+	}
+
+	// Free running counters may take a few steps to fill their msb registers
+	r.ok = (r.tail == 0 || !d.has_rst) && r.unique && r.mismatch < 0
+		&& (d.period == 0 || r.period == d.period)
+		&& (!strict || r.lockup == 0 || d.has_rst);
+	return r;
+}
+
+std::string describe(const design & d, const report & r)
+{
+	std::string s = d.name + ": period " + std::to_string(r.period);
+	if (d.period && r.period != d.period) s += " (expected " + std::to_string(d.period) + ")";
+	if (r.tail) s += " entered after " + std::to_string(r.tail) + (r.tail > 1 ? " steps" : " step") + " from reset";
+	s += r.unique ? ", unique" : ", repeated outputs";
+	if (r.mismatch >= 0) s += ", differs from States at step " + std::to_string(r.mismatch);
+	if (r.lockup)
+	{
+		s += ", " + std::to_string(r.lockup) + " of " + std::to_string(1L << d.w) + " states lock up in "
+			+ std::to_string(r.cycles) + (r.cycles > 1 ? " cycles" : " cycle");
+		if (d.has_rst) s += " until reset";
+	}
+	else s += ", no lock-up";
+	s += r.ok ? ", OK" : ", FAIL";
+	return s;
+}
+
+int main(int argc, char** argv)
+{
+	bool xval = 0;
+	bool quiet = 0;
+	bool strict = 0;
+	bool selftest = 0;
+	std::vector<std::string> files;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "prchk [options] [files]\n";
+			std::cerr << "Checks ctr_pr / div_pr modules or --all records, from files or stdin.\n";
+			std::cerr << "  -x [0|1]   Value of don't care LUT bits (default: 0)\n";
+			std::cerr << "  -l         Fail on lock-up states of modules without reset\n";
+			std::cerr << "  -q         Print failures only\n";
+			std::cerr << "  --selftest Checks records of every kind of counter\n";
+			return 0;
+		}
+		if (o == "-x" && a+1 < argc) xval = atoi(argv[++a]);
+		else if (o == "-l") strict = 1;
+		else if (o == "-q") quiet = 1;
+		else if (o == "--selftest") selftest = 1;
+		else files.push_back(o);
+	}
+	if (files.empty() && !selftest) files.push_back("-");
+
+	std::vector<design> ds;
+	// One LUT, and a chain of three from prcnt --luts
+	if (selftest) for (auto r : {
+		"cnt p=100 b=7 x=0 mode=0 lut1=02fd lut2=0000 cfg1=1001011 cfg2=0000000",
+		"cnt p=256 b=8 x=0 mode=3 lut1=0800 lut2=3080 cfg1=00001111 cfg2=01110000 lut3=0ee1 cfg3=10010001"})
+	{
+		ds.push_back(from_record(r));
+	}
+	for (auto & f : files)
+	{
+		std::ifstream fs;
+		if (f != "-")
+		{
+			fs.open(f);
+			if (!fs) {
+				std::cerr << "Can't open " << f << "\n";
+				return 1;
+			}
+		}
+		std::istream & in = f == "-" ? std::cin : fs;
+		std::string line, text;
+		while (std::getline(in, line))
+		{
+			if (line.compare(0, 6, "cnt p=") == 0 || line.compare(0, 6, "div p=") == 0) ds.push_back(from_record(line));
+			else text += line + "\n";
+		}
+		for (auto & d : reader(text).read()) ds.push_back(d);
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	int failed = 0;
+	for (auto & d : ds)
+	{
+		std::string s;
+		bool ok = 0;
+		if (!d.error.empty()) s = d.name + ": " + d.error + ", FAIL";
+		else
+		{
+			simulator sim(d, xval);
+			std::vector<uint32_t> succ = sim.run();
+			if (succ.empty()) s = d.name + ": " + sim.error + ", FAIL";
+			else
+			{
+				report r = check(d, succ, strict);
+				ok = r.ok;
+				s = describe(d, r);
+			}
+		}
+		if (!ok) failed++;
+		if (!ok || !quiet) std::cout << s << "\n";
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	std::cerr << "//// " << ds.size() << " modules checked, " << failed << " failed, " << ms << " ms\n";
+	return failed ? 1 : 0;
+}
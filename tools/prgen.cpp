@@ -0,0 +1,140 @@
+// Pseudo random counter / divider batch generator
+// by Tomek Szczęsny 2024
+//
+// Runs searches for a range of periods concurrently in one process
+// and prints the generated modules in period order.
+// Replaces "seq | xargs prcnt | sed" pipelines.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "prsearch.h"
+#include "prkernels.h"
+
+int main(int argc, char** argv)
+{
+	int st = prs::isa_args(argc, argv);
+	if (st >= 0) return st;
+	if (argc < 5) {
+		std::cerr << "Usage:\n";
+		std::cerr << "prgen [cnt|div] [first period] [last period] [extrabits] [options]\n";
+		std::cerr << "  -j [jobs]  Concurrent searches (default: all cores)\n";
+		std::cerr << "  --time-limit [s]  Budget of each period in seconds\n";
+		std::cerr << "  --node-limit [n]  Budget of each period in candidates tried\n";
+		std::cerr << "  --portfolio [stats file]  Search dividers with all engines at once,\n";
+		std::cerr << "                  splitting threads by past wins kept in the file\n";
+		std::cerr << "  --isa [name]    Kernel instruction set: auto, scalar, bmi2, avx2, avx512\n";
+		std::cerr << "  --selftest      Checks that all kernel sets agree\n";
+		std::cerr << "  --profile       Time search phases with hardware counters, table at exit\n";
+		std::cerr << "  --mem-limit [MB] Memory budget of the search tables, usage at exit (0: no limit)\n";
+		std::cerr << "  --huge-pages    Back large tables with transparent huge pages\n";
+		return 0;
+	}
+	std::string kind = argv[1];
+	if (kind != "cnt" && kind != "div") {
+		std::cerr << "Unknown kind " << kind << "\n";
+		return 1;
+	}
+	int first = atoi(argv[2]);
+	int last = atoi(argv[3]);
+	int sx = atoi(argv[4]);
+	int jobs = std::thread::hardware_concurrency();
+	prs::budget limit;
+	std::string statsfile;
+	for (int a=5; a+1<argc; a+=2)
+	{
+		std::string o = argv[a];
+		if (o == "-j") jobs = atoi(argv[a+1]);
+		else if (o == "--time-limit") limit.seconds = atof(argv[a+1]);
+		else if (o == "--node-limit") limit.nodes = atol(argv[a+1]);
+		else if (o == "--portfolio") statsfile = argv[a+1];
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (jobs < 1) jobs = 1;
+	if (first < 2 || last < first || last > 10240) {
+		std::cerr << "Bad period range\n";
+		return 1;
+	}
+
+	int n = last - first + 1;
+	prs::portfolio_stats stats;
+	if (!statsfile.empty()) stats.load(statsfile);
+	int pt = std::thread::hardware_concurrency() / std::min(jobs, n);	// Threads of each portfolio
+	std::vector<std::string> out(n);
+	std::vector<bool> done(n);
+	std::atomic<int> next{0};
+	std::mutex m;
+	std::condition_variable cv;
+
+	auto worker = [&]()
+	{
+		int i;
+		while ((i = next++) < n)
+		{
+			int p = first + i;
+			std::string s;
+			bool spent;
+			if (kind == "cnt")
+			{
+				prs::counter_config cfg;
+				cfg.period = p;
+				cfg.extrabits = sx;
+				cfg.limit = limit;
+				prs::counter_result r = prs::find_counter(cfg);
+				if (r.found) s = prs::counter_module(r).substr(1) + "\n";
+				spent = r.exhausted;
+				if (spent) s = "//// ctr_pr" + std::to_string(p) + " not found within budget\n" + prs::budget_report(r) + "\n";
+			}
+			else
+			{
+				prs::divider_result r;
+				if (statsfile.empty())
+				{
+					prs::divider_config cfg;
+					cfg.period = p;
+					cfg.extrabits = sx;
+					cfg.limit = limit;
+					r = prs::find_divider(cfg);
+				}
+				else
+				{
+					prs::portfolio_config cfg;
+					cfg.period = p;
+					cfg.extrabits = sx;
+					cfg.limit = limit;
+					cfg.threads = std::max(pt, 1);
+					r = prs::find_divider_portfolio(cfg, &stats).r;
+				}
+				if (r.found) s = prs::divider_module(r);
+				spent = r.exhausted;
+				if (spent) s = "\n//// div_pr" + std::to_string(p) + " not found within budget\n" + prs::budget_report(r);
+			}
+			if (s.empty()) std::cerr << "Period " << p << ": found nothing :(\n";
+			else if (spent) std::cerr << "Period " << p << ": budget spent\n";
+			std::lock_guard<std::mutex> l(m);
+			out[i] = s;
+			done[i] = 1;
+			cv.notify_one();
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int j=0; j<jobs && j<n; j++) pool.emplace_back(worker);
+
+	// Print in order as results arrive
+	for (int i=0; i<n; i++)
+	{
+		std::unique_lock<std::mutex> l(m);
+		cv.wait(l, [&]{ return bool(done[i]); });
+		std::cout << out[i] << std::flush;
+	}
+	for (auto & t : pool) t.join();
+	if (!statsfile.empty() && !stats.save(statsfile)) std::cerr << "Can't write " << statsfile << "\n";
+	return 0;
+}
@@ -0,0 +1,221 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// Kernel selection and self test, see prkernels.h
+//
+
+#include "prkernels.h"
+#include "prmem.h"
+#include "prprof.h"
+
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+
+namespace prs {
+
+extern const kernel_set ks_scalar;
+#if defined(__x86_64__)
+extern const kernel_set ks_bmi2;
+extern const kernel_set ks_avx2;
+extern const kernel_set ks_avx512;
+#endif
+
+namespace {
+
+struct isa {
+	const kernel_set * ks;
+	bool (*supported)();
+};
+
+// Best first
+const isa isas[] = {
+#if defined(__x86_64__)
+	{&ks_avx512, []{ return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+		&& __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx2")
+		&& __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt"); }},
+	{&ks_avx2, []{ return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")
+		&& __builtin_cpu_supports("popcnt"); }},
+	{&ks_bmi2, []{ return __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt"); }},
+#endif
+	{&ks_scalar, []{ return true; }},
+};
+
+const kernel_set * best()
+{
+	for (auto & i : isas) if (i.supported()) return i.ks;
+	return &ks_scalar;
+}
+
+const kernel_set * selected = best();
+
+// The selected kernels, each one run as a profiler phase
+kernel_set timed;
+
+int timed_run_counter(uint32_t data, uint32_t c1, uint32_t c2, int w, int mask, int * d, int * out, int from, int n)
+{
+	prof::scope s(prof::run_counter);
+	return selected->run_counter(data, c1, c2, w, mask, d, out, from, n);
+}
+
+bool timed_check_period(const int * v, int num)
+{
+	prof::scope s(prof::check_period);
+	return selected->check_period(v, num);
+}
+
+void timed_map_row(uint32_t mask, int w, int * out)
+{
+	prof::scope s(prof::map_row);
+	selected->map_row(mask, w, out);
+}
+
+void retime()
+{
+	timed = *selected;
+	timed.run_counter = timed_run_counter;
+	timed.check_period = timed_check_period;
+	timed.map_row = timed_map_row;
+}
+
+}
+
+const kernel_set & kernels()
+{
+	return prof::on ? timed : *selected;
+}
+
+bool set_isa(const std::string & name)
+{
+	if (name == "auto")
+	{
+		selected = best();
+		retime();
+		return 1;
+	}
+	for (auto & i : isas)
+	{
+		if (name == i.ks->name && i.supported())
+		{
+			selected = i.ks;
+			retime();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+std::vector<std::string> isa_available()
+{
+	std::vector<std::string> ret;
+	for (auto & i : isas) if (i.supported()) ret.push_back(i.ks->name);
+	return ret;
+}
+
+bool kernels_selftest(std::ostream & log)
+{
+	const kernel_set & r = ks_scalar;
+	std::mt19937 g(2024);
+	bool ok = 1;
+	for (auto & i : isas)
+	{
+		if (!i.supported()) continue;
+		const kernel_set & k = *i.ks;
+		long bad = 0;
+		int n;
+		for (n=0; n<100000; n++)
+		{
+			uint32_t a = g(), m = g() >> (g() % 32);
+			if (k.popcount(a) != r.popcount(a)) bad++;
+			if (k.pext(a, m) != r.pext(a, m)) bad++;
+		}
+		for (int w=4; w<=12; w++)
+		{
+			std::vector<int> o1(1 << w), o2(1 << w);
+			for (n=0; n<20; n++)
+			{
+				uint32_t m = g() & ((1 << w) - 1);
+				k.map_row(m, w, o1.data());
+				r.map_row(m, w, o2.data());
+				if (o1 != o2) bad++;
+			}
+		}
+		// Input selections as counter_search makes them: 4 bits for
+		// the first LUT, 3 for the second, which also takes the first
+		auto pick = [&](int bits, int w)
+		{
+			uint32_t c = 0;
+			while (__builtin_popcount(c) < bits) c |= 1u << (g() % w);
+			return c;
+		};
+		for (n=0; n<20000; n++)
+		{
+			int w = 4 + g() % 6;
+			uint32_t data = g(), c1 = pick(4, w), c2 = (n & 1) ? pick(3, w) : 0;
+			int len = 2 + g() % 80;
+			std::vector<int> o1(len), o2(len);
+			int d1 = 0, d2 = 0;
+			int s1 = k.run_counter(data, c1, c2, w, 15, &d1, o1.data(), 0, len);
+			int s2 = r.run_counter(data, c1, c2, w, 15, &d2, o2.data(), 0, len);
+			if (s1 != s2 || d1 != d2 || (s1 > 0 && o1 != o2)) bad++;
+		}
+		for (n=0; n<20000; n++)
+		{
+			int num = 1 + g() % 70;
+			std::vector<int> v(2*num);
+			for (int j=0; j<num; j++) v[j] = v[j+num] = (n % 3) ? j * 7 % 97 : g() % 64;
+			if (n % 5 == 0) v[g() % (2*num)] ^= 1;
+			if (k.check_period(v.data(), num) != r.check_period(v.data(), num)) bad++;
+		}
+		log << "ISA " << k.name << ": " << (bad ? "FAILED, " + std::to_string(bad) + " mismatches" : "ok") << "\n";
+		if (bad) ok = 0;
+	}
+	return ok;
+}
+
+int isa_args(int & argc, char ** argv)
+{
+	int i, o = 1;
+	for (i=1; i<argc; i++)
+	{
+		if (!strcmp(argv[i], "--selftest"))
+		{
+			return kernels_selftest(std::cerr) ? 0 : 1;
+		}
+		if (!strcmp(argv[i], "--isa") && i+1 < argc)
+		{
+			i++;
+			if (!set_isa(argv[i]))
+			{
+				std::cerr << "ISA " << argv[i] << " is not supported here. Available:";
+				for (auto & n : isa_available()) std::cerr << " " << n;
+				std::cerr << "\n";
+				return 1;
+			}
+			continue;
+		}
+		if (!strcmp(argv[i], "--profile"))
+		{
+			retime();
+			prof::enable();
+			continue;
+		}
+		if (!strcmp(argv[i], "--mem-limit") && i+1 < argc)
+		{
+			// 0 sets no limit, just reports
+			mem::set_limit(atol(argv[++i]) << 20);
+			continue;
+		}
+		if (!strcmp(argv[i], "--huge-pages"))
+		{
+			mem::huge = 1;
+			continue;
+		}
+		argv[o++] = argv[i];
+	}
+	argc = o;
+	return -1;
+}
+
+}
@@ -0,0 +1,59 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// Bit manipulation kernels of the search engines.
+// prkernels_isa.cpp is built once per instruction set;
+// the best set the CPU supports is picked at startup.
+//
+
+#ifndef PRKERNELS_H
+#define PRKERNELS_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace prs {
+
+struct kernel_set {
+	const char * name;
+	// Number of bits set
+	int (*popcount)(uint32_t in);
+	// Packs bits of "in" selected by "mask" into the least significant bits
+	uint32_t (*pext)(uint32_t in, uint32_t mask);
+	// out[j] = pext(j, mask) for all j < 2^w
+	void (*map_row)(uint32_t mask, int w, int * out);
+	// Simulates a prcnt counter: LUT contents "data", LUT inputs c1 and c2,
+	// w register bits and output "mask". Advances the register "d",
+	// filling out[from..n-1] and stopping early when a state repeats
+	// its predecessor. Returns n, or -1 if stopped early.
+	int (*run_counter)(uint32_t data, uint32_t c1, uint32_t c2, int w, int mask, int * d, int * out, int from, int n);
+	// Checks that v[0..2num-1] repeats with period num
+	// and v[0..num-1] are unique.
+	bool (*check_period)(const int * v, int num);
+};
+
+// Currently selected kernels
+const kernel_set & kernels();
+
+// Selects kernels by name, or the best supported ones for "auto".
+// Returns 0 if the CPU does not support them.
+bool set_isa(const std::string & name);
+
+// Names of kernel sets supported by this CPU, best first
+std::vector<std::string> isa_available();
+
+// Compares every supported kernel set against the scalar one.
+// Returns 1 if they all agree.
+bool kernels_selftest(std::ostream & log);
+
+// Handles "--isa [name]", "--selftest", "--profile" (see prprof.h),
+// "--mem-limit [MB]" and "--huge-pages" (see prmem.h)
+// command line options and removes them from argv.
+// Returns an exit code if the program should stop, -1 otherwise.
+int isa_args(int & argc, char ** argv);
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// Bit manipulation kernels of the counter and divider searches:
+// popcount, pext, config maps, counter runs and period checks,
+// one object per instruction set (PRK_ISA).
+//
+
+#include "prkernels.h"
+
+#if defined(__BMI2__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#ifndef PRK_ISA
+#define PRK_ISA scalar
+#endif
+
+#define PRK_STR2(x) #x
+#define PRK_STR(x) PRK_STR2(x)
+#define PRK_CAT2(a, b) a ## b
+#define PRK_CAT(a, b) PRK_CAT2(a, b)
+
+namespace prs {
+namespace PRK_CAT(isa_, PRK_ISA) {
+
+static int popcount(uint32_t in)
+{
+#ifdef __POPCNT__
+	return __builtin_popcount(in);
+#else
+	int o = 0;
+	while (in)
+	{
+		o += in & 1;
+		in >>= 1;
+	}
+	return o;
+#endif
+}
+
+static inline uint32_t pext_i(uint32_t in, uint32_t mask)
+{
+#ifdef __BMI2__
+	return _pext_u32(in, mask);
+#else
+	uint32_t ret = 0;
+	int k = 0;
+	while (mask != 0)
+	{
+		if (mask & 1) ret |= (in & 1) << k++;
+		mask >>= 1;
+		in >>= 1;
+	}
+	return ret;
+#endif
+}
+
+static uint32_t pext(uint32_t in, uint32_t mask)
+{
+	return pext_i(in, mask);
+}
+
+static void map_row(uint32_t mask, int w, int * out)
+{
+	int n = 1 << w;
+	int j = 0;
+#if defined(__AVX512F__)
+	// Gather selected bits of 16 states at once
+	const __m512i step = _mm512_set_epi32(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+	const __m512i one = _mm512_set1_epi32(1);
+	for (; j+16 <= n; j+=16)
+	{
+		__m512i in = _mm512_add_epi32(_mm512_set1_epi32(j), step);
+		__m512i r = _mm512_setzero_si512();
+		uint32_t m = mask;
+		int k = 0;
+		while (m)
+		{
+			int i = __builtin_ctz(m);
+			__m512i bit = _mm512_and_si512(_mm512_srli_epi32(in, i), one);
+			r = _mm512_or_si512(r, _mm512_slli_epi32(bit, k++));
+			m &= m-1;
+		}
+		_mm512_storeu_si512((void *) (out + j), r);
+	}
+#elif defined(__AVX2__)
+	// Gather selected bits of 8 states at once
+	const __m256i step = _mm256_set_epi32(7,6,5,4,3,2,1,0);
+	const __m256i one = _mm256_set1_epi32(1);
+	for (; j+8 <= n; j+=8)
+	{
+		__m256i in = _mm256_add_epi32(_mm256_set1_epi32(j), step);
+		__m256i r = _mm256_setzero_si256();
+		uint32_t m = mask;
+		int k = 0;
+		while (m)
+		{
+			int i = __builtin_ctz(m);
+			__m256i bit = _mm256_and_si256(_mm256_srli_epi32(in, i), one);
+			r = _mm256_or_si256(r, _mm256_slli_epi32(bit, k++));
+			m &= m-1;
+		}
+		_mm256_storeu_si256((__m256i *) (out + j), r);
+	}
+#endif
+	for (; j<n; j++) out[j] = pext_i(j, mask);
+}
+
+static int run_counter(uint32_t data, uint32_t c1, uint32_t c2, int w, int mask, int * d, int * out, int from, int n)
+{
+	uint32_t s = *d;
+	uint32_t wm = (1u << w) - 1;
+	uint32_t l1 = data & 0xffff;
+	uint32_t l2 = data >> 16;
+	int j;
+	for (j=from; j<n; j++)
+	{
+		uint32_t lo1 = (l1 >> pext_i(s, c1)) & 1;
+		uint32_t lo = lo1;
+		if (c2) lo = (l2 >> (pext_i(s, c2) | lo1 << 3)) & 1;
+		s = ((s << 1) & wm) | lo;
+		out[j] = s & mask;
+		if (j > 0 && out[j] == out[j-1])
+		{
+			*d = s;
+			return -1;
+		}
+	}
+	*d = s;
+	return n;
+}
+
+static bool check_period(const int * v, int num)
+{
+	int i, j;
+#if defined(__AVX2__)
+	for (i=0; i+8<=num; i+=8)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *) (v + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (v + i + num));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, b)) != -1) return 0;
+	}
+#else
+	i = 0;
+#endif
+	for (; i<num; i++)		// Check for period "num"
+	{
+		if (v[i] != v[i+num]) return 0;
+	}
+					// Check all states for uniqueness
+	for (i=0; i<num-1; i++)
+	{
+		j = i+1;
+#if defined(__AVX512F__)
+		__m512i a16 = _mm512_set1_epi32(v[i]);
+		for (; j+16<=num; j+=16)
+		{
+			if (_mm512_cmpeq_epi32_mask(a16, _mm512_loadu_si512((const void *) (v + j)))) return 0;
+		}
+#endif
+#if defined(__AVX2__)
+		__m256i a = _mm256_set1_epi32(v[i]);
+		for (; j+8<=num; j+=8)
+		{
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, _mm256_loadu_si256((const __m256i *) (v + j))))) return 0;
+		}
+#endif
+		for (; j<num; j++)
+		{
+			if (v[j] == v[i]) return 0;
+		}
+	}
+	return 1;
+}
+
+}
+
+extern const kernel_set PRK_CAT(ks_, PRK_ISA) = {
+	PRK_STR(PRK_ISA),
+	PRK_CAT(isa_, PRK_ISA)::popcount,
+	PRK_CAT(isa_, PRK_ISA)::pext,
+	PRK_CAT(isa_, PRK_ISA)::map_row,
+	PRK_CAT(isa_, PRK_ISA)::run_counter,
+	PRK_CAT(isa_, PRK_ISA)::check_period
+};
+
+}
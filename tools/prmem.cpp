@@ -0,0 +1,226 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// Memory budget, tables and arenas, see prmem.h
+//
+
+#include "prmem.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace prs {
+namespace mem {
+
+bool huge = 0;
+
+namespace {
+
+const char * names[components] = {"csmap", "ttable", "arenas", "answers"};
+
+std::mutex m;
+long lim = 0;
+long used[components] = {};
+long peak[components] = {};
+long total = 0, total_peak = 0;
+long over = 0;			// Required allocations that went over the limit
+long refused = 0;		// Optional ones that did not fit
+long reclaimed = 0;		// Bytes given back by caches
+bool reporting = 0;
+
+std::mutex pm;			// Guards "shrinkers", held while they run
+std::vector<std::function<long(long)>> shrinkers;
+
+void add(component c, long bytes)
+{
+	used[c] += bytes;
+	total += bytes;
+	peak[c] = std::max(peak[c], used[c]);
+	total_peak = std::max(total_peak, total);
+}
+
+void print()
+{
+	std::cerr << report();
+}
+
+}
+
+void set_limit(long bytes)
+{
+	std::lock_guard<std::mutex> l(m);
+	lim = bytes;
+	if (!reporting) atexit(print);
+	reporting = 1;
+}
+
+long limit()
+{
+	std::lock_guard<std::mutex> l(m);
+	return lim;
+}
+
+bool reserve(component c, long bytes)
+{
+	{
+		std::lock_guard<std::mutex> l(m);
+		if (!lim || total + bytes <= lim)
+		{
+			add(c, bytes);
+			return 1;
+		}
+	}
+	// Caches release memory, so "m" can not be held here
+	long freed = 0;
+	{
+		std::lock_guard<std::mutex> l(pm);
+		for (auto & f : shrinkers)
+		{
+			long need;
+			{
+				std::lock_guard<std::mutex> k(m);
+				need = total + bytes - lim;
+			}
+			if (need <= 0) break;
+			freed += f(need);
+		}
+	}
+	std::lock_guard<std::mutex> l(m);
+	reclaimed += freed;
+	if (total + bytes <= lim)
+	{
+		add(c, bytes);
+		return 1;
+	}
+	refused++;
+	return 0;
+}
+
+void force(component c, long bytes)
+{
+	if (reserve(c, bytes)) return;
+	std::lock_guard<std::mutex> l(m);
+	refused--;
+	over++;
+	add(c, bytes);
+}
+
+void release(component c, long bytes)
+{
+	std::lock_guard<std::mutex> l(m);
+	used[c] -= bytes;
+	total -= bytes;
+}
+
+void on_pressure(std::function<long(long)> shrink)
+{
+	std::lock_guard<std::mutex> l(pm);
+	shrinkers.push_back(shrink);
+}
+
+std::string report()
+{
+	std::lock_guard<std::mutex> l(m);
+	char line[160];
+	std::string s;
+	snprintf(line, sizeof(line), "//// %-9s %10s %10s\n", "memory", "peak MB", "now MB");
+	s += line;
+	for (int i=0; i<components; i++)
+	{
+		snprintf(line, sizeof(line), "//// %-9s %10.1f %10.1f\n", names[i], peak[i] / 1048576.0, used[i] / 1048576.0);
+		s += line;
+	}
+	snprintf(line, sizeof(line), "//// %-9s %10.1f %10.1f", "total", total_peak / 1048576.0, total / 1048576.0);
+	s += line;
+	if (lim) s += " of " + std::to_string(lim >> 20) + " MB allowed";
+	s += "\n";
+	if (reclaimed) s += "//// Caches gave back " + std::to_string(reclaimed >> 20) + " MB\n";
+	if (refused) s += "//// " + std::to_string(refused) + " optional table(s) did not fit\n";
+	if (over) s += "//// " + std::to_string(over) + " required table(s) went over the limit\n";
+	return s;
+}
+
+void * map(size_t bytes)
+{
+	if (!bytes) return nullptr;
+#if defined(__linux__)
+	const size_t hp = 2 << 20;
+	void * p;
+	if (huge && bytes >= hp)
+	{
+		// Huge pages have to be asked for before the first touch
+		p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) throw std::bad_alloc();
+		madvise(p, bytes, MADV_HUGEPAGE);
+		for (size_t i=0; i<bytes; i+=4096) ((volatile char *) p)[i] = 0;
+	}
+	else
+	{
+		p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (p == MAP_FAILED) throw std::bad_alloc();
+	}
+	return p;
+#else
+	void * p = calloc(bytes, 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+#endif
+}
+
+void unmap(void * p, size_t bytes)
+{
+	if (!p) return;
+#if defined(__linux__)
+	munmap(p, bytes);
+#else
+	free(p);
+#endif
+}
+
+//
+// arena
+//
+
+void * arena::grow(size_t bytes, size_t align)
+{
+	size_t next = chunks.empty() ? 0 : cur+1;
+	if (next >= chunks.size() || pad(chunks[next].p, align) + bytes > chunks[next].size)
+	{
+		// operator new only aligns to __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+		// leave room to align the start beyond that
+		size_t size = std::max<size_t>(bytes + align-1, chunks.empty() ? 1 << 16 : chunks.back().size * 2);
+		force(arena_chunks, size);
+		chunks.insert(chunks.begin() + next, {(char *) ::operator new(size), size});
+	}
+	cur = next;
+	size_t o = pad(chunks[cur].p, align);
+	off = o + bytes;
+	return chunks[cur].p + o;
+}
+
+arena::~arena()
+{
+	for (auto & i : chunks)
+	{
+		::operator delete(i.p);
+		release(arena_chunks, i.size);
+	}
+}
+
+arena & local()
+{
+	thread_local arena a;
+	return a;
+}
+
+}
+}
@@ -0,0 +1,202 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// Memory of the search tools under one budget.
+// Large tables are accounted per component against a process wide limit.
+// Optional ones (transposition tables) shrink to fit it, caches (csmap)
+// give memory back when asked, and tables a search cannot do without go
+// over the limit rather than fail. Per-node scratch comes from
+// thread-local bump arenas, so hot paths do not touch the allocator.
+//
+
+#ifndef PRMEM_H
+#define PRMEM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace prs {
+namespace mem {
+
+enum component {
+	csmap,
+	ttable,
+	arena_chunks,
+	answers,		// prsd answer cache
+	components
+};
+
+// Process wide limit in bytes, 0 - none.
+// Setting it also prints peak usage to stderr at exit.
+void set_limit(long bytes);
+long limit();
+
+// Large tables ask for transparent huge pages
+extern bool huge;
+
+// Accounts "bytes" to "c" if that fits the limit, returns 0 otherwise.
+// Caches are asked to shrink before giving up.
+bool reserve(component c, long bytes);
+// Accounts "bytes" even over the limit
+void force(component c, long bytes);
+void release(component c, long bytes);
+
+// Registers a cache. When memory runs short, "shrink" is asked to free
+// at least "bytes" and returns how much it did free.
+void on_pressure(std::function<long(long bytes)> shrink);
+
+// Peak use per component, "//// " comment lines
+std::string report();
+
+// Page aligned zeroed memory, touched up front so it is really there
+void * map(size_t bytes);
+void unmap(void * p, size_t bytes);
+
+template <class T>
+class table {
+	// A large zeroed array of T, allocated in one piece and accounted to
+	// a component. T has to be fine with all bits zero.
+
+	private:
+	T * p = nullptr;
+	size_t n = 0;
+	component c = csmap;
+
+	public:
+	table() {}
+	table(const table &) = delete;
+	table & operator=(const table &) = delete;
+	~table()
+	{
+		free();
+	}
+	// Returns 0 if it does not fit the limit, unless "required" is set
+	bool alloc(component c, size_t n, bool required = 1)
+	{
+		free();
+		long bytes = n * sizeof(T);
+		if (required) force(c, bytes);
+		else if (!reserve(c, bytes)) return 0;
+		this->c = c;
+		this->n = n;
+		p = (T *) map(bytes);
+		return 1;
+	}
+	void free()
+	{
+		if (!p) return;
+		unmap(p, n * sizeof(T));
+		release(c, n * sizeof(T));
+		p = nullptr;
+		n = 0;
+	}
+	T & operator[](size_t i)
+	{
+		return p[i];
+	}
+	const T & operator[](size_t i) const
+	{
+		return p[i];
+	}
+	T * data()
+	{
+		return p;
+	}
+	const T * data() const
+	{
+		return p;
+	}
+	size_t size() const
+	{
+		return n;
+	}
+	size_t bytes() const
+	{
+		return n * sizeof(T);
+	}
+};
+
+class arena {
+	// Bump allocator for per-node scratch of a single thread.
+	// Memory is handed out in stack order and given back by rewinding
+	// to a mark; chunks stay around for the next node.
+
+	private:
+	struct chunk {
+		char * p;
+		size_t size;
+	};
+	std::vector<chunk> chunks;
+	size_t cur = 0;		// Chunk being filled
+	size_t off = 0;		// First free byte in it
+
+	void * grow(size_t bytes, size_t align);
+
+	// Bytes to skip from "p" to a multiple of "align"
+	static size_t pad(const char * p, size_t align)
+	{
+		return -uintptr_t(p) & (align-1);
+	}
+
+	public:
+	struct mark {
+		size_t cur, off;
+	};
+
+	arena() {}
+	arena(const arena &) = delete;
+	arena & operator=(const arena &) = delete;
+	~arena();
+
+	mark top() const
+	{
+		return {cur, off};
+	}
+	void rewind(const mark & m)
+	{
+		cur = m.cur;
+		off = m.off;
+	}
+	// Uninitialized room for "n" trivially copyable T
+	template <class T>
+	T * alloc(size_t n)
+	{
+		size_t a = alignof(T);
+		if (cur < chunks.size())
+		{
+			size_t o = off + pad(chunks[cur].p + off, a);
+			if (o + n*sizeof(T) <= chunks[cur].size)
+			{
+				off = o + n*sizeof(T);
+				return (T *) (chunks[cur].p + o);
+			}
+		}
+		return (T *) grow(n*sizeof(T), a);
+	}
+};
+
+// Arena of the calling thread
+arena & local();
+
+class frame {
+	// Gives back everything allocated from an arena in its lifetime
+
+	private:
+	arena & a;
+	arena::mark m;
+
+	public:
+	frame(arena & a) : a(a), m(a.top()) {}
+	~frame()
+	{
+		a.rewind(m);
+	}
+};
+
+}
+}
+
+#endif
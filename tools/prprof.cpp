@@ -0,0 +1,261 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// Search phase profiler, see prprof.h
+//
+
+#include "prprof.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace prs {
+namespace prof {
+
+bool on = 0;
+
+namespace {
+
+const char * names[phases] = {
+	"other", "run_counter", "check_period", "map_row", "chain_run",
+	"fill_luts", "fill_luts_r", "lutshash", "ttable", "vari_next", "csmap"
+};
+
+// Hardware events, the first one leads the group
+const int events = 4;
+#if defined(__linux__)
+const uint64_t event_config[events] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_MISSES,	// Last level cache on most CPUs
+};
+#endif
+
+struct counts {
+	long calls = 0;
+	double ns = 0;
+	uint64_t ev[events] = {};
+};
+
+struct table {
+	counts c[phases];
+};
+
+// Tables outlive their threads, the report adds them up
+std::mutex m;
+std::vector<std::shared_ptr<table>> tables;
+int opened = -1;		// Events that opened on every thread so far, as bits
+std::string why;		// Why some did not
+std::atomic<bool> multiplexed{0};	// Counters shared the PMU with someone else
+
+class thread_counters {
+	int fd[events];
+	int slot[events];	// Position in a group read, -1 if not counting
+	int n = 0;		// Events in the group
+	uint64_t last[events] = {};
+	std::chrono::steady_clock::time_point t;
+
+	// Reads all counters of the group at once, returns 0 on failure
+	bool read_all(uint64_t * v)
+	{
+#if defined(__linux__)
+		if (!n) return 0;
+		uint64_t buf[3 + events];
+		ssize_t got = read(fd[0], buf, sizeof(buf));
+		if (got < ssize_t(sizeof(uint64_t) * (3 + n))) return 0;
+		for (int i=0; i<events; i++) v[i] = slot[i] < 0 ? 0 : buf[3 + slot[i]];
+		if (buf[2] < buf[1] - buf[1]/100) multiplexed = 1;
+		return 1;
+#else
+		return 0;
+#endif
+	}
+
+	void open()
+	{
+		std::string err;
+		for (int i=0; i<events; i++) fd[i] = -1, slot[i] = -1;
+#if defined(__linux__)
+		for (int i=0; i<events; i++)
+		{
+			perf_event_attr a;
+			memset(&a, 0, sizeof(a));
+			a.size = sizeof(a);
+			a.type = PERF_TYPE_HARDWARE;
+			a.config = event_config[i];
+			a.exclude_kernel = 1;
+			a.exclude_hv = 1;
+			a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			// Counts this thread only, on any CPU
+			fd[i] = syscall(SYS_perf_event_open, &a, 0, -1, n ? fd[0] : -1, 0);
+			if (fd[i] < 0)
+			{
+				if (err.empty()) err = std::string("perf_event_open: ") + strerror(errno);
+				if (!n) break;		// No leader, no group
+				continue;
+			}
+			slot[i] = n++;
+		}
+#else
+		err = "perf_event_open needs Linux";
+#endif
+		std::lock_guard<std::mutex> l(m);
+		int got = 0;
+		for (int i=0; i<events; i++) if (slot[i] >= 0) got |= 1 << i;
+		opened = (opened < 0) ? got : opened & got;
+		if (why.empty()) why = err;
+	}
+
+	public:
+	int cur = other;
+	std::shared_ptr<table> tab = std::make_shared<table>();
+
+	thread_counters()
+	{
+		open();
+		{
+			std::lock_guard<std::mutex> l(m);
+			tables.push_back(tab);
+		}
+		read_all(last);
+		t = std::chrono::steady_clock::now();
+	}
+	~thread_counters()
+	{
+		sample();
+#if defined(__linux__)
+		for (int i=0; i<events; i++) if (fd[i] >= 0) close(fd[i]);
+#endif
+	}
+
+	// Charges what happened since the last sample to the current phase
+	void sample()
+	{
+		auto now = std::chrono::steady_clock::now();
+		counts & c = tab->c[cur];
+		c.ns += std::chrono::duration<double, std::nano>(now - t).count();
+		t = now;
+		uint64_t v[events];
+		if (!read_all(v)) return;
+		for (int i=0; i<events; i++) c.ev[i] += v[i] - last[i];
+		memcpy(last, v, sizeof(last));
+	}
+};
+
+thread_local thread_counters tc;
+
+std::string summary();
+
+// At exit the counters of this thread are gone already,
+// they have charged their last phase on the way out.
+void print()
+{
+	std::cerr << summary();
+}
+
+}
+
+void enable()
+{
+	if (on) return;
+	on = 1;
+	tc.cur = other;		// Starts the clock of this thread
+	atexit(print);
+}
+
+int enter(phase p)
+{
+	thread_counters & t = tc;
+	t.sample();
+	int prev = t.cur;
+	t.cur = p;
+	t.tab->c[p].calls++;
+	return prev;
+}
+
+void leave(int prev)
+{
+	thread_counters & t = tc;
+	t.sample();
+	t.cur = prev;
+}
+
+std::string report()
+{
+	tc.sample();
+	return summary();
+}
+
+namespace {
+
+std::string summary()
+{
+	std::lock_guard<std::mutex> l(m);
+	table sum;
+	for (auto & i : tables)
+	{
+		for (int j=0; j<phases; j++)
+		{
+			counts & s = sum.c[j];
+			s.calls += i->c[j].calls;
+			s.ns += i->c[j].ns;
+			for (int e=0; e<events; e++) s.ev[e] += i->c[j].ev[e];
+		}
+	}
+
+	auto has = [&](int e) { return opened > 0 && (opened >> e & 1); };
+	char line[256];
+	std::string s = "//// Profile of " + std::to_string(tables.size()) + " thread(s)\n";
+	snprintf(line, sizeof(line), "//// %-13s %12s %11s %11s %12s %6s %11s %11s\n",
+		"phase", "calls", "wall ms", "Mcycles", "cycles/call", "IPC", "br-miss/ki", "llc-miss/ki");
+	s += line;
+	for (int j=0; j<phases; j++)
+	{
+		const counts & c = sum.c[j];
+		if (!c.calls && j != other) continue;
+		char mc[32] = "-", cyc[32] = "-", ipc[32] = "-", br[32] = "-", llc[32] = "-";
+		double ki = c.ev[1] / 1000.0;
+		if (has(0)) snprintf(mc, sizeof(mc), "%.1f", c.ev[0] / 1e6);
+		if (has(0) && c.calls) snprintf(cyc, sizeof(cyc), "%.1f", double(c.ev[0]) / c.calls);
+		if (has(0) && has(1) && c.ev[0]) snprintf(ipc, sizeof(ipc), "%.2f", double(c.ev[1]) / c.ev[0]);
+		if (has(1) && has(2) && ki > 0) snprintf(br, sizeof(br), "%.2f", c.ev[2] / ki);
+		if (has(1) && has(3) && ki > 0) snprintf(llc, sizeof(llc), "%.2f", c.ev[3] / ki);
+		snprintf(line, sizeof(line), "//// %-13s %12ld %11.1f %11s %12s %6s %11s %11s\n",
+			names[j], c.calls, c.ns / 1e6, mc, cyc, ipc, br, llc);
+		s += line;
+	}
+	if (opened <= 0)
+	{
+		s += "//// No hardware counters (" + (why.empty() ? std::string("not supported") : why) + "), timing only\n";
+	}
+	else if (opened != (1 << events) - 1)
+	{
+		s += "//// Some hardware counters are missing (" + (why.empty() ? std::string("not supported") : why)
+			+ "), their columns are empty\n";
+	}
+	if (multiplexed) s += "//// Counters were multiplexed with other users of the PMU, counts are low\n";
+	s += "//// Wall time of \"other\" includes threads waiting for each other.\n";
+	s += "//// Every phase change reads the counters, so phases of a few hundred cycles are inflated.\n";
+	return s;
+}
+
+}
+
+}
+}
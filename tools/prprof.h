@@ -0,0 +1,70 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// Optional profiling of search phases with hardware counters.
+// Each thread opens its own perf_event_open counters the first time it
+// enters a phase. Cycles, instructions, branch misses and last level cache
+// misses counted between two phase changes go to the phase that was running,
+// so nested phases are not counted twice. Without perf (no PMU in a VM,
+// perf_event_paranoid, seccomp) only calls and time are kept.
+// Off by default, a scope then costs a single test.
+//
+
+#ifndef PRPROF_H
+#define PRPROF_H
+
+#include <string>
+
+namespace prs {
+namespace prof {
+
+enum phase {
+	other,		// Outside any named phase
+	run_counter,	// Kernels
+	check_period,
+	map_row,
+	chain_run,	// Counter search
+	fill_luts,	// Divider search
+	fill_luts_r,
+	lutshash,
+	ttable,
+	vari_next,
+	csmap,
+	phases
+};
+
+extern bool on;
+
+// Starts profiling the calling thread and any thread entering a phase
+// later on. The table is printed to stderr at exit.
+void enable();
+
+// Per-phase table, "//// " comment lines
+std::string report();
+
+// Use "scope" instead
+int enter(phase p);
+void leave(int prev);
+
+class scope {
+	// Attributes everything until it goes out of scope to phase "p",
+	// except for phases nested in it
+
+	private:
+	int prev = -1;
+
+	public:
+	scope(phase p)
+	{
+		if (on) prev = enter(p);
+	}
+	~scope()
+	{
+		if (prev >= 0) leave(prev);
+	}
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,106 @@
+// Pseudo random counter / divider search daemon client
+// by Tomek Szczęsny 2024
+//
+// Sends queries to prsd and prints the modules it returns.
+// Queries come from the command line or, without one, from stdin,
+// one per line: cnt|div|alt [period] [extrabits] [priority]
+// Result headers are printed as "////" comments, like prcnt does.
+//
+
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int main(int argc, char** argv)
+{
+	std::string path = "/tmp/prsd.sock";
+	std::string q;
+	int a = 1;
+	if (argc > 2 && std::string(argv[1]) == "-s") {
+		path = argv[2];
+		a = 3;
+	}
+	if (a < argc && std::string(argv[a]) == "-h") {
+		std::cerr << "Usage:\n";
+		std::cerr << "prq [-s socket] [cnt|div|alt] [period] [extrabits] [priority]\n";
+		std::cerr << "prq [-s socket] < queries\n";
+		return 0;
+	}
+	if (a < argc)
+	{
+		for (; a<argc; a++) q += std::string(argv[a]) + " ";
+		q += "\n";
+	}
+	else
+	{
+		std::string l;
+		while (std::getline(std::cin, l)) if (l.find_first_not_of(" \t") != std::string::npos) q += l + "\n";
+	}
+	long n = 0;		// Requests sent
+	for (char c : q) n += (c == '\n');
+
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+	if (s < 0 || connect(s, (sockaddr *) &addr, sizeof(addr)) < 0) {
+		std::cerr << "Can't connect to " << path << ", is prsd running?\n";
+		return 1;
+	}
+	if (send(s, q.data(), q.size(), MSG_NOSIGNAL) != q.size()) {
+		std::cerr << "Can't send queries\n";
+		return 1;
+	}
+
+	// Every request ends with a single line reply, or a result block ending with "."
+	std::string buf;
+	char rb[4096];
+	bool inres = 0;
+	int ret = 0;
+	while (n > 0)
+	{
+		ssize_t r = recv(s, rb, sizeof(rb), 0);
+		if (r <= 0) {
+			std::cerr << "Connection lost\n";
+			return 1;
+		}
+		buf.append(rb, r);
+		size_t e;
+		while (n > 0 && (e = buf.find('\n')) != std::string::npos)
+		{
+			std::string l = buf.substr(0, e);
+			buf.erase(0, e+1);
+			if (inres)
+			{
+				if (l == ".") {
+					inres = 0;
+					n--;
+				}
+				else std::cout << l << "\n";
+			}
+			else if (l.compare(0, 7, "result ") == 0)
+			{
+				std::cout << "//// " << l << "\n";
+				if (l.find(" found ") == std::string::npos) ret = 1;
+				inres = 1;
+			}
+			else if (l.compare(0, 6, "stats ") == 0)
+			{
+				std::cout << l << "\n";
+				n--;
+			}
+			else if (l.compare(0, 6, "error ") == 0)
+			{
+				std::cerr << "Bad query #" << l.substr(6) << "\n";
+				ret = 1;
+				n--;
+			}
+		}
+	}
+	std::cout << std::flush;
+	close(s);
+	return ret;
+}
@@ -0,0 +1,463 @@
+// Pseudo random counter / divider search daemon
+// by Tomek Szczęsny 2024
+//
+// Keeps precomputed tables and found solutions in memory
+// and answers queries over a Unix domain socket.
+// Queries from all clients share one pool of workers.
+//
+// Protocol, one request per line:
+//   cnt|div|alt [period] [extrabits] [priority]
+//   stats
+// Replies, streamed as soon as available:
+//   queued [id]
+//   result [id] [kind] [period] [extrabits] found|none|cancelled [cached]
+//   ...module text...
+//   .
+// where [id] counts requests of the connection from 0.
+// Jobs of a client that disconnects are cancelled. Answers are cached,
+// the oldest dropped first when the cache is full or memory runs short.
+// Replies are queued per connection and written by a thread of its own, so
+// a client that does not read holds up nobody else. One that lets more
+// than 64 MB pile up is cut off.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "prsearch.h"
+#include "prkernels.h"
+
+struct job;
+
+struct conn {
+	int fd;
+	std::mutex wm;			// Guards the outgoing queue and jobs
+	std::condition_variable wcv;
+	std::deque<std::string> out;	// Replies not written yet
+	size_t queued = 0;		// Bytes in "out"
+	bool closing = 0;
+	std::vector<std::shared_ptr<job>> jobs;
+
+	static const size_t max_queued = 64 << 20;
+
+	// Queues a reply, never blocks
+	void send(const std::string & s)
+	{
+		std::lock_guard<std::mutex> l(wm);
+		if (closing) return;
+		if (queued + s.size() > max_queued)
+		{
+			// It doesn't read, so the reader finds the socket shut down
+			closing = 1;
+			out.clear();
+			queued = 0;
+			shutdown(fd, SHUT_RDWR);
+			wcv.notify_one();
+			return;
+		}
+		out.push_back(s);
+		queued += s.size();
+		wcv.notify_one();
+	}
+
+	// Writes "s" out, returns 0 if the client is gone, or would block with "flags"
+	bool write(const std::string & s, int flags)
+	{
+		size_t o = 0;
+		while (o < s.size())
+		{
+			ssize_t n = ::send(fd, s.data() + o, s.size() - o, MSG_NOSIGNAL | flags);
+			if (n <= 0) return 0;
+			o += n;
+		}
+		return 1;
+	}
+
+	// Thread of the connection writing the queue out
+	void writer()
+	{
+		std::unique_lock<std::mutex> l(wm);
+		while (1)
+		{
+			wcv.wait(l, [&]{ return !out.empty() || closing; });
+			if (out.empty()) return;
+			std::string s = std::move(out.front());
+			out.pop_front();
+			queued -= s.size();
+			// When closing, what fits the socket buffer goes out, the rest is dropped
+			int flags = closing ? MSG_DONTWAIT : 0;
+			l.unlock();
+			bool ok = write(s, flags);
+			l.lock();
+			if (!ok)
+			{
+				closing = 1;
+				out.clear();
+				queued = 0;
+				shutdown(fd, SHUT_RDWR);
+				return;
+			}
+		}
+	}
+
+	void close_queue()
+	{
+		std::lock_guard<std::mutex> l(wm);
+		closing = 1;
+		wcv.notify_one();
+	}
+};
+
+struct waiter {
+	std::shared_ptr<conn> c;
+	long id;
+};
+
+struct job {
+	std::string key;		// "kind period extrabits"
+	std::string kind;
+	int p, x;
+	int prio;
+	long seq;			// FIFO order within a priority
+	bool started = 0;
+	prs::cancel_token cancel;
+	std::vector<waiter> waiters;	// Guarded by the server mutex
+};
+
+struct jobcmp {
+	bool operator()(const std::shared_ptr<job> & a, const std::shared_ptr<job> & b) const
+	{
+		if (a->prio != b->prio) return a->prio < b->prio;
+		return a->seq > b->seq;
+	}
+};
+
+struct answer {
+	std::string status;		// found or none
+	std::string text;
+	long bytes = 0;			// Accounted to mem::answers
+};
+
+class server {
+	std::mutex m;
+	std::condition_variable cv;
+	std::priority_queue<std::shared_ptr<job>, std::vector<std::shared_ptr<job>>, jobcmp> queue;
+	std::map<std::string, std::shared_ptr<job>> inflight;
+	std::map<std::string, answer> cache;
+	std::deque<std::string> order;	// Cache keys, oldest first
+	size_t max_cache;
+	long seq = 0;
+	long running = 0;
+	long hits = 0;
+	long misses = 0;
+	int maxw;
+
+	// Drops the oldest answer, returns its bytes. Needs "m".
+	long evict()
+	{
+		auto a = cache.find(order.front());
+		order.pop_front();
+		long b = a->second.bytes;
+		cache.erase(a);
+		return b;
+	}
+
+	// Caches an answer already accounted for, returns the bytes to
+	// release. Needs "m".
+	long remember(const std::string & key, answer a)
+	{
+		if (cache.count(key)) return a.bytes;
+		cache[key] = a;
+		order.push_back(key);
+		long freed = 0;
+		while (cache.size() > max_cache) freed += evict();
+		return freed;
+	}
+
+	public:
+	server(int maxw, size_t max_cache) : maxw(maxw), max_cache(max_cache)
+	{
+		// Gives up rather than wait for a thread holding the server
+		prs::mem::on_pressure([this](long bytes)
+		{
+			long freed = 0;
+			{
+				std::unique_lock<std::mutex> l(m, std::try_to_lock);
+				if (!l.owns_lock()) return freed;
+				while (!order.empty() && freed < bytes) freed += evict();
+			}
+			prs::mem::release(prs::mem::answers, freed);
+			return freed;
+		});
+	}
+
+	static std::string header(long id, const job & j, const std::string & status, bool cached)
+	{
+		return "result " + std::to_string(id) + " " + j.kind + " " + std::to_string(j.p) + " "
+			+ std::to_string(j.x) + " " + status + " " + (cached ? "1" : "0") + "\n";
+	}
+
+	// Returns the reply to a "stats" request
+	std::string stats()
+	{
+		std::lock_guard<std::mutex> l(m);
+		return "stats queued " + std::to_string(queue.size()) + " running " + std::to_string(running)
+			+ " cached " + std::to_string(cache.size()) + " hits " + std::to_string(hits)
+			+ " misses " + std::to_string(misses) + "\n";
+	}
+
+	// Queues a request, or answers it from the cache
+	void submit(std::shared_ptr<conn> c, long id, const std::string & kind, int p, int x, int prio)
+	{
+		auto j = std::make_shared<job>();
+		j->kind = kind;
+		j->p = p;
+		j->x = x;
+		j->prio = prio;
+		j->key = kind + " " + std::to_string(p) + " " + std::to_string(x);
+
+		std::unique_lock<std::mutex> l(m);
+		auto a = cache.find(j->key);
+		if (a != cache.end())
+		{
+			hits++;
+			answer ans = a->second;
+			l.unlock();
+			c->send(header(id, *j, ans.status, 1) + ans.text + ".\n");
+			return;
+		}
+		misses++;
+		auto f = inflight.find(j->key);
+		if (f != inflight.end() && !f->second->cancel.cancelled()) j = f->second;	// Someone asked already
+		else
+		{
+			j->seq = seq++;
+			inflight[j->key] = j;
+			queue.push(j);
+			cv.notify_one();
+		}
+		j->waiters.push_back({c, id});
+
+		// Under "m", so the worker can't finish the job before it is listed
+		std::lock_guard<std::mutex> w(c->wm);
+		c->jobs.push_back(j);
+	}
+
+	// Removes a finished job from the in-flight list, unless it was replaced
+	void forget(const std::shared_ptr<job> & j)
+	{
+		auto f = inflight.find(j->key);
+		if (f != inflight.end() && f->second == j) inflight.erase(f);
+	}
+
+	// Forgets a closed connection, cancelling jobs nobody waits for
+	void drop(std::shared_ptr<conn> c)
+	{
+		std::vector<std::shared_ptr<job>> jobs;
+		{
+			std::lock_guard<std::mutex> w(c->wm);
+			jobs.swap(c->jobs);
+		}
+		std::lock_guard<std::mutex> l(m);
+		for (auto & j : jobs)
+		{
+			auto & wv = j->waiters;
+			wv.erase(std::remove_if(wv.begin(), wv.end(), [&](const waiter & i) { return i.c == c; }), wv.end());
+			if (wv.empty()) j->cancel.cancel();
+		}
+	}
+
+	void worker()
+	{
+		while (1)
+		{
+			std::shared_ptr<job> j;
+			{
+				std::unique_lock<std::mutex> l(m);
+				cv.wait(l, [&]{ return !queue.empty(); });
+				j = queue.top();
+				queue.pop();
+				if (j->cancel.cancelled())
+				{
+					forget(j);
+					continue;
+				}
+				j->started = 1;
+				running++;
+			}
+
+			prs::control ctl;
+			ctl.cancel = &j->cancel;
+			answer a;
+			bool cancelled;
+			if (j->kind == "cnt")
+			{
+				prs::counter_config cfg;
+				cfg.period = j->p;
+				cfg.extrabits = j->x;
+				prs::counter_result r = prs::find_counter(cfg, ctl);
+				cancelled = r.cancelled;
+				if (r.found) a.text = prs::counter_module(r);
+			}
+			else
+			{
+				prs::divider_config cfg;
+				cfg.period = j->p;
+				cfg.extrabits = j->x;
+				cfg.threads = 1;	// The pool provides the parallelism
+				if (j->kind == "alt") cfg.engine = prs::divider_engine::recursive;
+				prs::divider_result r = prs::find_divider(cfg, ctl);
+				cancelled = r.cancelled;
+				if (r.found) a.text = prs::divider_module(r);
+			}
+			a.status = cancelled ? "cancelled" : (a.text.empty() ? "none" : "found");
+
+			// Accounted before taking "m", as it may make the cache shrink
+			long freed = 0;
+			if (!cancelled)
+			{
+				a.bytes = sizeof(answer) + 2 * j->key.size() + a.status.size() + a.text.size() + 64;
+				prs::mem::force(prs::mem::answers, a.bytes);
+			}
+			std::vector<waiter> wv;
+			{
+				std::lock_guard<std::mutex> l(m);
+				running--;
+				forget(j);
+				if (!cancelled) freed = remember(j->key, a);
+				wv.swap(j->waiters);
+			}
+			if (freed) prs::mem::release(prs::mem::answers, freed);
+			for (auto & w : wv)
+			{
+				{
+					std::lock_guard<std::mutex> l(w.c->wm);
+					auto & cj = w.c->jobs;
+					cj.erase(std::remove(cj.begin(), cj.end(), j), cj.end());
+				}
+				w.c->send(header(w.id, *j, a.status, 0) + a.text + ".\n");
+			}
+		}
+	}
+
+	// Serves one client until it disconnects
+	void client(int fd)
+	{
+		auto c = std::make_shared<conn>();
+		c->fd = fd;
+		std::thread wr([c]() { c->writer(); });
+		long id = 0;
+		std::string buf;
+		char rb[4096];
+		while (1)
+		{
+			ssize_t n = recv(fd, rb, sizeof(rb), 0);
+			if (n <= 0) break;
+			buf.append(rb, n);
+			size_t e;
+			while ((e = buf.find('\n')) != std::string::npos)
+			{
+				std::istringstream in(buf.substr(0, e));
+				buf.erase(0, e+1);
+				std::string kind;
+				int p = 0, x = 0, prio = 0;
+				if (!(in >> kind)) continue;
+				if (kind == "stats")
+				{
+					c->send(stats());
+					continue;
+				}
+				in >> p >> x >> prio;
+				bool ok = (kind == "cnt" || kind == "div" || kind == "alt")
+					&& p >= 2 && p <= 10240 && x >= 0
+					&& (kind == "cnt" || prs::bitness(p) + x <= maxw);
+				long i = id++;
+				c->send(ok ? "queued " + std::to_string(i) + "\n" : "error " + std::to_string(i) + "\n");
+				if (ok) submit(c, i, kind, p, x, prio);
+			}
+		}
+		drop(c);
+		c->close_queue();
+		wr.join();
+		close(fd);
+	}
+
+	// Builds config-state maps up front so the first queries find them ready
+	void warm()
+	{
+		for (int w=4; w<=maxw; w++) prs::csmap(w);
+	}
+};
+
+int main(int argc, char** argv)
+{
+	int st = prs::isa_args(argc, argv);
+	if (st >= 0) return st;
+	std::string path = "/tmp/prsd.sock";
+	int threads = std::thread::hardware_concurrency();
+	int maxw = 12;
+	long max_cache = 100000;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h" || a+1 >= argc) {
+			std::cerr << "Usage:\n";
+			std::cerr << "prsd [options]\n";
+			std::cerr << "  -s [path]   Socket path (default: /tmp/prsd.sock)\n";
+			std::cerr << "  -t [n]      Worker threads (default: all cores)\n";
+			std::cerr << "  -w [bits]   Widest counter served, tables up to it are kept warm (default: 12)\n";
+			std::cerr << "  -c [n]      Answers kept in the cache (default: 100000)\n";
+			std::cerr << "  --mem-limit [MB]  Memory budget, idle tables are dropped to stay within it\n";
+			return 0;
+		}
+		if (o == "-s") path = argv[++a];
+		else if (o == "-t") threads = atoi(argv[++a]);
+		else if (o == "-w") maxw = atoi(argv[++a]);
+		else if (o == "-c") max_cache = atol(argv[++a]);
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (threads < 1) threads = 1;
+	if (max_cache < 0) max_cache = 0;
+
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (s < 0 || path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Can't create socket " << path << "\n";
+		return 1;
+	}
+	path.copy(addr.sun_path, path.size());
+	unlink(path.c_str());
+	if (bind(s, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(s, 64) < 0) {
+		std::cerr << "Can't listen on " << path << "\n";
+		return 1;
+	}
+
+	server srv(maxw, max_cache);
+	std::cerr << "Warming up tables up to " << maxw << " bits...\n";
+	srv.warm();
+	for (int i=0; i<threads; i++) std::thread(&server::worker, &srv).detach();
+	std::cerr << "Listening on " << path << " with " << threads << " workers\n";
+
+	while (1)
+	{
+		int fd = accept(s, nullptr, nullptr);
+		if (fd < 0) continue;
+		std::thread(&server::client, &srv, fd).detach();
+	}
+}
@@ -0,0 +1,2445 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// See prsearch.h
+//
+
+#include "prsearch.h"
+#include "prkernels.h"
+#include "prprof.h"
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+
+namespace prs {
+
+std::string bincout(int in, int w)
+{
+	std::string s = std::bitset<32>(in).to_string();
+	s.erase(0, 32-w);
+	return s;
+}
+
+std::vector<int> parseconfig(int config, int w)
+{
+	std::vector<int> rets;
+	int i;
+	for (i=0;i<w;i++)
+	{
+		if ((config >> i) & 1)
+		{
+			rets.push_back(i);
+		}
+	}
+	return rets;
+}
+
+int bitness(int p)
+{
+	int b = int(std::ceil(std::log2(p)));
+	if (b < 4) b = 4;
+	return b;
+}
+
+//
+// line_writer
+//
+
+void line_writer::write(const std::string & line)
+{
+	std::lock_guard<std::mutex> l(m);
+	buf += line;
+	buf += '\n';
+	if (buf.size() >= limit)
+	{
+		fwrite(buf.data(), 1, buf.size(), f);
+		buf.clear();
+	}
+}
+
+void line_writer::flush()
+{
+	std::lock_guard<std::mutex> l(m);
+	fwrite(buf.data(), 1, buf.size(), f);
+	buf.clear();
+	fflush(f);
+}
+
+//
+// solution_set
+//
+
+bool solution_set::insert(const std::string & key)
+{
+	uint64_t h = std::hash<std::string>()(key);
+	std::lock_guard<std::mutex> l(m);
+	if (seen.insert(h).second) return 1;
+	duplicates++;
+	return 0;
+}
+
+long solution_set::size()
+{
+	std::lock_guard<std::mutex> l(m);
+	return seen.size();
+}
+
+//
+// lut
+//
+
+std::string lut::str() const
+{
+	int i;
+	std::string ret;
+	for (i=15;i>=0;i--)
+	{
+		if ((lut_x >> i) & 1) ret += "x";
+		else ret += (((lut_d >> i ) & 1) ? "1" : "0");
+	}
+	return ret;
+}
+
+//
+// comb
+//
+
+comb::comb(int k, int n)
+{
+	this->k = k;
+	this->n = n;
+	this->set(0);
+}
+
+bool comb::next()
+{
+	while (1)
+	{
+		c++;
+		c &= (1 << n) - 1;
+		if (c == 0)
+		{
+			next();
+			return 0;
+		}
+		if (check()) return 1;
+	}
+}
+
+bool comb::set(int i)
+{
+	c = i;
+	if (check()) return 1;
+	else return next();
+}
+
+bool comb::check() const
+{
+	return kernels().popcount(c) == k;
+}
+
+int comb::map(int in) const
+{
+	return kernels().pext(in, c);
+}
+
+std::string comb::str() const
+{
+	int i;
+	std::string ret;
+	for (i=n-1;i>=0;i--)
+	{
+		ret += ((c >> i) & 1 ? "1" : "0");
+	}
+	return ret;
+}
+
+std::vector<int> comb::vec() const
+{
+	return parseconfig(c, n);
+}
+
+bool mass_next(std::vector<comb> & c)
+{
+	for (comb & i : c)
+	{
+		if (i.next()) return 1;
+	}
+	return 0;
+}
+
+//
+// vari
+//
+
+vari::vari(int l, int h, int k)
+{
+	int i;
+	this->n = h-l+1;
+	this->k = k;
+	for (i=l; i<=h; i++)
+	{
+		range.push_back(i);
+	}
+	s.assign(k, 0);
+	update();
+}
+
+// Generates the next internal state.
+bool vari::next_state(int num)
+{
+	int i;
+	if (num > k-1) num = k-1;
+	s[num] +=1;
+	for (i=num; i>=0; i--)
+	{
+		if (s[i] > n-i-1)
+		{
+			s[i] = 0;
+			if (i == 0) return 0;
+			s[i-1] += 1;
+		}
+	}
+	for (i=num+1; i<k; i++)
+	{
+		s[i] = 0;
+	}
+	return 1;
+}
+
+// Translates the internal state into a result vector
+void vari::update()
+{
+	left = range;			// A disposable copy, in storage kept from the last call
+	result.clear();
+	int i; for (i=0;i<k;i++)
+	{
+		result.push_back(left[s[i]]);
+		left.erase(left.begin() + s[i]);
+	}
+}
+
+bool vari::next(int num)
+{
+	prof::scope ps(prof::vari_next);
+	if (next_state(num) == 0) return 0;
+	update();
+	return 1;
+}
+
+bool vari::next_at(int num)
+{
+	prof::scope ps(prof::vari_next);
+	int i;
+	if (num >= k) return 0;
+	s[num] += 1;
+	bool ro = (s[num] > n-num-1);
+	if (ro) s[num] = 0;
+	for (i=num+1; i<k; i++) s[i] = 0;
+	update();
+	return !ro;
+}
+
+bool vari::set_state(const std::vector<int> & st)
+{
+	int i;
+	if (st.size() != k) return 0;
+	for (i=0; i<k; i++)
+	{
+		if (st[i] < 0 || st[i] > n-i-1) return 0;
+	}
+	s = st;
+	update();
+	return 1;
+}
+
+double vari::position() const
+{
+	double ret = 0;
+	double w = 1;
+	int i;
+	for (i=0; i<k; i++)
+	{
+		w /= n-i;
+		ret += s[i]*w;
+	}
+	return ret;
+}
+
+long int vari::cases() const
+{
+	long int ret = 1;
+	int i;
+	for (i=(n-k+1); i<=n; i++)
+	{
+		ret *= i;
+	}
+	return ret;
+}
+
+//
+// csmap
+//
+
+std::shared_ptr<const mem::table<int>> csmap(int w)
+{
+	// Recursive, as building a table may make the memory budget ask
+	// this very cache to shrink
+	static std::recursive_mutex m;
+	static std::map<int, std::shared_ptr<const mem::table<int>>> cache;
+	static bool registered = 0;
+
+	std::lock_guard<std::recursive_mutex> l(m);
+	if (!registered)
+	{
+		// Drops tables nobody is using, the widest first. Gives up rather
+		// than wait for a thread that is building one.
+		mem::on_pressure([](long bytes)
+		{
+			std::unique_lock<std::recursive_mutex> l(m, std::try_to_lock);
+			long freed = 0;
+			if (!l.owns_lock()) return freed;
+			for (auto i = cache.end(); i != cache.begin() && freed < bytes; )
+			{
+				i--;
+				if (!i->second || i->second.use_count() > 1) continue;
+				freed += i->second->bytes();
+				i = cache.erase(i);
+			}
+			return freed;
+		});
+		registered = 1;
+	}
+	auto & ret = cache[w];
+	if (ret) return ret;
+	prof::scope ps(prof::csmap);
+
+	auto t = std::make_shared<mem::table<int>>();
+	t->alloc(mem::csmap, size_t(1) << 2*w);
+	comb gmc(4, w);
+	while (1)
+	{
+		kernels().map_row(gmc.intg(), w, t->data() + (size_t(gmc.intg()) << w));
+		if (!gmc.next()) break;
+	}
+	ret = t;
+	return ret;
+}
+
+//
+// Budgets and resume positions
+//
+
+namespace {
+
+class meter {
+	// Keeps a search within its budget.
+	// Each thread counts nodes on its own and hands them over in batches,
+	// so the shared total and the clock are touched once per batch.
+
+	private:
+	budget lim;
+	std::chrono::steady_clock::time_point deadline;
+	std::atomic<long> total{0};
+	std::atomic<bool> out{0};
+
+	public:
+	static const long batch = 1024;
+
+	meter(const budget & lim) : lim(lim)
+	{
+		deadline = std::chrono::steady_clock::now()
+			+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(lim.seconds));
+	}
+	// Counts one node in "pending", a per-thread counter.
+	// Returns 1 when the budget is spent.
+	bool tick(long & pending)
+	{
+		if (++pending < batch) return 0;
+		return flush(pending);
+	}
+	// Hands over pending nodes and checks the limits
+	bool flush(long & pending)
+	{
+		long t = total.fetch_add(pending, std::memory_order_relaxed) + pending;
+		pending = 0;
+		if (lim.nodes > 0 && t >= lim.nodes) out = 1;
+		if (lim.seconds > 0 && std::chrono::steady_clock::now() >= deadline) out = 1;
+		return out;
+	}
+	long nodes() const
+	{
+		return total;
+	}
+};
+
+// Resume positions are fields separated by "/", lists are separated by ","
+std::vector<std::string> split(const std::string & s, char c)
+{
+	std::vector<std::string> ret(1);
+	for (char i : s)
+	{
+		if (i == c) ret.emplace_back();
+		else ret.back() += i;
+	}
+	return ret;
+}
+
+bool parse_num(const std::string & s, long & v)
+{
+	if (s.empty()) return 0;
+	char * e;
+	v = strtol(s.c_str(), &e, 10);
+	return *e == 0;
+}
+
+bool parse_list(const std::string & s, std::vector<int> & v)
+{
+	v.clear();
+	if (s.empty()) return 1;
+	for (auto & i : split(s, ','))
+	{
+		long n;
+		if (!parse_num(i, n)) return 0;
+		v.push_back(n);
+	}
+	return 1;
+}
+
+std::string join(const std::vector<int> & v)
+{
+	std::string ret;
+	for (int i : v) ret += (ret.empty() ? "" : ",") + std::to_string(i);
+	return ret;
+}
+
+// Number of "k" bit values in (lo, hi]
+long count_bits(int k, int lo, int hi)
+{
+	const kernel_set & ks = kernels();
+	long ret = 0;
+	for (long i=lo+1; i<=hi; i++) ret += (ks.popcount(i) == k);
+	return ret;
+}
+
+}
+
+//
+// Counter search (prcnt)
+//
+
+namespace {
+
+// A counter's LUTs in the order the feedback passes them, lut1 first.
+// Each LUT past the first one takes the previous one's output on I3.
+struct lut_chain {
+	std::vector<int> data, config;
+
+	lut_chain(const counter_result & r)
+	{
+		data = {r.reactor1};
+		config = {r.config1};
+		if (r.config2)
+		{
+			data.push_back(r.reactor2);
+			config.push_back(r.config2);
+		}
+		data.insert(data.end(), r.reactors.begin(), r.reactors.end());
+		config.insert(config.end(), r.configs.begin(), r.configs.end());
+	}
+
+	// The next register state, "used" collects LUT bits that were read
+	uint32_t step(uint32_t s, uint32_t wm, int * used = nullptr) const
+	{
+		const kernel_set & k = kernels();
+		int lo = 0;
+		for (size_t i=0; i<data.size(); i++)
+		{
+			int a = k.pext(s, config[i]) | (i ? lo << 3 : 0);
+			if (used) used[i] |= 1 << a;
+			lo = (data[i] >> a) & 1;
+		}
+		return ((s << 1) & wm) | lo;
+	}
+};
+
+// Runs a two LUT counter from reset and tells how far it is from being
+// a counter of period "p". Scratch of one annealing thread.
+struct cycle_probe {
+	int p, max;
+	const kernel_set & k = kernels();
+	std::vector<uint32_t> seen;	// Run that last visited a register state
+	std::vector<int> when;		// Step it was visited at
+	std::vector<uint32_t> outs;	// Run that last gave an output
+	uint32_t run = 0;
+
+	cycle_probe(int p, int b, int w) : p(p), max(1 << b), seen(1 << w), when(1 << w), outs(1 << b) {}
+
+	uint32_t step(uint32_t s, uint32_t data, uint32_t c1, uint32_t c2, uint32_t wm) const
+	{
+		uint32_t lo1 = (data >> k.pext(s, c1)) & 1;
+		uint32_t lo = (data >> 16 >> (k.pext(s, c2) | lo1 << 3)) & 1;
+		return ((s << 1) & wm) | lo;
+	}
+
+	// 0 for a counter. Otherwise the distance of the cycle length from p,
+	// plus the steps it takes to enter the cycle, plus outputs repeated
+	// within it. 3p if nothing comes back within 4p steps.
+	int energy(uint32_t data, uint32_t c1, uint32_t c2, int w)
+	{
+		if (++run == 0)
+		{
+			std::fill(seen.begin(), seen.end(), 0);
+			std::fill(outs.begin(), outs.end(), 0);
+			run = 1;
+		}
+		uint32_t wm = (1u << w) - 1;
+		uint32_t s = 0;
+		for (int j=0; j<=4*p; j++)
+		{
+			if (seen[s] == run)
+			{
+				int e = std::abs(j - when[s] - p) + when[s];
+				if (e) return e;
+				for (int i=0; i<p; i++)
+				{
+					int o = s & (max-1);
+					if (outs[o] == run) e++;
+					outs[o] = run;
+					s = step(s, data, c1, c2, wm);
+				}
+				return e;
+			}
+			seen[s] = run;
+			when[s] = j;
+			s = step(s, data, c1, c2, wm);
+		}
+		return 3*p;
+	}
+};
+
+class counter_search {
+	int p, b, sx;
+	int x = 0;		// Extra bits
+	int max;
+	std::vector<int> results;
+	const control & ctl;
+	const kernel_set & k = kernels();
+	const counter_config & cfg;
+
+	// Budget
+	meter m;
+	long pending = 0;
+	struct position {
+		int stage = 0;
+		int x = 0;
+		int config1 = 0;
+		int config2 = 0;
+		long reactor1 = 0;	// Last candidate tried
+		long reactor2 = 0;
+
+		// Order of testloop calls, chains go by length first
+		std::vector<int> order() const
+		{
+			if (stage == 4) return {stage, config2, config1, x};
+			return {stage, x, config2, config1};
+		}
+	};
+	position at;		// Current position
+	position from;		// Resume position
+	bool skip = 0;		// Fast forwarding to "from"
+
+	// LUT chain being tried
+	int n = 0;			// Chain length
+	std::vector<int> tap;		// Input selections
+	std::vector<lut> fn;		// Partial LUT functions
+	std::vector<char> seen;		// States visited by the first period
+	std::vector<int> hist;		// States from reset
+	double tapsets = 0;		// Input selections at this length and level
+	long cap = 0;			// Nodes allowed per input selection, 0 - no limit
+	long spent = 0;			// Nodes spent on the current one
+	bool capped = 0;		// It was left unfinished
+
+	public:
+	counter_result r;
+	solution_set sols;
+	long steps = 0;
+
+	counter_search(const counter_config & cfg, const control & ctl) : ctl(ctl), cfg(cfg), m(cfg.limit)
+	{
+		p = cfg.period;
+		sx = cfg.extrabits;
+		b = bitness(p);
+		max = 1 << b;
+		results.resize(2*p+1);
+		r.period = p;
+		r.b = b;
+		if (!cfg.resume.empty()) skip = parse(cfg.resume);
+	}
+
+	// Reads a resume position, "cnt/period/stage/x/config1/config2/reactor1/reactor2"
+	bool parse(const std::string & s)
+	{
+		auto f = split(s, '/');
+		std::vector<long> v(7);
+		if (f.size() != 8 || f[0] != "cnt") return 0;
+		for (int i=0; i<7; i++)
+		{
+			if (!parse_num(f[i+1], v[i])) return 0;
+		}
+		if (v[0] != p || v[1] < 0 || v[1] > 4 || v[2] < 0 || v[2] > sx) return 0;
+		if ((v[1] == 4) != chained()) return 0;
+		if (v[1] == 4 && (v[3] < 2 || v[3] > chain_max())) return 0;
+		from.stage = v[1];
+		from.x = v[2];
+		from.config1 = v[3];
+		from.config2 = v[4];
+		from.reactor1 = v[5];
+		from.reactor2 = v[6];
+		return 1;
+	}
+
+	// Fills in the report of a search stopped by its budget
+	void exhausted(long reactor1, long reactor2)
+	{
+		int w = b+x;
+		int top = (1 << w) - 1;
+		double total, done, frac;
+		if (at.stage == 0)
+		{
+			total = count_bits(4, 1 << w-1, top);
+			done = count_bits(4, 1 << w-1, at.config1) - 1;
+		}
+		else if (at.stage == 4)
+		{
+			total = tapsets;
+			done = reactor1;
+		}
+		else
+		{
+			double n4 = count_bits(4, 0, top);
+			total = n4 * count_bits(3, 0, top);
+			done = (count_bits(3, 0, at.config2) - 1) * n4 + count_bits(4, 0, at.config1) - 1;
+		}
+		if (at.stage == 3) frac = (reactor1 * 65536.0 + reactor2) / 4294967296.0;
+		else if (at.stage == 4) frac = 0;
+		else frac = reactor1 / 65536.0;
+
+		r.exhausted = 1;
+		r.stage = at.stage;
+		r.level = x;
+		r.coverage = (done + frac) / total;
+		r.resume = "cnt/" + std::to_string(p) + "/" + std::to_string(at.stage) + "/" + std::to_string(x)
+			+ "/" + std::to_string(at.config1) + "/" + std::to_string(at.config2)
+			+ "/" + std::to_string(reactor1) + "/" + std::to_string(reactor2);
+	}
+
+	void say(const std::string & s)
+	{
+		progress pr;
+		pr.period = p;
+		pr.extrabits = x;
+		pr.steps = steps;
+		pr.text = s;
+		ctl.report(pr);
+	}
+
+	int nextconfig(int i, bool s = 0)
+	{
+		int target = s ? 3 : 4;
+		while (1)
+		{
+			i++;
+			i &= (1 << b+x) - 1;
+			if (k.popcount(i) == target) return i;
+		}
+	}
+
+	// Mode is the minimum number of zeroes or ones
+	// in the 16-bit reactor integer
+	int nextreactor(int i, int mode)
+	{
+		if (mode == 0) return 0xffff & (i+1);
+
+		int o;
+		while (1)
+		{
+			i++;
+			i &= 0xffff;
+			o = k.popcount(i);
+			if (o >= mode && 16-o >= mode) return i;
+		}
+	}
+
+	bool testloop(int mode, int config1, int config2, int mode1, int mode2)	// Returns 1 if succeeded
+	{
+		// Mode 0 - only one reactor working
+		// Mode 1 - both reactors work with the same value
+		// Mode 2 - Brute force
+		long int i;
+		int d;			// Simulated register
+		long int reactor1 = 0;
+		long int reactor2 = 0;
+		at.x = x;
+		at.config1 = config1;
+		at.config2 = config2;
+		if (skip)
+		{
+			if (at.order() < from.order()) return 0;
+			if (at.order() == from.order())
+			{
+				reactor1 = from.reactor1;
+				reactor2 = from.reactor2;
+			}
+			skip = 0;
+		}
+		say("//// Test Loop " + std::string((mode) ? "with   " : "without") + " secondary LUT;\t"
+			+ "Config1: " + bincout(config1, b+x) + "\t"
+			+ "Config2: " + bincout(config2, b+x)
+			+ "\tUseful b: " + std::to_string(b) + "; Extra b: " + std::to_string(x) + "\n");
+
+		while (reactor1 < nextreactor(reactor1, mode1))
+		{
+			if (ctl.cancelled())
+			{
+				r.cancelled = 1;
+				return 0;
+			}
+			if (m.tick(pending))
+			{
+				exhausted(reactor1, reactor2);
+				return 0;
+			}
+			steps++;
+			if (mode == 0 || mode == 1) reactor1 = nextreactor(reactor1, mode1);
+			if (mode == 1) reactor2 = reactor1;
+			if (mode == 2)
+			{
+				if (reactor2 > nextreactor(reactor2,mode2))
+					reactor1 = nextreactor(reactor1, mode1);
+				reactor2 = nextreactor(reactor2,mode2);
+			}
+			i = reactor1 + (reactor2 << 16);
+
+			d = 0;
+			results[0] = 0;
+			if (k.run_counter(i, config1, config2, b+x, max-1, &d, results.data(), 1, 2*p) < 0) continue;
+			if (!k.check_period(results.data(), p)) continue;
+			if (k.run_counter(i, config1, config2, b+x, max-1, &d, results.data(), 0, 2*p) < 0) continue;
+			if (!k.check_period(results.data(), p)) continue;
+
+			// At this point check had succeeded.
+			counter_result s = r;
+			s.found = 1;
+			s.x = x;
+			s.mode = mode;
+			s.reactor1 = reactor1;
+			s.reactor2 = reactor2;
+			s.config1 = config1;
+			s.config2 = config2;
+			d = 0;
+			s.output.assign(2*p+3, 0);
+			k.run_counter(i, config1, config2, b+x, max-1, &d, s.output.data(), 1, 2*p+3);
+			if (accept(s)) return 1;
+		}
+		return 0;
+	}
+
+	// Takes a solution, returns 1 if the search is over
+	bool accept(counter_result & s)
+	{
+		if (!cfg.all)
+		{
+			r = s;
+			return 1;
+		}
+		if (!sols.insert(counter_key(s))) return 0;
+		if (!r.found) r = s;
+		r.solutions++;
+		s.solutions = r.solutions;
+		if (ctl.on_counter) ctl.on_counter(s);
+		return cfg.max_solutions && r.solutions >= cfg.max_solutions;
+	}
+
+	// Chains replace the two LUT phases when allowed to be longer than
+	// two LUTs, and are all there is to search when taps are fixed.
+	bool chained() const
+	{
+		return cfg.luts > 2 || !cfg.taps.empty();
+	}
+	int chain_max() const
+	{
+		return std::max(std::max(cfg.luts, 2), int(cfg.taps.size()));
+	}
+
+	// Runs the chain from step "t" and register "s" until a LUT bit is read
+	// that nothing has decided yet; that bit is then tried both ways.
+	// So LUT functions are fixed bit by bit, in the order the counter needs
+	// them, and a branch dies as soon as a state comes back too early or the
+	// second period departs from the first one. Once the register has gone
+	// p+x steps, the whole register repeats and the counter is proven.
+	// Returns 1 if the search is over or the node cap is hit.
+	bool chain_run(int t, uint32_t s)
+	{
+		prof::scope ps(prof::chain_run);
+		uint32_t wm = (1u << b+x) - 1;
+		int t0 = t;
+		int marked = t;		// Last state marked in "seen" by this call
+		bool ret = 0;
+		while (1)
+		{
+			if (t == p+x)
+			{
+				ret = chain_found();
+				break;
+			}
+			int i, a = 0, lo = 0;
+			for (i=0; i<n; i++)
+			{
+				a = k.pext(s, tap[i]) | (i ? lo << 3 : 0);
+				if (!fn[i].known(a)) break;
+				lo = fn[i][a];
+			}
+			if (i < n)
+			{
+				// Inverting a LUT and swapping halves of the next one gives
+				// the same counter, so the first bit of all but the last LUT is 0.
+				int vals = (i < n-1 && fn[i].dontcare() == 0xffff) ? 1 : 2;
+				for (int v=0; v<vals && !ret; v++)
+				{
+					fn[i].set(a, v);
+					ret = chain_run(t, s);
+					fn[i].unset(a);
+				}
+				break;
+			}
+			if (ctl.cancelled())
+			{
+				r.cancelled = 1;
+				ret = 1;
+				break;
+			}
+			if (m.tick(pending))
+			{
+				exhausted(at.reactor1, 0);
+				ret = 1;
+				break;
+			}
+			if (cap && ++spent > cap)
+			{
+				capped = 1;
+				ret = 1;
+				break;
+			}
+			steps++;
+			s = ((s << 1) & wm) | lo;
+			int o = s & (max-1);
+			t++;
+			// Only 100..0 leads back to 0, so it comes last
+			if (t < p-1)
+			{
+				if (seen[o]) break;
+				seen[o] = 1;
+				marked = t;
+			}
+			else if (t == p-1)
+			{
+				if (o != max/2) break;
+			}
+			else if (o != hist[t-p]) break;
+			hist[t] = o;
+		}
+		for (int j=t0+1; j<=marked; j++) seen[hist[j]] = 0;
+		return ret;
+	}
+
+	bool chain_found()
+	{
+		counter_result s = r;
+		s.found = 1;
+		s.x = x;
+		s.mode = 3;
+		s.reactor1 = fn[0].data();
+		s.config1 = tap[0];
+		s.reactor2 = fn[1].data();
+		s.config2 = tap[1];
+		s.reactors.clear();
+		s.configs.clear();
+		for (int i=2; i<n; i++)
+		{
+			s.reactors.push_back(fn[i].data());
+			s.configs.push_back(tap[i]);
+		}
+		lut_chain c(s);
+		uint32_t d = 0;
+		s.output.assign(2*p+3, 0);
+		for (int j=1; j<2*p+3; j++)
+		{
+			d = c.step(d, (1u << b+x) - 1);
+			s.output[j] = d & (max-1);
+		}
+		return accept(s);
+	}
+
+	// Tries chains of "n" LUTs wired every possible way at the current level.
+	// lut1 takes four register bits, the rest take three and the previous LUT.
+	// Returns 1 if the search is over; "capped" tells if anything was left unfinished.
+	bool chains(int pass)
+	{
+		int w = b+x;
+		std::vector<std::vector<int>> sel(n);
+		for (int i=0; i<n; i++)
+		{
+			int f = i < cfg.taps.size() ? cfg.taps[i] : 0;
+			if (f)
+			{
+				if (f >> w) return 0;
+				sel[i].push_back(f);
+				continue;
+			}
+			for (int c=1; c<(1 << w); c++)
+			{
+				if (k.popcount(c) == (i ? 3 : 4)) sel[i].push_back(c);
+			}
+		}
+		tapsets = 1;
+		for (auto & i : sel) tapsets *= i.size();
+
+		long j = 0;
+		at.x = x;
+		at.config1 = n;
+		at.config2 = pass;
+		if (skip)
+		{
+			if (at.order() < from.order()) return 0;
+			if (at.order() == from.order()) j = from.reactor1;
+			skip = 0;
+		}
+		say("//// Chains of " + std::to_string(n) + " LUTs;\t" + std::to_string(long(tapsets)) + " ways to wire them"
+			+ (cap ? ", " + std::to_string(cap) + " steps each" : "")
+			+ "\tUseful b: " + std::to_string(b) + "; Extra b: " + std::to_string(x) + "\n");
+
+		bool left = 0;
+		tap.assign(n, 0);
+		seen.assign(max, 0);
+		hist.assign(p+x+1, 0);
+		seen[0] = 1;
+		seen[max/2] = 1;
+		for (; j<tapsets; j++)
+		{
+			long q = j;
+			int u = 0;
+			for (int i=n-1; i>=0; i--)
+			{
+				tap[i] = sel[i][q % sel[i].size()];
+				q /= sel[i].size();
+				u |= tap[i];
+			}
+			// Without the top bit, two states that differ only there have the
+			// same successor, which is too few states, or was tried a level below.
+			if (!(u >> w-1) && (x || p > max/2)) continue;
+			at.reactor1 = j;
+			fn.assign(n, lut());
+			spent = 0;
+			capped = 0;
+			if (chain_run(0, 0) && !capped) return 1;
+			left |= capped;
+		}
+		capped = left;
+		return 0;
+	}
+
+	// Chains go in passes with growing node caps per input selection,
+	// so that no single wiring holds up the rest. Enumerating all solutions
+	// takes a single pass without caps.
+	void chain_stage()
+	{
+		say("////>>> Chaining LUTs, filling in LUT data as the counter runs.\n");
+		at.stage = 4;
+		int lo = std::max(2, int(cfg.taps.size()));
+		int hi = chain_max();
+		std::vector<char> done((hi+1) * (sx+1));
+		for (int pass=0; ; pass++)
+		{
+			cap = cfg.all ? 0 : 4096L << 2*std::min(pass, 24);
+			bool left = 0;
+			for (n=lo; n<=hi; n++)
+			{
+				for (int i=0; i<=sx; i++)
+				{
+					if (done[n*(sx+1) + i]) continue;
+					x = i;
+					if (chains(pass)) return;
+					if (r.cancelled || r.exhausted) return;
+					if (capped) left = 1;
+					else done[n*(sx+1) + i] = 1;
+				}
+			}
+			if (!left) return;
+		}
+	}
+
+	// Local search, stage 5. Every thread anneals two LUT counters from
+	// random starts. A move flips a LUT bit or moves one LUT input to another
+	// register bit, and the energy (see cycle_probe) takes the cycle reached
+	// from reset towards a counter. Incomplete, and there is nothing to resume.
+	void anneal_stage()
+	{
+		say("////>>> Annealing two LUT counters, seed " + std::to_string(cfg.seed) + ".\n");
+		at.stage = 5;
+		int threads = cfg.threads;
+		if (threads < 1) threads = std::thread::hardware_concurrency();
+		if (threads < 1) threads = 1;
+		std::atomic<bool> over{0};
+		std::mutex l;			// Guards r, sols and progress
+		std::vector<std::thread> pool;
+		for (int t=0; t<threads; t++) pool.emplace_back([&, t]() { anneal(t, over, l); });
+		for (auto & t : pool) t.join();
+	}
+
+	void anneal(int t, std::atomic<bool> & over, std::mutex & l)
+	{
+		const long len = 1 << 18;	// Moves per restart
+		std::mt19937_64 g(cfg.seed * 0x9e3779b97f4a7c15ull + t);
+		std::uniform_real_distribution<double> u(0, 1);
+		cycle_probe pr(p, b, b+sx);
+		long pend = 0, mine = 0;
+		for (long i=0; !over; i++)
+		{
+			int w = b + (t+i) % (sx+1);
+			uint32_t top = 1u << w-1;
+			auto bit = [&]() { return 1u << g() % w; };
+			auto retap = [&](uint32_t c)
+			{
+				// Moves one input to a register bit it does not take yet
+				uint32_t o, n;
+				do o = bit(); while (!(c & o));
+				do n = bit(); while (c & n);
+				return c ^ o ^ n;
+			};
+			uint32_t data = g();
+			uint32_t c1 = top, c2 = 0;
+			while (k.popcount(c1) < std::min(4, w)) c1 |= bit();
+			while (k.popcount(c2) < std::min(3, w)) c2 |= bit();
+			int e = pr.energy(data, c1, c2, w);
+			int best = e;
+			// Starts hot enough to climb out of a short cycle and ends
+			// taking only improvements
+			double t0 = 1 + p/8.0, t1 = 0.05;
+			double temp = t0, cool = std::pow(t1/t0, 1.0/len);
+			for (long j=0; j<len && e && !over; j++, temp *= cool)
+			{
+				if (m.tick(pend) || ((pend & 1023) == 0 && ctl.cancelled())) break;
+				mine++;
+				uint32_t nd = data, n1 = c1, n2 = c2;
+				uint64_t mv = g() % 8;
+				// A LUT taking every register bit has nothing to retap
+				if ((mv == 6 && k.popcount(c1) == w) || (mv == 7 && k.popcount(c2) == w)) mv = 0;
+				if (mv < 6) nd ^= 1u << g() % 32;
+				else if (mv == 6) n1 = retap(c1);
+				else n2 = retap(c2);
+				if (!((n1 | n2) & top)) continue;	// The top bit would be of no use
+				int ne = pr.energy(nd, n1, n2, w);
+				if (ne > e && u(g) >= std::exp((e - ne) / temp)) continue;
+				data = nd, c1 = n1, c2 = n2, e = ne;
+				best = std::min(best, e);
+			}
+
+			std::lock_guard<std::mutex> lk(l);
+			if (over) break;
+			if (ctl.cancelled())
+			{
+				r.cancelled = 1;
+				over = 1;
+				break;
+			}
+			if (m.flush(pend))
+			{
+				r.exhausted = 1;
+				r.stage = 5;
+				r.level = sx;
+				r.coverage = 0;
+				r.resume.clear();
+				over = 1;
+				break;
+			}
+			if (e)
+			{
+				say("//// Annealing restart " + std::to_string(i) + " of thread " + std::to_string(t)
+					+ ", closest energy " + std::to_string(best)
+					+ "\tUseful b: " + std::to_string(b) + "; Extra b: " + std::to_string(w-b) + "\n");
+				continue;
+			}
+			// The same test as the other stages
+			int d = 0;
+			results[0] = 0;
+			if (k.run_counter(data, c1, c2, w, max-1, &d, results.data(), 1, 2*p) < 0) continue;
+			if (!k.check_period(results.data(), p)) continue;
+			if (k.run_counter(data, c1, c2, w, max-1, &d, results.data(), 0, 2*p) < 0) continue;
+			if (!k.check_period(results.data(), p)) continue;
+			counter_result s = r;
+			s.found = 1;
+			s.x = w-b;
+			s.mode = 2;
+			s.reactor1 = data & 0xffff;
+			s.reactor2 = data >> 16;
+			s.config1 = c1;
+			s.config2 = c2;
+			d = 0;
+			s.output.assign(2*p+3, 0);
+			k.run_counter(data, c1, c2, w, max-1, &d, s.output.data(), 1, 2*p+3);
+			if (accept(s)) over = 1;
+		}
+		std::lock_guard<std::mutex> lk(l);
+		steps += mine;
+	}
+
+	// Runs phases of two LUT searches
+	bool phase2(int mode, int mode1, int mode2)
+	{
+		int i;
+		int config1, config2;
+		for (i=0; i<=sx; i++)
+		{
+			x = i;
+			config1 = 1;
+			config2 = 1;
+			if (i > 0) config1 = 1 << b+i-1;
+
+			while (config2 < nextconfig(config2, 1))
+			{
+				config2 = nextconfig(config2, 1);
+				config1 = 1;
+				while (config1 < nextconfig(config1))
+				{
+					config1 = nextconfig(config1);
+					if (testloop(mode, config1, config2, mode1, mode2)) return 1;
+					if (r.cancelled || r.exhausted) return 0;
+				}
+			}
+		}
+		return 0;
+	}
+
+	void run()
+	{
+		int i;
+		int config1 = 0;
+		int config2 = 0;
+		if (!cfg.resume.empty())
+		{
+			if (skip) say("////>>> Resuming from " + cfg.resume + "\n");
+			else say("////>>> Ignoring resume position " + cfg.resume + ", it does not fit this search.\n");
+		}
+		if (cfg.anneal)
+		{
+			anneal_stage();
+			return;
+		}
+		if (!cfg.taps.empty())
+		{
+			chain_stage();
+			return;
+		}
+		at.stage = 0;
+		for (i=0; i<=sx; i++)
+		{
+			x = i;
+			config1 = 1 << (b+x-1);
+			while (config1 < nextconfig(config1))
+			{
+				config1 = nextconfig(config1);
+				if (testloop(0, config1, config2, 0, 0)) return;
+				if (r.cancelled || r.exhausted) return;
+			}
+		}
+
+		say("////>>> Single LUT solutions depleted. Adding Secondary LUT.\n");
+		if (chained())
+		{
+			// Chains of two cover both phases below, and much faster
+			chain_stage();
+			return;
+		}
+		say("////>>> Trying two LUTs with the same data.\n");
+		say("////>>> Assuming that each LUT contains exactly eight 1's.\n");
+		at.stage = 1;
+		if (phase2(1, 8, 8) || r.cancelled || r.exhausted) return;
+
+		say("////>>> Trying two LUTs with the same data.\n");
+		say("////>>> Broadening search to any LUT values.\n");
+		at.stage = 2;
+		if (phase2(1, 0, 0) || r.cancelled || r.exhausted) return;
+
+		say("////>>> Brute forcing all possible LUT data combinations.\n");
+		say("////>>> This will take a while, lol...\n");
+		at.stage = 3;
+		phase2(2, 0, 0);
+	}
+};
+
+}
+
+counter_result find_counter(const counter_config & cfg, const control & ctl)
+{
+	counter_search s(cfg, ctl);
+	s.run();
+	s.r.duplicates = s.sols.duplicates;
+	s.r.nodes = s.steps;
+	return s.r;
+}
+
+std::string counter_record(const counter_result & r)
+{
+	char h[16];
+	std::string s = "cnt p=" + std::to_string(r.period) + " b=" + std::to_string(r.b)
+		+ " x=" + std::to_string(r.x) + " mode=" + std::to_string(r.mode);
+	snprintf(h, sizeof(h), "%04x", r.reactor1);
+	s += " lut1=" + std::string(h);
+	snprintf(h, sizeof(h), "%04x", r.reactor2);
+	s += " lut2=" + std::string(h);
+	s += " cfg1=" + bincout(r.config1, r.b+r.x) + " cfg2=" + bincout(r.config2, r.b+r.x);
+	for (size_t i=0; i<r.reactors.size(); i++)
+	{
+		snprintf(h, sizeof(h), "%04x", r.reactors[i]);
+		s += " lut" + std::to_string(i+3) + "=" + std::string(h);
+		s += " cfg" + std::to_string(i+3) + "=" + bincout(r.configs[i], r.b+r.x);
+	}
+	return s;
+}
+
+std::string counter_key(const counter_result & r)
+{
+	// Replays one period and keeps only LUT bits that are ever read
+	int w = r.b + r.x;
+	int p = r.period;
+	uint32_t wm = (1u << w) - 1;
+	lut_chain c(r);
+	std::vector<int> used(c.data.size());
+	uint32_t d = 0;
+	for (int t=0; t<p; t++) d = c.step(d, wm);
+	for (int t=0; t<p; t++) d = c.step(d, wm, used.data());
+	int r1 = r.reactor1 & used[0];
+	int r2 = r.config2 ? r.reactor2 & used[1] : 0;
+	std::string s = std::to_string(w) + " " + std::to_string(r.config1) + " " + std::to_string(r.config2)
+		+ " " + std::to_string(r1) + " " + std::to_string(r2);
+	for (size_t i=2; i<c.data.size(); i++)
+	{
+		s += " " + std::to_string(c.config[i]) + " " + std::to_string(c.data[i] & used[i]);
+	}
+	return s;
+}
+
+std::string budget_report(const counter_result & r)
+{
+	char c[32];
+	snprintf(c, sizeof(c), "%.2f", 100*r.coverage);
+	if (r.stage == 5) return "//// Budget spent after " + std::to_string(r.nodes) + " nodes of annealing\n";
+	std::string s = "//// Budget spent after " + std::to_string(r.nodes) + " nodes, phase "
+		+ std::to_string(r.stage) + " at extrabits " + std::to_string(r.level) + " is " + c + "% covered\n";
+	s += "//// Continue with --resume " + r.resume + "\n";
+	return s;
+}
+
+std::string counter_module(const counter_result & r)
+{
+	int p = r.period;
+	int b = r.b;
+	int x = r.x;
+	lut_chain c(r);
+	int n = c.data.size();
+	std::vector<int> pc;
+	auto pcs = [&](int i)
+	{
+		if (pc.at(i) < b) return "out[" + std::to_string(pc[i]) + "]";
+		else return "msb[" + std::to_string(pc[i]-b) + "]";
+	};
+	std::ostringstream o;
+
+	o << "\n";
+	o << "module ctr_pr" << p << "(input wire clk, input wire inc, output reg [" << b-1 << ":0] out = 0);\n";
+
+	for (int i=0; i<n; i++) o << "localparam lut" << i+1 << "_data = 16'b" << bincout(c.data[i],16) << ";\n";
+
+	o << "wire lo1;";
+	for (int i=1; i<n; i++) o << " wire lo" << i+1 << ";";
+	o << "\n";
+	if (x) o << "reg [" << x-1 << ":0] msb = 0;\n";
+
+	pc = parseconfig(r.config1, b+x);
+	o << "SB_LUT4 lut1 (.O(lo1), .I0(" << pcs(0);
+	o << "), .I1(" << pcs(1) << "), .I2(";
+	o << pcs(2) << "), .I3(" << pcs(3) << "));\n";
+	o << "defparam lut1.LUT_INIT = lut1_data;\n";
+
+	for (int i=1; i<n; i++) {
+		pc = parseconfig(c.config[i], b+x);
+		o << "SB_LUT4 lut" << i+1 << " (.O(lo" << i+1 << "), .I0(" << pcs(0);
+		o << "), .I1(" << pcs(1) << "), .I2(" << pcs(2) << "), .I3(lo" << i << "));\n";
+		o << "defparam lut" << i+1 << ".LUT_INIT = lut" << i+1 << "_data;\n";
+	}
+
+	o << "always @ (posedge clk) begin\n";
+	o << "\tif (inc) begin\n";
+	if (x == 1)    o << "\t\tmsb <= out[" << b-1 << "];\n";
+	if (x >= 2)    o << "\t\tmsb <= {msb[" << x-2 << ":0], out[" << b-1 << "]};\n";
+	               o << "\t\tout[" << b-1 << ":1] <= out[" << b-2 << ":0];\n";
+	               o << "\t\tout[0] <= lo" << n << ";\n";
+	               o << "\tend\n";
+	               o << "end\n";
+	               o << "endmodule\n";
+	return o.str();
+}
+
+//
+// Divider search (prdiv, prdiv_alt)
+//
+
+namespace {
+
+class ttable {
+	// A fixed size, lock-free transposition table.
+	// Stores Zobrist hashes of partial LUT states known to be dead ends.
+	// Shared by all worker threads; a lost race only costs a re-search.
+
+	private:
+	mem::table<std::atomic<uint64_t>> t;
+	uint64_t mask = 0;
+
+	public:
+	std::atomic<long> probes{0};
+	std::atomic<long> hits{0};
+	std::atomic<long> stores{0};
+	long wanted = 0;		// Entries asked for
+
+	// Allocates the largest power of two number of entries within "mb" megabytes,
+	// or fewer if the memory limit says so. Below 64 kB it is not worth having.
+	ttable(long mb)
+	{
+		long n = 1;
+		while (n*2*sizeof(uint64_t) <= mb << 20) n *= 2;
+		if (mb <= 0) n = 0;
+		wanted = n;
+		while (n >= 8192 && !t.alloc(mem::ttable, n, 0)) n /= 2;
+		if (n < 8192) t.free();
+		mask = t.size()-1;
+	}
+	bool dead(uint64_t key)
+	{
+		if (t.size() == 0) return 0;
+		prof::scope ps(prof::ttable);
+		probes.fetch_add(1, std::memory_order_relaxed);
+		if (t[key & mask].load(std::memory_order_relaxed) != key) return 0;
+		hits.fetch_add(1, std::memory_order_relaxed);
+		return 1;
+	}
+	void store(uint64_t key)
+	{
+		if (t.size() == 0) return;
+		prof::scope ps(prof::ttable);
+		stores.fetch_add(1, std::memory_order_relaxed);
+		t[key & mask].store(key, std::memory_order_relaxed);	// Always replace
+	}
+	long size() const
+	{
+		return t.size();
+	}
+};
+
+class activity {
+	// Decaying conflict counters, as in the VSIDS heuristic of SAT solvers.
+	// Instead of decaying all counters after every conflict,
+	// each bump is worth a bit more than the previous one.
+
+	private:
+	std::vector<double> a;
+	double inc = 1;
+	double decay;
+
+	public:
+	activity(int n = 0, double decay = 0.95) : a(n), decay(decay) {}
+	void bump(int i)
+	{
+		a[i] += inc;
+	}
+	// Ages all counters, once per conflict
+	void age()
+	{
+		inc /= decay;
+		if (inc > 1e100)
+		{
+			for (auto & i : a) i *= 1e-100;
+			inc *= 1e-100;
+		}
+	}
+	double operator[](int i) const
+	{
+		return a[i];
+	}
+	// Indices, the most active first
+	std::vector<int> order() const
+	{
+		std::vector<int> ret(a.size());
+		for (int i=0; i<ret.size(); i++) ret[i] = i;
+		std::stable_sort(ret.begin(), ret.end(), [&](int l, int r) { return a[l] > a[r]; });
+		return ret;
+	}
+};
+
+class divider_search {
+	int p, b, sx;
+	int x = 0;		// Extra bits
+	int ps;			// A number of selectable states (without two fixed states)
+	int p2;
+	const divider_config & cfg;
+	const control & ctl;
+	const int * cs = nullptr;	// csmap of the current width
+	long steps = 0;
+
+	// Recursive engine
+	std::unique_ptr<ttable> tt;
+	std::atomic<bool> stop{0};		// Set when the search should stop
+	std::atomic<long> nsol{0};		// Solutions seen, including duplicates
+	std::mutex wm;				// Guards r and the best partial result
+
+	// Budget
+	meter m;
+	std::atomic<bool> spent{0};
+	std::atomic<int> best{0};		// Depth of the best partial result
+	std::vector<int> best_states;
+	std::vector<comb> best_configs;
+
+	// Resume position, "div/period/x/ltb/states/configs" (ordered)
+	// or "alt/period/x/configs/states" (recursive), where "states"
+	// is the internal state of the state list generator
+	bool skip = 0;
+	int from_x = 0;
+	int from_ltb = 0;
+	std::vector<int> from_st;
+	std::vector<int> from_cfg;
+
+	solution_set sols;
+
+	// Zobrist keys, regenerated for every extrabits level
+	std::vector<uint64_t> z_lut;		// [lut][lut bit][value]
+	std::vector<uint64_t> z_cfg;		// [lut][config]
+	std::vector<uint64_t> z_dep;		// [depth]
+	std::vector<uint64_t> z_last;		// [last state]
+	std::vector<uint64_t> z_used;		// [state already used]
+
+	public:
+	divider_result r;
+
+	divider_search(const divider_config & cfg, const control & ctl) : cfg(cfg), ctl(ctl), m(cfg.limit)
+	{
+		p = cfg.period;
+		sx = cfg.extrabits;
+		b = bitness(p);
+		ps = ((p+1)/2)-1;
+		p2 = (p+1)/2;
+		r.period = p;
+		r.b = b;
+		if (!cfg.resume.empty()) skip = parse(cfg.resume);
+	}
+
+	bool parse(const std::string & s)
+	{
+		auto f = split(s, '/');
+		long pp, x, ltb = 0;
+		bool rec = (cfg.engine == divider_engine::recursive);
+		if (cfg.engine == divider_engine::restarts) return 0;		// Nothing to resume
+		if (f.size() != (rec ? 5 : 6) || f[0] != (rec ? "alt" : "div")) return 0;
+		if (!parse_num(f[1], pp) || !parse_num(f[2], x) || pp != p || x < 0 || x > sx) return 0;
+		if (!rec && (!parse_num(f[3], ltb) || ltb < 0 || ltb >= b+x)) return 0;
+		from_x = x;
+		from_ltb = ltb;
+		return parse_list(f[rec ? 3 : 5], from_cfg) && from_cfg.size() == b+x
+			&& parse_list(f[4], from_st) && from_st.size() == ps;
+	}
+
+	std::string cfglist(const std::vector<comb> & configs)
+	{
+		std::vector<int> v;
+		for (auto & i : configs) v.push_back(i.intg());
+		return join(v);
+	}
+
+	// Fraction of config sets that come before "configs" in the order
+	// of mass_next, plus "within" the current one
+	double cfgposition(const std::vector<comb> & configs, double within)
+	{
+		int w = b+x;
+		double n = count_bits(4, -1, (1 << w) - 1);
+		double ret = within;
+		for (auto & i : configs) ret = (ret + count_bits(4, -1, i.intg() - 1)) / n;
+		return ret;
+	}
+
+	// Remembers the longest consistent state prefix
+	void partial(const std::vector<int> & states, const std::vector<comb> & configs, int d)
+	{
+		std::lock_guard<std::mutex> l(wm);
+		if (d <= best) return;
+		best = d;
+		best_states.assign(states.begin(), states.begin() + d+1);
+		best_configs = configs;
+	}
+
+	void say(const std::string & s)
+	{
+		progress pr;
+		pr.period = p;
+		pr.extrabits = x;
+		pr.steps = steps;
+		pr.text = s;
+		ctl.report(pr);
+	}
+
+	std::string configstr(const std::vector<comb> & configs)
+	{
+		std::string s;
+		int j;
+		for (j=0; j<b+x; j++)
+		{
+			s += "C" + std::to_string(j) + ":" + configs[j].str() + " ";
+		}
+		return s;
+	}
+
+	// "perm" optionally relabels the states below the MSB
+	void genstates(const vari & stv, std::vector<int> & states, const std::vector<int> * perm = nullptr)
+	{
+		states.clear();
+		states.push_back(0);
+		for (int j : stv.get()) states.push_back(perm ? (*perm)[j] : j);
+		states.push_back(1 << b+x-1);
+		for (int j : stv.get()) states.push_back((perm ? (*perm)[j] : j) + (1 << b+x-1));
+		if (p%2) states.pop_back();
+	}
+
+	// Records a solution.
+	// Returns 1 if the search should stop.
+	bool win(const std::vector<lut> & luts, const std::vector<comb> & configs, const std::vector<int> & states)
+	{
+		divider_result s;
+		s.found = 1;
+		s.period = p;
+		s.b = b;
+		s.x = x;
+		s.luts = luts;
+		s.configs = configs;
+		s.states = states;
+		nsol++;
+		std::lock_guard<std::mutex> l(wm);
+		if (!cfg.all)
+		{
+			if (!r.found) r = s;
+			return 1;
+		}
+		if (!sols.insert(divider_key(s))) return 0;
+		if (!r.found) r = s;
+		r.solutions++;
+		s.solutions = r.solutions;
+		if (ctl.on_divider) ctl.on_divider(s);
+		return cfg.max_solutions && r.solutions >= cfg.max_solutions;
+	}
+
+	// Return the state number in which emplacement failed,
+	// and the failing bit shifted by 16.
+	// Returns 0 if succeeded.
+	// Bits are checked in order "bo" if given. They don't affect each other,
+	// so of several bits failing at the same state, the first in "bo" is reported.
+	int fill_luts(std::vector<lut> & luts, std::vector<int> & states, std::vector<comb> & configs, const std::vector<int> * bo = nullptr)
+	{
+		prof::scope ps(prof::fill_luts);
+		int i, j, k;
+		for (i=0; i<b+x; i++) luts[i].clear();
+
+		for (j=1; j<(p2)+1; j++)		// For each state
+		{
+			for (k=0; k<b+x; k++)		// For each bit
+			{
+				i = bo ? (*bo)[k] : k;
+				int ma = (configs[i].intg() << b+x);
+				if (luts[i].set(cs[ma + states[j-1]], states[j] >> i & 1) == 0)
+					return j + (i << 16);
+				if ((j+p2) < states.size()) {
+					if (luts[i].set(cs[ma + states[j-1+p2]], states[j+p2] >> i & 1) == 0)
+						return j + (i << 16);
+				}
+				// Special case - machine state loop back
+				else if (luts[i].set(cs[ma + states[p-1]], states[0] >> i & 1) == 0)
+					return j + (i << 16);
+			}
+		}
+		return 0;
+	}
+
+	// Iterative engine, one extrabits level
+	void ordered()
+	{
+		std::vector<int> states;
+		int gws = 0;		// Greatest working state
+		int tb = 0;		// Troublesome bit
+		int ltb = 0;		// Last troublesome bit
+
+		std::vector<comb> configs(b+x, comb(4, b+x));
+		std::vector<lut> luts(b+x);
+
+		vari stv(1, (1 << b+x-1)-1, ps);
+		if (skip)
+		{
+			for (int i=0; i<b+x; i++) configs[i].set(from_cfg[i]);
+			ltb = from_ltb;
+			if (!stv.set_state(from_st)) say("Ignoring the state list of the resume position\n");
+			skip = 0;
+		}
+
+		// Conflict driven ordering, see divider_config::activity.
+		// Failures bump the failing bit, the failing state slot and the
+		// input selection of the failing bit. Bits are checked the most
+		// active first, so the troublesome bit is the hottest of those
+		// failing together. Each bit goes through its input selections
+		// in a fixed order, re-sorted by fewest conflicts at every rollover,
+		// so every selection is still tried once per round.
+		bool act = cfg.activity;
+		long conflicts = 0;
+		activity abit(b+x);
+		activity aslot(p2+1);
+		std::vector<activity> acfg;
+		std::vector<int> border;		// Bits, the most active first
+		std::vector<std::vector<int>> corder;	// Input selections of each bit, in trying order
+		std::vector<int> cpos;			// Position of the current one in corder
+		if (act)
+		{
+			int i;
+			std::vector<int> all;
+			comb c(4, b+x);
+			do all.push_back(c.intg()); while (c.next());
+			acfg.assign(b+x, activity(1 << b+x));
+			corder.assign(b+x, all);
+			for (i=0; i<b+x; i++)
+			{
+				border.push_back(i);
+				cpos.push_back(std::find(all.begin(), all.end(), configs[i].intg()) - all.begin());
+			}
+		}
+		// Advances the input selection of bit "i", returns zero if rolled over
+		auto nextcfg = [&](int i)
+		{
+			if (!act) return configs[i].next();
+			auto & o = corder[i];
+			if (++cpos[i] < o.size())
+			{
+				configs[i].set(o[cpos[i]]);
+				return true;
+			}
+			std::stable_sort(o.begin(), o.end(), [&](int l, int r) { return acfg[i][l] < acfg[i][r]; });
+			cpos[i] = 0;
+			configs[i].set(o[0]);
+			return false;
+		};
+		auto hot = [&](const activity & a, int n)
+		{
+			std::string s;
+			std::vector<int> o = a.order();
+			for (int i=0; i<n && i<o.size(); i++) s += " " + std::to_string(o[i]);
+			return s;
+		};
+		long pending = 0;
+		long sl = 0;		// State lists tried, the clock is read once per a batch of them
+		auto timer = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (1)		// State list
+		{
+			if (ctl.cancelled())
+			{
+				r.cancelled = 1;
+				return;
+			}
+			if (++sl % meter::batch == 0 && timer < std::chrono::steady_clock::now())
+			{
+				timer += std::chrono::seconds(10);
+				std::string s;
+				for (int j : states) s += std::to_string(j) + " ";
+				if (act) s += "\tHot bits:" + hot(abit, 3) + ", hot states:" + hot(aslot, 3);
+				say(s + "\t" + configstr(configs) + "\n");
+			}
+
+			genstates(stv, states);
+
+			while (1)	// Config rollover
+			{
+				if (m.tick(pending))
+				{
+					spent = 1;
+					r.coverage = stv.position();
+					r.resume = "div/" + std::to_string(p) + "/" + std::to_string(x) + "/" + std::to_string(ltb)
+						+ "/" + join(stv.state()) + "/" + cfglist(configs);
+					return;
+				}
+				steps++;
+				gws = 0;
+
+				int fl = fill_luts(luts, states, configs, act ? &border : nullptr);
+				if (fl % (1 << 16) > gws) gws = fl % (1 << 16);
+				if (fl && fl % (1 << 16) - 1 > best) partial(states, configs, fl % (1 << 16) - 1);
+
+				if (fl == 0)
+				{
+					if (win(luts, configs, states)) return;
+					gws = p2;		// Keep the states, try other inputs of LUT 0
+				}
+
+				tb = fl/(1 << 16);
+				if (act && fl)
+				{
+					abit.bump(tb);
+					aslot.bump(fl % (1 << 16));
+					acfg[tb].bump(configs[tb].intg());
+					abit.age();
+					aslot.age();
+					for (auto & a : acfg) a.age();
+					if (++conflicts % 16 == 0) border = abit.order();
+				}
+				if (!nextcfg(tb))
+				{
+					if (tb == ltb) break;
+					else ltb = tb;
+				}
+			}
+			if (stv.next(gws-1) == 0) break;
+		}
+	}
+
+	// Hash of the LUT input selection, constant for the whole search
+	uint64_t cfghash(const std::vector<comb> & configs)
+	{
+		uint64_t h = 0;
+		for (int i=0; i<configs.size(); i++) h ^= z_cfg[(i << b+x) + configs[i].intg()];
+		return h;
+	}
+
+	void genzobrist()
+	{
+		std::mt19937_64 g(0x1ce40);
+		int n = b+x;
+		int s = 1 << n;
+		auto fill = [&](std::vector<uint64_t> & v, int size)
+		{
+			v.resize(size);
+			for (auto & i : v) i = g();
+		};
+		fill(z_lut, n*16*2);
+		fill(z_cfg, n*s);
+		fill(z_dep, p+1);
+		fill(z_last, s);
+		fill(z_used, s);
+	}
+
+	// Hash of the LUT bits that can still cause a conflict at depth "d".
+	// Only addresses reachable from the last state and the unused states matter,
+	// so the rest is left out to let more transpositions meet.
+	uint64_t lutshash(const lut * luts, const std::vector<int> & states, const std::vector<comb> & configs, int d)
+	{
+		prof::scope ps(prof::lutshash);
+		int h = 1 << b+x-1;
+		mem::arena & a = mem::local();
+		mem::frame f(a);
+		char * used = a.alloc<char>(h);
+		std::fill(used, used+h, 0);
+		int i, j;
+		for (i=1; i<d; i++) used[states[i]] = 1;	// The last state leads on
+		if (d > 0) used[0] = 1;
+
+		uint64_t ret = 0;
+		for (i=0; i<b+x; i++)
+		{
+			int ma = (configs[i].intg() << b+x);
+			int mask = 0;
+			for (j=0; j<h; j++)
+			{
+				if (used[j]) continue;
+				mask |= 1 << cs[ma + j];
+				mask |= 1 << cs[ma + j + h];
+			}
+			for (j=0; j<16; j++)
+			{
+				if ((mask >> j & 1) && luts[i].known(j)) ret ^= z_lut[(i*16 + j)*2 + luts[i][j]];
+			}
+		}
+		return ret;
+	}
+
+	// Per-thread state of the recursive engine
+	struct walker {
+		long n = 0;			// Nodes not yet handed to the meter
+		bool path = 0;			// Descending along a resumed path
+		std::vector<int> at;		// State list generator where the walk stopped
+		long cap = 0;			// Nodes allowed before giving up, 0 - no limit
+		long used = 0;
+		bool cut = 0;			// Gave up because of "cap"
+		const std::vector<int> * perm = nullptr;	// State relabelling, see genstates
+	};
+
+	// Recursive lut filling function
+	// One iteration for one state progression.
+	// Returns 1 and leaves the solution in luts and states on success.
+	// "h" is the hash of states used so far,
+	// "hc" is the hash of configs.
+	// "stv" and "states" are shared by the whole recursion: a level only ever
+	// changes what lies past its own depth, and regenerates it before reading.
+	// LUTs are copied per level, on the arena of the thread.
+	bool fill_luts_r(const lut * parent, vari & stv, std::vector<int> & states, const std::vector<comb> & configs, int d, uint64_t h, uint64_t hc, std::vector<lut> & rl, std::vector<int> & rs, walker & wk)
+	{
+		// One iteration of the function does the following:
+		// 1  - Checks the validity of the current state progression (if depth > 0)
+		// 2  -- If valid, goto 4
+		// 3  -- If not, returns failure
+		// 4  - If this partial state is known to be dead, returns failure
+		// 5  - launch the next iteration
+		// 6  -- If succeeded, return success yourself
+		// 7  - Prepare the next state on its own depth
+		// 8  - if the state rolled over, remember the dead state and return failure
+
+		prof::scope ps(prof::fill_luts_r);
+		mem::arena & a = mem::local();
+		mem::frame f(a);
+		lut * luts = a.alloc<lut>(b+x);
+		std::copy(parent, parent+b+x, luts);
+		if (m.tick(wk.n))
+		{
+			spent = 1;
+			stop = 1;
+			wk.at = stv.state();
+			return 0;
+		}
+		if (wk.cap && ++wk.used > wk.cap)
+		{
+			wk.cut = 1;
+			return 0;
+		}
+		bool onpath = wk.path;		// Parts of this subtree were searched by an earlier run
+
+		// #1
+		if (d > 0)
+		{
+			int i;
+			for (i=0; i<b+x; i++)		// For each bit
+			{
+				int ma = (configs[i].intg() << b+x);
+				if (!luts[i].set(cs[ma + states[d-1]], states[d] >> i & 1))
+					return 0;
+				if ((d+p2) < states.size()) {
+					if (!luts[i].set(cs[ma + states[d-1+p2]], states[d+p2] >> i & 1))
+						return 0;
+				}
+				// Special case - machine state loop back
+				else if (!luts[i].set(cs[ma + states[p-1]], states[0] >> i & 1))
+					return 0;
+			}
+			// At this point the check was successful
+			if (d >= p2)
+			{
+				if (!cfg.all)
+				{
+					rl.assign(luts, luts+b+x);
+					rs = states;
+					return 1;
+				}
+				if (win(std::vector<lut>(luts, luts+b+x), configs, states)) stop = 1;
+				return 0;
+			}
+			if (d > best) partial(states, configs, d);
+		}
+
+		// #4
+		uint64_t key = h ^ hc ^ z_dep[d] ^ z_last[states[d]] ^ lutshash(luts, states, configs, d);
+		if (tt->dead(key)) return 0;
+		long ns0 = nsol;		// Subtrees holding solutions are not dead
+
+		while (1)
+		{
+			if (wk.cut) return 0;
+			if (stop || ctl.cancelled())
+			{
+				if (wk.at.empty()) wk.at = stv.state();		// The next subtree to search
+				return 0;
+			}
+
+			// #5
+			int ns = (d+1 < states.size()) ? states[d+1] : 0;
+			if (fill_luts_r(luts, stv, states, configs, d+1, h ^ z_used[ns], hc, rl, rs, wk)) return 1;
+			wk.path = 0;
+
+			// #7
+			bool ro = (stv.next_at(d) == 0);
+			genstates(stv, states, wk.perm);
+
+			// #8
+			if (ro)
+			{
+				if (nsol == ns0 && !stop && !wk.cut && !onpath) tt->store(key);	// Only fully searched subtrees
+				return 0;
+			}
+		}
+	}
+
+	// Recursive engine, one extrabits level
+	void recursive()
+	{
+		int threads = cfg.threads;
+		if (threads < 1) threads = std::thread::hardware_concurrency();
+		if (threads < 1) threads = 1;
+		genzobrist();
+
+		std::vector<comb> configs(b+x, comb(4, b+x));
+		bool cro = 1;
+		std::mutex cm;			// Guards configs, cro and open
+		long seq = 0;
+		struct task {
+			std::vector<comb> configs;
+			std::vector<int> at;	// Where to continue
+		};
+		std::map<long, task> open;	// Config sets being searched, in order
+		std::vector<int> start;		// Resumed position in the first config set
+		if (skip)
+		{
+			for (int i=0; i<b+x; i++) configs[i].set(from_cfg[i]);
+			start = from_st;
+			skip = 0;
+		}
+
+		auto worker = [&]()
+		{
+			walker wk;
+			while (1)	// Config change
+			{
+				std::vector<comb> c;
+				long id;
+				{
+					std::lock_guard<std::mutex> l(cm);
+					if (cro == 0 || stop) break;
+					if (ctl.cancelled())
+					{
+						r.cancelled = 1;
+						break;
+					}
+					say(configstr(configs) + "\n");
+					steps++;
+					c = configs;
+					id = seq++;
+					open[id].configs = c;
+					cro = mass_next(configs);
+				}
+				vari stv(1, (1 << b+x-1)-1, ps);
+				wk.path = (id == 0 && !start.empty());
+				if (wk.path && !stv.set_state(start)) say("Ignoring the state list of the resume position\n");
+				wk.at.clear();
+				std::vector<int> states;
+				genstates(stv, states);
+
+				std::vector<lut> luts(b+x);
+				std::vector<lut> rl;
+				std::vector<int> rs;
+				bool ok = fill_luts_r(luts.data(), stv, states, c, 0, 0, cfghash(c), rl, rs, wk);
+				{
+					std::lock_guard<std::mutex> l(cm);
+					if (ok || !spent) open.erase(id);
+					else open[id].at = wk.at;
+				}
+				if (!ok) continue;
+
+				if (win(rl, c, rs)) stop = 1;
+				break;
+			}
+			m.flush(wk.n);
+		};
+		std::vector<std::thread> pool;
+		for (int t=0; t<threads; t++) pool.emplace_back(worker);
+		for (auto & t : pool) t.join();
+
+		if (spent)
+		{
+			// Resume from the first config set that was not finished
+			vari stv(1, (1 << b+x-1)-1, ps);
+			if (!open.empty())
+			{
+				configs = open.begin()->second.configs;
+				stv.set_state(open.begin()->second.at);
+			}
+			else if (!cro) return;		// The level was finished after all
+			r.coverage = cfgposition(configs, stv.position());
+			r.resume = "alt/" + std::to_string(p) + "/" + std::to_string(x) + "/" + cfglist(configs)
+				+ "/" + join(stv.state());
+		}
+	}
+
+	// The Luby sequence 1 1 2 1 1 2 4 1 1 2 1 1 2 4 8..., "i" counts from 1
+	static long luby(long i)
+	{
+		int k = 1;
+		while ((1L << k) - 1 < i) k++;
+		if ((1L << k) - 1 == i) return 1L << k-1;
+		return luby(i - (1L << k-1) + 1);
+	}
+
+	// Restarts engine, one extrabits level.
+	// Each try searches one random config set, with the states relabelled
+	// at random, and gives up after a number of nodes following the Luby
+	// sequence. Dead ends found by all tries meet in the shared TT.
+	void randomized()
+	{
+		const long base = 1000;		// Nodes per unit of the Luby sequence
+		int threads = cfg.threads;
+		if (threads < 1) threads = std::thread::hardware_concurrency();
+		if (threads < 1) threads = 1;
+		genzobrist();
+		int w = b+x;
+		int h = 1 << w-1;
+		std::atomic<long> tries{0};
+		say("Random restarts, seed " + std::to_string(cfg.seed) + "\n");
+
+		auto worker = [&](int t)
+		{
+			std::mt19937_64 g(cfg.seed * 0x9e3779b97f4a7c15ull + t*(sx+1) + x);
+			walker wk;
+			std::vector<int> bits(w);
+			std::vector<int> perm(h);
+			long i;
+			while ((i = ++tries) <= cfg.restarts)
+			{
+				if (stop) break;
+				if (ctl.cancelled())
+				{
+					std::lock_guard<std::mutex> l(wm);
+					r.cancelled = 1;
+					break;
+				}
+				std::vector<comb> c(w, comb(4, w));
+				for (auto & j : c)
+				{
+					for (int k=0; k<w; k++) bits[k] = k;
+					std::shuffle(bits.begin(), bits.end(), g);
+					j.set((1 << bits[0]) | (1 << bits[1]) | (1 << bits[2]) | (1 << bits[3]));
+				}
+				for (int k=0; k<h; k++) perm[k] = k;
+				std::shuffle(perm.begin()+1, perm.end(), g);
+				wk.perm = &perm;
+				wk.cap = luby(i) * base;
+				wk.used = 0;
+				wk.cut = 0;
+
+				vari stv(1, h-1, ps);
+				std::vector<int> states;
+				genstates(stv, states, &perm);
+				std::vector<lut> luts(w);
+				std::vector<lut> rl;
+				std::vector<int> rs;
+				if (!fill_luts_r(luts.data(), stv, states, c, 0, 0, cfghash(c), rl, rs, wk)) continue;
+
+				if (win(rl, c, rs)) stop = 1;
+				break;
+			}
+			m.flush(wk.n);
+		};
+		std::vector<std::thread> pool;
+		for (int t=0; t<threads; t++) pool.emplace_back(worker, t);
+		for (auto & t : pool) t.join();
+	}
+
+	void run()
+	{
+		bool rec = (cfg.engine == divider_engine::recursive);
+		bool dfs = (cfg.engine != divider_engine::ordered);
+		if (dfs)
+		{
+			tt.reset(new ttable(cfg.tt_mb));
+			if (tt->size() < tt->wanted)
+			{
+				say("Transposition table cut to " + std::to_string(tt->size() * sizeof(uint64_t) >> 20)
+					+ " MB by the memory limit\n");
+			}
+		}
+		if (!cfg.resume.empty())
+		{
+			if (skip) say("Resuming from " + cfg.resume + "\n");
+			else say("Ignoring resume position " + cfg.resume + ", it does not fit this search.\n");
+		}
+
+		int i;
+		for (i = skip ? from_x : 0; i<=sx; i++)
+		{
+			x = i;
+			auto map = csmap(b+x);
+			cs = map->data();
+			if (rec) recursive();
+			else if (dfs) randomized();
+			else ordered();
+			if (r.found || r.cancelled || spent) break;
+			if (ctl.on_level) ctl.on_level(x);
+		}
+		r.level = x;
+		r.nodes = dfs ? m.nodes() : steps;
+		if (spent && !(r.found && !cfg.all))
+		{
+			r.exhausted = 1;
+			if (rec && r.resume.empty())		// The level was finished just as the budget ran out
+			{
+				if (x < sx)
+				{
+					r.level = x+1;
+					r.resume = "alt/" + std::to_string(p) + "/" + std::to_string(x+1) + "/"
+						+ cfglist(std::vector<comb>(b+x+1, comb(4, b+x+1))) + "/" + join(std::vector<int>(ps));
+				}
+				else r.exhausted = 0;
+			}
+		}
+		r.depth = best;
+		r.prefix = best_states;
+		r.prefix_configs = best_configs;
+		r.duplicates = sols.duplicates;
+		if (tt)
+		{
+			r.tt_entries = tt->size();
+			r.tt_probes = tt->probes;
+			r.tt_hits = tt->hits;
+			r.tt_stores = tt->stores;
+		}
+	}
+};
+
+}
+
+divider_result find_divider(const divider_config & cfg, const control & ctl)
+{
+	divider_search s(cfg, ctl);
+	s.run();
+	return s.r;
+}
+
+std::string divider_record(const divider_result & r)
+{
+	std::string s = "div p=" + std::to_string(r.period) + " b=" + std::to_string(r.b)
+		+ " x=" + std::to_string(r.x) + " luts=";
+	int j;
+	for (j=0; j<r.luts.size(); j++) s += (j ? "," : "") + r.luts[j].str();
+	s += " cfg=";
+	for (j=0; j<r.configs.size(); j++) s += (j ? "," : "") + r.configs[j].str();
+	s += " states=";
+	for (j=0; j<r.states.size(); j++) s += (j ? "," : "") + std::to_string(r.states[j]);
+	return s;
+}
+
+std::string divider_key(const divider_result & r)
+{
+	// Each bit below the MSB is described by its column: its values
+	// along the state sequence. Sorting the columns undoes any
+	// permutation of those bits. Bits with equal columns share a label.
+	int w = r.b + r.x;
+	int i;
+	std::vector<std::string> col(w);
+	for (i=0; i<w; i++)
+	{
+		for (int s : r.states) col[i] += char('0' + (s >> i & 1));
+	}
+	std::vector<std::string> sorted(col.begin(), col.end()-1);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<int> label(w, w-1);
+	for (i=0; i<w-1; i++) label[i] = std::lower_bound(sorted.begin(), sorted.end(), col[i]) - sorted.begin();
+
+	std::vector<std::string> ent(w);
+	for (i=0; i<w; i++)
+	{
+		std::vector<int> in;
+		for (int c : r.configs[i].vec()) in.push_back(label[c]);
+		std::sort(in.begin(), in.end());
+		ent[i] = col[i] + ":";
+		for (int c : in) ent[i] += std::to_string(c) + ",";
+	}
+	std::sort(ent.begin(), ent.end()-1);
+	std::string key;
+	for (auto & e : ent) key += e + " ";
+	return key;
+}
+
+std::string budget_report(const divider_result & r)
+{
+	char c[32];
+	snprintf(c, sizeof(c), "%.2f", 100*r.coverage);
+	std::string s = "//// Budget spent after " + std::to_string(r.nodes) + " nodes, extrabits "
+		+ std::to_string(r.level) + " is " + c + "% covered\n";
+	if (!r.prefix.empty())
+	{
+		s += "//// Deepest consistent prefix: " + std::to_string(r.depth) + " of "
+			+ std::to_string((r.period+1)/2) + " steps, states";
+		for (int i : r.prefix) s += " " + std::to_string(i);
+		s += ", configs";
+		for (auto & i : r.prefix_configs) s += " " + i.str();
+		s += "\n";
+	}
+	if (!r.resume.empty()) s += "//// Continue with --resume " + r.resume + "\n";
+	return s;
+}
+
+std::string divider_module(const divider_result & r)
+{
+	std::ostringstream o;
+	int j;
+
+	o << "\n";
+	o << "// Auto generated divider / pseudo-random counter.\n";
+	o << "// States:";
+	for (auto i : r.states) o << " " << i;
+	o << "\n";
+	o << "module div_pr" << r.period << "(input wire clk, input wire rst, output reg [" << r.b+r.x-1 << ":0] out);\n";
+
+	j = 0;
+	for (auto & i : r.luts)
+	{
+		o << "localparam lut" << j << "_data = 16'b" << i.str() << ";\n";
+		j++;
+	}
+
+	o << "wire [" << r.luts.size()-1 << ":0] lo;\n";
+
+	std::vector<int> pcs;
+	for (j=0;j<r.luts.size();j++)
+	{
+		pcs = r.configs[j].vec();
+		o << "SB_LUT4 lut" << j << " (.O(lo[" << j << "]), ";
+		o << ".I0(out[" << pcs.at(0) << "]), ";
+		o << ".I1(out[" << pcs.at(1) << "]), ";
+		o << ".I2(out[" << pcs.at(2) << "]), ";
+		o << ".I3(out[" << pcs.at(3) << "]));\n";
+		o << "defparam lut" << j << ".LUT_INIT = lut" << j << "_data;\n";
+	}
+
+	o << "always @ (posedge clk) begin\n";
+	o << "\tif (rst) out <= 0;\n";
+	o << "\telse out <= lo;\n";
+	o << "end\n";
+	o << "endmodule\n";
+	return o.str();
+}
+
+//
+// Strategy portfolio
+//
+
+std::vector<strategy> default_strategies()
+{
+	return {
+		{"ordered", divider_engine::ordered, 0},
+		{"recursive", divider_engine::recursive, 0},
+		{"restarts1", divider_engine::restarts, 1},
+		{"restarts2", divider_engine::restarts, 2},
+	};
+}
+
+bool portfolio_stats::load(const std::string & file)
+{
+	std::ifstream f(file);
+	if (!f) return 0;
+	std::lock_guard<std::mutex> l(m);
+	std::string line;
+	while (std::getline(f, line))
+	{
+		if (line.empty() || line[0] == '#') continue;
+		std::istringstream in(line);
+		int p;
+		std::string n;
+		entry e;
+		if (in >> p >> n >> e.wins >> e.seconds) t[p][n] = e;
+	}
+	return 1;
+}
+
+bool portfolio_stats::save(const std::string & file)
+{
+	std::ofstream f(file);
+	if (!f) return 0;
+	std::lock_guard<std::mutex> l(m);
+	f << "# period strategy wins seconds\n";
+	for (auto & i : t)
+	{
+		for (auto & j : i.second) f << i.first << " " << j.first << " " << j.second.wins << " " << j.second.seconds << "\n";
+	}
+	return bool(f);
+}
+
+void portfolio_stats::record(int period, const std::string & name, double seconds)
+{
+	std::lock_guard<std::mutex> l(m);
+	entry & e = t[period][name];
+	e.wins++;
+	e.seconds += seconds;
+}
+
+// Past wins plus one, so that strategies without any still run.
+// The caller holds the lock.
+double portfolio_stats::weight(int period, const std::string & name)
+{
+	long wins = 0;
+	auto i = t.find(period);
+	if (i != t.end())
+	{
+		auto j = i->second.find(name);
+		if (j != i->second.end()) wins = j->second.wins;
+	}
+	else
+	{
+		for (auto & k : t)
+		{
+			if (bitness(k.first) != bitness(period)) continue;
+			auto j = k.second.find(name);
+			if (j != k.second.end()) wins += j->second.wins;
+		}
+	}
+	return wins + 1;
+}
+
+std::vector<int> portfolio_stats::allocate(int period, const std::vector<strategy> & s, int threads)
+{
+	std::lock_guard<std::mutex> l(m);
+	int n = s.size();
+	int i;
+	std::vector<double> w(n);
+	std::vector<int> ret(n);
+	for (i=0; i<n; i++) w[i] = weight(period, s[i].name);
+
+	// One thread each, even if that is more than asked for,
+	// so that no strategy is starved by a lucky streak of another
+	for (i=0; i<n; i++) ret[i] = 1;
+	threads -= n;
+
+	// The rest in proportion to the weights, one by one
+	// to the strategy with the highest weight per thread held
+	for (; threads > 0; threads--)
+	{
+		int best = -1;
+		for (i=0; i<n; i++)
+		{
+			if (s[i].engine == divider_engine::ordered) continue;		// Single threaded
+			if (best < 0 || w[i] / (ret[i]+1) > w[best] / (ret[best]+1)) best = i;
+		}
+		if (best < 0) break;
+		ret[best]++;
+	}
+	return ret;
+}
+
+portfolio_result find_divider_portfolio(const portfolio_config & cfg, portfolio_stats * stats, const control & ctl)
+{
+	portfolio_result pr;
+	int n = cfg.strategies.size();
+	int threads = cfg.threads;
+	if (threads < 1) threads = std::thread::hardware_concurrency();
+	if (threads < 1) threads = 1;
+	portfolio_stats none;
+	pr.threads = (stats ? stats : &none)->allocate(cfg.period, cfg.strategies, threads);
+	pr.nodes.assign(n, 0);
+	pr.r.period = cfg.period;
+	pr.r.b = bitness(cfg.period);
+
+	cancel_token stop;
+	stop.parent = ctl.cancel;
+	std::mutex m;				// Guards pr and the rest below
+	bool settled = 0;			// Found, or proven that there is nothing to find
+	int cleared = 0;			// Levels below this have no solution
+	divider_result held;			// Narrowest solution found above "cleared"
+	int held_by = -1;
+	double held_at = 0;
+	auto t0 = std::chrono::steady_clock::now();
+
+	// Needs "m"
+	auto settle = [&](int i, const divider_result & r, double seconds)
+	{
+		settled = 1;
+		pr.winner = i;
+		pr.r = r;
+		pr.seconds = seconds;
+		stop.cancel();
+	};
+
+	auto run = [&](int i)
+	{
+		const strategy & s = cfg.strategies[i];
+		divider_config dc;
+		dc.period = cfg.period;
+		dc.extrabits = cfg.extrabits;
+		dc.engine = s.engine;
+		dc.threads = pr.threads[i];
+		dc.tt_mb = cfg.tt_mb;
+		dc.seed = s.seed;
+		dc.limit = cfg.limit;
+		control c;
+		c.cancel = &stop;
+		if (s.engine == divider_engine::recursive)
+		{
+			c.on_level = [&](int x)
+			{
+				std::lock_guard<std::mutex> l(m);
+				cleared = std::max(cleared, x+1);
+				if (!settled && held_by >= 0 && held.x <= cleared) settle(held_by, held, held_at);
+			};
+		}
+		divider_result r = find_divider(dc, c);
+
+		std::lock_guard<std::mutex> l(m);
+		pr.nodes[i] = r.nodes;
+		if (settled) return;
+		if (r.found)
+		{
+			// Restarts give up on a level and move on, so they may come
+			// up with a solution wider than needed
+			double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			if (r.x <= cleared) settle(i, r, t);
+			else if (held_by < 0 || r.x < held.x)
+			{
+				held = r;
+				held_by = i;
+				held_at = t;
+			}
+		}
+		else if (s.engine == divider_engine::recursive && !r.cancelled && !r.exhausted)
+		{
+			// The complete engine went through everything. The ordered
+			// one drops state lists on the way, so its "none" proves nothing.
+			if (held_by >= 0) settle(held_by, held, held_at);
+			else
+			{
+				settled = 1;
+				pr.r = r;
+				stop.cancel();
+			}
+		}
+		else if (r.depth > pr.r.depth || pr.r.prefix.empty()) pr.r = r;	// Keep the best partial result
+	};
+	std::vector<std::thread> pool;
+	int i;
+	for (i=0; i<n; i++)
+	{
+		if (pr.threads[i] > 0) pool.emplace_back(run, i);
+	}
+	for (auto & t : pool) t.join();
+
+	if (!settled && held_by >= 0) settle(held_by, held, held_at);
+	if (pr.winner < 0)
+	{
+		pr.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		pr.r.cancelled = ctl.cancelled();
+	}
+	else if (stats) stats->record(cfg.period, cfg.strategies[pr.winner].name, pr.seconds);
+	return pr;
+}
+
+}
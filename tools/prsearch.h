@@ -0,0 +1,469 @@
+// Pseudo random counter and divider search library
+// by Tomek Szczęsny 2024
+//
+// The engines behind prcnt, prdiv and prdiv_alt.
+// Each search takes a config struct and returns a result object.
+// There is no global state, so any number of searches may run
+// concurrently in one process. Precomputed tables are shared
+// between searches of the same width.
+//
+
+#ifndef PRSEARCH_H
+#define PRSEARCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "prmem.h"
+
+namespace prs {
+
+// Returns "w" least significant bits of "in" as a binary string
+std::string bincout(int in, int w = 32);
+
+// Returns a list of bits set in "config", out of "w" bits
+std::vector<int> parseconfig(int config, int w);
+
+class lut {
+	// A class representing a 4-bit LUT
+	// It supports "don't care" states to some extent
+
+	private:
+		static const int max = (1 << 16) - 1;
+		int lut_d = 0;
+		int lut_x = max;
+
+	public:
+	// reading
+	bool operator[](int i) const
+	{
+		return ((lut_d >> i) & 1);
+	}
+	// writing
+	// Returns zero when trying to overwrite an opposite value
+	bool set(int i, bool val)
+	{
+		int p = 1 << i;
+		if (bool(lut_d & p) != val)
+		{
+			if (!(lut_x & p)) return 0;
+			if (val) lut_d |= p;
+		}
+		lut_x &= ~p;
+		return 1;
+	}
+	void unset(int i)
+	{
+		int p = 1 << i;
+		lut_d &= ~p;
+		lut_x |= p;
+	}
+	void clear()
+	{
+		lut_d = 0;
+		lut_x = max;
+	}
+	// Returns 1 if the bit is no longer "don't care"
+	bool known(int i) const
+	{
+		return !((lut_x >> i) & 1);
+	}
+	int data() const
+	{
+		return lut_d;
+	}
+	int dontcare() const
+	{
+		return lut_x;
+	}
+	std::string str() const;
+	// Evaluates the LUT output for a given set of inputs,
+	// represented by a binary number 0000 - 1111.
+	bool eval(int d) const
+	{
+		return ((lut_d >> d) & 1);
+	}
+};
+
+class comb {
+	// A class representing a combination "k of n"
+	// without repetitions
+	// Used for selecting LUT inputs
+	// It can also return "k of n" bits from an integer.
+	// Starts at the first valid combination.
+
+	private:
+		int c = 0;
+		int k = 0;
+		int n = 0;
+
+	public:
+	comb(int k, int n);
+	// Set the next combination
+	// Returns zero if rolled over.
+	bool next();
+	// Set an internal state
+	// If the state is invalid, it tries to reach the next valid one.
+	// Returns zero if rolled over in the process.
+	bool set(int i);
+	// Checks if its internal state is valid.
+	bool check() const;
+	// Composes a new int from selected bits of the in.
+	int map(int in) const;
+	// get current state as a string
+	std::string str() const;
+	// get current state as a vector of numbers
+	std::vector<int> vec() const;
+	int intg() const
+	{
+		return c;
+	}
+};
+
+// Advances a set of combinations like digits of a number.
+// Returns zero if all of them rolled over.
+bool mass_next(std::vector<comb> & c);
+
+class vari {
+	// Helps generating variants without repetitions
+	// Operates on a range of numbers from l to h.
+	// selects k of n items, where n = (h-l+1);
+
+	private:
+	int k; int n;
+	std::vector<int> s;		// internal state
+	std::vector<int> range;
+	std::vector<int> result;
+	std::vector<int> left;		// Scratch of update()
+
+	bool next_state(int num);
+	void update();
+
+	public:
+	vari(int l, int h, int k);
+	// Generates the next variance
+	// Returns zero if rolled back to the first one.
+	bool next(int num = 1000);
+	// Generates the next variance, changing only the item "num"
+	// and resetting all items after it.
+	// Returns zero if item "num" rolled over (no carry to lower items).
+	bool next_at(int num);
+	// Returns a current result vector
+	const std::vector<int> & get() const
+	{
+		return result;
+	}
+	// Returns a number of cases to go through
+	long int cases() const;
+	// Internal state, for saving a position
+	const std::vector<int> & state() const
+	{
+		return s;
+	}
+	// Restores a saved state. Returns zero if it is invalid.
+	bool set_state(const std::vector<int> & st);
+	// Fraction of cases that come before the current one
+	double position() const;
+};
+
+// Config-state map: csmap[(config << w) + state] is the LUT address
+// seen by a LUT wired to "config" when the register holds "state".
+// Tables are built once per width and shared by all searches.
+// Tables no search holds are dropped when memory runs short.
+std::shared_ptr<const mem::table<int>> csmap(int w);
+
+class cancel_token {
+	// Lets another thread stop a running search.
+	// Searches poll it cooperatively and return with "cancelled" set.
+
+	private:
+	std::atomic<bool> f{0};
+
+	public:
+	const cancel_token * parent = nullptr;	// Cancelling the parent cancels this one too
+
+	void cancel()
+	{
+		f.store(1, std::memory_order_relaxed);
+	}
+	bool cancelled() const
+	{
+		return f.load(std::memory_order_relaxed) || (parent && parent->cancelled());
+	}
+	void reset()
+	{
+		f.store(0, std::memory_order_relaxed);
+	}
+};
+
+struct progress {
+	int period = 0;
+	int extrabits = 0;	// Extra bits level being searched
+	long steps = 0;		// Candidates tried so far
+	std::string text;	// Human readable note, one line
+};
+
+typedef std::function<void(const progress &)> progress_fn;
+
+// Limits of a single search, zero means no limit.
+// They are checked once per a batch of nodes, so a search may overrun
+// a node limit by up to a batch per thread.
+struct budget {
+	double seconds = 0;
+	long nodes = 0;
+};
+
+struct counter_result;
+struct divider_result;
+
+// Optional hooks for a running search
+struct control {
+	const cancel_token * cancel = nullptr;
+	progress_fn on_progress;
+	// Called for every distinct solution in enumerate-all mode,
+	// possibly from several threads at once.
+	std::function<void(const counter_result &)> on_counter;
+	std::function<void(const divider_result &)> on_divider;
+	// Called when a divider search leaves an extrabits level without a
+	// solution. Only the recursive engine makes that a proof of none.
+	std::function<void(int level)> on_level;
+
+	bool cancelled() const
+	{
+		return cancel && cancel->cancelled();
+	}
+	void report(const progress & pr) const
+	{
+		if (on_progress) on_progress(pr);
+	}
+};
+
+// Bitness of a counter with period "p"
+int bitness(int p);
+
+class line_writer {
+	// Collects output lines and writes them in large blocks
+	// instead of flushing every line. Safe to use from several threads.
+
+	private:
+	std::mutex m;
+	std::string buf;
+	FILE * f;
+	size_t limit;
+
+	public:
+	line_writer(FILE * f = stdout, size_t limit = 1 << 16) : f(f), limit(limit) {}
+	~line_writer()
+	{
+		flush();
+	}
+	void write(const std::string & line);
+	void flush();
+};
+
+class solution_set {
+	// Remembers canonical keys of solutions seen so far,
+	// so that solutions differing only by symmetry are reported once.
+
+	private:
+	std::mutex m;
+	std::unordered_set<uint64_t> seen;
+
+	public:
+	long duplicates = 0;
+	// Returns 1 if the key is new
+	bool insert(const std::string & key);
+	long size();
+};
+
+//
+// Pseudo random counters (prcnt)
+//
+
+struct counter_config {
+	int period = 0;
+	int extrabits = 3;		// Max extra bits
+	bool all = 0;			// Enumerate all solutions instead of the first one
+	long max_solutions = 0;		// Stop after this many distinct solutions, 0 - no limit
+	int luts = 2;			// Longest LUT chain, over 2 replaces the two LUT phases with chains
+	std::vector<int> taps;		// Fixed input selections of a chain, lut1 first, 0 - free.
+					// When set, only chains are searched.
+	bool anneal = 0;		// Local search on two LUT counters instead of the phases. Incomplete.
+	int threads = 0;		// Annealing threads, 0 - all cores
+	uint64_t seed = 0;		// Annealing random seed
+	budget limit;
+	std::string resume;		// Position reported by an exhausted search, empty - from the start
+};
+
+struct counter_result {
+	bool found = 0;
+	bool cancelled = 0;
+	int period = 0;
+	int b = 0;			// Useful bits
+	int x = 0;			// Extra bits
+	int mode = 0;			// 0 - single LUT, 1, 2 - two LUTs, 3 - LUT chain
+	int reactor1 = 0;		// LUT contents
+	int reactor2 = 0;
+	int config1 = 0;		// LUT input selections
+	int config2 = 0;
+	std::vector<int> reactors;	// Chain LUTs past lut2, each taking the previous one on I3
+	std::vector<int> configs;
+	std::vector<int> output;	// States from reset, 2p+3 of them
+	long solutions = 0;		// Distinct solutions reported in enumerate-all mode
+	long duplicates = 0;		// Symmetric solutions dropped
+	bool exhausted = 0;		// The budget ran out before the search space did
+	long nodes = 0;			// Candidates tried
+	int stage = 0;			// Phase reached: 0 - single LUT, 1..3 - two LUT phases, 4 - chains,
+					// 5 - annealing
+	int level = 0;			// Extrabits level reached
+	double coverage = 0;		// Fraction of that phase and level covered
+	std::string resume;		// Position to continue from when exhausted
+};
+
+counter_result find_counter(const counter_config & cfg, const control & ctl = control());
+std::string counter_module(const counter_result & r);
+// One line description of a solution
+std::string counter_record(const counter_result & r);
+// Key equal for solutions that differ only in LUT bits the counter never reads
+std::string counter_key(const counter_result & r);
+// Comment lines describing a search stopped by its budget
+std::string budget_report(const counter_result & r);
+
+//
+// Pseudo random dividers (prdiv, prdiv_alt)
+//
+
+enum class divider_engine {
+	ordered,	// Iterative, adapts configs to the failing bit (prdiv)
+	recursive,	// Recursive over states, all configs (prdiv_alt)
+	restarts	// Recursive over states, random configs and state order,
+			// restarted after a growing number of nodes. Incomplete.
+};
+
+struct divider_config {
+	int period = 0;
+	int extrabits = 3;		// Max extra bits
+	divider_engine engine = divider_engine::ordered;
+	bool activity = 0;		// Ordered engine: order bits and input selections by past conflicts
+	int threads = 0;		// Recursive engine only, 0 - all cores
+	long tt_mb = 64;		// Recursive engine transposition table, 0 disables
+	uint64_t seed = 0;		// Restarts engine random seed
+	long restarts = 256;		// Restarts engine tries per extrabits level
+	bool all = 0;			// Enumerate all solutions instead of the first one
+	long max_solutions = 0;		// Stop after this many distinct solutions, 0 - no limit
+	budget limit;
+	std::string resume;		// Position reported by an exhausted search, empty - from the start
+};
+
+struct divider_result {
+	bool found = 0;
+	bool cancelled = 0;
+	int period = 0;
+	int b = 0;			// Useful bits
+	int x = 0;			// Extra bits
+	std::vector<lut> luts;		// One per output bit
+	std::vector<comb> configs;	// Inputs of each LUT
+	std::vector<int> states;	// State sequence from reset
+	long tt_entries = 0;		// Transposition table statistics
+	long tt_probes = 0;
+	long tt_hits = 0;
+	long tt_stores = 0;
+	long solutions = 0;		// Distinct solutions reported in enumerate-all mode
+	long duplicates = 0;		// Symmetric solutions dropped
+	bool exhausted = 0;		// The budget ran out before the search space did
+	long nodes = 0;			// Candidates tried
+	int level = 0;			// Extrabits level reached
+	double coverage = 0;		// Fraction of that level covered
+	std::string resume;		// Position to continue from when exhausted
+	// Best partial result: the longest state prefix consistent with
+	// some LUT contents. Each step places a state and its twin with
+	// the MSB set, so a full solution takes (period+1)/2 steps.
+	int depth = 0;
+	std::vector<int> prefix;
+	std::vector<comb> prefix_configs;
+};
+
+divider_result find_divider(const divider_config & cfg, const control & ctl = control());
+std::string divider_module(const divider_result & r);
+// One line description of a solution
+std::string divider_record(const divider_result & r);
+// Key equal for solutions that differ only by a permutation of register bits
+// below the MSB (the MSB marks the second half of the state list)
+std::string divider_key(const divider_result & r);
+// Comment lines describing a search stopped by its budget
+std::string budget_report(const divider_result & r);
+
+//
+// Strategy portfolio (prdiv --portfolio)
+//
+
+struct strategy {
+	std::string name;
+	divider_engine engine;
+	uint64_t seed = 0;
+};
+
+// Ordered, recursive and two seeds of restarts
+std::vector<strategy> default_strategies();
+
+class portfolio_stats {
+	// Remembers which strategy won for which period.
+	// Kept in a text file, one "period strategy wins seconds" line each,
+	// where "seconds" is the total time of those wins.
+
+	private:
+	struct entry {
+		long wins = 0;
+		double seconds = 0;
+	};
+	std::mutex m;
+	std::map<int, std::map<std::string, entry>> t;
+
+	double weight(int period, const std::string & name);
+
+	public:
+	bool load(const std::string & file);
+	bool save(const std::string & file);
+	void record(int period, const std::string & name, double seconds);
+	// Splits "threads" between strategies, giving more to those that won
+	// before for this period, or for periods of the same bitness if
+	// there is no history yet. Every strategy gets at least one thread
+	// and the ordered engine never gets more than one.
+	std::vector<int> allocate(int period, const std::vector<strategy> & s, int threads);
+};
+
+struct portfolio_config {
+	int period = 0;
+	int extrabits = 3;
+	int threads = 0;		// All strategies together, 0 - all cores
+	long tt_mb = 64;		// Per strategy
+	budget limit;			// Per strategy
+	std::vector<strategy> strategies = default_strategies();
+};
+
+struct portfolio_result {
+	divider_result r;		// From the winner
+	int winner = -1;		// Index of the winning strategy, -1 - none
+	double seconds = 0;
+	std::vector<int> threads;	// Given to each strategy
+	std::vector<long> nodes;	// Tried by each strategy
+};
+
+// Runs all strategies at once. A solution cancels the rest once the
+// recursive engine has ruled out every level below it; until then it is
+// held, and a narrower one may still take its place. Without the
+// recursive engine, the narrowest held solution wins when all are done.
+// With "stats", threads are split by past wins and the win is recorded.
+portfolio_result find_divider_portfolio(const portfolio_config & cfg, portfolio_stats * stats = nullptr, const control & ctl = control());
+
+}
+
+#endif
@@ -0,0 +1,636 @@
+// PWM fill order optimizer
+// by Tomek Szczęsny 2024
+//
+// Searches the order in which pwm_pr fills the states of its period with
+// ones, for any period, and writes it as a Verilog module or a .mem table.
+// pwm_pr.v compares the input with a bit reversed counter, which is one
+// such order, and only exists for powers of 2.
+//
+// An order gives every state t of the period a rank; an input of v sets the
+// states ranked below v. The output is periodic, so its spectrum is made of
+// the harmonics k * fclk / p. The score of an order is the power of the
+// harmonics below the cutoff, summed over all input levels; that is the
+// ripple a filter behind the output lets through.
+//
+// Scoring does not need an FFT per level. Level v holds the states of level
+// v-1 plus one, so each harmonic of it is the one of the level before plus
+// a single twiddle, and a whole order costs p times the harmonics in the
+// band. Swapping the states of two ranks a < b only changes the levels in
+// between, by the same amount each.
+//
+// The search:
+// - a beam search fills the order rank by rank, from state 0 (rotations
+//   of an order have the same spectrum). Orders that have filled the same
+//   set of states so far have the same future, only the cheapest is kept.
+//   With --exact it keeps them all, under the bound of the best order
+//   found, which proves the optimum for periods up to 20;
+// - every thread anneals the result of the beam by swapping ranks, with a
+//   seed of its own, and the best order wins.
+// The result is checked against a mixed radix FFT of every level, run in
+// parallel.
+//
+// The module is pwm_pr with a case table instead of the bit reversal, and
+// the same ports. Inputs above p-1 keep the output high. The .mem file lists
+// the ranks in time order, one hex word per line, for rom.v or rompack.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+typedef std::complex<double> cpx;
+
+namespace {
+
+const int max_period = 4096;
+const int max_exact = 20;
+
+class fft {
+	// Mixed radix FFT of any length, over its prime factors, each one a
+	// plain DFT of that size
+
+	private:
+	int n;
+	std::vector<cpx> w;		// n-th roots of unity
+	std::vector<int> f;		// Factors
+
+	void step(const cpx * x, int stride, int m, int d, cpx * y, cpx * t) const
+	{
+		if (m == 1)
+		{
+			y[0] = x[0];
+			return;
+		}
+		int r = f[d], q = m / r, s = n / m;
+		for (int j=0; j<r; j++) step(x + j*stride, stride*r, q, d+1, y + j*q, t);
+		for (int k=0; k<q; k++)
+		{
+			for (int j=0; j<r; j++) t[j] = y[j*q + k];
+			for (int l=0; l<r; l++)
+			{
+				cpx acc = 0;
+				long e = k + l*q;
+				for (int j=0; j<r; j++) acc += t[j] * w[(j*e % m) * s];
+				y[k + l*q] = acc;
+			}
+		}
+	}
+
+	public:
+	fft(int n) : n(n), w(n)
+	{
+		for (int i=0; i<n; i++) w[i] = std::polar(1.0, -2*M_PI*i/n);
+		int m = n;
+		for (int p=2; p*p<=m; p++) while (m % p == 0) f.push_back(p), m /= p;
+		if (m > 1) f.push_back(m);
+	}
+
+	std::vector<cpx> run(const std::vector<cpx> & x) const
+	{
+		std::vector<cpx> y(n), t(n);
+		step(x.data(), 1, n, 0, y.data(), t.data());
+		return y;
+	}
+};
+
+class scorer {
+	public:
+	int p, kc;			// Period, harmonics in the band
+	std::vector<cpx> tw;		// Harmonics 1 to kc of a single one at state t, kc per t
+	std::vector<double> wt;		// Weight of each harmonic
+
+	scorer(int p, double cutoff) : p(p)
+	{
+		kc = std::min(p/2, std::max(1, int(std::floor(cutoff * p + 1e-9))));
+		tw.resize(size_t(p) * kc);
+		for (int t=0; t<p; t++)
+		{
+			for (int k=1; k<=kc; k++) tw[size_t(t)*kc + k-1] = std::polar(1.0, -2*M_PI*double(long(k)*t % p)/p);
+		}
+		// Both sides of the spectrum, but Nyquist has only one
+		wt.assign(kc, 2.0);
+		if (2*kc == p) wt[kc-1] = 1;
+	}
+
+	const cpx * row(int t) const
+	{
+		return &tw[size_t(t) * kc];
+	}
+
+	double energy(const cpx * x) const
+	{
+		double e = 0;
+		for (int k=0; k<kc; k++) e += wt[k] * std::norm(x[k]);
+		return e;
+	}
+
+	// Energy of level v+1, given level v and the state it adds
+	double energy(const cpx * x, int t) const
+	{
+		const cpx * w = row(t);
+		double e = 0;
+		for (int k=0; k<kc; k++) e += wt[k] * std::norm(x[k] + w[k]);
+		return e;
+	}
+
+	// Power in the band of every level, 0 to p
+	std::vector<double> levels(const std::vector<int> & pos) const
+	{
+		std::vector<double> l(p+1, 0);
+		std::vector<cpx> x(kc, 0);
+		for (int v=1; v<=p; v++)
+		{
+			const cpx * w = row(pos[v-1]);
+			for (int k=0; k<kc; k++) x[k] += w[k];
+			l[v] = energy(x.data()) / (double(p) * p);
+		}
+		l[p] = 0;		// Rounding aside, the full set is all DC
+		return l;
+	}
+
+	double score(const std::vector<int> & pos) const
+	{
+		double s = 0;
+		for (double e : levels(pos)) s += e;
+		return s;
+	}
+};
+
+// Time of each rank, from the ranks in time order, or back
+std::vector<int> invert(const std::vector<int> & v)
+{
+	std::vector<int> r(v.size());
+	for (size_t i=0; i<v.size(); i++) r[v[i]] = i;
+	return r;
+}
+
+struct search {
+	const scorer & sc;
+	int beam = 64;
+	bool exact = 0;
+	long moves = 1L << 21;
+	int threads = 1;
+	uint64_t seed = 1;
+	double bound = INFINITY;	// Only orders scoring less are of interest
+	long nodes = 0;
+	std::mutex m;
+
+	search(const scorer & sc) : sc(sc) {}
+
+	template <class F>
+	void run(F & f, int jobs)
+	{
+		std::vector<std::thread> pool;
+		for (int i=1; i<std::min(threads, jobs); i++) pool.emplace_back([&]() { f(); });
+		f();
+		for (auto & th : pool) th.join();
+	}
+
+	struct cand {
+		double s;
+		int parent, t;
+		uint64_t h;		// Of the set of states filled
+	};
+
+	// Fills the order rank by rank, keeping the "beam" cheapest sets of
+	// states (all with "exact"). Returns the time of each rank, empty if
+	// nothing beat "bound".
+	std::vector<int> fill()
+	{
+		int p = sc.p, kc = sc.kc;
+		int words = (p + 63) / 64;
+		std::vector<uint64_t> zob(p);
+		std::mt19937_64 g(seed);
+		for (auto & z : zob) z = g();
+
+		// Rank 0 sits at state 0
+		std::vector<cpx> x(sc.row(0), sc.row(0) + kc);
+		std::vector<uint64_t> set(words, 0);
+		set[0] = 1;
+		std::vector<double> score = {sc.energy(x.data()) / (double(p) * p)};
+		std::vector<std::vector<std::pair<int, int>>> path;	// Parent, state per rank
+		double norm = 1.0 / (double(p) * p);
+
+		for (int v=1; v<p; v++)
+		{
+			size_t n = score.size();
+			std::vector<std::vector<cand>> part;
+			std::atomic<size_t> next{0};
+			std::atomic<long> seen{0};
+			auto expand = [&]()
+			{
+				std::vector<cand> out;
+				size_t i;
+				while ((i = next.fetch_add(16)) < n)
+				{
+					for (size_t e=std::min(n, i+16); i<e; i++)
+					{
+						const cpx * xi = &x[i * kc];
+						const uint64_t * si = &set[i * words];
+						uint64_t h = 0;
+						for (int t=0; t<p; t++) if (si[t >> 6] >> (t & 63) & 1) h ^= zob[t];
+						for (int t=0; t<p; t++)
+						{
+							if (si[t >> 6] >> (t & 63) & 1) continue;
+							// The last level costs nothing, it is all ones
+							double s = score[i] + (v == p-1 ? 0 : sc.energy(xi, t) * norm);
+							if (s >= bound) continue;
+							out.push_back({s, int(i), t, h ^ zob[t]});
+						}
+					}
+				}
+				seen += out.size();
+				std::lock_guard<std::mutex> l(m);
+				part.push_back(std::move(out));
+			};
+			run(expand, n / 16 + 1);
+			nodes += seen;
+
+			std::vector<cand> all;
+			for (auto & q : part) all.insert(all.end(), q.begin(), q.end());
+			std::sort(all.begin(), all.end(), [](const cand & a, const cand & b) {
+				return a.s < b.s || (a.s == b.s && (a.parent < b.parent || (a.parent == b.parent && a.t < b.t)));
+			});
+			std::vector<cand> keep;
+			std::unordered_set<uint64_t> have;
+			for (auto & c : all)
+			{
+				if (!exact && int(keep.size()) >= beam) break;
+				if (have.insert(c.h).second) keep.push_back(c);
+			}
+			if (keep.empty()) return {};
+
+			std::vector<cpx> nx(keep.size() * kc);
+			std::vector<uint64_t> nset(keep.size() * words);
+			std::vector<double> ns(keep.size());
+			std::vector<std::pair<int, int>> step(keep.size());
+			for (size_t i=0; i<keep.size(); i++)
+			{
+				const cand & c = keep[i];
+				const cpx * w = sc.row(c.t);
+				for (int k=0; k<kc; k++) nx[i*kc + k] = x[size_t(c.parent)*kc + k] + w[k];
+				for (int q=0; q<words; q++) nset[i*words + q] = set[size_t(c.parent)*words + q];
+				nset[i*words + (c.t >> 6)] |= 1ull << (c.t & 63);
+				ns[i] = c.s;
+				step[i] = {c.parent, c.t};
+			}
+			x.swap(nx);
+			set.swap(nset);
+			score.swap(ns);
+			path.push_back(std::move(step));
+		}
+
+		// The cheapest, back from the last rank
+		std::vector<int> pos(p);
+		int i = 0;
+		for (int v=p-1; v>=1; v--)
+		{
+			pos[v] = path[v-1][i].second;
+			i = path[v-1][i].first;
+		}
+		pos[0] = 0;
+		return pos;
+	}
+
+	// Swaps ranks of "pos" while that lowers the score, with the odd
+	// uphill step while hot
+	std::vector<int> anneal(std::vector<int> pos, uint64_t s) const
+	{
+		int p = sc.p, kc = sc.kc;
+		if (p < 3) return pos;
+		double norm = 1.0 / (double(p) * p);
+		std::mt19937_64 g(s);
+		// Harmonics of every level
+		std::vector<cpx> x(size_t(p+1) * kc, 0);
+		for (int v=1; v<=p; v++)
+		{
+			const cpx * w = sc.row(pos[v-1]);
+			for (int k=0; k<kc; k++) x[size_t(v)*kc + k] = x[size_t(v-1)*kc + k] + w[k];
+		}
+		std::vector<cpx> d(kc);
+		auto pick = [&](int & a, int & b)
+		{
+			// Mostly near ranks, they are cheap to try
+			a = g() % (p-1);
+			int far = p-1 - a;
+			int span = (g() & 3) ? std::min(far, 16) : far;
+			b = a + 1 + g() % span;
+		};
+		auto delta = [&](int a, int b)
+		{
+			const cpx * wa = sc.row(pos[a]), * wb = sc.row(pos[b]);
+			for (int k=0; k<kc; k++) d[k] = wb[k] - wa[k];
+			double e = 0;
+			for (int v=a+1; v<=b; v++)
+			{
+				const cpx * xv = &x[size_t(v)*kc];
+				for (int k=0; k<kc; k++) e += sc.wt[k] * (2 * (xv[k].real()*d[k].real() + xv[k].imag()*d[k].imag()) + std::norm(d[k]));
+			}
+			return e * norm;
+		};
+
+		double t0 = 0;
+		for (int i=0; i<256; i++)
+		{
+			int a, b;
+			pick(a, b);
+			t0 += std::abs(delta(a, b));
+		}
+		t0 = t0 / 256 / 2 + 1e-300;
+		double cool = std::pow(1e-4, 1.0 / std::max(1L, moves));
+		double temp = t0;
+		double cur = sc.score(pos), best = cur;
+		std::vector<int> keep = pos;
+		std::uniform_real_distribution<double> u(0, 1);
+		for (long i=0; i<moves; i++, temp *= cool)
+		{
+			int a, b;
+			pick(a, b);
+			double e = delta(a, b);
+			if (e > 0 && u(g) >= std::exp(-e / temp)) continue;
+			for (int v=a+1; v<=b; v++) for (int k=0; k<kc; k++) x[size_t(v)*kc + k] += d[k];
+			std::swap(pos[a], pos[b]);
+			cur += e;
+			if (cur < best - 1e-12)
+			{
+				best = cur;
+				keep = pos;
+			}
+		}
+		return keep;
+	}
+};
+
+// The state 0 gets rank 0, as the one of pwm_pr does
+std::vector<int> rotate(const std::vector<int> & rank)
+{
+	int p = rank.size(), z = 0;
+	while (rank[z]) z++;
+	std::vector<int> r(p);
+	for (int t=0; t<p; t++) r[t] = rank[(t + z) % p];
+	return r;
+}
+
+int clog2(int p)
+{
+	int n = 0;
+	while ((1 << n) < p) n++;
+	return std::max(n, 1);
+}
+
+std::string summary(const scorer & sc, const std::vector<int> & pos)
+{
+	auto l = sc.levels(pos);
+	double mean = 0, worst = 0;
+	for (int v=1; v<sc.p; v++)
+	{
+		mean += l[v];
+		worst = std::max(worst, l[v]);
+	}
+	mean /= sc.p - 1;
+	char line[96];
+	snprintf(line, sizeof(line), "mean %.2f dB, worst %.2f dB", 10*std::log10(mean + 1e-300), 10*std::log10(worst + 1e-300));
+	return line;
+}
+
+std::vector<int> parse(const std::string & s)
+{
+	std::vector<int> v;
+	size_t i = 0;
+	while (i < s.size())
+	{
+		size_t j = s.find(',', i);
+		if (j == std::string::npos) j = s.size();
+		v.push_back(atoi(s.substr(i, j-i).c_str()));
+		i = j + 1;
+	}
+	return v;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	int p = 0;
+	double cutoff = 0.125;
+	int threads = std::thread::hardware_concurrency();
+	if (threads < 1) threads = 1;
+	int beam = 64;
+	bool exact = 0, quiet = 0;
+	long moves = 1L << 21;
+	uint64_t seed = 1;
+	std::string given, name, out, memf;
+
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h" || o == "--help") {
+			std::cerr << "Usage:\n";
+			std::cerr << "pwmord [options]\n";
+			std::cerr << "Searches the fill order of pwm_pr with the least ripple below a cutoff, see pwmord.cpp.\n";
+			std::cerr << "  -p [period]       States in a period, 2 - " << max_period << "\n";
+			std::cerr << "  --cutoff [f]      Band, as a fraction of the clock, up to 0.5 (default: 0.125)\n";
+			std::cerr << "  --beam [n]        Partial orders kept per rank (default: 64)\n";
+			std::cerr << "  --exact           Keep them all, proves the best order, periods up to " << max_exact << "\n";
+			std::cerr << "  --moves [n]       Annealing moves per thread, 0 - none (default: 2097152)\n";
+			std::cerr << "  --seed [n]        Random seed (default: 1)\n";
+			std::cerr << "  --order [list]    Scores this order (ranks in time order, \"0,4,2,6,1,5,3,7\") instead\n";
+			std::cerr << "  --name [name]     Module name (default: pwm_pr<period>)\n";
+			std::cerr << "  -o [file]         Verilog output (default: stdout)\n";
+			std::cerr << "  --mem [file]      Also write the ranks as a .mem file\n";
+			std::cerr << "  -j [threads]      Threads (default: all)\n";
+			std::cerr << "  -q                No statistics\n";
+			return 0;
+		}
+		else if (a+1 < argc && o == "-p") p = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--cutoff") cutoff = atof(argv[++a]);
+		else if (a+1 < argc && o == "--beam") beam = std::max(1, atoi(argv[++a]));
+		else if (o == "--exact") exact = 1;
+		else if (a+1 < argc && o == "--moves") moves = std::max(0L, atol(argv[++a]));
+		else if (a+1 < argc && o == "--seed") seed = strtoull(argv[++a], nullptr, 10);
+		else if (a+1 < argc && o == "--order") given = argv[++a];
+		else if (a+1 < argc && o == "--name") name = argv[++a];
+		else if (a+1 < argc && o == "-o") out = argv[++a];
+		else if (a+1 < argc && o == "--mem") memf = argv[++a];
+		else if (a+1 < argc && o == "-j") threads = std::max(1, atoi(argv[++a]));
+		else if (o == "-q") quiet = 1;
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+
+	std::vector<int> rank;
+	if (!given.empty())
+	{
+		rank = parse(given);
+		if (p && p != int(rank.size())) {
+			std::cerr << "The order has " << rank.size() << " states, not " << p << "\n";
+			return 1;
+		}
+		p = rank.size();
+		std::vector<bool> used(p, 0);
+		for (int r : rank)
+		{
+			if (r < 0 || r >= p || used[r]) {
+				std::cerr << "The order has to hold every rank 0 to " << p-1 << " once\n";
+				return 1;
+			}
+			used[r] = 1;
+		}
+	}
+	if (p < 2 || p > max_period) {
+		std::cerr << "Periods are 2 to " << max_period << "\n";
+		return 1;
+	}
+	if (!(cutoff > 0 && cutoff <= 0.5)) {
+		std::cerr << "The cutoff is above 0 and up to 0.5 of the clock\n";
+		return 1;
+	}
+	if (exact && p > max_exact) {
+		std::cerr << "--exact takes periods up to " << max_exact << "\n";
+		return 1;
+	}
+	if (name.empty()) name = "pwm_pr" + std::to_string(p);
+
+	scorer sc(p, cutoff);
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector<int> conv(p);
+	for (int t=0; t<p; t++) conv[t] = t;
+	long nodes = 0;
+	std::vector<int> beampos;
+	if (rank.empty())
+	{
+		search s(sc);
+		s.beam = beam;
+		s.moves = moves;
+		s.threads = threads;
+		s.seed = seed;
+		std::vector<int> pos = s.fill();
+		beampos = pos;
+		nodes = s.nodes;
+
+		// Every thread anneals the beam result on its own
+		std::vector<std::vector<int>> res(threads);
+		if (moves)
+		{
+			std::atomic<int> next{0};
+			auto work = [&]()
+			{
+				int i;
+				while ((i = next++) < threads) res[i] = s.anneal(pos, seed * 0x9e3779b97f4a7c15ull + i + 1);
+			};
+			s.run(work, threads);
+			for (auto & r : res) if (sc.score(r) < sc.score(pos) - 1e-12) pos = r;
+		}
+		if (exact)
+		{
+			// All sets of states under the best so far: either nothing
+			// beats it, or the search finds what does
+			s.exact = 1;
+			s.bound = sc.score(pos) - 1e-12;
+			std::vector<int> e = s.fill();
+			if (!e.empty() && sc.score(e) < sc.score(pos)) pos = e;
+			nodes = s.nodes;
+		}
+		rank = invert(pos);
+	}
+	rank = rotate(rank);
+	std::vector<int> pos = invert(rank);
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	// Every level through the FFT, levels spread over threads
+	std::vector<double> inc = sc.levels(pos);
+	std::vector<double> full(p+1, 0);
+	fft tf(p);
+	std::atomic<int> next{1};
+	auto check = [&]()
+	{
+		int v;
+		std::vector<cpx> x(p);
+		while ((v = next++) < p)
+		{
+			for (int t=0; t<p; t++) x[t] = rank[t] < v ? 1 : 0;
+			auto y = tf.run(x);
+			double e = 0;
+			for (int k=1; k<=sc.kc; k++) e += sc.wt[k-1] * std::norm(y[k]);
+			full[v] = e / (double(p) * p);
+		}
+	};
+	{
+		std::vector<std::thread> pool;
+		for (int i=1; i<std::min(threads, p); i++) pool.emplace_back(check);
+		check();
+		for (auto & th : pool) th.join();
+	}
+	double diff = 0;
+	for (int v=1; v<p; v++) diff = std::max(diff, std::abs(full[v] - inc[v]));
+	if (diff > 1e-6) {
+		std::cerr << "The FFT does not agree with the score, off by " << diff << "\n";
+		return 1;
+	}
+
+	FILE * f = stdout;
+	if (!out.empty() && !(f = fopen(out.c_str(), "w"))) {
+		std::cerr << "Can't write " << out << "\n";
+		return 1;
+	}
+	int n = clog2(p);
+	std::string ord;
+	for (int t=0; t<p; t++) ord += (t ? " " : "") + std::to_string(rank[t]);
+	fprintf(f, "// pwm_pr fill order for a period of %d, made by pwmord\n", p);
+	fprintf(f, "// Ranks in time order: %s\n", ord.c_str());
+	fprintf(f, "// Harmonics 1 to %d of %d in the band: %s\n", sc.kc, p, summary(sc, pos).c_str());
+	if ((1 << n) != p) fprintf(f, "// Inputs above %d keep the output high.\n", p-1);
+	fprintf(f, "\nmodule %s(\n\tinput wire clk,\n\tinput wire [%d:0] in,\n\toutput wire out);\n\n", name.c_str(), n-1);
+	fprintf(f, "reg [%d:0] cnt = 0;\nreg [%d:0] rank;\n\n", n-1, n-1);
+	fprintf(f, "always @ (posedge clk) begin\n");
+	if ((1 << n) == p) fprintf(f, "\t\tcnt <= cnt + 1;\n");
+	else fprintf(f, "\t\tcnt <= (cnt == %d'd%d) ? 0 : cnt + 1;\n", n, p-1);
+	fprintf(f, "end\n\nalways @ (*) begin\n\tcase (cnt)\n");
+	for (int t=0; t<p; t++) fprintf(f, "\t%d'd%d: rank = %d'd%d;\n", n, t, n, rank[t]);
+	fprintf(f, "\tdefault: rank = 0;\n\tendcase\nend\n\n");
+	fprintf(f, "assign out = (in > rank) ? 1 : 0;\n\nendmodule\n");
+	if (f != stdout) fclose(f);
+
+	if (!memf.empty())
+	{
+		FILE * mf = fopen(memf.c_str(), "w");
+		if (!mf) {
+			std::cerr << "Can't write " << memf << "\n";
+			return 1;
+		}
+		fprintf(mf, "// pwm_pr ranks in time order, period %d\n", p);
+		for (int t=0; t<p; t++) fprintf(mf, "%0*x\n", (n+3)/4, rank[t]);
+		fclose(mf);
+	}
+
+	if (!quiet)
+	{
+		std::cerr << "//// Period " << p << ", harmonics 1 to " << sc.kc << " in the band\n";
+		std::cerr << "//// conventional: " << summary(sc, invert(conv)) << "\n";
+		if ((1 << n) == p)
+		{
+			std::vector<int> br(p);
+			for (int t=0; t<p; t++)
+			{
+				br[t] = 0;
+				for (int b=0; b<n; b++) br[t] |= ((t >> b) & 1) << (n-1-b);
+			}
+			std::cerr << "//// bit reversed: " << summary(sc, invert(br)) << "\n";
+		}
+		if (!beampos.empty()) std::cerr << "//// beam " << beam << ": " << summary(sc, beampos) << "\n";
+		std::cerr << "//// " << (given.empty() ? "found" : "given") << ": " << summary(sc, pos) << "\n";
+		std::cerr << "//// " << nodes << " partial orders, " << secs << " s, FFT check of " << p-1 << " levels within " << diff << "\n";
+	}
+	return 0;
+}
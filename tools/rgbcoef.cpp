@@ -0,0 +1,406 @@
+// RGB to gray coefficient optimizer
+// by Tomek Szczęsny 2024
+//
+// Searches coefficient triples and rounding offsets for rgb_g_cie1931 and
+// rgb_g_ntsc (rgb_to_gray.v), which compute
+//   y = (cr*R + cg*G + cb*B + k) >> (n+s-m)
+// with shift-add terms, out of n-bit inputs and into m-bit outputs, for
+// denominators 2^s. Errors are measured against the exact formula, scaled
+// from full n-bit to full m-bit range, over all 2^(3n) inputs.
+//
+// The cost of a triple is the number of shift-add terms, one for each set
+// bit of a coefficient (or nonzero digit of its canonical signed digit form,
+// with --csd) and one for a nonzero offset. Every term but one is an adder
+// of n+s bits, i.e. n+s logic cells on iCE40.
+//
+// The result is the Pareto front of cost and error. Candidates are taken in
+// the order of increasing cost and scored by several threads, with
+// vectorized kernels (see vidkernels.h). A lower bound of the error of every
+// candidate follows from its linear part alone, so candidates that can't
+// beat the front at their cost are dropped without scoring, and scoring is
+// abandoned once the partial error passes the front.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vidkernels.h"
+
+namespace vid {
+extern const kernel_set vk_scalar;
+#if defined(__x86_64__)
+extern const kernel_set vk_avx2;
+#endif
+}
+
+const double inf = std::numeric_limits<double>::infinity();
+
+const vid::kernel_set * ks = nullptr;
+
+bool set_isa(const std::string & name)
+{
+	struct isa {
+		const vid::kernel_set * ks;
+		bool supported;
+	};
+	// Best first
+	const isa isas[] = {
+#if defined(__x86_64__)
+		{&vid::vk_avx2, bool(__builtin_cpu_supports("avx2"))},
+#endif
+		{&vid::vk_scalar, true},
+	};
+	for (auto & i : isas)
+	{
+		if ((name == "auto" || name == i.ks->name) && i.supported)
+		{
+			ks = i.ks;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Nonzero digits of x in canonical signed digit form, LSB first
+std::vector<int> csd(int x)
+{
+	std::vector<int> d;
+	while (x)
+	{
+		int v = 0;
+		if (x & 1) v = 2 - (x & 3);	// 1 or -1
+		d.push_back(v);
+		x = (x - v) >> 1;
+	}
+	return d;
+}
+
+int terms(int x, bool signed_digits)
+{
+	if (!signed_digits) return __builtin_popcount(x);
+	int t = 0;
+	for (int v : csd(x)) t += v != 0;
+	return t;
+}
+
+struct cand {
+	int s;			// Denominator 2^s
+	int c[3];		// Coefficients of R, G, B
+	int k;			// Rounding offset
+	int cost;		// Shift-add terms
+	double lb;		// Lower bound of the error
+	double max, rms;	// Scored errors
+};
+
+struct problem {
+	int n = 8, m = 8;
+	double w[3];
+	bool signed_digits = 0;
+	bool by_rms = 0;
+
+	double scale() const
+	{
+		return double((1 << m) - 1) / ((1 << n) - 1);
+	}
+
+	// Error of the exact part x/2^q - ref, which is linear in R, G and B.
+	// The error of y differs from it by the truncated fraction only, in [0, 1).
+	double bound(const cand & a) const
+	{
+		int q = n + a.s - m;
+		double N = (1 << n) - 1;
+		double d[3], hi = a.k / double(1 << q), lo = hi, mu = hi;
+		double var = 0;
+		for (int i=0; i<3; i++)
+		{
+			d[i] = a.c[i] / double(1 << q) - w[i] * scale();
+			(d[i] > 0 ? hi : lo) += d[i] * N;
+			mu += d[i] * N / 2;
+			var += d[i] * d[i] * (N * (N + 2)) / 12;
+		}
+		if (!by_rms) return std::max({0.0, hi - 1, -lo});
+		// rms(e) >= rms(linear - 1/2) - 1/2
+		return std::max(0.0, std::sqrt((mu - 0.5) * (mu - 0.5) + var) - 0.5);
+	}
+
+	// Scores a candidate; gives up and returns 0 when the error reaches limit
+	bool score(cand & a, double limit) const
+	{
+		int N = 1 << n, q = n + a.s - m;
+		double total = double(N) * N * N;
+		float mx = 0;
+		double sq = 0;
+		float wb = w[2] * scale();
+		for (int r=0; r<N; r++)
+		{
+			for (int g=0; g<N; g++)
+			{
+				ks->gray_err(a.c[0]*r + a.c[1]*g + a.k, a.c[2], q, (w[0]*r + w[1]*g) * scale(), wb, N, &mx, &sq);
+			}
+			if (!by_rms && mx >= limit) return 0;
+			if (by_rms && sq >= limit * limit * total) return 0;
+		}
+		a.max = mx;
+		a.rms = std::sqrt(sq / total);
+		return 1;
+	}
+
+	double error(const cand & a) const
+	{
+		return by_rms ? a.rms : a.max;
+	}
+
+	// The sum as rgb_to_gray.v writes it
+	std::string verilog(const cand & a) const
+	{
+		const char * ch[3] = {"r", "g", "b"};
+		std::string pos, neg;
+		for (int i=0; i<3; i++)
+		{
+			std::vector<int> d;
+			if (signed_digits) d = csd(a.c[i]);
+			else for (int v = a.c[i]; v; v >>= 1) d.push_back(v & 1);
+			for (int j=0; j<d.size(); j++)
+			{
+				if (!d[j]) continue;
+				std::string t = j ? std::string("(") + ch[i] + " << " + std::to_string(j) + ")" : ch[i];
+				if (d[j] > 0) pos += (pos.empty() ? "" : " + ") + t;
+				else neg += " - " + t;
+			}
+		}
+		if (a.k) pos += (pos.empty() ? "" : " + ") + std::to_string(a.k);
+		if (pos.empty()) pos = "0";
+		std::string s = std::to_string(a.s);
+		std::string s1 = std::to_string(a.s-1);
+		return "wire [n+" + s1 + ":0] out;\n"
+			"assign out = " + pos + neg + ";\n"
+			"assign y = out[n+" + s1 + ":n+" + s + "-m];\n";
+	}
+};
+
+int main(int argc, char** argv)
+{
+	problem p;
+	std::string formula = "cie1931", isaname = "auto", eval;
+	std::vector<int> dens;
+	int window = 2;
+	double lambda = -1;
+	bool verilog = 0;
+	int threads = std::thread::hardware_concurrency();
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "rgbcoef [cie1931|ntsc] [options]\n";
+			std::cerr << "  -n [bits]      Input bits per channel, up to 10 (default: 8)\n";
+			std::cerr << "  -m [bits]      Output bits (default: 8)\n";
+			std::cerr << "  -s [s|s1-s2]   Denominators 2^s, may be repeated (default: 4-7)\n";
+			std::cerr << "  -w [window]    Coefficients tried on each side of the exact ones (default: 2)\n";
+			std::cerr << "  --csd          Allow subtracted terms\n";
+			std::cerr << "  --rms          Optimize RMS error instead of max error\n";
+			std::cerr << "  -l [lambda]    Also pick the best of error + lambda * terms\n";
+			std::cerr << "  -e [r,g,b[,k]] Only score the given coefficients, with a single -s\n";
+			std::cerr << "  -v             Print the Verilog of every result\n";
+			std::cerr << "  -j [threads]   Threads (default: all cores)\n";
+			std::cerr << "  --isa [name]   Kernel instruction set: auto, scalar, avx2\n";
+			std::cerr << "Errors are in output LSBs, e.g. rgbcoef ntsc -s 7 -e 38,75,15\n";
+			return 0;
+		}
+		if (a+1 < argc && o == "-n") p.n = atoi(argv[++a]);
+		else if (a+1 < argc && o == "-m") p.m = atoi(argv[++a]);
+		else if (a+1 < argc && o == "-s")
+		{
+			int s1, s2;
+			int c = sscanf(argv[++a], "%d-%d", &s1, &s2);
+			if (c == 1) s2 = s1;
+			for (int s=s1; c >= 1 && s<=s2; s++) dens.push_back(s);
+		}
+		else if (a+1 < argc && o == "-w") window = atoi(argv[++a]);
+		else if (o == "--csd") p.signed_digits = 1;
+		else if (o == "--rms") p.by_rms = 1;
+		else if (a+1 < argc && o == "-l") lambda = atof(argv[++a]);
+		else if (a+1 < argc && o == "-e") eval = argv[++a];
+		else if (o == "-v") verilog = 1;
+		else if (a+1 < argc && o == "-j") threads = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--isa") isaname = argv[++a];
+		else if (o == "cie1931" || o == "ntsc") formula = o;
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (!set_isa(isaname)) {
+		std::cerr << "ISA " << isaname << " is not supported here\n";
+		return 1;
+	}
+	if (formula == "ntsc")
+	{
+		p.w[0] = 0.299;
+		p.w[1] = 0.587;
+		p.w[2] = 0.114;
+	}
+	else
+	{
+		p.w[0] = 0.2126;
+		p.w[1] = 0.7152;
+		p.w[2] = 0.0722;
+	}
+	if (dens.empty()) for (int s=4; s<=7; s++) dens.push_back(s);
+	if (p.n < 1 || p.n > 10 || p.m < 1) {
+		std::cerr << "Input must have 1 to 10 bits\n";
+		return 1;
+	}
+	for (int s : dens)
+	{
+		// The sum is n+s bits wide and has to hold m bits
+		if (s < 0 || s > 16 || p.n + s < p.m) {
+			std::cerr << "Denominator 2^" << s << " can't give " << p.m << " output bits\n";
+			return 1;
+		}
+	}
+	threads = std::max(1, threads);
+	auto t0 = std::chrono::steady_clock::now();
+
+	std::vector<cand> cs;
+	auto add = [&](int s, int cr, int cg, int cb, int k)
+	{
+		cand a = {s, {cr, cg, cb}, k, 0, 0, inf, inf};
+		// The top of the sum must not overflow out[n+s-1:0]
+		if (long((1 << p.n) - 1) * (cr + cg + cb) + k >= (1L << (p.n + s))) return;
+		for (int i=0; i<3; i++) a.cost += terms(a.c[i], p.signed_digits);
+		a.cost += k != 0;
+		a.lb = p.bound(a);
+		cs.push_back(a);
+	};
+	if (!eval.empty())
+	{
+		int c[4] = {0, 0, 0, 0};
+		if (dens.size() != 1 || sscanf(eval.c_str(), "%d,%d,%d,%d", &c[0], &c[1], &c[2], &c[3]) < 3) {
+			std::cerr << "-e needs three coefficients and a single -s\n";
+			return 1;
+		}
+		add(dens[0], c[0], c[1], c[2], c[3]);
+		if (cs.empty()) {
+			std::cerr << "The sum overflows n+s bits\n";
+			return 1;
+		}
+	}
+	else
+	{
+		for (int s : dens)
+		{
+			int q = p.n + s - p.m;
+			// Offsets: every one for short truncations, eighths of an LSB otherwise
+			int kstep = q > 3 ? 1 << (q - 3) : 1;
+			int c0[3];
+			for (int i=0; i<3; i++) c0[i] = std::lround(p.w[i] * p.scale() * (1 << q));
+			for (int cr = std::max(0, c0[0]-window); cr <= c0[0]+window; cr++)
+			{
+				for (int cg = std::max(0, c0[1]-window); cg <= c0[1]+window; cg++)
+				{
+					for (int cb = std::max(0, c0[2]-window); cb <= c0[2]+window; cb++)
+					{
+						for (int k=0; k < (1 << q); k += kstep) add(s, cr, cg, cb, k);
+					}
+				}
+			}
+		}
+	}
+	std::stable_sort(cs.begin(), cs.end(), [](const cand & a, const cand & b)
+	{
+		return a.cost != b.cost ? a.cost < b.cost : a.lb < b.lb;
+	});
+
+	// Best error found at each cost
+	int maxcost = 0;
+	for (auto & a : cs) maxcost = std::max(maxcost, a.cost);
+	std::vector<double> best(maxcost + 1, inf);
+	std::mutex lock;
+	auto limit = [&](int cost)
+	{
+		double l = inf;
+		for (int c=0; c<=cost; c++) l = std::min(l, best[c]);
+		return l;
+	};
+	std::atomic<int> next{0};
+	std::atomic<long> pruned{0}, aborted{0};
+	bool all = !eval.empty();
+	auto worker = [&]()
+	{
+		int i;
+		while ((i = next++) < cs.size())
+		{
+			cand & a = cs[i];
+			double l;
+			{
+				std::lock_guard<std::mutex> g(lock);
+				l = all ? inf : limit(a.cost);
+			}
+			if (a.lb >= l)
+			{
+				pruned++;
+				continue;
+			}
+			if (!p.score(a, l))
+			{
+				aborted++;
+				continue;
+			}
+			std::lock_guard<std::mutex> g(lock);
+			best[a.cost] = std::min(best[a.cost], p.error(a));
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int t=1; t<threads; t++) pool.emplace_back(worker);
+	worker();
+	for (auto & t : pool) t.join();
+
+	// Threads may have scored candidates that a cheaper one beat later
+	std::vector<cand> front;
+	double l = inf;
+	std::vector<cand> scored;
+	for (auto & a : cs) if (a.max < inf) scored.push_back(a);
+	std::stable_sort(scored.begin(), scored.end(), [&](const cand & a, const cand & b)
+	{
+		return a.cost != b.cost ? a.cost < b.cost : p.error(a) < p.error(b);
+	});
+	for (auto & a : scored)
+	{
+		if (all || p.error(a) < l)
+		{
+			front.push_back(a);
+			l = p.error(a);
+		}
+	}
+
+	std::cout << "// rgb_g_" << formula << ", n = " << p.n << ", m = " << p.m << ", errors in output LSBs\n";
+	std::cout << "// terms adders   s    r    g    b    k     max     rms\n";
+	char line[128];
+	for (auto & a : front)
+	{
+		snprintf(line, sizeof(line), "%8d %6d %3d %4d %4d %4d %4d %7.4f %7.4f\n", a.cost, a.cost - 1, a.s,
+			a.c[0], a.c[1], a.c[2], a.k, a.max, a.rms);
+		std::cout << line;
+		if (verilog) std::cout << p.verilog(a) << "\n";
+	}
+	if (lambda >= 0 && !front.empty())
+	{
+		const cand * pick = &front[0];
+		for (auto & a : front)
+		{
+			if (p.error(a) + lambda * a.cost < p.error(*pick) + lambda * pick->cost) pick = &a;
+		}
+		std::cout << "// Best of error + " << lambda << " * terms:\n" << p.verilog(*pick);
+	}
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	std::cerr << "//// " << cs.size() << " candidates, " << pruned << " pruned by bounds, " << aborted
+		<< " abandoned, " << cs.size() - pruned - aborted << " scored in full, " << t << " s, " << ks->name << " kernels\n";
+	return 0;
+}
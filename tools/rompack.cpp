@@ -0,0 +1,489 @@
+// ROM image packer
+// by Tomek Szczęsny 2024
+//
+// Turns a binary file or a $readmemh style hex file into a module built of
+// rom.v instances, and optionally into a .mem file.
+//
+// An iCE40 4kb block works as 256x16, 512x8, 1024x4 or 2048x2 ROM. The words
+// are cut into slices of these widths, each slice being a rom.v of its own,
+// so that they take the fewest blocks. 2048 words of 10 bits become a 512x8
+// slice and a 2048x2 one, five blocks instead of eight 512x8 ones.
+// Slice depths are rounded up to whole blocks.
+//
+// Binary input is read as a bit stream, MSB first, cut into n bit words.
+// Hex input takes whitespace separated words, "//" comments and "@addr"
+// jumps, as $readmemh does; with no -n, words are 4 bits per digit wide.
+//
+// The words are kept packed in memory, w bits apiece; the data literals
+// (chunked hex constants in a concatenation) and the .mem file are written
+// as a stream.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// Buffered output of a FILE
+class writer {
+	private:
+	FILE * f;
+	char buf[1 << 16];
+	size_t n = 0;
+
+	public:
+	writer(FILE * f) : f(f) {}
+	~writer()
+	{
+		flush();
+	}
+	void flush()
+	{
+		fwrite(buf, 1, n, f);
+		n = 0;
+	}
+	void put(char c)
+	{
+		if (n == sizeof(buf)) flush();
+		buf[n++] = c;
+	}
+	void put(const std::string & s)
+	{
+		for (char c : s) put(c);
+	}
+	void hex(int d)
+	{
+		put("0123456789abcdef"[d]);
+	}
+};
+
+class image {
+	private:
+	std::vector<uint64_t> bits;	// Words, w bits apiece, word 0 at bit 0
+
+	public:
+	int w = 0;			// Word width
+	size_t size = 0;		// Words
+
+	uint32_t get(size_t i) const
+	{
+		if (!w) return 0;
+		size_t b = i * w, k = b / 64;
+		int o = b % 64;
+		uint64_t x = bits[k] >> o;
+		if (o + w > 64) x |= bits[k + 1] << (64 - o);
+		return x & mask();
+	}
+
+	// Stores a word that fits in w bits, growing the image up to it
+	void set(size_t i, uint32_t x)
+	{
+		if (i >= size) resize(i + 1);
+		if (!w) return;
+		size_t b = i * w, k = b / 64;
+		int o = b % 64;
+		uint64_t m = mask();
+		bits[k] = (bits[k] & ~(m << o)) | (uint64_t(x) << o);
+		if (o + w > 64) bits[k + 1] = (bits[k + 1] & ~(m >> (64 - o))) | (uint64_t(x) >> (64 - o));
+	}
+
+	void push(uint32_t x)
+	{
+		set(size, x);
+	}
+
+	// New words are zeroes
+	void resize(size_t n)
+	{
+		size = n;
+		bits.resize((n * w + 63) / 64, 0);
+	}
+
+	// Makes words n bits wide, moving them from the top down so that
+	// none is overwritten before it is read
+	void widen(int n)
+	{
+		int o = w;
+		bits.resize((size * n + 63) / 64, 0);
+		for (size_t i=size; i-- > 0; )
+		{
+			w = o;
+			uint32_t x = get(i);
+			w = n;
+			set(i, x);
+		}
+		w = n;
+	}
+
+	// Binary files, as a bit stream
+	bool read_bin(FILE * f, int n)
+	{
+		w = n;
+		uint64_t acc = 0;
+		int bits = 0;
+		std::vector<unsigned char> buf(1 << 20);
+		size_t k;
+		while ((k = fread(buf.data(), 1, buf.size(), f)) > 0)
+		{
+			for (size_t i=0; i<k; i++)
+			{
+				acc = acc << 8 | buf[i];
+				bits += 8;
+				while (bits >= n)
+				{
+					bits -= n;
+					push((acc >> bits) & mask());
+				}
+			}
+		}
+		// The last word is padded with zeroes
+		if (bits) push((acc << (n - bits)) & mask());
+		return 1;
+	}
+
+	// $readmemh files; n = 0 for words as wide as their digits
+	bool read_hex(FILE * f, int n, std::string & err)
+	{
+		std::vector<char> buf(1 << 20);
+		size_t k, addr = 0;
+		uint32_t word = 0;
+		int digits = 0;
+		w = n;
+		bool at = 0, comment = 0, block = 0;
+		char prev = 0;
+		long line = 1;
+		auto end = [&]() -> bool
+		{
+			if (!digits) return 1;
+			if (at) addr = word;
+			else if (n && (word & ~mask()))
+			{
+				err = "line " + std::to_string(line) + ": word doesn't fit in " + std::to_string(n) + " bits";
+				return 0;
+			}
+			else
+			{
+				if (!n && 4 * digits > w) widen(4 * digits);
+				set(addr++, word);
+			}
+			word = 0;
+			digits = 0;
+			at = 0;
+			return 1;
+		};
+		while ((k = fread(buf.data(), 1, buf.size(), f)) > 0)
+		{
+			for (size_t i=0; i<k; i++)
+			{
+				char c = buf[i];
+				if (comment)
+				{
+					if (c == '\n') comment = 0;
+				}
+				else if (block)
+				{
+					if (prev == '*' && c == '/') block = 0;
+				}
+				else if (c == '/' && prev == '/')
+				{
+					comment = 1;
+				}
+				else if (c == '*' && prev == '/')
+				{
+					block = 1;
+				}
+				else if (c == '/')
+				{
+					if (!end()) return 0;
+				}
+				else if (isxdigit(c))
+				{
+					if (++digits > 8) {
+						err = "line " + std::to_string(line) + ": words over 32 bits";
+						return 0;
+					}
+					word = word << 4 | (isdigit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+				}
+				else if (c == 'x' || c == 'X' || c == 'z' || c == 'Z')
+				{
+					// Unknown digits are zeroes
+					digits++;
+					word <<= 4;
+				}
+				else if (c == '@')
+				{
+					if (!end()) return 0;
+					at = 1;
+				}
+				else if (c == '_')
+				{
+				}
+				else if (isspace(c) || c == ',')
+				{
+					if (!end()) return 0;
+				}
+				else {
+					err = "line " + std::to_string(line) + ": unexpected \"" + c + "\"";
+					return 0;
+				}
+				prev = c == '/' && prev == '/' ? 0 : c;
+				if (c == '\n') line++;
+			}
+		}
+		return end();
+	}
+
+	uint32_t mask() const
+	{
+		return w >= 32 ? ~0u : (1u << w) - 1;
+	}
+};
+
+// A slice of the words, in blocks of one width
+struct slice {
+	int hi, lo;
+	int bw, bd;		// Block width and depth
+	long depth;		// Words, whole blocks
+	long blocks;
+};
+
+// Slices of words of w bits, from the top, taking the fewest blocks (then
+// the fewest slices); bw = 0 lets every slice use the best block width
+std::vector<slice> plan(int w, long depth, int bw)
+{
+	auto cost = [&](int b) -> long
+	{
+		long d = 4096 / b;
+		return (depth + d - 1) / d;
+	};
+	// f[i]: blocks and slices for the top i bits
+	std::vector<std::pair<long, int>> f(w + 1, {0, 0});
+	std::vector<int> pick(w + 1);
+	for (int i=1; i<=w; i++)
+	{
+		f[i] = {-1, 0};
+		for (int b : {2, 4, 8, 16})
+		{
+			if (bw && b != bw) continue;
+			auto x = f[std::max(0, i - b)];
+			x.first += cost(b);
+			x.second++;
+			if (f[i].first < 0 || x < f[i])
+			{
+				f[i] = x;
+				pick[i] = b;
+			}
+		}
+	}
+	std::vector<slice> r;
+	for (int i=w; i>0; )
+	{
+		slice s;
+		s.bw = pick[i];
+		s.bd = 4096 / s.bw;
+		s.hi = i - 1;
+		s.lo = std::max(0, i - s.bw);
+		s.blocks = cost(s.bw);
+		s.depth = s.blocks * s.bd;
+		r.push_back(s);
+		i = s.lo;
+	}
+	return r;
+}
+
+long blocks(const std::vector<slice> & p)
+{
+	long n = 0;
+	for (auto & s : p) n += s.blocks;
+	return n;
+}
+
+int clog2(long x)
+{
+	int n = 0;
+	while ((1L << n) < x) n++;
+	return n;
+}
+
+// Bits [lo, lo+n) of every word, as a concatenation of hex constants,
+// word 0 first; 256 digits per constant and line
+void literal(writer & o, const image & im, int lo, int n)
+{
+	long L = long(n) * im.size;
+	long pad = (4 - L % 4) % 4;
+	long digits = (L + pad) / 4;
+	long first = digits % 256 ? digits % 256 : 256;
+	long left = first;		// Digits left in this constant
+	bool head = 1;
+	auto open = [&](long d, long bits)
+	{
+		if (!head) o.put(",\n");
+		o.put("\t\t" + std::to_string(bits) + "'h");
+		head = 0;
+		left = d;
+	};
+	open(first, first * 4 - pad);
+	uint64_t acc = 0;
+	int bits = pad;
+	for (size_t i=0; i<im.size; i++)
+	{
+		uint32_t x = im.get(i);
+		acc = acc << n | ((x >> lo) & ((1ull << n) - 1));
+		bits += n;
+		while (bits >= 4)
+		{
+			if (!left) open(256, 1024);
+			bits -= 4;
+			o.hex((acc >> bits) & 15);
+			left--;
+		}
+	}
+	o.put("\n");
+}
+
+void verilog(FILE * f, const image & im, const std::vector<slice> & p, const std::string & name, const std::string & src)
+{
+	writer o(f);
+	long depth = 0;
+	for (auto & x : p) depth = std::max(depth, x.depth);
+	int a = std::max(clog2(depth), 1);
+	char s[256];
+	snprintf(s, sizeof(s), "// %s: %zu words of %d bits, %ld blocks\n", src.c_str(), im.size, im.w, blocks(p));
+	o.put("// Generated by rompack\n");
+	o.put(s);
+	o.put("\n`include \"rom.v\"\n\n");
+	o.put("module " + name + " (\n");
+	o.put("\tinput wire clk,\n");
+	o.put("\tinput wire [" + std::to_string(a - 1) + ":0] address,\n");
+	o.put("\toutput wire [" + std::to_string(im.w - 1) + ":0] data_o\n");
+	o.put(");\n");
+	for (size_t i=0; i<p.size(); i++)
+	{
+		const slice & x = p[i];
+		int n = x.hi - x.lo + 1;
+		snprintf(s, sizeof(s), "\n// %ld %dx%d blocks\n", x.blocks, x.bd, x.bw);
+		o.put(s);
+		o.put("rom #(\n");
+		o.put("\t.n(" + std::to_string(n) + "),\n");
+		o.put("\t.m(" + std::to_string(x.depth) + "),\n");
+		o.put("\t.content_size(" + std::to_string(im.size) + "),\n");
+		o.put("\t.data({\n");
+		literal(o, im, x.lo, n);
+		o.put("\t})\n");
+		snprintf(s, sizeof(s), ") slice%zu (clk, address[%d:0], data_o[%d:%d]);\n", i, std::max(clog2(x.depth), 1) - 1, x.hi, x.lo);
+		o.put(s);
+	}
+	o.put("\nendmodule\n");
+}
+
+// $readmemh format, as assets/*.mem: 32 words per line
+void mem(FILE * f, const image & im)
+{
+	writer o(f);
+	int d = (im.w + 3) / 4;
+	for (size_t i=0; i<im.size; i++)
+	{
+		uint32_t x = im.get(i);
+		for (int j=d-1; j>=0; j--) o.hex(x >> (4*j) & 15);
+		o.put(i % 32 == 31 || i + 1 == im.size ? '\n' : ' ');
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string in, out, memf, name = "rom_image";
+	bool hex = 0, quiet = 0;
+	int n = 0, force = 0;
+	long minm = 0;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "rompack [options] [file]\n";
+			std::cerr << "Packs a file (- or none for stdin) into rom.v instances, see rompack.cpp.\n";
+			std::cerr << "  --hex           Input is a $readmemh file (default: binary)\n";
+			std::cerr << "  -n [bits]       Word width, 1 - 32 (default: 8, or the hex digits)\n";
+			std::cerr << "  -m [words]      Smallest depth (default: the input length)\n";
+			std::cerr << "  --block [bits]  Only blocks of this width: 2, 4, 8 or 16 (default: any)\n";
+			std::cerr << "  --name [name]   Module name (default: rom_image)\n";
+			std::cerr << "  -o [file]       Verilog output (default: stdout)\n";
+			std::cerr << "  --mem [file]    Also write the words as a .mem file\n";
+			std::cerr << "  -q              No statistics\n";
+			return 0;
+		}
+		if (o == "--hex") hex = 1;
+		else if (a+1 < argc && o == "-n") n = atoi(argv[++a]);
+		else if (a+1 < argc && o == "-m") minm = atol(argv[++a]);
+		else if (a+1 < argc && o == "--block") force = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--name") name = argv[++a];
+		else if (a+1 < argc && o == "-o") out = argv[++a];
+		else if (a+1 < argc && o == "--mem") memf = argv[++a];
+		else if (o == "-q") quiet = 1;
+		else if (o[0] != '-' || o == "-") in = o;
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (n < 0 || n > 32 || (force && force != 2 && force != 4 && force != 8 && force != 16)) {
+		std::cerr << "Words are 1 to 32 bits, blocks 2, 4, 8 or 16 bits wide\n";
+		return 1;
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	FILE * f = in.empty() || in == "-" ? stdin : fopen(in.c_str(), "rb");
+	if (!f) {
+		std::cerr << "Can't open " << in << "\n";
+		return 1;
+	}
+	image im;
+	std::string err;
+	bool ok = hex ? im.read_hex(f, n, err) : im.read_bin(f, n ? n : 8);
+	if (f != stdin) fclose(f);
+	if (!ok) {
+		std::cerr << in << ": " << err << "\n";
+		return 1;
+	}
+	if (!im.size || !im.w) {
+		std::cerr << "No data\n";
+		return 1;
+	}
+
+	long depth = std::max(std::max(long(im.size), minm), 2L);
+	std::vector<slice> best = plan(im.w, depth, force);
+	if (!quiet && !force)
+	{
+		for (int bw : {16, 8, 4, 2})
+		{
+			std::cerr << "//// " << 4096 / bw << "x" << bw << " only: " << blocks(plan(im.w, depth, bw)) << " blocks\n";
+		}
+	}
+
+	FILE * vf = out.empty() ? stdout : fopen(out.c_str(), "w");
+	if (!vf) {
+		std::cerr << "Can't write " << out << "\n";
+		return 1;
+	}
+	verilog(vf, im, best, name, in.empty() || in == "-" ? "stdin" : in);
+	if (vf != stdout) fclose(vf);
+	if (!memf.empty())
+	{
+		FILE * mf = fopen(memf.c_str(), "w");
+		if (!mf) {
+			std::cerr << "Can't write " << memf << "\n";
+			return 1;
+		}
+		mem(mf, im);
+		fclose(mf);
+	}
+	if (!quiet) {
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		std::cerr << "//// " << im.size << " words of " << im.w << " bits in " << blocks(best) << " blocks:";
+		for (auto & x : best) std::cerr << " " << x.hi << ":" << x.lo << " " << x.blocks << "x" << x.bd << "x" << x.bw;
+		std::cerr << ", " << secs << " s\n";
+	}
+	return 0;
+}
@@ -0,0 +1,1227 @@
+// Sequencer assembler and simulator
+// by Tomek Szczęsny 2024
+//
+// Compiles sequences for sequencer.v out of a description of steps, loops
+// and named blocks, and runs sequencer programs cycle by cycle.
+//
+// Every opcode of the sequencer takes a clock cycle and outputs its "D"
+// field, so control opcodes are not free in time: PUSHI, CALL, DECJNZ and
+// JMP take the place of output steps that keep "d" as it is. The assembler
+// tries loops, loops with the first or last pass peeled off, nested loops
+// for counts beyond the stack width, unrolling, and named blocks as inline
+// code or subroutines, and keeps the shortest program. The result is run
+// on the simulator against the description before it is printed.
+//
+// Source format, with // comments:
+//   ocw 16            opcode width (16)
+//   ddw 4             width of "D" (4)
+//   stack 256         stack depth (256)
+//   def name { ... }  a named block
+//   entry name { ... } an entry point; the first one runs after reset,
+//                     the others are started with the "addr" / "jump" inputs
+// Blocks hold, in order of execution:
+//   0110              a step: one cycle of output "D", in binary
+//   0110:5            ... also setting "d" to 5; "d" is kept otherwise
+//                     and is 0 at the start of every entry
+//   12 * { ... }      a block repeated 12 times
+//   forever { ... }   a block repeated until the end of time
+//   name              a named block
+//   stop 0000         the final step of an entry, it stops the sequencer
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// Opcodes, as in sequencer.v
+enum {
+	SEQ_STOP = 0, SEQ_OUT = 1, SEQ_POP = 2, SEQ_RET = 3,
+	SEQ_CALL = 4, SEQ_JMP = 5, SEQ_PUSHI = 6, SEQ_DECJNZ = 7
+};
+const char * mnemonic[8] = {"STOP", "OUT", "POP", "RET", "CALL", "JMP", "PUSHI", "DECJNZ"};
+
+struct format {
+	int ocw = 16, ddw = 4, std = 256;
+
+	int sw() const
+	{
+		return ocw - ddw - 3;
+	}
+	long word(int op, long param, int D) const
+	{
+		return (long(op) << (ocw-3)) | (param << ddw) | D;
+	}
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+//
+// Simulator
+//
+
+class machine {
+	// sequencer.v with its rom.v and stack.v, cycle by cycle
+
+	public:
+	format f;
+	std::vector<long> rom;
+	int pcr = 1;
+	long oc = 0;		// The ROM output is 0 (STOP) until the first clock
+	long data_o = 0;
+	// stack.v
+	std::vector<long> buf;
+	long top = 0;
+	int lvl = 0;
+	long cycles = 0;
+	int amask = 1;		// The program counter is clog2(plen) bits wide
+
+	machine(const format & f, const std::vector<long> & rom) : f(f), rom(rom), buf(f.std, 0)
+	{
+		while (amask + 1 < int(rom.size())) amask = 2*amask + 1;
+	}
+
+	int cmd() const
+	{
+		return oc >> (f.ocw-3);
+	}
+
+	bool stopped() const
+	{
+		return cmd() == SEQ_STOP;
+	}
+
+	// One clock; returns 0 when the program counter leaves the ROM
+	bool step(bool jump = 0, int addr = 0)
+	{
+		int c = cmd();
+		long smask = (1L << f.sw()) - 1, dmask = (1L << f.ddw) - 1;
+		long param = (oc >> f.ddw) & smask, dd = oc & dmask;
+		int pcrp1 = (pcr + 1) & amask;
+		int pcrn;
+		if (jump && c == SEQ_STOP) pcrn = addr;
+		else switch (c)
+		{
+			case SEQ_STOP:   pcrn = pcr; break;
+			case SEQ_RET:    pcrn = lvl ? top & amask : pcrp1; break;
+			case SEQ_DECJNZ: pcrn = top < 2 ? pcrp1 : param & amask; break;
+			case SEQ_JMP:
+			case SEQ_CALL:   pcrn = param & amask; break;
+			default:         pcrn = pcrp1;
+		}
+		// All opcodes update "D", "0xx" ones update "d" too
+		data_o = (c & 4) ? (data_o & ~dmask) | dd : (param << f.ddw) | dd;
+		// stack.v, with its indexes wrapping around
+		int m = f.std;
+		auto push = [&](long v)
+		{
+			if (lvl == m) return;
+			buf[(lvl - 1 + m) % m] = top;
+			top = v & smask;
+			lvl++;
+		};
+		auto pop = [&]()
+		{
+			if (!lvl) return;
+			top = buf[(lvl - 2 + 2*m) % m];
+			lvl--;
+		};
+		switch (c)
+		{
+			case SEQ_RET:
+			case SEQ_POP:    pop(); break;
+			case SEQ_PUSHI:  push(param); break;
+			case SEQ_CALL:   push(pcrp1); break;
+			case SEQ_DECJNZ:
+				if (top < 2) pop();
+				else if (lvl) top = (top - 1) & smask;
+				break;
+		}
+		pcr = pcrn;
+		cycles++;
+		if (pcrn >= int(rom.size())) return 0;
+		oc = rom[pcrn];
+		return 1;
+	}
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+//
+// Source
+//
+
+struct node {
+	enum {STEP, SEQ, REPEAT, FOREVER, REF} kind;
+	int D = 0, d = -1;		// Steps; d -1 keeps "d"
+	bool stop = 0;
+	long n = 0;			// Repeat count
+	std::vector<node *> kids;
+	std::string name;
+	int line = 0;
+};
+
+struct source {
+	format f;
+	std::deque<node> nodes;
+	std::map<std::string, node *> defs;
+	std::vector<std::pair<std::string, node *>> entries;
+	bool uses_d = 0;
+
+	node * make(int kind, int line)
+	{
+		nodes.emplace_back();
+		nodes.back().kind = decltype(node::kind)(kind);
+		nodes.back().line = line;
+		return &nodes.back();
+	}
+
+	void parse(std::istream & in)
+	{
+		std::vector<std::pair<std::string, int>> tok;
+		std::string l;
+		int line = 0;
+		while (std::getline(in, l))
+		{
+			line++;
+			size_t c = l.find("//");
+			if (c != std::string::npos) l.resize(c);
+			std::string t;
+			for (char ch : l + " ")
+			{
+				if (isspace(ch) || ch == '{' || ch == '}' || ch == '*')
+				{
+					if (!t.empty()) tok.push_back({t, line});
+					t.clear();
+					if (!isspace(ch)) tok.push_back({std::string(1, ch), line});
+				}
+				else t += ch;
+			}
+		}
+		size_t p = 0;
+		auto fail = [&](const std::string & msg)
+		{
+			int ln = p < tok.size() ? tok[p].second : line;
+			throw std::runtime_error("line " + std::to_string(ln) + ": " + msg);
+		};
+		auto next = [&]() -> std::string
+		{
+			if (p >= tok.size()) fail("unexpected end of file");
+			return tok[p++].first;
+		};
+		auto number = [&]() -> long
+		{
+			std::string t = next();
+			char * e;
+			long v = strtol(t.c_str(), &e, 0);
+			if (t.empty() || *e) fail("number expected, not " + t);
+			return v;
+		};
+		std::function<node *()> block;
+		auto step = [&](const std::string & t, bool stop) -> node *
+		{
+			node * s = make(node::STEP, tok[p-1].second);
+			size_t c = t.find(':');
+			std::string D = t.substr(0, c);
+			if (int(D.size()) != f.ddw || D.find_first_not_of("01") != std::string::npos)
+				fail("step " + t + " is not " + std::to_string(f.ddw) + " binary digits");
+			s->D = strtol(D.c_str(), nullptr, 2);
+			if (c != std::string::npos)
+			{
+				s->d = strtol(t.c_str() + c + 1, nullptr, 0);
+				if (s->d < 0 || s->d >= (1L << f.sw())) fail("d of " + t + " doesn't fit");
+				uses_d = 1;
+			}
+			s->stop = stop;
+			return s;
+		};
+		block = [&]() -> node *
+		{
+			if (next() != "{") fail("{ expected");
+			node * b = make(node::SEQ, tok[p-1].second);
+			while (1)
+			{
+				std::string t = next();
+				if (t == "}") break;
+				if (t == "stop") b->kids.push_back(step(next(), 1));
+				else if (t == "forever")
+				{
+					node * r = make(node::FOREVER, tok[p-1].second);
+					r->kids.push_back(block());
+					b->kids.push_back(r);
+				}
+				else if (p < tok.size() && tok[p].first == "*")
+				{
+					node * r = make(node::REPEAT, tok[p-1].second);
+					char * e;
+					r->n = strtol(t.c_str(), &e, 0);
+					if (*e || r->n < 0) fail("bad count " + t);
+					p++;
+					r->kids.push_back(block());
+					b->kids.push_back(r);
+				}
+				else if (isdigit(t[0])) b->kids.push_back(step(t, 0));
+				else
+				{
+					node * r = make(node::REF, tok[p-1].second);
+					r->name = t;
+					b->kids.push_back(r);
+				}
+			}
+			return b;
+		};
+		while (p < tok.size())
+		{
+			std::string t = next();
+			if (t == "ocw") f.ocw = number();
+			else if (t == "ddw") f.ddw = number();
+			else if (t == "stack") f.std = number();
+			else if (t == "def" || t == "entry")
+			{
+				std::string name = next();
+				node * b = block();
+				b->name = name;
+				if (t == "def")
+				{
+					if (defs.count(name)) fail(name + " defined twice");
+					defs[name] = b;
+				}
+				else entries.push_back({name, b});
+			}
+			else fail("unknown keyword " + t);
+		}
+		if (f.ddw < 1 || f.sw() < 1 || f.ocw > 62) throw std::runtime_error("bad ocw / ddw");
+		if (f.std < 1 || (f.std & (f.std - 1))) throw std::runtime_error("stack depth must be a power of 2");
+		if (entries.empty()) throw std::runtime_error("no entry");
+		for (auto & n : nodes)
+		{
+			if (n.kind == node::REF && !defs.count(n.name))
+				throw std::runtime_error("line " + std::to_string(n.line) + ": " + n.name + " is not defined");
+		}
+		// Named blocks may not use themselves
+		std::map<node *, int> state;
+		std::function<void(node *)> visit = [&](node * n)
+		{
+			if (n->kind == node::REF)
+			{
+				node * b = defs[n->name];
+				if (state[b] == 1) throw std::runtime_error(n->name + " uses itself");
+				if (state[b] == 0)
+				{
+					state[b] = 1;
+					visit(b);
+					state[b] = 2;
+				}
+			}
+			for (node * k : n->kids) visit(k);
+		};
+		for (auto & e : entries) visit(e.second);
+	}
+
+	// Walks the steps of an entry in the order of execution, until emit returns 0
+	bool walk(node * n, long & d, const std::function<bool(int D, long d, bool stop)> & emit)
+	{
+		switch (n->kind)
+		{
+			case node::STEP:
+				if (n->d >= 0) d = n->d;
+				return emit(n->D, d, n->stop);
+			case node::SEQ:
+				for (node * k : n->kids) if (!walk(k, d, emit)) return 0;
+				return 1;
+			case node::REPEAT:
+				for (long i=0; i<n->n; i++) if (!walk(n->kids[0], d, emit)) return 0;
+				return 1;
+			case node::FOREVER:
+				while (1) if (!walk(n->kids[0], d, emit)) return 0;
+			case node::REF:
+				return walk(defs[n->name], d, emit);
+		}
+		return 1;
+	}
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+//
+// Compiler
+//
+
+struct slot {
+	int op = SEQ_OUT;
+	int D = 0;
+	long d = 0;
+	long din = 0;		// "d" before this step, -1 if it depends on the way in
+	long param = 0;		// PUSHI count
+	int target = 0;		// DECJNZ / JMP slot, CALL subroutine
+	int line = 0;
+
+	// Can become a control opcode, which keeps "d"
+	bool free() const
+	{
+		return op == SEQ_OUT && din == d;
+	}
+};
+
+struct frag {
+	std::vector<slot> s;
+	bool steps = 0;		// Takes any time at all
+	int pre = 0;		// Opcode for the step before this, 0 for none
+	long pre_param = 0;
+	int pre_target = 0;
+	int tail = -1;		// Slot executed last, if it can still change
+	long dout = 0;		// "d" afterwards
+};
+
+// "d" before a step, as passed around the compiler: its value, with
+// unknown set if the sequencer may hold something else (after a STOP),
+// or ambiguous if it depends on the way in (the start of a loop body)
+const long ambiguous = -1;
+const long unknown = 1L << 48;
+
+long value(long din)
+{
+	return din == ambiguous ? din : din & ~unknown;
+}
+
+class compiler {
+	// Keeps the shortest fragment of every kind (prefix or not, open tail or not)
+
+	public:
+	typedef std::vector<frag> set;	// Up to 4, indexed by kind()
+
+	source & src;
+	std::map<std::string, int> subs;	// Named blocks compiled as subroutines
+	std::map<std::tuple<node *, long, long>, set> memo;
+	std::map<std::pair<node *, long>, node *> inner;	// Repeats made up while nesting loops
+	std::deque<node> extra;
+	long max;				// Largest loop count
+
+	compiler(source & s) : src(s)
+	{
+		max = (1L << s.f.sw()) - 1;
+	}
+
+	static int kind(const frag & f)
+	{
+		return (f.pre ? 2 : 0) | (f.tail >= 0 ? 1 : 0);
+	}
+
+	static void keep(set & v, const frag & f)
+	{
+		if (v.empty()) v.resize(4);
+		frag & b = v[kind(f)];
+		if (!b.steps || f.s.size() < b.s.size()) b = f;
+	}
+
+	// The fragments of a set, which may be a temporary
+	struct view {
+		set v;
+		std::vector<const frag *> p;
+		std::vector<const frag *>::const_iterator begin() const { return p.begin(); }
+		std::vector<const frag *>::const_iterator end() const { return p.end(); }
+		bool empty() const { return p.empty(); }
+	};
+
+	static view all(set v)
+	{
+		view r;
+		r.v = std::move(v);
+		for (auto & f : r.v) if (f.steps) r.p.push_back(&f);
+		return r;
+	}
+
+	// a then b; 0 if b needs a step before that a can't give
+	static bool join(const frag & a, const frag & b, frag & r)
+	{
+		if (!a.steps)
+		{
+			r = b;
+			return 1;
+		}
+		r = a;
+		if (b.pre)
+		{
+			if (a.tail < 0 || !a.s[a.tail].free()) return 0;
+			slot & t = r.s[a.tail];
+			t.op = b.pre;
+			t.param = b.pre_param;
+			t.target = b.pre == SEQ_CALL ? b.pre_target : b.pre_target + a.s.size();
+		}
+		int off = a.s.size();
+		for (slot t : b.s)
+		{
+			if (t.op == SEQ_DECJNZ || t.op == SEQ_JMP) t.target += off;
+			r.s.push_back(t);
+		}
+		r.tail = b.tail >= 0 ? b.tail + off : -1;
+		r.dout = b.dout;
+		return 1;
+	}
+
+	// "d" after a node, given "d" before it
+	long dout(node * n, long din)
+	{
+		switch (n->kind)
+		{
+			case node::STEP: return n->d >= 0 ? n->d : value(din);
+			case node::SEQ:
+				for (node * k : n->kids) din = dout(k, din);
+				return din;
+			case node::REPEAT:
+				if (n->n == 0) return din;
+				din = dout(n->kids[0], din);
+				return n->n == 1 ? din : dout(n->kids[0], din);
+			case node::FOREVER: return dout(n->kids[0], din);
+			case node::REF: return dout(src.defs[n->name], din);
+		}
+		return din;
+	}
+
+	// "d" before the first step of a loop body, which comes from two places
+	long loop_din(node * b, long din)
+	{
+		return dout(b, din) == value(din) ? din : ambiguous;
+	}
+
+	// "d" before every named block, ambiguous if it differs between uses
+	std::map<std::string, long> sub_din;
+
+	void find_sub_din(node * n, long din)
+	{
+		switch (n->kind)
+		{
+			case node::STEP: break;
+			case node::SEQ:
+				for (node * k : n->kids)
+				{
+					find_sub_din(k, din);
+					din = dout(k, din);
+				}
+				break;
+			case node::REPEAT:
+			case node::FOREVER:
+				find_sub_din(n->kids[0], loop_din(n->kids[0], din));
+				break;
+			case node::REF:
+			{
+				long v = value(din);
+				auto it = sub_din.find(n->name);
+				if (it == sub_din.end()) sub_din[n->name] = v;
+				else if (it->second != v) it->second = ambiguous;
+				find_sub_din(src.defs[n->name], din);
+				break;
+			}
+		}
+	}
+
+	set compile(node * n, long din)
+	{
+		auto key = std::make_tuple(n, 0L, din);
+		auto it = memo.find(key);
+		if (it != memo.end()) return it->second;
+		set r;
+		switch (n->kind)
+		{
+			case node::STEP:
+			{
+				if (n->d < 0 && din == ambiguous) break;
+				// Until the first "0xx" opcode the sequencer holds "d" of the program before
+				frag f;
+				slot s;
+				s.D = n->D;
+				s.d = n->d >= 0 ? n->d : value(din);
+				s.din = din & unknown ? ambiguous : din;
+				s.line = n->line;
+				if (n->stop) s.op = SEQ_STOP;
+				f.s.push_back(s);
+				f.steps = 1;
+				f.tail = n->stop ? -1 : 0;
+				f.dout = s.d;
+				keep(r, f);
+				break;
+			}
+			case node::SEQ:
+				r = sequence(n->kids, din);
+				break;
+			case node::REPEAT:
+				r = repeat(n->kids[0], n->n, din);
+				break;
+			case node::FOREVER:
+			{
+				node * b = n->kids[0];
+				auto loops = [&](long d)
+				{
+					set l;
+					for (const frag * f : all(compile(b, loop_din(b, d))))
+					{
+						if (f->pre || f->tail < 0 || !f->s[f->tail].free()) continue;
+						frag j = *f;
+						j.s[j.tail].op = SEQ_JMP;
+						j.s[j.tail].target = 0;
+						j.tail = -1;
+						keep(l, j);
+					}
+					return l;
+				};
+				for (const frag * f : all(loops(din))) keep(r, *f);
+				// The first pass peeled off, the loop then starts from
+				// what the body leaves behind
+				set first = compile(b, din);
+				set rest = loops(dout(b, din));
+				for (const frag * f : all(first))
+				{
+					for (const frag * g : all(rest))
+					{
+						frag j;
+						if (join(*f, *g, j)) keep(r, j);
+					}
+				}
+				break;
+			}
+			case node::REF:
+			{
+				// Inline, or a call where there's a step for CALL before it
+				r = compile(src.defs[n->name], din);
+				auto s = subs.find(n->name);
+				if (s == subs.end()) break;
+				frag f;
+				f.steps = 1;
+				f.pre = SEQ_CALL;
+				f.pre_target = s->second;
+				f.tail = -1;
+				f.dout = dout(src.defs[n->name], din);
+				keep(r, f);
+				break;
+			}
+		}
+		memo[key] = r;
+		return r;
+	}
+
+	set sequence(const std::vector<node *> & items, long din)
+	{
+		set cur;
+		bool empty = 1;		// Nothing yet
+		long d = din;
+		for (node * k : items)
+		{
+			if (k->kind == node::REPEAT && k->n == 0) continue;
+			set ks = compile(k, d);
+			d = dout(k, d);
+			if (empty)
+			{
+				cur = ks;
+				empty = 0;
+			}
+			else
+			{
+				set nxt;
+				for (const frag * a : all(cur))
+				{
+					for (const frag * b : all(ks))
+					{
+						frag f;
+						if (join(*a, *b, f)) keep(nxt, f);
+					}
+				}
+				cur = nxt;
+			}
+			if (all(cur).empty()) return set();
+		}
+		return cur;
+	}
+
+	// Loops without peeled passes
+	set loop(node * b, long n, long din)
+	{
+		auto key = std::make_tuple(b, -n, din);
+		auto it = memo.find(key);
+		if (it != memo.end()) return it->second;
+		set r;
+		long ld = loop_din(b, din);
+		if (n < 2) return r;
+		if (n <= max)
+		{
+			for (const frag * f : all(compile(b, ld)))
+			{
+				if (f->pre || f->tail < 0 || !f->s[f->tail].free()) continue;
+				frag l = *f;
+				l.s[l.tail].op = SEQ_DECJNZ;
+				l.s[l.tail].target = 0;
+				l.tail = -1;
+				l.pre = SEQ_PUSHI;
+				l.pre_param = n;
+				l.pre_target = 0;
+				keep(r, l);
+			}
+			memo[key] = r;
+			return r;
+		}
+		// Nested loops: a passes of an inner loop of c passes, and the rest
+		std::vector<long> cs;
+		for (long c = max; c >= 2 && c > max - 2; c--) cs.push_back(c);
+		for (long c = std::min(max, n / 2); c >= 2 && cs.size() < 6; c--) if (n % c == 0) cs.push_back(c);
+		for (long c : cs)
+		{
+			long a = n / c, rest = n % c;
+			if (a < 2) continue;
+			node *& in = inner[{b, c}];
+			if (!in)
+			{
+				extra.emplace_back();
+				in = &extra.back();
+				in->kind = node::REPEAT;
+				in->n = c;
+				in->kids.push_back(b);
+				in->line = b->line;
+			}
+			set outer = repeat_loops(in, a, din);
+			if (!rest)
+			{
+				for (const frag * f : all(outer)) keep(r, *f);
+				continue;
+			}
+			long d2 = din;
+			for (const frag * f : all(outer)) d2 = f->dout;
+			set tail = repeat(b, rest, d2);
+			for (const frag * f : all(outer))
+			{
+				for (const frag * t : all(tail))
+				{
+					frag j;
+					if (join(*f, *t, j)) keep(r, j);
+				}
+			}
+		}
+		memo[key] = r;
+		return r;
+	}
+
+	// Loops, with the first and last passes peeled off where that helps
+	set repeat_loops(node * b, long n, long din)
+	{
+		auto key = std::make_tuple(b, n, din);
+		auto it = memo.find(key);
+		if (it != memo.end()) return it->second;
+		set r = loop(b, n, din);
+		auto cat = [&](const set & x, const set & y)
+		{
+			for (const frag * f : all(x))
+			{
+				for (const frag * g : all(y))
+				{
+					frag j;
+					if (join(*f, *g, j)) keep(r, j);
+				}
+			}
+		};
+		auto after = [&](const set & x)
+		{
+			long d = din;
+			for (const frag * f : all(x)) d = f->dout;
+			return d;
+		};
+		if (n >= 3)
+		{
+			set first = compile(b, din);
+			set rest = loop(b, n-1, after(first));
+			cat(first, rest);
+			set most = loop(b, n-1, din);
+			set last = compile(b, after(most));
+			cat(most, last);
+		}
+		if (n >= 4)
+		{
+			// Two passes peeled off: when the first pass changes "d" all
+			// the way through, the second one may keep it and take PUSHI
+			std::vector<node *> two(2, b);
+			set head = sequence(two, din);
+			cat(head, loop(b, n-2, after(head)));
+
+			set first = compile(b, din);
+			set mid = loop(b, n-2, after(first));
+			set both;
+			for (const frag * f : all(first))
+			{
+				for (const frag * g : all(mid))
+				{
+					frag j;
+					if (join(*f, *g, j)) keep(both, j);
+				}
+			}
+			cat(both, compile(b, after(both)));
+		}
+		memo[key] = r;
+		return r;
+	}
+
+	// Why "n" doesn't compile: the innermost part that doesn't, with a reason
+	std::string why(node * n, long din)
+	{
+		auto at = [](node * k) { return "line " + std::to_string(k->line) + ": "; };
+		auto control = [](node * k) -> std::string
+		{
+			if (k->kind == node::REPEAT) return "PUSHI";
+			if (k->kind == node::REF) return "CALL";
+			return "a control opcode";
+		};
+		switch (n->kind)
+		{
+			case node::STEP:
+				return at(n) + "the step keeps \"d\", which differs between the ways into it";
+			case node::SEQ:
+			{
+				std::vector<node *> done;
+				long d = din;
+				for (node * k : n->kids)
+				{
+					if (all(compile(k, d)).empty()) return why(k, d);
+					done.push_back(k);
+					if (all(sequence(done, din)).empty()) return at(k) + "no step before this can take " + control(k);
+					d = dout(k, d);
+				}
+				if (n->kids.empty()) break;
+				return at(n->kids[0]) + "there's no step before this to take " + control(n->kids[0]);
+			}
+			case node::REPEAT:
+			case node::FOREVER:
+			{
+				node * b = n->kids[0];
+				if (all(compile(b, din)).empty()) return why(b, din);
+				// A pass once "d" has settled
+				bool keeps = 0;
+				for (const frag * f : all(compile(b, dout(b, dout(b, din)))))
+				{
+					for (const slot & t : f->s) if (t.free()) keeps = 1;
+				}
+				if (n->kind == node::FOREVER)
+				{
+					if (!keeps) return at(n) + "every step of the forever block changes \"d\", so none can take JMP";
+					break;
+				}
+				if (!keeps) return at(n) + "every step of the repeated block changes \"d\", so none can take DECJNZ";
+				return at(n) + "there's no step before this to take PUSHI";
+			}
+			case node::REF:
+				return why(src.defs[n->name], din);
+		}
+		return at(n) + "can't compile this";
+	}
+
+	set repeat(node * b, long n, long din)
+	{
+		if (n == 0) return set();
+		if (n == 1) return compile(b, din);
+		set r = repeat_loops(b, n, din);
+		// Unrolled
+		if (n <= 64)
+		{
+			std::vector<node *> copies(n, b);
+			for (const frag * f : all(sequence(copies, din))) keep(r, *f);
+		}
+		return r;
+	}
+};
+
+struct program {
+	std::vector<long> rom;
+	std::vector<slot> code;			// By address, 0 is the filler
+	std::vector<std::string> labels;
+	std::vector<int> entry_addr;
+};
+
+// Lays out entries and subroutines, or returns 0
+bool build(source & src, const std::map<std::string, int> & subs, program & p, std::string & error)
+{
+	compiler c(src);
+	c.subs = subs;
+	long din0 = src.uses_d ? unknown : 0;
+	for (auto & e : src.entries) c.find_sub_din(e.second, din0);
+	std::vector<frag> parts;
+	std::vector<std::string> names;
+	for (auto & e : src.entries)
+	{
+		frag best;
+		for (const frag * f : compiler::all(c.compile(e.second, din0)))
+		{
+			// Entries start after a STOP, which can't take a prefix
+			if (f->pre) continue;
+			if (!best.steps || f->s.size() < best.s.size()) best = *f;
+		}
+		if (!best.steps) {
+			error = "can't compile entry " + e.first + ", " + c.why(e.second, din0);
+			return 0;
+		}
+		if (best.tail >= 0) {
+			error = "entry " + e.first + " doesn't end with stop or forever";
+			return 0;
+		}
+		parts.push_back(best);
+		names.push_back("entry " + e.first);
+	}
+	std::vector<std::string> sname(subs.size());
+	for (auto & s : subs) sname[s.second] = s.first;
+	for (auto & s : sname)
+	{
+		frag best;
+		long din = c.sub_din[s];
+		for (const frag * f : compiler::all(c.compile(src.defs[s], din)))
+		{
+			// The last step returns; RET sets "d" anyway
+			if (f->pre || f->tail < 0 || f->s[f->tail].op != SEQ_OUT) continue;
+			if (!best.steps || f->s.size() < best.s.size()) best = *f;
+		}
+		if (!best.steps) {
+			error = "can't compile " + s + " as a subroutine";
+			return 0;
+		}
+		best.s[best.tail].op = SEQ_RET;
+		parts.push_back(best);
+		names.push_back("sub " + s);
+	}
+	p.code.assign(1, slot());
+	p.code[0].op = SEQ_STOP;
+	p.labels.assign(1, "filler, never executed");
+	std::vector<int> base;
+	for (int i=0; i<parts.size(); i++)
+	{
+		base.push_back(p.code.size());
+		for (int j=0; j<parts[i].s.size(); j++)
+		{
+			p.code.push_back(parts[i].s[j]);
+			p.labels.push_back(j ? "" : names[i]);
+		}
+	}
+	p.entry_addr.assign(base.begin(), base.begin() + src.entries.size());
+	int aw = 1;
+	while ((1L << aw) < long(p.code.size())) aw++;
+	if (aw > src.f.sw()) {
+		error = "the program takes " + std::to_string(p.code.size()) + " words, more than the stack width addresses";
+		return 0;
+	}
+	p.rom.clear();
+	for (int i=0; i<p.code.size(); i++)
+	{
+		slot & s = p.code[i];
+		int part = std::upper_bound(base.begin(), base.end(), i) - base.begin() - 1;
+		long param = s.d;
+		if (s.op == SEQ_PUSHI) param = s.param;
+		if (s.op == SEQ_DECJNZ || s.op == SEQ_JMP) param = base[part] + s.target;
+		if (s.op == SEQ_CALL) param = base[src.entries.size() + s.target];
+		if (s.op == SEQ_CALL || s.op == SEQ_DECJNZ || s.op == SEQ_JMP || s.op == SEQ_PUSHI) s.param = param;
+		p.rom.push_back(src.f.word(s.op, param, s.D));
+	}
+	return 1;
+}
+
+// Runs every entry against its description, up to limit cycles each
+bool verify(source & src, const program & p, long limit, std::string & error)
+{
+	for (int e=0; e<src.entries.size(); e++)
+	{
+		machine m(src.f, p.rom);
+		if (e > 0)
+		{
+			// Started from a STOP by an external jump
+			m.step(1, p.entry_addr[e]);
+		}
+		else m.step();		// The STOP read before the first clock
+		m.data_o = 0;
+		long d = 0, t = 0;
+		long dmask = (1L << src.f.ddw) - 1;
+		bool ok = 1;
+		src.walk(src.entries[e].second, d, [&](int D, long dd, bool stop)
+		{
+			if (!m.step())
+			{
+				ok = 0;
+				error = "left the ROM";
+				return false;
+			}
+			long want = (dd << src.f.ddw) | D;
+			if (m.data_o != want) {
+				ok = 0;
+				char b[160];
+				snprintf(b, sizeof(b), "cycle %ld: data_o %lx, expected %lx (D %lx)", t, m.data_o, want, long(D) & dmask);
+				error = b;
+				return false;
+			}
+			t++;
+			return !stop && t < limit;
+		});
+		if (!ok)
+		{
+			error = "entry " + src.entries[e].first + ", " + error;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Reads a program list of sequencer.v, as in tb_sequencer.v: `SEQ_OUT, 5'd2, 4'b1001, ...
+bool read_verilog(std::istream & in, format & f, std::vector<long> & rom)
+{
+	std::string s((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	std::map<std::string, int> ops = {{"STOP", 0}, {"OUT", 1}, {"POP", 2}, {"RET", 3},
+		{"CALL", 4}, {"JMP", 5}, {"PUSHI", 6}, {"DECJNZ", 7}};
+	size_t p = 0;
+	int pw = -1, dw = -1;
+	// Skips comments, reads a sized literal
+	auto literal = [&](int & w, long & v) -> bool
+	{
+		while (p < s.size() && !isdigit(s[p])) p++;
+		char base;
+		if (sscanf(s.c_str() + p, "%d'%c", &w, &base) != 2) return 0;
+		p = s.find('\'', p) + 2;
+		size_t e = p;
+		while (e < s.size() && (isalnum(s[e]) || s[e] == '_')) e++;
+		std::string digits = s.substr(p, e-p);
+		digits.erase(std::remove(digits.begin(), digits.end(), '_'), digits.end());
+		v = strtol(digits.c_str(), nullptr, base == 'b' ? 2 : base == 'h' ? 16 : base == 'o' ? 8 : 10);
+		p = e;
+		return 1;
+	};
+	while ((p = s.find("`SEQ_", p)) != std::string::npos)
+	{
+		p += 5;
+		size_t e = p;
+		while (e < s.size() && isalpha(s[e])) e++;
+		auto op = ops.find(s.substr(p, e-p));
+		p = e;
+		int w1, w2;
+		long v1, v2;
+		if (op == ops.end() || !literal(w1, v1) || !literal(w2, v2)) return 0;
+		if (pw >= 0 && (w1 != pw || w2 != dw)) return 0;
+		pw = w1;
+		dw = w2;
+		rom.push_back((long(op->second) << (w1 + w2)) | (v1 << w2) | v2);
+	}
+	f.ocw = pw + dw + 3;
+	f.ddw = dw;
+	return !rom.empty();
+}
+
+int main(int argc, char** argv)
+{
+	std::string file, sim, outfmt = "sequencer";
+	long cycles = 1000, verify_limit = 10000000;
+	std::vector<int> queue;
+	bool quiet = 0, listing = 0;
+	int depth = -1;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "seqasm [options] [file]\n";
+			std::cerr << "Assembles a sequence description (see seqasm.cpp) from the file or stdin,\n";
+			std::cerr << "checks it on the simulator and prints the program parameter of sequencer.v.\n";
+			std::cerr << "  --rom           Print the data parameter of rom.v instead\n";
+			std::cerr << "  -l              Print a listing too\n";
+			std::cerr << "  --verify [n]    Cycles checked per entry (default: 10000000)\n";
+			std::cerr << "Simulation:\n";
+			std::cerr << "  --sim           Run the program, assembled or read from a sequencer.v\n";
+			std::cerr << "                  program list (`SEQ_OUT, 5'd2, 4'b1001, ...) in a .v file\n";
+			std::cerr << "  -c [cycles]     Cycles to run (default: 1000)\n";
+			std::cerr << "  -a [addr]       Queue a jump to addr, taken at the next STOP, may be repeated\n";
+			std::cerr << "  --stack [depth] Stack depth of a .v program (default: 256)\n";
+			std::cerr << "  -q              Print the final state only\n";
+			return 0;
+		}
+		if (o == "--rom") outfmt = "rom";
+		else if (o == "-l") listing = 1;
+		else if (a+1 < argc && o == "--verify") verify_limit = atol(argv[++a]);
+		else if (o == "--sim") sim = "1";
+		else if (a+1 < argc && o == "-c") cycles = atol(argv[++a]);
+		else if (a+1 < argc && o == "-a") queue.push_back(atoi(argv[++a]));
+		else if (a+1 < argc && o == "--stack") depth = atoi(argv[++a]);
+		else if (o == "-q") quiet = 1;
+		else if (o == "-" || o[0] != '-') file = o;
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	std::ifstream fin;
+	if (!file.empty() && file != "-")
+	{
+		fin.open(file);
+		if (!fin) {
+			std::cerr << "Can't open " << file << "\n";
+			return 1;
+		}
+	}
+	std::istream & in = fin.is_open() ? fin : std::cin;
+
+	format f;
+	std::vector<long> rom;
+	program prog;
+	source src;
+	bool verilog = file.size() > 2 && file.substr(file.size() - 2) == ".v";
+	if (verilog)
+	{
+		if (!read_verilog(in, f, rom)) {
+			std::cerr << "No consistent `SEQ_ program list in " << file << "\n";
+			return 1;
+		}
+		if (depth > 0) f.std = depth;
+	}
+	else
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		try {
+			src.parse(in);
+		} catch (std::exception & e) {
+			std::cerr << file << ": " << e.what() << "\n";
+			return 1;
+		}
+		f = src.f;
+		// Named blocks used more than once may become subroutines;
+		// every choice is tried when there are few of them, otherwise one at a time
+		std::map<std::string, int> uses;
+		for (auto & n : src.nodes) if (n.kind == node::REF) uses[n.name]++;
+		std::vector<std::string> cand;
+		for (auto & u : uses) if (u.second > 1) cand.push_back(u.first);
+		std::string error;
+		long best = -1;
+		std::map<std::string, int> best_subs;
+		auto attempt = [&](const std::vector<std::string> & chosen)
+		{
+			std::map<std::string, int> subs;
+			for (auto & s : chosen) subs[s] = subs.size();
+			program p;
+			std::string e;
+			if (!build(src, subs, p, e))
+			{
+				if (error.empty()) error = e;
+				return -1L;
+			}
+			if (best < 0 || long(p.rom.size()) < best)
+			{
+				best = p.rom.size();
+				best_subs = subs;
+				prog = p;
+			}
+			return long(p.rom.size());
+		};
+		if (cand.size() <= 10)
+		{
+			for (long m=0; m < (1L << cand.size()); m++)
+			{
+				std::vector<std::string> chosen;
+				for (int i=0; i<cand.size(); i++) if (m >> i & 1) chosen.push_back(cand[i]);
+				attempt(chosen);
+			}
+		}
+		else
+		{
+			std::vector<std::string> chosen;
+			attempt(chosen);
+			for (auto & c : cand)
+			{
+				long before = best;
+				chosen.push_back(c);
+				long now = attempt(chosen);
+				if (now < 0 || now >= before) chosen.pop_back();
+			}
+		}
+		if (best < 0) {
+			std::cerr << file << ": " << error << "\n";
+			return 1;
+		}
+		rom = prog.rom;
+		double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		if (!verify(src, prog, verify_limit, error)) {
+			std::cerr << "Simulation doesn't match the description: " << error << "\n";
+			return 1;
+		}
+		int blocks = (long(rom.size()) * f.ocw + 4095) / 4096;
+		std::cerr << "//// " << rom.size() << " words (" << blocks << " RAM block" << (blocks > 1 ? "s" : "")
+			<< "), " << best_subs.size() << " subroutine" << (best_subs.size() == 1 ? "" : "s") << ", " << t << " s\n";
+	}
+
+	if (!sim.empty())
+	{
+		machine m(f, rom);
+		size_t next = 0;
+		char line[160];
+		auto t0 = std::chrono::steady_clock::now();
+		for (long c=0; c<cycles; c++)
+		{
+			bool jump = next < queue.size() && m.stopped();
+			int addr = jump ? queue[next] : 0;
+			int pc = m.pcr;
+			int op = m.cmd();
+			bool ok = m.step(jump, addr);
+			if (jump) next++;
+			if (!quiet)
+			{
+				snprintf(line, sizeof(line), "cycle: %ld\tpc: %d\t%-6s\tdata_o: %lx\tstop: %d\n", c, pc, mnemonic[op], m.data_o, op == SEQ_STOP);
+				std::cout << line;
+			}
+			if (!ok) {
+				std::cerr << "Jumped out of the ROM at cycle " << c << "\n";
+				return 1;
+			}
+		}
+		double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		std::cerr << "//// " << cycles << " cycles, pc " << m.pcr << ", data_o " << std::hex << m.data_o << std::dec
+			<< ", stack level " << m.lvl << ", " << cycles / t / 1e6 << " Mcycles/s\n";
+		return 0;
+	}
+
+	int sw = f.ocw - f.ddw - 3;
+	if (listing)
+	{
+		for (int i=0; i<prog.code.size(); i++)
+		{
+			const slot & s = prog.code[i];
+			std::string D;
+			for (int b=f.ddw-1; b>=0; b--) D += '0' + (s.D >> b & 1);
+			char line[160];
+			long param = (rom[i] >> f.ddw) & ((1L << sw) - 1);
+			snprintf(line, sizeof(line), "// %3d  %-6s %5ld  %s", i, mnemonic[s.op], param, D.c_str());
+			std::cout << line;
+			if (!prog.labels[i].empty()) std::cout << "\t" << prog.labels[i];
+			else if (s.line) std::cout << "\tline " << s.line;
+			std::cout << "\n";
+		}
+	}
+	for (int e=0; e<src.entries.size(); e++)
+	{
+		std::cout << "// entry " << src.entries[e].first << " at " << prog.entry_addr[e] << "\n";
+	}
+	if (outfmt == "rom")
+	{
+		std::cout << "rom #(\n\t.n(" << f.ocw << "),\n\t.m(" << rom.size() << "),\n\t.content_size(" << rom.size() << "),\n\t.data({\n";
+		char w[32];
+		for (int i=0; i<rom.size(); i++)
+		{
+			snprintf(w, sizeof(w), "%d'h%0*lx", f.ocw, (f.ocw + 3) / 4, rom[i]);
+			std::cout << "\t\t" << w << (i+1 < rom.size() ? "," : "") << "\t// " << i << "\n";
+		}
+		std::cout << "\t})\n)\n";
+		return 0;
+	}
+	std::cout << "\t.ocw(" << f.ocw << "),\n\t.ddw(" << f.ddw << "),\n\t.plen(" << rom.size() << "),\n\t.std(" << f.std << "),\n\t.program({\n";
+	for (int i=0; i<prog.code.size(); i++)
+	{
+		const slot & s = prog.code[i];
+		std::string D;
+		for (int b=f.ddw-1; b>=0; b--) D += '0' + (s.D >> b & 1);
+		long param = (rom[i] >> f.ddw) & ((1L << sw) - 1);
+		std::string op = std::string("`SEQ_") + mnemonic[s.op] + ",";
+		char line[160];
+		snprintf(line, sizeof(line), "\t\t%-12s %d'd%ld, %d'b%s%s\t// %02d", op.c_str(), sw, param, f.ddw, D.c_str(),
+			i+1 < prog.code.size() ? "," : "", i);
+		std::cout << line;
+		if (!prog.labels[i].empty()) std::cout << " " << prog.labels[i];
+		std::cout << "\n";
+	}
+	std::cout << "\t\t})\n";
+	return 0;
+}
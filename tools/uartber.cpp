@@ -0,0 +1,578 @@
+// UART receiver error rate analyzer
+// by Tomek Szczęsny 2024
+//
+// Bit exact models of the receivers of uart_rx.v, fed with 8n1 frames of
+// random data over lines with a clock error, edge jitter and glitches,
+// for bit error rate curves against the clock ratio.
+// Eight lines run side by side in vector lanes (see urkernels.h)
+// and batches of them are spread over threads.
+//
+// Time is counted in receiver clk cycles. A bit on the line lasts
+// o * (1 + e) cycles for the clock error e, o / 2 * (1 + e) for uart_rx_ddr
+// and 1 + e for uart_rx_no; the receiver clock is fast when e > 0.
+// Every line starts at a random phase of clk. Edges are moved by gaussian
+// jitter (in bits rms, clipped at 8 sigma) and glitches invert the line
+// for a while at random (poisson) times.
+//
+// A received byte belongs to the frame whose middle is the last one before
+// it. The 8 bits of a frame are compared with the first byte that belongs
+// to it, a frame with none counts as lost, and as 8 bit errors.
+// Further bytes are counted as spurious.
+//
+// uart_rx, uart_rx_vo and uart_rx_vo_dr sample the line the same way, and so
+// do uart_rx_no and uart_rx_no_dr; they only differ in their control ports.
+// uart_rx_ddr samples its pin like ddr_in_fake.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "urkernels.h"
+
+namespace ur {
+extern const kernel_set urk_scalar;
+#if defined(__x86_64__)
+extern const kernel_set urk_avx2;
+#endif
+}
+
+namespace {
+
+struct isa {
+	const ur::kernel_set * ks;
+	bool (*supported)();
+};
+
+// Best first
+const isa isas[] = {
+#if defined(__x86_64__)
+	{&ur::urk_avx2, []() -> bool { return __builtin_cpu_supports("avx2"); }},
+#endif
+	{&ur::urk_scalar, []() -> bool { return true; }},
+};
+
+const ur::kernel_set * ks = nullptr;
+
+bool set_isa(const std::string & name)
+{
+	for (auto & i : isas)
+	{
+		if ((name == "auto" || name == i.ks->name) && i.supported())
+		{
+			ks = i.ks;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+enum kind {OS, NO, DDR};
+
+struct variant {
+	const char * name;
+	kind k;
+	bool vo;		// "o" is an input, ow bits wide
+};
+
+const variant variants[] = {
+	{"uart_rx", OS, 0},
+	{"uart_rx_vo", OS, 1},
+	{"uart_rx_vo_dr", OS, 1},
+	{"uart_rx_no", NO, 0},
+	{"uart_rx_no_dr", NO, 0},
+	{"uart_rx_ddr", DDR, 0},
+};
+
+int clog2(int x)
+{
+	int w = 0;
+	while ((1 << w) < x) w++;
+	return w;
+}
+
+struct point {
+	const variant * v;
+	int o, w;		// "o" and the width of osc / osb
+	double e, jitter, glitch;
+	// Results
+	long frames = 0, errors = 0, lost = 0, spurious = 0;
+
+	double tb() const
+	{
+		return (v->k == NO ? 1 : v->k == DDR ? o / 2 : o) * (1 + e);
+	}
+};
+
+struct settings {
+	double gw = 1;		// Glitch length, clk cycles
+	double idle = 0;	// Longest idle time between frames, bits
+	long frames = 16384;	// Frames per lane and batch
+};
+
+// A transmitter and the line from it, as the receiver samples it
+class line {
+	public:
+	std::mt19937_64 g;
+	std::normal_distribution<double> nd;
+	std::exponential_distribution<double> ed;
+	std::uniform_real_distribution<double> ud;
+	double tb, jitter, grate, gw, idle;
+	double ph;			// Sampling phase of clk
+	double next = 0;		// Start of the next frame
+	double gnext;			// Next glitch
+	std::vector<double> tog;	// Level toggles, sorted from "head" on
+	size_t head = 0;
+	bool level = 1;			// Line level before tog[head]
+
+	struct frame {
+		double start;
+		int data;
+		bool got;
+	};
+	std::vector<frame> frames;	// Not closed from "fh" on
+	size_t fh = 0;
+	long closed = 0, errors = 0, lost = 0, spurious = 0;
+
+	line(unsigned long seed, const point & p, const settings & s) :
+		g(seed), ed(1), ud(0, 1), tb(p.tb()), jitter(p.jitter * p.tb()),
+		grate(p.glitch / p.tb()), gw(s.gw), idle(s.idle)
+	{
+		ph = ud(g);
+		next = 1 + ud(g) * tb;
+		gnext = grate ? ed(g) / grate : 0;
+	}
+
+	// Adds frames and glitches up to "until"
+	void extend(double until)
+	{
+		size_t from = tog.size();
+		while (next < until)
+		{
+			int d = g() & 255;
+			frames.push_back({next, d, 0});
+			// Start bit, data bits, stop bit
+			int prev = 1;
+			for (int k=0; k<10; k++)
+			{
+				int bit = k == 0 ? 0 : k == 9 ? 1 : d >> (k-1) & 1;
+				if (bit == prev) continue;
+				prev = bit;
+				double j = jitter ? std::max(-8., std::min(8., nd(g))) * jitter : 0;
+				tog.push_back(next + k*tb + j);
+			}
+			next += (10 + (idle ? ud(g) * idle : 0)) * tb;
+		}
+		while (grate && gnext < until)
+		{
+			tog.push_back(gnext);
+			tog.push_back(gnext + gw);
+			gnext += ed(g) / grate;
+		}
+		// Toggles come nearly sorted, only jitter and glitches move them
+		for (size_t i = std::max(from, head + 1); i < tog.size(); i++)
+		{
+			double x = tog[i];
+			size_t j = i;
+			for (; j > head && tog[j-1] > x; j--) tog[j] = tog[j-1];
+			tog[j] = x;
+		}
+	}
+
+	// Clears bit "bit" of the samples of [t0, t0+len) at which the line is low,
+	// the sample of cycle t being taken at t + off
+	void fill(uint8_t * in, long len, int64_t t0, double off, uint8_t bit) const
+	{
+		bool lv = level;
+		size_t h = head;
+		double s0 = t0 + off;
+		while (h < tog.size() && tog[h] <= s0)
+		{
+			lv = !lv;
+			h++;
+		}
+		long i = 0;
+		while (i < len)
+		{
+			long j = len;
+			if (h < tog.size()) j = std::min(len, long(std::ceil(tog[h] - s0)));
+			if (!lv) for (long k=i; k<j; k++) in[k] &= ~bit;
+			i = std::max(i, j);
+			if (h++ >= tog.size()) break;
+			lv = !lv;
+		}
+	}
+
+	// Drops toggles before "t"
+	void consume(double t)
+	{
+		while (head < tog.size() && tog[head] <= t)
+		{
+			level = !level;
+			head++;
+		}
+		if (head > 4096 && head * 2 > tog.size())
+		{
+			tog.erase(tog.begin(), tog.begin() + head);
+			head = 0;
+		}
+	}
+
+	void close()
+	{
+		frame & f = frames[fh++];
+		closed++;
+		if (!f.got)
+		{
+			lost++;
+			errors += 8;
+		}
+		if (fh > 4096 && fh * 2 > frames.size())
+		{
+			frames.erase(frames.begin(), frames.begin() + fh);
+			fh = 0;
+		}
+	}
+
+	// Received byte
+	void got(int64_t t, int out)
+	{
+		settle(t);
+		if (fh == frames.size() || t < frames[fh].start + 5*tb || frames[fh].got)
+		{
+			spurious++;
+			return;
+		}
+		frames[fh].got = 1;
+		errors += __builtin_popcount((out ^ frames[fh].data) & 255);
+	}
+
+	// Closes the frames no byte received after "t" can belong to
+	void settle(int64_t t)
+	{
+		while (fh + 1 < frames.size() && t >= frames[fh+1].start + 5*tb) close();
+	}
+};
+
+void setup(ur::batch & b, const point & p)
+{
+	b = {};
+	for (int l=0; l<ur::lanes; l++)
+	{
+		b.o[l] = p.o;
+		b.wm[l] = (1 << p.w) - 1;
+		b.state[l] = p.v->k == NO ? 2 : 0;
+		b.ib[l] = (1 << (p.o + 1)) - 1;
+		b.np[l] = 1;
+	}
+}
+
+// Runs a batch of lines through receivers
+void run_batch(point & p, const settings & s, unsigned long seed)
+{
+	const long chunk = 1 << 16;
+	std::vector<uint8_t> in(chunk), inn(chunk);
+	std::vector<ur::event> ev(chunk * ur::lanes / 8 + ur::lanes);
+	std::vector<line> ls;
+	for (int l=0; l<ur::lanes; l++) ls.emplace_back(seed * ur::lanes + l, p, s);
+	ur::batch b;
+	setup(b, p);
+	double tb = p.tb();
+	int64_t len = std::ceil(s.frames * (10 + s.idle / 2) * tb);
+	for (int64_t t0 = 0; t0 < len; t0 += chunk)
+	{
+		long n = std::min<int64_t>(chunk, len - t0);
+		std::fill(in.begin(), in.end(), 0xff);
+		if (p.v->k == DDR) std::fill(inn.begin(), inn.end(), 0xff);
+		for (int l=0; l<ur::lanes; l++)
+		{
+			line & x = ls[l];
+			x.extend(t0 + n + 2 + tb * (1 + 8 * p.jitter));
+			x.fill(in.data(), n, t0, x.ph, 1 << l);
+			if (p.v->k == DDR) x.fill(inn.data(), n, t0, x.ph + 0.5, 1 << l);
+			x.consume(t0 + n + x.ph);
+		}
+		long k;
+		if (p.v->k == OS) k = ks->os(&b, in.data(), n, t0, ev.data());
+		else if (p.v->k == NO) k = ks->no(&b, in.data(), n, t0, ev.data());
+		else k = ks->ddr(&b, in.data(), inn.data(), n, t0, ev.data());
+		for (long i=0; i<k; i++) ls[ev[i].lane].got(ev[i].t, ev[i].out);
+		for (auto & x : ls) x.settle(t0 + n);
+	}
+	for (auto & x : ls)
+	{
+		p.frames += x.closed;
+		p.errors += x.errors;
+		p.lost += x.lost;
+		p.spurious += x.spurious;
+	}
+}
+
+// Parses "a,b,c" and "from:to:step" lists
+std::vector<double> list(const std::string & s)
+{
+	std::vector<double> v;
+	size_t i = 0;
+	while (i <= s.size())
+	{
+		size_t j = s.find(',', i);
+		if (j == std::string::npos) j = s.size();
+		std::string e = s.substr(i, j-i);
+		double a, b, st;
+		if (sscanf(e.c_str(), "%lf:%lf:%lf", &a, &b, &st) == 3 && st != 0)
+		{
+			for (double x = a; st > 0 ? x <= b + 1e-9 : x >= b - 1e-9; x += st) v.push_back(x);
+		}
+		else if (!e.empty()) v.push_back(atof(e.c_str()));
+		i = j + 1;
+	}
+	return v;
+}
+
+// Compares the kernel sets on random lines, and checks that clean lines
+// are received without errors
+bool selftest()
+{
+	std::mt19937 g(1);
+	bool ok = 1;
+	const long len = 20000;
+	for (auto & i : isas)
+	{
+		if (!i.supported()) continue;
+		long bad = 0;
+		for (int r=0; r<60; r++)
+		{
+			std::vector<uint8_t> in(len), inn(len);
+			// Runs of random length, so the receivers see frames of sorts
+			for (int l=0; l<ur::lanes; l++)
+			{
+				int lv = 1;
+				for (long t=0; t<len; t++)
+				{
+					if (g() % 6 == 0) lv = !lv;
+					in[t] |= lv << l;
+					if (g() % 6 == 0) lv = !lv;
+					inn[t] |= lv << l;
+				}
+			}
+			point p;
+			p.v = &variants[r % 6];
+			p.o = p.v->k == DDR ? 4 + 2 * (g() % 12) : 4 + g() % 20;
+			p.w = p.v->vo ? 5 : clog2(p.o);
+			ur::batch b1, b2;
+			setup(b1, p);
+			setup(b2, p);
+			std::vector<ur::event> e1(len * ur::lanes / 8 + ur::lanes), e2(e1.size());
+			long k1 = 0, k2 = 0;
+			// Two runs, registers carried over
+			for (long t0 = 0; t0 < len; t0 += len / 2)
+			{
+				auto run = [&](const ur::kernel_set * k, ur::batch & b, ur::event * e) -> long
+				{
+					if (p.v->k == OS) return k->os(&b, in.data() + t0, len / 2, t0, e);
+					if (p.v->k == NO) return k->no(&b, in.data() + t0, len / 2, t0, e);
+					return k->ddr(&b, in.data() + t0, inn.data() + t0, len / 2, t0, e);
+				};
+				k1 += run(i.ks, b1, e1.data() + k1);
+				k2 += run(&ur::urk_scalar, b2, e2.data() + k2);
+			}
+			bool same = k1 == k2;
+			for (long j=0; same && j<k1; j++)
+			{
+				same = e1[j].t == e2[j].t && e1[j].lane == e2[j].lane && e1[j].out == e2[j].out;
+			}
+			if (!same) bad++;
+		}
+		std::cerr << "ISA " << i.ks->name << ": " << (bad ? "FAILED, " + std::to_string(bad) + " mismatches" : "ok") << "\n";
+		if (bad) ok = 0;
+	}
+	settings s;
+	s.frames = 500;
+	s.idle = 3;
+	set_isa("auto");
+	for (auto & v : variants)
+	{
+		point p;
+		p.v = &v;
+		p.o = 8;
+		p.w = v.vo ? 4 : 3;
+		p.e = p.jitter = p.glitch = 0;
+		run_batch(p, s, 1);
+		bool clean = p.frames > 400 && !p.errors && !p.spurious;
+		std::cerr << v.name << ", clean line: " << (clean ? "ok" : "FAILED") << "\n";
+		if (!clean) ok = 0;
+	}
+	return ok;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	settings s;
+	std::vector<std::string> vnames = {"uart_rx", "uart_rx_no", "uart_rx_ddr"};
+	std::vector<double> os = {4, 8, 16}, es = {-5, -4, -3, -2, -1, 0, 1, 2, 3, 4, 5}, js = {0}, gs = {0};
+	double bits = 1e9;
+	int ow = 0;
+	unsigned long seed = 1;
+	int threads = std::thread::hardware_concurrency();
+	std::string isaname = "auto";
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "uartber [options]\n";
+			std::cerr << "Lists are given as a,b,c or from:to:step, and every combination is simulated.\n";
+			std::cerr << "  -v [names]      Receivers, module names or \"all\" (default: uart_rx,uart_rx_no,uart_rx_ddr)\n";
+			std::cerr << "  -o [list]       Oversampling \"o\", not used by uart_rx_no (default: 4,8,16)\n";
+			std::cerr << "  --ow [bits]     \"ow\" of uart_rx_vo, 0 for the smallest that holds o (default: 0)\n";
+			std::cerr << "  -e [list]       Receiver clock error, % (default: -5:5:1)\n";
+			std::cerr << "  --jitter [list] Edge jitter, bits rms (default: 0)\n";
+			std::cerr << "  -g [list]       Glitches per bit (default: 0)\n";
+			std::cerr << "  --gw [cycles]   Glitch length, clk cycles (default: 1)\n";
+			std::cerr << "  --idle [bits]   Idle line between frames, random up to this (default: 0)\n";
+			std::cerr << "  -b [bits]       Bits per point (default: 1e9)\n";
+			std::cerr << "  -s [seed]       Random seed (default: 1)\n";
+			std::cerr << "  -j [threads]    Threads (default: all cores)\n";
+			std::cerr << "  --isa [name]    Kernel instruction set: auto, scalar, avx2\n";
+			std::cerr << "  --selftest      Checks the kernel sets and clean lines\n";
+			return 0;
+		}
+		if (o == "--selftest") return selftest() ? 0 : 1;
+		if (a+1 < argc && o == "-v")
+		{
+			vnames.clear();
+			std::string l = argv[++a];
+			size_t i = 0;
+			while (i <= l.size())
+			{
+				size_t j = l.find(',', i);
+				if (j == std::string::npos) j = l.size();
+				if (j > i) vnames.push_back(l.substr(i, j-i));
+				i = j + 1;
+			}
+		}
+		else if (a+1 < argc && o == "-o") os = list(argv[++a]);
+		else if (a+1 < argc && o == "--ow") ow = atoi(argv[++a]);
+		else if (a+1 < argc && o == "-e") es = list(argv[++a]);
+		else if (a+1 < argc && o == "--jitter") js = list(argv[++a]);
+		else if (a+1 < argc && o == "-g") gs = list(argv[++a]);
+		else if (a+1 < argc && o == "--gw") s.gw = atof(argv[++a]);
+		else if (a+1 < argc && o == "--idle") s.idle = atof(argv[++a]);
+		else if (a+1 < argc && o == "-b") bits = atof(argv[++a]);
+		else if (a+1 < argc && o == "-s") seed = atol(argv[++a]);
+		else if (a+1 < argc && o == "-j") threads = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--isa") isaname = argv[++a];
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (!set_isa(isaname)) {
+		std::cerr << "ISA " << isaname << " is not supported here\n";
+		return 1;
+	}
+	if (vnames.size() == 1 && vnames[0] == "all")
+	{
+		vnames.clear();
+		for (auto & v : variants) vnames.push_back(v.name);
+	}
+
+	// Every combination
+	std::vector<point> ps;
+	for (auto & n : vnames)
+	{
+		const variant * v = nullptr;
+		for (auto & x : variants) if (n == x.name) v = &x;
+		if (!v) {
+			std::cerr << "Unknown receiver " << n << "\n";
+			return 1;
+		}
+		for (double o : os)
+		{
+			int io = o;
+			// uart_rx_no has no "o"
+			if (v->k == NO && o != os[0]) continue;
+			if (v->k == NO) io = 1;
+			else if (io < 4 || io > 1000 || (v->k == DDR && (io % 2 || io > 28))) {
+				std::cerr << v->name << " can't oversample " << io << " times\n";
+				return 1;
+			}
+			int w = v->vo ? (ow ? ow : std::max(3, clog2(io + 1))) : clog2(io);
+			if (v->vo && (1 << w) <= io) {
+				std::cerr << "o = " << io << " doesn't fit in ow = " << w << " bits\n";
+				return 1;
+			}
+			for (double e : es) for (double j : js) for (double gl : gs)
+			{
+				if (e <= -50 || j < 0 || gl < 0) {
+					std::cerr << "Bad clock error, jitter or glitch rate\n";
+					return 1;
+				}
+				point p;
+				p.v = v;
+				p.o = io;
+				p.w = w;
+				p.e = e / 100;
+				p.jitter = j;
+				p.glitch = gl;
+				ps.push_back(p);
+			}
+		}
+	}
+
+	// Every point gets enough batches for its bits; results are summed
+	// per batch, so they don't depend on the threads
+	long nb = std::max(1L, std::lround(std::ceil(bits / (8. * ur::lanes * s.frames))));
+	long units = ps.size() * nb;
+	std::vector<point> res(units);
+	std::atomic<long> next{0};
+	auto t0 = std::chrono::steady_clock::now();
+	auto worker = [&]()
+	{
+		long u;
+		while ((u = next++) < units)
+		{
+			res[u] = ps[u / nb];
+			run_batch(res[u], s, seed * 1000003 + u % nb);
+		}
+	};
+	threads = std::max(1, std::min<int>(threads, units));
+	std::vector<std::thread> pool;
+	for (int t=1; t<threads; t++) pool.emplace_back(worker);
+	worker();
+	for (auto & t : pool) t.join();
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	printf("%-14s %4s %8s %6s %6s %8s %12s %10s %10s %10s %10s\n",
+		"receiver", "o", "clk/bit", "e %", "jitter", "glitch", "bits", "errors", "BER", "lost", "spurious");
+	long total = 0;
+	for (size_t i=0; i<ps.size(); i++)
+	{
+		point & p = ps[i];
+		for (long u=0; u<nb; u++)
+		{
+			point & r = res[i * nb + u];
+			p.frames += r.frames;
+			p.errors += r.errors;
+			p.lost += r.lost;
+			p.spurious += r.spurious;
+		}
+		long n = p.frames * 8;
+		total += n;
+		char ber[32];
+		// No errors: the 95% upper bound
+		if (p.errors) snprintf(ber, sizeof(ber), "%.3e", double(p.errors) / n);
+		else snprintf(ber, sizeof(ber), "<%.1e", 3. / n);
+		printf("%-14s %4d %8.4f %6.2f %6.3f %8.2e %12ld %10ld %10s %10ld %10ld\n",
+			p.v->name, p.v->k == NO ? 1 : p.o, p.tb(), p.e * 100, p.jitter, p.glitch,
+			n, p.errors, ber, p.lost, p.spurious);
+	}
+	std::cerr << "//// " << ks->name << ", " << total / secs / 1e6 << " Mbit/s\n";
+	return 0;
+}
@@ -0,0 +1,52 @@
+// UART receiver error rate analyzer
+// by Tomek Szczęsny 2024
+//
+// Receiver kernels of uartber.
+// urkernels_isa.cpp is built once per instruction set;
+// the best set the CPU supports is picked at startup.
+//
+
+#ifndef URKERNELS_H
+#define URKERNELS_H
+
+#include <cstdint>
+
+namespace ur {
+
+const int lanes = 8;
+
+// Eight receivers of uart_rx.v run side by side, one per lane, each on its
+// own line. Registers start at their initial values and are kept between
+// runs, so a stream can be fed in chunks.
+struct batch {
+	// Parameters
+	int32_t o[lanes];		// os, ddr: "o" of the module
+	int32_t wm[lanes];		// os: osc and osb width mask
+	// Registers
+	int32_t state[lanes], osc[lanes], osb[lanes], oub[lanes];
+	int32_t ib[lanes], offset[lanes], np[lanes];	// ddr only
+};
+
+// "out" updated at clock edge t
+struct event {
+	int64_t t;
+	int32_t lane, out;
+};
+
+struct kernel_set {
+	const char * name;
+	// Run len clk cycles, which are numbered from t0. Bit i of in[t] is the
+	// input of lane i at posedge t, of inn[t] at the following negedge.
+	// Each receiver emits fewer than one event per 8 cycles, so ev has to hold
+	// len * lanes / 8 + lanes events. Returns the number of events.
+	// uart_rx, uart_rx_vo and uart_rx_vo_dr:
+	long (*os)(batch * b, const uint8_t * in, long len, int64_t t0, event * ev);
+	// uart_rx_no and uart_rx_no_dr:
+	long (*no)(batch * b, const uint8_t * in, long len, int64_t t0, event * ev);
+	// uart_rx_ddr, with ddr_in sampling as ddr_in_fake does:
+	long (*ddr)(batch * b, const uint8_t * in, const uint8_t * inn, long len, int64_t t0, event * ev);
+};
+
+}
+
+#endif
@@ -0,0 +1,342 @@
+// UART receiver error rate analyzer
+// by Tomek Szczęsny 2024
+//
+// The os, no and ddr receiver kernels, eight receivers per call,
+// one object per instruction set (URK_ISA).
+//
+// Every kernel is the "always @(posedge clk)" block of its module,
+// the nonblocking assignments done on copies of the registers.
+//
+
+#include "urkernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifndef URK_ISA
+#define URK_ISA scalar
+#endif
+
+#define URK_STR2(x) #x
+#define URK_STR(x) URK_STR2(x)
+#define URK_CAT2(a, b) a ## b
+#define URK_CAT(a, b) URK_CAT2(a, b)
+
+namespace ur {
+namespace URK_CAT(isa_, URK_ISA) {
+
+#if defined(__AVX2__)
+
+#define LD(f) _mm256_loadu_si256((const __m256i *) b->f)
+#define ST(f, v) _mm256_storeu_si256((__m256i *) b->f, v)
+#define SET(x) _mm256_set1_epi32(x)
+#define EQ(a, b) _mm256_cmpeq_epi32(a, b)
+#define GT(a, b) _mm256_cmpgt_epi32(a, b)
+#define AND(a, b) _mm256_and_si256(a, b)
+#define ANDN(a, b) _mm256_andnot_si256(a, b)
+#define OR(a, b) _mm256_or_si256(a, b)
+#define ADD(a, b) _mm256_add_epi32(a, b)
+#define SEL(m, a, b) _mm256_blendv_epi8(b, a, m)	// m ? a : b
+
+// Lane l of the result is -1 if bit l of x is set
+static inline __m256i unpack(uint8_t x)
+{
+	const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	return EQ(AND(SET(x), bit), bit);
+}
+
+static inline long emit(__m256i m, __m256i out, int64_t t, event * ev)
+{
+	int mask = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+	if (!mask) return 0;
+	int32_t v[lanes];
+	_mm256_storeu_si256((__m256i *) v, out);
+	long k = 0;
+	for (int l=0; l<lanes; l++)
+	{
+		if (!(mask >> l & 1)) continue;
+		ev[k].t = t;
+		ev[k].lane = l;
+		ev[k++].out = v[l];
+	}
+	return k;
+}
+
+static long os(batch * b, const uint8_t * in, long len, int64_t t0, event * ev)
+{
+	const __m256i o1 = ADD(LD(o), SET(-1)), oh = _mm256_srai_epi32(LD(o), 1), wm = LD(wm);
+	const __m256i one = SET(1), zero = _mm256_setzero_si256(), nine = SET(9);
+	__m256i s = LD(state), c = LD(osc), bb = LD(osb), oub = LD(oub);
+	long k = 0;
+	for (long t=0; t<len; t++)
+	{
+		__m256i xm = unpack(in[t]);
+		__m256i x = AND(xm, one);
+		__m256i arb = GT(ADD(bb, x), oh);
+		__m256i idle = EQ(s, zero), stop = GT(s, nine);
+		__m256i start = ANDN(xm, idle);
+		__m256i end = ANDN(OR(idle, stop), EQ(c, o1));
+		k += emit(AND(stop, EQ(c, zero)), oub, t0 + t, ev + k);
+		// Bit ends: a start bit is checked, data bits shift into oub
+		__m256i sb = EQ(s, one);
+		oub = SEL(ANDN(sb, end), OR(_mm256_srli_epi32(oub, 1), AND(arb, SET(128))), oub);
+		__m256i ns = SEL(sb, ANDN(arb, SET(2)), ADD(s, one));
+		ns = SEL(end, ns, s);
+		ns = SEL(start, one, ns);
+		s = SEL(AND(stop, EQ(c, one)), zero, ns);
+		__m256i cnt = ANDN(idle, OR(stop, _mm256_cmpeq_epi32(end, zero)));
+		bb = SEL(ANDN(stop, cnt), AND(ADD(bb, x), wm), bb);
+		c = SEL(cnt, AND(ADD(c, one), wm), c);
+		bb = SEL(OR(start, end), zero, bb);
+		c = SEL(start, one, SEL(end, zero, c));
+	}
+	ST(state, s);
+	ST(osc, c);
+	ST(osb, bb);
+	ST(oub, oub);
+	return k;
+}
+
+static long no(batch * b, const uint8_t * in, long len, int64_t t0, event * ev)
+{
+	const __m256i one = SET(1), zero = _mm256_setzero_si256();
+	__m256i s = LD(state), oub = LD(oub);
+	long k = 0;
+	for (long t=0; t<len; t++)
+	{
+		__m256i xm = unpack(in[t]);
+		__m256i x = AND(xm, one);
+		k += emit(EQ(AND(s, SET(11)), zero), OR(_mm256_slli_epi32(x, 7), oub), t0 + t, ev + k);
+		oub = SEL(GT(s, SET(7)), OR(_mm256_srli_epi32(oub, 1), _mm256_slli_epi32(x, 6)), oub);
+		__m256i wait = EQ(AND(s, SET(10)), SET(2));
+		s = SEL(wait, SEL(xm, s, SET(9)), AND(ADD(s, one), SET(15)));
+	}
+	ST(state, s);
+	ST(oub, oub);
+	return k;
+}
+
+static inline __m256i popcount(__m256i v)
+{
+	v = _mm256_sub_epi32(v, AND(_mm256_srli_epi32(v, 1), SET(0x55555555)));
+	v = ADD(AND(v, SET(0x33333333)), AND(_mm256_srli_epi32(v, 2), SET(0x33333333)));
+	v = AND(ADD(v, _mm256_srli_epi32(v, 4)), SET(0x0f0f0f0f));
+	return _mm256_srli_epi32(_mm256_mullo_epi32(v, SET(0x01010101)), 24);
+}
+
+static long ddr(batch * b, const uint8_t * in, const uint8_t * inn, long len, int64_t t0, event * ev)
+{
+	int32_t vcm[lanes], vom[lanes], vibm[lanes];
+	for (int l=0; l<lanes; l++)
+	{
+		int oh = b->o[l] / 2, w = 0;
+		while ((1 << w) < oh) w++;
+		vcm[l] = w ? (1 << w) - 1 : 0;
+		vom[l] = (1 << b->o[l]) - 1;
+		vibm[l] = (1 << (b->o[l] + 1)) - 1;
+	}
+	const __m256i cm = _mm256_loadu_si256((const __m256i *) vcm);
+	const __m256i om = _mm256_loadu_si256((const __m256i *) vom);
+	const __m256i ibm = _mm256_loadu_si256((const __m256i *) vibm);
+	const __m256i oh = _mm256_srai_epi32(LD(o), 1), oh1 = ADD(oh, SET(-1));
+	const __m256i one = SET(1), zero = _mm256_setzero_si256(), three = SET(3);
+	__m256i s = LD(state), c = LD(osc), oub = LD(oub), ib = LD(ib), off = LD(offset), np = LD(np);
+	long k = 0;
+	for (long t=0; t<len; t++)
+	{
+		__m256i arb = GT(popcount(AND(_mm256_srlv_epi32(ib, off), om)), oh);
+		__m256i i2 = AND(ib, three);
+		__m256i idle = EQ(s, zero), sb = EQ(s, one), last = EQ(s, SET(9)), stop = GT(s, SET(9));
+		__m256i start = ANDN(EQ(i2, three), idle);
+		__m256i late = EQ(i2, SET(2));
+		__m256i end = ANDN(OR(idle, stop), EQ(c, oh1));
+		k += emit(AND(last, end), OR(oub, AND(arb, SET(128))), t0 + t, ev + k);
+		__m256i data = ANDN(OR(sb, last), end);
+		oub = SEL(data, OR(_mm256_srli_epi32(oub, 1), AND(arb, SET(64))), oub);
+		__m256i ns = SEL(end, SEL(sb, ANDN(arb, SET(2)), ADD(s, one)), s);
+		ns = SEL(start, one, ns);
+		s = SEL(stop, zero, ns);
+		c = SEL(ANDN(OR(idle, stop), _mm256_cmpeq_epi32(end, zero)), AND(ADD(c, one), cm), c);
+		c = SEL(end, zero, c);
+		c = SEL(start, OR(ANDN(one, c), ANDN(late, one)), c);
+		off = SEL(start, AND(late, one), SEL(stop, zero, off));
+		// Negedge: ddr_in outputs, sampled at the last posedge and negedge
+		__m256i p = AND(unpack(in[t]), one);
+		ib = AND(OR(_mm256_slli_epi32(ib, 2), OR(_mm256_slli_epi32(np, 1), p)), ibm);
+		np = AND(unpack(inn[t]), one);
+	}
+	ST(state, s);
+	ST(osc, c);
+	ST(oub, oub);
+	ST(ib, ib);
+	ST(offset, off);
+	ST(np, np);
+	return k;
+}
+
+#undef LD
+#undef ST
+
+#else
+
+static long os(batch * b, const uint8_t * in, long len, int64_t t0, event * ev)
+{
+	long k = 0;
+	for (long t=0; t<len; t++)
+	{
+		for (int l=0; l<lanes; l++)
+		{
+			int x = in[t] >> l & 1;
+			int s = b->state[l], c = b->osc[l], bb = b->osb[l], o = b->o[l], m = b->wm[l];
+			bool arb = bb + x > (o >> 1);
+			if (s == 0)
+			{
+				// Waiting for start bit
+				if (!x)
+				{
+					s = 1;
+					c = 1;
+					bb = 0;
+				}
+			}
+			else if (s < 10)
+			{
+				// Start and data bits
+				if (c == o-1)
+				{
+					if (s == 1) s = arb ? 0 : 2;
+					else
+					{
+						s++;
+						b->oub[l] = b->oub[l] >> 1 | arb << 7;
+					}
+					c = 0;
+					bb = 0;
+				}
+				else
+				{
+					c = (c + 1) & m;
+					bb = (bb + x) & m;
+				}
+			}
+			else
+			{
+				// Stop bit
+				if (c == 0)
+				{
+					ev[k].t = t0 + t;
+					ev[k].lane = l;
+					ev[k++].out = b->oub[l];
+				}
+				if (c == 1) s = 0;
+				c = (c + 1) & m;
+			}
+			b->state[l] = s;
+			b->osc[l] = c;
+			b->osb[l] = bb;
+		}
+	}
+	return k;
+}
+
+static long no(batch * b, const uint8_t * in, long len, int64_t t0, event * ev)
+{
+	long k = 0;
+	for (long t=0; t<len; t++)
+	{
+		for (int l=0; l<lanes; l++)
+		{
+			int x = in[t] >> l & 1;
+			int s = b->state[l];
+			// The last bit
+			if ((s & 11) == 0)
+			{
+				ev[k].t = t0 + t;
+				ev[k].lane = l;
+				ev[k++].out = x << 7 | b->oub[l];
+			}
+			// Data bits
+			if (s & 8) b->oub[l] = b->oub[l] >> 1 | x << 6;
+			// Waiting for a start bit
+			if ((s & 10) == 2)
+			{
+				if (!x) s = 9;
+			}
+			else s = (s + 1) & 15;
+			b->state[l] = s;
+		}
+	}
+	return k;
+}
+
+static long ddr(batch * b, const uint8_t * in, const uint8_t * inn, long len, int64_t t0, event * ev)
+{
+	long k = 0;
+	for (long t=0; t<len; t++)
+	{
+		for (int l=0; l<lanes; l++)
+		{
+			int o = b->o[l], oh = o / 2, w = 0;
+			while ((1 << w) < oh) w++;
+			int cm = (1 << w) - 1;
+			int s = b->state[l], c = b->osc[l], ib = b->ib[l], off = b->offset[l];
+			bool arb = __builtin_popcount((ib >> off) & ((1 << o) - 1)) > oh;
+			if (s == 0)
+			{
+				if ((ib & 3) != 3)
+				{
+					s = 1;
+					c = (c & ~1) | ((ib & 3) != 2);
+					off = (ib & 3) == 2;
+				}
+			}
+			else if (s < 10)
+			{
+				if (c == oh-1)
+				{
+					if (s == 1) s = arb ? 0 : 2;
+					else if (s < 9)
+					{
+						s++;
+						b->oub[l] = b->oub[l] >> 1 | arb << 6;
+					}
+					else
+					{
+						s = 10;
+						ev[k].t = t0 + t;
+						ev[k].lane = l;
+						ev[k++].out = arb << 7 | b->oub[l];
+					}
+					c = 0;
+				}
+				else c = (c + 1) & cm;
+			}
+			else
+			{
+				s = 0;
+				off = 0;
+			}
+			// Negedge: ddr_in outputs, sampled at the last posedge and negedge
+			b->ib[l] = ((ib << 2) | (b->np[l] << 1) | (in[t] >> l & 1)) & ((1 << (o + 1)) - 1);
+			b->np[l] = inn[t] >> l & 1;
+			b->state[l] = s;
+			b->osc[l] = c;
+			b->offset[l] = off;
+		}
+	}
+	return k;
+}
+
+#endif
+
+}
+
+extern const kernel_set URK_CAT(urk_, URK_ISA) = {
+	URK_STR(URK_ISA),
+	URK_CAT(isa_, URK_ISA)::os,
+	URK_CAT(isa_, URK_ISA)::no,
+	URK_CAT(isa_, URK_ISA)::ddr
+};
+
+}
@@ -0,0 +1,36 @@
+// Video path reference model
+// by Tomek Szczęsny 2024
+//
+// Pixel kernels of vidref and rgbcoef.
+// vidkernels_isa.cpp is built once per instruction set;
+// the best set the CPU supports is picked at startup.
+//
+
+#ifndef VIDKERNELS_H
+#define VIDKERNELS_H
+
+#include <cstdint>
+
+namespace vid {
+
+struct kernel_set {
+	const char * name;
+	// y[i] = (cr*R + cg*G + cb*B) >> sh for n pixels of interleaved 8-bit RGB,
+	// as rgb_g_cie1931 and rgb_g_ntsc add their shifted terms.
+	// Weights add up to 128 at most, so sums fit 16 bits.
+	void (*gray)(const uint8_t * rgb, int n, int cr, int cg, int cb, int sh, uint16_t * y);
+	// Monochrome dither of n pixels against thresholds t:
+	//   v = (in[i] << shl >> shr) & mask, all in 16 bits
+	//   out[i] = v > lo && (v >= hi || v == eq || v > t[i])
+	// which covers both ordered_mono and blue_mono.
+	void (*dither)(const uint16_t * in, const uint16_t * t, int n, int shl, int shr, int mask,
+		int lo, int eq, int hi, uint8_t * out);
+	// Error of a gray sum along the blue axis, b = 0 .. n-1:
+	//   e = ((base + c*b) >> q) - (ref + wb*b)
+	// Raises *emax to the largest |e| and adds the sum of e^2 to *esq.
+	void (*gray_err)(int base, int c, int q, float ref, float wb, int n, float * emax, double * esq);
+};
+
+}
+
+#endif
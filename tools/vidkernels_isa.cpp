@@ -0,0 +1,159 @@
+// Video path reference model
+// by Tomek Szczęsny 2024
+//
+// Gray conversion, ordered dither and coefficient error kernels of
+// vidref and rgbcoef, one object per instruction set (VIDK_ISA).
+//
+
+#include "vidkernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifndef VIDK_ISA
+#define VIDK_ISA scalar
+#endif
+
+#define VIDK_STR2(x) #x
+#define VIDK_STR(x) VIDK_STR2(x)
+#define VIDK_CAT2(a, b) a ## b
+#define VIDK_CAT(a, b) VIDK_CAT2(a, b)
+
+namespace vid {
+namespace VIDK_CAT(isa_, VIDK_ISA) {
+
+static void gray(const uint8_t * rgb, int n, int cr, int cg, int cb, int sh, uint16_t * y)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	// 16 pixels at a time: three 16 byte loads are sorted into R, G and B
+	// by byte shuffles, then widened to 16 bits.
+	alignas(16) int8_t sel[3][3][16];
+	for (int c=0; c<3; c++)
+	{
+		for (int part=0; part<3; part++)
+		{
+			for (int k=0; k<16; k++)
+			{
+				int src = 3*k + c - 16*part;
+				sel[c][part][k] = src >= 0 && src < 16 ? src : -1;
+			}
+		}
+	}
+	__m128i s[3][3];
+	for (int c=0; c<3; c++)
+	{
+		for (int part=0; part<3; part++) s[c][part] = _mm_load_si128((const __m128i *) sel[c][part]);
+	}
+	const __m256i wr = _mm256_set1_epi16(cr), wg = _mm256_set1_epi16(cg), wb = _mm256_set1_epi16(cb);
+	const __m128i shc = _mm_cvtsi32_si128(sh);
+	for (; i+16 <= n; i += 16)
+	{
+		const uint8_t * p = rgb + 3*i;
+		__m128i a = _mm_loadu_si128((const __m128i *) p);
+		__m128i b = _mm_loadu_si128((const __m128i *) (p+16));
+		__m128i c = _mm_loadu_si128((const __m128i *) (p+32));
+		__m256i ch[3];
+		for (int k=0; k<3; k++)
+		{
+			__m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, s[k][0]), _mm_shuffle_epi8(b, s[k][1])),
+				_mm_shuffle_epi8(c, s[k][2]));
+			ch[k] = _mm256_cvtepu8_epi16(v);
+		}
+		__m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(ch[0], wr),
+			_mm256_mullo_epi16(ch[1], wg)), _mm256_mullo_epi16(ch[2], wb));
+		_mm256_storeu_si256((__m256i *) (y+i), _mm256_srl_epi16(sum, shc));
+	}
+#endif
+	for (; i<n; i++)
+	{
+		const uint8_t * p = rgb + 3*i;
+		y[i] = uint16_t(cr*p[0] + cg*p[1] + cb*p[2]) >> sh;
+	}
+}
+
+static void dither(const uint16_t * in, const uint16_t * t, int n, int shl, int shr, int mask,
+	int lo, int eq, int hi, uint8_t * out)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	// Unsigned 16 bit compares: a <= b exactly when min(a, b) == a
+	const __m128i l = _mm_cvtsi32_si128(shl), r = _mm_cvtsi32_si128(shr);
+	const __m256i m = _mm256_set1_epi16(mask), vlo = _mm256_set1_epi16(lo);
+	const __m256i veq = _mm256_set1_epi16(eq), vhi = _mm256_set1_epi16(hi);
+	const __m256i one = _mm256_set1_epi8(1);
+	for (; i+16 <= n; i += 16)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) (in+i));
+		v = _mm256_and_si256(_mm256_srl_epi16(_mm256_sll_epi16(v, l), r), m);
+		__m256i th = _mm256_loadu_si256((const __m256i *) (t+i));
+		__m256i le_lo = _mm256_cmpeq_epi16(_mm256_min_epu16(v, vlo), v);
+		__m256i le_t = _mm256_cmpeq_epi16(_mm256_min_epu16(v, th), v);
+		__m256i ge_hi = _mm256_cmpeq_epi16(_mm256_max_epu16(v, vhi), v);
+		__m256i is_eq = _mm256_cmpeq_epi16(v, veq);
+		__m256i set = _mm256_or_si256(_mm256_or_si256(ge_hi, is_eq), _mm256_andnot_si256(le_t, _mm256_cmpeq_epi16(v, v)));
+		set = _mm256_andnot_si256(le_lo, set);
+		// Words to bytes; packs works within 128 bit lanes, so put the halves back together
+		__m256i b = _mm256_permute4x64_epi64(_mm256_packs_epi16(set, set), 0x08);
+		_mm_storeu_si128((__m128i *) (out+i), _mm256_castsi256_si128(_mm256_and_si256(b, one)));
+	}
+#endif
+	for (; i<n; i++)
+	{
+		int v = (uint16_t(in[i] << shl) >> shr) & mask;
+		out[i] = v > lo && (v >= hi || v == eq || v > t[i]);
+	}
+}
+
+static void gray_err(int base, int c, int q, float ref, float wb, int n, float * emax, double * esq)
+{
+	int i = 0;
+	float mx = *emax, sq = 0;
+#if defined(__AVX2__)
+	const __m128i qc = _mm_cvtsi32_si128(q);
+	const __m256i step = _mm256_set1_epi32(8*c);
+	const __m256 vref = _mm256_set1_ps(ref), vwb = _mm256_set1_ps(wb), eight = _mm256_set1_ps(8);
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	__m256i s = _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+		_mm256_set1_epi32(c)));
+	__m256 x = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256 vmx = _mm256_set1_ps(mx), vsq = _mm256_setzero_ps();
+	for (; i+8 <= n; i += 8)
+	{
+		__m256 e = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_srl_epi32(s, qc)), _mm256_add_ps(vref, _mm256_mul_ps(vwb, x)));
+		vmx = _mm256_max_ps(vmx, _mm256_andnot_ps(sign, e));
+		vsq = _mm256_add_ps(vsq, _mm256_mul_ps(e, e));
+		s = _mm256_add_epi32(s, step);
+		x = _mm256_add_ps(x, eight);
+	}
+	alignas(32) float t[2][8];
+	_mm256_store_ps(t[0], vmx);
+	_mm256_store_ps(t[1], vsq);
+	for (int k=0; k<8; k++)
+	{
+		mx = t[0][k] > mx ? t[0][k] : mx;
+		sq += t[1][k];
+	}
+#endif
+	for (; i<n; i++)
+	{
+		float e = float((base + c*i) >> q) - (ref + wb*float(i));
+		e = e < 0 ? -e : e;
+		mx = e > mx ? e : mx;
+		sq += e*e;
+	}
+	*emax = mx;
+	*esq += sq;
+}
+
+}
+
+extern const kernel_set VIDK_CAT(vk_, VIDK_ISA) = {
+	VIDK_STR(VIDK_ISA),
+	VIDK_CAT(isa_, VIDK_ISA)::gray,
+	VIDK_CAT(isa_, VIDK_ISA)::dither,
+	VIDK_CAT(isa_, VIDK_ISA)::gray_err
+};
+
+}
@@ -0,0 +1,463 @@
+// Video path reference model
+// by Tomek Szczęsny 2024
+//
+// A bit exact model of rgb_g_cie1931 / rgb_g_ntsc (rgb_to_gray.v) and of
+// ordered_mono / blue_mono (dither.v), for whole frames at video rates.
+// Pixel kernels are vectorized (see vidkernels.h), and rows of a frame
+// are split into bands processed by several threads.
+//
+// Input is a stream of binary PPM / PGM images, or raw frames with -s:
+// 8-bit RGB with -g, 8-bit gray otherwise. Output is of the same kind:
+// PGM (maxval 2^m-1 for gray, 1 for dithered pixels) or raw frames
+// (dithered pixels as 0 / 1 bytes, gray in 1 byte, or 2 bytes little
+// endian if m > 8).
+//
+// Golden vectors of the first frame, for testbenches ($readmemh),
+// have one pixel per line:
+//   r g b x y gray out
+// x and y are the pixel coordinates given to the dither module.
+// blue_mono registers its map lookup, so a testbench has to present
+// x and y one clock before "in".
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vidkernels.h"
+
+namespace vid {
+extern const kernel_set vk_scalar;
+#if defined(__x86_64__)
+extern const kernel_set vk_avx2;
+#endif
+}
+
+namespace {
+
+struct isa {
+	const vid::kernel_set * ks;
+	bool (*supported)();
+};
+
+// Best first
+const isa isas[] = {
+#if defined(__x86_64__)
+	{&vid::vk_avx2, []() -> bool { return __builtin_cpu_supports("avx2"); }},
+#endif
+	{&vid::vk_scalar, []() -> bool { return true; }},
+};
+
+const vid::kernel_set * ks = nullptr;
+
+bool set_isa(const std::string & name)
+{
+	for (auto & i : isas)
+	{
+		if ((name == "auto" || name == i.ks->name) && i.supported())
+		{
+			ks = i.ks;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Compares every supported kernel set against the scalar one
+bool selftest()
+{
+	std::mt19937 g(1);
+	bool ok = 1;
+	for (auto & i : isas)
+	{
+		if (!i.supported()) continue;
+		const vid::kernel_set & k = *i.ks;
+		const vid::kernel_set & r = vid::vk_scalar;
+		long bad = 0;
+		for (int n=0; n<2000; n++)
+		{
+			int len = g() % 100;
+			std::vector<uint8_t> rgb(3*len + 1);
+			for (auto & c : rgb) c = g();
+			int w[3];
+			for (int & c : w) c = g() % 43;
+			int sh = g() % 8;
+			std::vector<uint16_t> y1(len), y2(len);
+			k.gray(rgb.data(), len, w[0], w[1], w[2], sh, y1.data());
+			r.gray(rgb.data(), len, w[0], w[1], w[2], sh, y2.data());
+			if (y1 != y2) bad++;
+		}
+		for (int n=0; n<2000; n++)
+		{
+			int len = g() % 100;
+			std::vector<uint16_t> in(len), t(len);
+			for (auto & c : in) c = g() % 4096;
+			for (auto & c : t) c = g();
+			int shl = g() % 9, shr = g() % 5, mask = (1 << (1 + g() % 16)) - 1;
+			int lo = g() % 8, eq = g() % 4096, hi = g() % 65536;
+			std::vector<uint8_t> o1(len), o2(len);
+			k.dither(in.data(), t.data(), len, shl, shr, mask, lo, eq, hi, o1.data());
+			r.dither(in.data(), t.data(), len, shl, shr, mask, lo, eq, hi, o2.data());
+			if (o1 != o2) bad++;
+		}
+		// Float sums are added in another order, so these compare loosely
+		for (int n=0; n<2000; n++)
+		{
+			int len = g() % 300, c = g() % 200, q = g() % 12, base = g() % 100000;
+			float ref = (g() % 100000) / 37.0f, wb = (g() % 1000) / 3.0f;
+			float m1 = 0, m2 = 0;
+			double s1 = 0, s2 = 0;
+			k.gray_err(base, c, q, ref, wb, len, &m1, &s1);
+			r.gray_err(base, c, q, ref, wb, len, &m2, &s2);
+			if (std::abs(m1 - m2) > 1e-5 * (m1 + m2) || std::abs(s1 - s2) > 1e-5 * (s1 + s2)) bad++;
+		}
+		std::cerr << "ISA " << k.name << ": " << (bad ? "FAILED, " + std::to_string(bad) + " mismatches" : "ok") << "\n";
+		if (bad) ok = 0;
+	}
+	return ok;
+}
+
+struct image {
+	int w = 0, h = 0;
+	bool rgb = 0;
+	std::vector<uint8_t> px;
+};
+
+// Reads one netpbm token, skipping comments
+bool token(std::istream & in, int & v)
+{
+	int c;
+	while ((c = in.peek()) != EOF && (isspace(c) || c == '#'))
+	{
+		if (c == '#') while ((c = in.get()) != EOF && c != '\n');
+		else in.get();
+	}
+	return bool(in >> v);
+}
+
+// Reads the next image of a stream; returns 0 at the end
+bool read_frame(std::istream & in, image & f, bool raw, std::string & error)
+{
+	if (!raw)
+	{
+		char m[2];
+		if (!in.read(m, 2)) return 0;
+		int maxval;
+		if (m[0] != 'P' || (m[1] != '5' && m[1] != '6') || !token(in, f.w) || !token(in, f.h) || !token(in, maxval))
+		{
+			error = "not a binary PPM / PGM image";
+			return 0;
+		}
+		if (maxval != 255)
+		{
+			error = "only 8-bit images are supported";
+			return 0;
+		}
+		in.get();
+		f.rgb = m[1] == '6';
+	}
+	f.px.resize(size_t(f.w) * f.h * (f.rgb ? 3 : 1));
+	if (!in.read((char *) f.px.data(), f.px.size()))
+	{
+		if (in.gcount()) error = "truncated image";
+		return 0;
+	}
+	return 1;
+}
+
+struct model {
+	// rgb_g_*
+	int cr = 0, cg = 0, cb = 0, sh = 0;
+	int m = 8;			// Gray bits
+	// Dither, 0 for none
+	char dither = 0;
+	int shl = 0, shr = 0, mask = 0, lo = 0, eq = 0, hi = 0;
+	int period = 1;			// Rows of the threshold tables
+	std::vector<uint16_t> map;	// blue_mono ROM
+	int mapbits = 0;
+	int bayer = 4;			// m of ordered_mono
+	std::vector<std::vector<uint16_t>> t;	// Thresholds, one row per "period" rows
+
+	// Threshold of pixel x, y: the "bo" / "bn" signal of the dither modules
+	int threshold(int x, int y) const
+	{
+		if (dither == 'b') return map[((x & ((1 << mapbits) - 1)) << mapbits) | (y & ((1 << mapbits) - 1))];
+		int o = 0;
+		for (int i=0; i<bayer; i++)
+		{
+			int yb = (y >> (bayer-i-1)) & 1;
+			int xb = (x >> (bayer-i-1)) & 1;
+			o |= yb << (2*i);
+			o |= (xb ^ yb) << (2*i+1);
+		}
+		return o;
+	}
+
+	void tables(int w)
+	{
+		if (!dither || (!t.empty() && t[0].size() == w)) return;
+		period = 1 << (dither == 'b' ? mapbits : bayer);
+		t.assign(period, std::vector<uint16_t>(w));
+		for (int y=0; y<period; y++)
+		{
+			for (int x=0; x<w; x++) t[y][x] = threshold(x, y);
+		}
+	}
+
+	// Processes rows a to b of a frame
+	void rows(const image & f, int a, int b, uint16_t * gray, uint8_t * out) const
+	{
+		for (int y=a; y<b; y++)
+		{
+			uint16_t * g = gray + size_t(y) * f.w;
+			if (f.rgb) ks->gray(f.px.data() + size_t(y) * f.w * 3, f.w, cr, cg, cb, sh, g);
+			else for (int x=0; x<f.w; x++) g[x] = f.px[size_t(y) * f.w + x];
+			if (dither) ks->dither(g, t[y % period].data(), f.w, shl, shr, mask, lo, eq, hi, out + size_t(y) * f.w);
+		}
+	}
+};
+
+}
+
+int main(int argc, char** argv)
+{
+	std::string formula, dither, mapname = "16", infile = "-", outfile, vecfile;
+	int fidelity = 2, m = 8, bayer = 4, rw = 0, rh = 0;
+	long vcount = -1;
+	int threads = std::thread::hardware_concurrency();
+	std::string isaname = "auto";
+	std::vector<std::string> files;
+	for (int a=1; a<argc; a++)
+	{
+		std::string o = argv[a];
+		if (o == "-h") {
+			std::cerr << "Usage:\n";
+			std::cerr << "vidref [options] [input] [output]\n";
+			std::cerr << "Input and output default to stdin and nothing, - is stdin / stdout.\n";
+			std::cerr << "  -g [cie1931|ntsc]   Convert RGB to gray like rgb_g_cie1931 / rgb_g_ntsc\n";
+			std::cerr << "  -f [1-3]            Fidelity of the conversion (default: 2)\n";
+			std::cerr << "  -m [bits]           Gray output bits, 1 - 11 (default: 8)\n";
+			std::cerr << "  -d [ordered|blue]   Dither gray to monochrome like ordered_mono / blue_mono\n";
+			std::cerr << "  -b [m]              Bayer matrix edge 2^m of ordered_mono (default: 4)\n";
+			std::cerr << "  --map [16|32|64|file]  Blue noise map of blue_mono, sizes are read\n";
+			std::cerr << "                      from assets/bn[size].mem (default: 16)\n";
+			std::cerr << "  -s [WxH]            Raw frames of this size\n";
+			std::cerr << "  --vectors [file]    Write golden vectors of the first frame\n";
+			std::cerr << "  --vector-count [n]  Limit the vectors to the first n pixels\n";
+			std::cerr << "  -j [threads]        Threads (default: all cores)\n";
+			std::cerr << "  --isa [name]        Kernel instruction set: auto, scalar, avx2\n";
+			std::cerr << "  --selftest          Checks that all kernel sets agree\n";
+			return 0;
+		}
+		if (o == "--selftest") return selftest() ? 0 : 1;
+		if (a+1 < argc && o == "-g") formula = argv[++a];
+		else if (a+1 < argc && o == "-f") fidelity = atoi(argv[++a]);
+		else if (a+1 < argc && o == "-m") m = atoi(argv[++a]);
+		else if (a+1 < argc && o == "-d") dither = argv[++a];
+		else if (a+1 < argc && o == "-b") bayer = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--map") mapname = argv[++a];
+		else if (a+1 < argc && o == "-s") sscanf(argv[++a], "%dx%d", &rw, &rh);
+		else if (a+1 < argc && o == "--vectors") vecfile = argv[++a];
+		else if (a+1 < argc && o == "--vector-count") vcount = atol(argv[++a]);
+		else if (a+1 < argc && o == "-j") threads = atoi(argv[++a]);
+		else if (a+1 < argc && o == "--isa") isaname = argv[++a];
+		else if (o == "-" || o[0] != '-') files.push_back(o);
+		else std::cerr << "Unknown option " << o << "\n";
+	}
+	if (files.size() > 0) infile = files[0];
+	if (files.size() > 1) outfile = files[1];
+	if (!set_isa(isaname)) {
+		std::cerr << "ISA " << isaname << " is not supported here\n";
+		return 1;
+	}
+	threads = std::max(1, threads);
+
+	model md;
+	md.m = m;
+	// Weights and output width of rgb_to_gray.v, by formula and fidelity
+	const int cie[3][4] = {{3, 12, 1, 4}, {7, 23, 2, 5}, {27, 92, 9, 7}};
+	const int ntsc[3][4] = {{5, 9, 2, 4}, {19, 38, 7, 6}, {38, 75, 15, 7}};
+	if (!formula.empty())
+	{
+		if ((formula != "cie1931" && formula != "ntsc") || fidelity < 1 || fidelity > 3) {
+			std::cerr << "Unknown formula " << formula << " or fidelity " << fidelity << "\n";
+			return 1;
+		}
+		const int * c = (formula == "ntsc" ? ntsc : cie)[fidelity-1];
+		if (m < 1 || m >= 8+4) {
+			std::cerr << "Gray output must have 1 to 11 bits\n";
+			return 1;
+		}
+		md.cr = c[0];
+		md.cg = c[1];
+		md.cb = c[2];
+		md.sh = 8 + c[3] - m;		// y = out[n+s-1:n+s-m]
+	}
+	else md.m = 8;
+
+	if (dither == "ordered")
+	{
+		// in_x = in << (bdw - n), bdw = 2m bits wide
+		int bdw = 2*bayer;
+		if (bayer < 1 || bayer > 8 || md.m > bdw) {
+			std::cerr << "ordered_mono needs gray bits <= 2m, and m up to 8\n";
+			return 1;
+		}
+		md.dither = 'o';
+		md.bayer = bayer;
+		md.shl = bdw - md.m;
+		md.mask = (1 << bdw) - 1;
+		md.lo = 0;
+		md.eq = ((1 << md.m) - 1) & 0xffff;
+		md.hi = 0xffff;
+	}
+	else if (dither == "blue")
+	{
+		// 8-bit "in", narrower values padded towards the MSB
+		md.dither = 'b';
+		md.shl = md.m < 8 ? 8 - md.m : 0;
+		md.shr = md.m > 8 ? md.m - 8 : 0;
+		md.mask = 255;
+		md.lo = 3;
+		md.eq = 252;
+		md.hi = 252;
+		std::string f = mapname;
+		// Map sizes are looked up like $readmemh of blue_mono does, or from tools/
+		if (isdigit(f[0]) && f.find('.') == std::string::npos)
+		{
+			f = "assets/bn" + f + ".mem";
+			if (!std::ifstream(f)) f = "../" + f;
+		}
+		std::ifstream mf(f);
+		std::string v;
+		while (mf >> v) md.map.push_back(strtol(v.c_str(), nullptr, 16));
+		while ((1u << (2*md.mapbits)) < md.map.size()) md.mapbits++;
+		if (md.map.empty() || md.map.size() != (1u << (2*md.mapbits))) {
+			std::cerr << "Can't read a square power of two map from " << f << "\n";
+			return 1;
+		}
+	}
+	else if (!dither.empty()) {
+		std::cerr << "Unknown dither " << dither << "\n";
+		return 1;
+	}
+
+	std::ifstream fin;
+	if (infile != "-")
+	{
+		fin.open(infile, std::ios::binary);
+		if (!fin) {
+			std::cerr << "Can't open " << infile << "\n";
+			return 1;
+		}
+	}
+	std::istream & in = infile == "-" ? std::cin : fin;
+	std::ofstream fout;
+	if (!outfile.empty() && outfile != "-") fout.open(outfile, std::ios::binary);
+	std::ostream * out = outfile.empty() ? nullptr : outfile == "-" ? &std::cout : &fout;
+	bool raw = rw > 0;
+
+	image f;
+	f.w = rw;
+	f.h = rh;
+	f.rgb = !formula.empty();
+	std::vector<uint16_t> gray;
+	std::vector<uint8_t> mono, bytes;
+	std::string error;
+	long frames = 0;
+	double busy = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	while (read_frame(in, f, raw, error))
+	{
+		if (f.rgb && formula.empty()) {
+			std::cerr << "RGB input needs -g\n";
+			return 1;
+		}
+		if (!f.rgb && !formula.empty()) {
+			std::cerr << "-g needs RGB input\n";
+			return 1;
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		size_t n = size_t(f.w) * f.h;
+		gray.resize(n);
+		mono.resize(n);
+		md.tables(f.w);
+		int nt = std::min(threads, std::max(1, f.h / 16));
+		std::vector<std::thread> pool;
+		for (int t=1; t<nt; t++) pool.emplace_back(&model::rows, &md, std::cref(f), f.h*t/nt, f.h*(t+1)/nt, gray.data(), mono.data());
+		md.rows(f, 0, f.h/nt, gray.data(), mono.data());
+		for (auto & t : pool) t.join();
+		busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+
+		if (frames == 0 && !vecfile.empty())
+		{
+			std::ofstream vf(vecfile);
+			vf << "// vidref golden vectors: r g b x y gray out";
+			if (!formula.empty()) vf << ", rgb_g_" << formula << " fidelity " << fidelity << " m " << md.m;
+			if (md.dither == 'o') vf << ", ordered_mono n " << md.m << " m " << md.bayer;
+			if (md.dither == 'b') vf << ", blue_mono map " << (1 << md.mapbits);
+			vf << "\n";
+			long c = vcount < 0 ? long(n) : std::min(vcount, long(n));
+			char line[64];
+			for (long i=0; i<c; i++)
+			{
+				const uint8_t * p = f.rgb ? &f.px[3*i] : &f.px[i];
+				int x = i % f.w, y = i / f.w;
+				int ix = md.dither == 'b' ? x & ((1 << md.mapbits) - 1) : x & ((1 << md.bayer) - 1);
+				int iy = md.dither == 'b' ? y & ((1 << md.mapbits) - 1) : y & ((1 << md.bayer) - 1);
+				snprintf(line, sizeof(line), "%02x %02x %02x %04x %04x %03x %x\n", p[0], p[f.rgb ? 1 : 0], p[f.rgb ? 2 : 0],
+					ix, iy, gray[i], md.dither ? mono[i] : 0);
+				vf << line;
+			}
+		}
+
+		if (out)
+		{
+			int maxval = md.dither ? 1 : (1 << md.m) - 1;
+			bool wide = maxval > 255;
+			if (!raw) *out << "P5\n" << f.w << " " << f.h << "\n" << maxval << "\n";
+			if (md.dither) out->write((const char *) mono.data(), n);
+			else
+			{
+				bytes.resize(n * (wide ? 2 : 1));
+				for (size_t i=0; i<n; i++)
+				{
+					if (!wide) bytes[i] = gray[i];
+					else if (raw)
+					{
+						bytes[2*i] = gray[i];
+						bytes[2*i+1] = gray[i] >> 8;
+					}
+					else
+					{
+						bytes[2*i] = gray[i] >> 8;
+						bytes[2*i+1] = gray[i];
+					}
+				}
+				out->write((const char *) bytes.data(), bytes.size());
+			}
+		}
+		frames++;
+	}
+	if (!error.empty()) {
+		std::cerr << infile << ": " << error << "\n";
+		return 1;
+	}
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	if (frames)
+	{
+		std::cerr << "//// " << frames << " frames of " << f.w << "x" << f.h << " with " << ks->name << " kernels, "
+			<< frames / busy << " fps processing, " << frames / total << " fps with I/O\n";
+	}
+	return 0;
+}
@@ -17,6 +17,7 @@
 // This happens in a single clk cycle.
 // Since there are single-frame RX buffers, the matrix theoretically may be
 // overwhelmed if there's more than 10 input ports. 
+// tools/matsim checks whether it keeps up with given traffic.
 // 
 // Each row in the LUT corresponds to RX port of the matrix.
 // Each bit in the LUT row indicates TX ports for the data to be forwarded to.
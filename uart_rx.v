@@ -4,6 +4,7 @@
 // Receives data in 8n1 format, at any clock rate.
 // Performs user defined oversample (at least 4x).
 // Theoretically should handle 2.5% clk frequency mismatch between tx and rx.
+// tools/uartber measures the error rates of all receivers in this file.
 //
 //             +------------------+
 //      in --->|                  |===> out[8]